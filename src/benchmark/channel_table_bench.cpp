@@ -0,0 +1,119 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmark of channel id lookups under connection churn: the slot table of
+ * ChannelService against the btree it replaced, with ids of closed channels mixed in.
+ * Build with 'make benchmark', run 'benchmark/channel_table_bench [live channels] [rounds]'.
+ */
+#include "common.hpp"
+#include "util/time_helper.hpp"
+#include "channel/all_includes.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+#include <vector>
+
+using namespace comms;
+
+typedef TreeMap<uint32, Channel*>::Type BTreeChannelTable;
+
+int main(int argc, char** argv)
+{
+    uint32 live = argc > 1 ? atoi(argv[1]) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 50;
+    ChannelService serv(live + 1024);
+    BTreeChannelTable btree;
+    std::deque<Channel*> channels;
+    std::vector<uint32> ids, stale_ids;
+    for (uint32 i = 0; i < live; i++)
+    {
+        Channel* ch = serv.NewClientSocketChannel();
+        channels.push_back(ch);
+        btree[ch->GetID()] = ch;
+    }
+    uint64 churn_cost = 0, slot_cost = 0, btree_cost = 0;
+    uint64 lookups = 0, stale_hits = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        /* a tenth of the connections go away and as many come in */
+        uint64 start = get_current_epoch_micros();
+        for (uint32 i = 0; i < live / 10; i++)
+        {
+            Channel* ch = channels.front();
+            channels.pop_front();
+            stale_ids.push_back(ch->GetID());
+            btree.erase(ch->GetID());
+            ch->Close();
+            Channel* newch = serv.NewClientSocketChannel();
+            channels.push_back(newch);
+            btree[newch->GetID()] = newch;
+        }
+        serv.Continue(); /* destroys the closed channels, their slots become reusable */
+        churn_cost += get_current_epoch_micros() - start;
+
+        /* deliveries to live channels, one in four aimed at a channel closed earlier */
+        ids.clear();
+        for (uint32 i = 0; i < live; i++)
+        {
+            ids.push_back(channels[random() % channels.size()]->GetID());
+            if (i % 4 == 0)
+            {
+                ids.push_back(stale_ids[random() % stale_ids.size()]);
+            }
+        }
+        start = get_current_epoch_micros();
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            Channel* ch = serv.GetChannel(ids[i]);
+            if (NULL != ch && ch->GetID() != ids[i])
+            {
+                stale_hits++;
+            }
+        }
+        slot_cost += get_current_epoch_micros() - start;
+        start = get_current_epoch_micros();
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            BTreeChannelTable::iterator found = btree.find(ids[i]);
+            if (found != btree.end() && found->second->GetID() != ids[i])
+            {
+                stale_hits++;
+            }
+        }
+        btree_cost += get_current_epoch_micros() - start;
+        lookups += ids.size();
+    }
+    printf("%u live channels, %d rounds of 10%% churn, %llu lookups\n", live, rounds, (unsigned long long) lookups);
+    printf("%-24s %8.1f us/round\n", "churn", (double) churn_cost / rounds);
+    printf("%-24s %8.1f ns/lookup\n", "slot table", slot_cost * 1000.0 / lookups);
+    printf("%-24s %8.1f ns/lookup\n", "btree", btree_cost * 1000.0 / lookups);
+    printf("%-24s %8llu\n", "stale id hits", (unsigned long long) stale_hits);
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmark of RedisReplyEncoder::Encode on array replies, compared with
+ * the previous Printf based encoder.
+ * Build with 'make benchmark', run 'benchmark/reply_encode_bench [rounds]'.
+ */
+#include "common.hpp"
+#include "channel/all_includes.hpp"
+#include "util/time_helper.hpp"
+#include "util/string_helper.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace comms;
+using namespace comms::codec;
+
+static bool printf_encode(Buffer& buf, RedisReply& reply)
+{
+    switch (reply.type)
+    {
+        case REDIS_REPLY_NIL:
+        {
+            buf.Printf("$-1\r\n");
+            break;
+        }
+        case REDIS_REPLY_STRING:
+        {
+            buf.Printf("$%d\r\n", reply.str.size());
+            buf.Write(reply.str.data(), reply.str.size());
+            buf.Printf("\r\n");
+            break;
+        }
+        case REDIS_REPLY_INTEGER:
+        {
+            buf.Printf(":%lld\r\n", reply.integer);
+            break;
+        }
+        case REDIS_REPLY_ARRAY:
+        {
+            buf.Printf("*%d\r\n", reply.MemberSize());
+            for (uint32 i = 0; i < reply.MemberSize(); i++)
+            {
+                printf_encode(buf, reply.MemberAt(i));
+            }
+            break;
+        }
+        default:
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef bool EncodeFunc(Buffer& buf, RedisReply& reply);
+
+static void bench(const char* name, RedisReply& reply, int rounds)
+{
+    EncodeFunc* funcs[] = { printf_encode, RedisReplyEncoder::Encode };
+    const char* names[] = { "printf", "encoder" };
+    uint64 costs[2];
+    size_t bytes = 0;
+    for (int f = 0; f < 2; f++)
+    {
+        Buffer buf;
+        uint64 start = get_current_epoch_micros();
+        for (int r = 0; r < rounds; r++)
+        {
+            buf.Clear();
+            funcs[f](buf, reply);
+        }
+        costs[f] = get_current_epoch_micros() - start;
+        if (costs[f] == 0)
+        {
+            costs[f] = 1;
+        }
+        bytes = buf.ReadableBytes();
+    }
+    for (int f = 0; f < 2; f++)
+    {
+        printf("%-28s %-8s %8.1f MB/s %8.2f us/reply\n", name, names[f], (double) bytes * rounds / costs[f],
+                (double) costs[f] / rounds);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 5000;
+    char tmp[64];
+
+    /* LRANGE 0 999 with short values */
+    RedisReply lrange;
+    for (int i = 0; i < 1000; i++)
+    {
+        sprintf(tmp, "item:%d", i);
+        lrange.AddMember().str = tmp;
+        lrange.MemberAt(i).type = REDIS_REPLY_STRING;
+    }
+    bench("lrange 1000 x ~9B", lrange, rounds);
+
+    /* MGET 100 keys of 256 byte values, some missing */
+    RedisReply mget;
+    for (int i = 0; i < 100; i++)
+    {
+        RedisReply& r = mget.AddMember();
+        if (i % 10 == 0)
+        {
+            r.type = REDIS_REPLY_NIL;
+        }
+        else
+        {
+            r.type = REDIS_REPLY_STRING;
+            r.str.assign(256, 'v');
+        }
+    }
+    bench("mget 100 x 256B", mget, rounds);
+
+    /* SMEMBERS-like array of integers */
+    RedisReply ints;
+    for (int i = 0; i < 1000; i++)
+    {
+        RedisReply& r = ints.AddMember();
+        r.type = REDIS_REPLY_INTEGER;
+        r.integer = i * 37;
+    }
+    bench("array 1000 integers", ints, rounds);
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmark of the RESP scanning kernels on a realistic pipeline.
+ * Build with 'make benchmark', run 'benchmark/resp_scan_bench [rounds]'.
+ */
+#include "common.hpp"
+#include "util/scan_helper.hpp"
+#include "util/time_helper.hpp"
+#include "channel/all_includes.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace comms;
+using namespace comms::codec;
+
+static void append_command(std::string& out, const std::vector<std::string>& args)
+{
+    char tmp[64];
+    sprintf(tmp, "*%u\r\n", (uint32) args.size());
+    out.append(tmp);
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        sprintf(tmp, "$%u\r\n", (uint32) args[i].size());
+        out.append(tmp).append(args[i]).append("\r\n");
+    }
+}
+
+/*
+ * 1000 requests the way a pipelining client would send them: SET/GET with
+ * short keys and 64 byte values, HMSET, MGET of 10 keys and a few inline PINGs.
+ */
+static std::string build_pipeline()
+{
+    std::string out;
+    std::string value(64, 'v');
+    char key[32];
+    for (int i = 0; i < 1000; i++)
+    {
+        sprintf(key, "key:%06d", i);
+        std::vector<std::string> args;
+        switch (i % 5)
+        {
+            case 0:
+                args.push_back("SET");
+                args.push_back(key);
+                args.push_back(value);
+                break;
+            case 1:
+                args.push_back("GET");
+                args.push_back(key);
+                break;
+            case 2:
+                args.push_back("HMSET");
+                args.push_back(key);
+                args.push_back("field1");
+                args.push_back(value);
+                args.push_back("field2");
+                args.push_back(value);
+                break;
+            case 3:
+                args.push_back("MGET");
+                for (int j = 0; j < 10; j++)
+                {
+                    sprintf(key, "key:%06d", i + j);
+                    args.push_back(key);
+                }
+                break;
+            default:
+                out.append("PING\r\n");
+                continue;
+        }
+        append_command(out, args);
+    }
+    return out;
+}
+
+static const char* find_crlf_bytewise(const char* s, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i++)
+    {
+        if (s[i] == '\r' && s[i + 1] == '\n')
+        {
+            return s + i;
+        }
+    }
+    return NULL;
+}
+
+typedef const char* FindCRLF(const char* s, size_t len);
+
+static void bench_crlf(const char* name, FindCRLF* func, const std::string& data, int rounds)
+{
+    uint64 start = get_current_epoch_micros();
+    uint64 found = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        const char* p = data.data();
+        const char* end = p + data.size();
+        const char* crlf;
+        while ((crlf = func(p, end - p)) != NULL)
+        {
+            found++;
+            p = crlf + 2;
+        }
+    }
+    uint64 cost = get_current_epoch_micros() - start;
+    printf("%-24s %8.1f MB/s (%llu CRLFs)\n", name, (double) data.size() * rounds / (cost ? cost : 1),
+            (unsigned long long) found);
+}
+
+static void bench_decimal(const std::string& data, int rounds)
+{
+    std::vector<const char*> headers;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        if (data[i] == '$' || data[i] == '*')
+        {
+            headers.push_back(data.data() + i + 1);
+        }
+    }
+    int64 sum = 0;
+    uint64 start = get_current_epoch_micros();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < headers.size(); i++)
+        {
+            sum += strtol(headers[i], NULL, 10);
+        }
+    }
+    uint64 strtol_cost = get_current_epoch_micros() - start;
+    start = get_current_epoch_micros();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < headers.size(); i++)
+        {
+            int64 v = 0;
+            size_t consumed;
+            parse_crlf_decimal(headers[i], 24, v, consumed);
+            sum -= v;
+        }
+    }
+    uint64 fast_cost = get_current_epoch_micros() - start;
+    double n = (double) headers.size() * rounds;
+    printf("%-24s %8.1f ns/header\n", "strtol", strtol_cost * 1000.0 / n);
+    printf("%-24s %8.1f ns/header (check %lld)\n", "parse_crlf_decimal", fast_cost * 1000.0 / n, (long long) sum);
+}
+
+static void bench_decode(const std::string& data, int rounds)
+{
+    uint64 commands = 0;
+    uint64 start = get_current_epoch_micros();
+    for (int r = 0; r < rounds; r++)
+    {
+        Buffer buffer(const_cast<char*>(data.data()), 0, data.size());
+        std::string err;
+        while (buffer.Readable())
+        {
+            RedisCommandFrame frame;
+            if (!RedisCommandDecoder::Decode(buffer, frame, err))
+            {
+                break;
+            }
+            commands++;
+        }
+    }
+    uint64 cost = get_current_epoch_micros() - start;
+    cost = cost ? cost : 1;
+    printf("%-24s %8.1f MB/s, %.2f M commands/s\n", "RedisCommandDecoder", (double) data.size() * rounds / cost,
+            (double) commands / cost);
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    std::string data = build_pipeline();
+    printf("pipeline of %u bytes, %d rounds, kernel:%s\n", (uint32) data.size(), rounds, scan_kernel_name());
+    bench_crlf("bytewise", find_crlf_bytewise, data, rounds);
+    bench_crlf("find_crlf_scalar", find_crlf_scalar, data, rounds);
+    bench_crlf("find_crlf", find_crlf, data, rounds);
+    bench_decimal(data, rounds);
+    bench_decode(data, rounds);
+    return 0;
+}
@@ -35,13 +35,14 @@
 OP_NAMESPACE_BEGIN
     int Comms::PFAdd(Context& ctx, RedisCommandFrame& cmd)
     {
-        const std::string& key = cmd.GetArguments()[0];
+        ArgumentSlice key = cmd.GetArgumentSlice(0);
         mmkv::DataArray members;
-        for (uint32 i = 1; i < cmd.GetArguments().size(); i++)
+        members.reserve(cmd.GetArgumentCount() - 1);
+        for (uint32 i = 1; i < cmd.GetArgumentCount(); i++)
         {
-            members.push_back(cmd.GetArguments()[i]);
+            members.push_back(ArgumentData(cmd.GetArgumentSlice(i)));
         }
-        int ret = m_kv_store->PFAdd(ctx.currentDB, key, members);
+        int ret = m_kv_store->PFAdd(ctx.currentDB, ArgumentData(key), members);
         if (ret >= 0)
         {
             FireKeyChangedEvent(ctx, key);
@@ -59,9 +60,10 @@ OP_NAMESPACE_BEGIN
     {
         uint64 card = 0;
         mmkv::DataArray keys;
-        for (uint32 i = 0; i < cmd.GetArguments().size(); i++)
+        keys.reserve(cmd.GetArgumentCount());
+        for (uint32 i = 0; i < cmd.GetArgumentCount(); i++)
         {
-            keys.push_back(cmd.GetArguments()[i]);
+            keys.push_back(ArgumentData(cmd.GetArgumentSlice(i)));
         }
         int ret = m_kv_store->PFCount(ctx.currentDB, keys);
         if (ret >= 0)
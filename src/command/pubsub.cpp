@@ -161,7 +161,7 @@ namespace comms
 
     int Comms::Subscribe(Context& ctx, RedisCommandFrame& cmd)
     {
-        ctx.client->GetWritableOptions().max_write_buffer_size = (int32)(m_cfg.pubsub_client_output_buffer_limit);
+        SetClientOutputClass(ctx.client, CLIENT_OUTPUT_PUBSUB);
         for (uint32 i = 0; i < cmd.GetArguments().size(); i++)
         {
             SubscribeChannel(ctx, cmd.GetArguments()[i], true);
@@ -182,11 +182,16 @@ namespace comms
                 UnsubscribeChannel(ctx, cmd.GetArguments()[i], true);
             }
         }
+        if (NULL == ctx.pubsub || (ctx.pubsub->pubsub_channels.empty() && ctx.pubsub->pubsub_patterns.empty()))
+        {
+            //back to a normal client
+            SetClientOutputClass(ctx.client, CLIENT_OUTPUT_NORMAL);
+        }
         return 0;
     }
     int Comms::PSubscribe(Context& ctx, RedisCommandFrame& cmd)
     {
-        ctx.client->GetWritableOptions().max_write_buffer_size = (int32)(m_cfg.pubsub_client_output_buffer_limit);
+        SetClientOutputClass(ctx.client, CLIENT_OUTPUT_PUBSUB);
         for (uint32 i = 0; i < cmd.GetArguments().size(); i++)
         {
             PSubscribeChannel(ctx, cmd.GetArguments()[i], true);
@@ -206,6 +211,11 @@ namespace comms
                 PUnsubscribeChannel(ctx, cmd.GetArguments()[i], true);
             }
         }
+        if (NULL == ctx.pubsub || (ctx.pubsub->pubsub_channels.empty() && ctx.pubsub->pubsub_patterns.empty()))
+        {
+            //back to a normal client
+            SetClientOutputClass(ctx.client, CLIENT_OUTPUT_NORMAL);
+        }
         return 0;
     }
 
@@ -240,17 +250,38 @@ namespace comms
     static void async_write_message(Channel* ch, void * data)
     {
         RedisReply* r = (RedisReply*) data;
-        if(!ch->Write(*r))
+        if (NULL != ch && !ch->Write(*r))
         {
             ch->Close();
         }
         DELETE(r);
     }
 
+    static void fill_message_reply(RedisReply& reply, const std::string& message, SharedSegment* payload)
+    {
+        if (NULL != payload)
+        {
+            fill_shared_str_reply(reply, payload);
+        }
+        else
+        {
+            fill_str_reply(reply, message);
+        }
+    }
+
     int Comms::PublishMessage(Context& ctx, const std::string& channel, const std::string& message)
     {
         ReadLockGuard<SpinRWLock> guard(m_pubsub_ctx_lock);
         PubsubContextTable::iterator fit = m_pubsub_channels.find(channel);
+        /*
+         * a large message is copied once and referenced by the replies to all subscribers
+         */
+        SharedSegment* payload = NULL;
+        if (message.size() >= REDIS_REPLY_SHARED_PAYLOAD_LENGTH)
+        {
+            std::string copy(message);
+            NEW(payload, SharedSegment(copy));
+        }
 
         int receiver = 0;
         if (fit != m_pubsub_channels.end())
@@ -268,7 +299,7 @@ namespace comms
                     RedisReply& r3 = r->AddMember();
                     fill_str_reply(r1, "message");
                     fill_str_reply(r2, channel);
-                    fill_str_reply(r3, message);
+                    fill_message_reply(r3, message, payload);
                     cc->client->GetService().AsyncIO(cc->client->GetID(), async_write_message, r);
                     receiver++;
                 }
@@ -296,7 +327,7 @@ namespace comms
                         fill_str_reply(r1, "pmessage");
                         fill_str_reply(r2, pattern);
                         fill_str_reply(r3, channel);
-                        fill_str_reply(r4, message);
+                        fill_message_reply(r4, message, payload);
                         cc->client->GetService().AsyncIO(cc->client->GetID(), async_write_message, r);
                         receiver++;
                     }
@@ -305,6 +336,10 @@ namespace comms
             }
             pit++;
         }
+        if (NULL != payload)
+        {
+            payload->Release();
+        }
         return receiver;
     }
 
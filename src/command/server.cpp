@@ -158,6 +158,7 @@ namespace comms
                     0,0,0
 #endif
                     );
+            info.append("multiplexing_api:").append(aeGetApiName()).append("\r\n");
             info.append("gcc_version:").append(tmp).append("\r\n");
             info.append("process_id:").append(stringfromll(getpid())).append("\r\n");
             info.append("run_id:").append(m_repl.GetServerKey()).append("\r\n");
@@ -175,6 +176,7 @@ namespace comms
                 LockGuard<SpinMutexLock> guard(m_clients_lock);
                 info.append("connected_clients:").append(stringfromll(m_clients.size())).append("\r\n");
             }
+            info.append("tracking_clients:").append(stringfromll(m_tracking.Clients())).append("\r\n");
             {
                 WriteLockGuard<SpinRWLock> guard(m_block_ctx_lock);
                 info.append("blocked_clients:").append(stringfromll(m_block_context_table.size())).append("\r\n");
@@ -209,6 +211,10 @@ namespace comms
             info.append("repl_dir: ").append(m_cfg.repl_data_dir).append("\r\n");
             info.append("repl_wal_size: ").append(stringfromll(m_cfg.repl_wal_size)).append("\r\n");
             info.append("repl_wal_cache_size: ").append(stringfromll(m_cfg.repl_wal_cache_size)).append("\r\n");
+            info.append("repl_lz4_sent_bytes_saved: ").append(stringfromll(g_repl->GetMaster().LZ4SavedBytes())).append(
+                    "\r\n");
+            info.append("repl_lz4_recv_bytes_saved: ").append(stringfromll(g_repl->GetSlave().LZ4SavedBytes())).append(
+                    "\r\n");
             info.append("\r\n");
         }
 
@@ -218,6 +224,8 @@ namespace comms
             std::string tmp;
             info.append("used_memory_rss:").append(stringfromll(mem_rss_size())).append("\r\n");
             info.append("used_memory_shr:").append(stringfromll(mem_shr_size())).append("\r\n");
+            info.append("used_buffer_bytes:").append(stringfromll(BufferPool::UsedBytes())).append("\r\n");
+            info.append("pooled_buffer_bytes:").append(stringfromll(BufferPool::PooledBytes())).append("\r\n");
             info.append("\r\n");
         }
 
@@ -229,6 +237,40 @@ namespace comms
             WriteLockGuard<SpinRWLock> guard(m_pubsub_ctx_lock);
             info.append("pubsub_channels:").append(stringfromll(m_pubsub_channels.size())).append("\r\n");
             info.append("pubsub_patterns:").append(stringfromll(m_pubsub_patterns.size())).append("\r\n");
+            info.append("tracking_total_keys:").append(stringfromll(m_tracking.TotalKeys())).append("\r\n");
+            info.append("tracking_total_prefixes:").append(stringfromll(m_tracking.TotalPrefixes())).append("\r\n");
+            uint64 output_limit_closed = 0;
+            uint64 refused_channels = 0;
+            for (uint32 i = 0; i <= m_service->GetThreadPoolSize(); i++)
+            {
+                ChannelService* serv = 0 == i ? m_service : m_service->GetSubPoolService(i - 1);
+                if (NULL == serv)
+                {
+                    break;
+                }
+                ChannelAsyncIOStats stats;
+                serv->GetAsyncIOStats(stats);
+                info.append("async_io_loop").append(stringfromll(i)).append(":pending=").append(
+                        stringfromll(stats.pending)).append(",batches=").append(stringfromll(stats.batches)).append(
+                        ",tasks=").append(stringfromll(stats.tasks)).append(",budget_exhausted=").append(
+                        stringfromll(stats.budget_exhausted)).append("\r\n");
+                ChannelLoadStats load;
+                serv->GetLoadStats(load);
+                info.append("loop").append(stringfromll(i)).append(":cpu_usage=").append(stringfromll(load.cpu_usage)).append(
+                        ",channels=").append(stringfromll(load.channels)).append(",migrated_in=").append(
+                        stringfromll(load.migrated_in)).append(",migrated_out=").append(stringfromll(load.migrated_out)).append(
+                        ",busy_poll_us=").append(stringfromll(load.busy_poll)).append(",spin_us=").append(
+                        stringfromll(load.spin_time)).append(",block_us=").append(stringfromll(load.block_time)).append("\r\n");
+                output_limit_closed += load.output_limit_closed;
+                refused_channels += load.refused_channels;
+            }
+            //slaves are served by the replication loop
+            ChannelLoadStats repl_load;
+            g_repl->GetIOServ().GetLoadStats(repl_load);
+            output_limit_closed += repl_load.output_limit_closed;
+            info.append("client_output_buffer_limit_disconnections:").append(stringfromll(output_limit_closed)).append(
+                    "\r\n");
+            info.append("rejected_connections:").append(stringfromll(refused_channels)).append("\r\n");
             info.append("\r\n");
         }
 
@@ -340,6 +382,26 @@ namespace comms
                 fill_str_reply(ctx.reply, ctx.name);
             }
         }
+        else if (subcmd == "id")
+        {
+            fill_int_reply(ctx.reply, ctx.client->GetID());
+        }
+        else if (subcmd == "tracking")
+        {
+            return ClientTracking(ctx, cmd);
+        }
+        else if (subcmd == "getredir")
+        {
+            if (NULL == ctx.tracking)
+            {
+                fill_int_reply(ctx.reply, -1);
+            }
+            else
+            {
+                uint32 target = ctx.tracking->target.id;
+                fill_int_reply(ctx.reply, target == ctx.client->GetID() ? 0 : target);
+            }
+        }
         else if (subcmd == "pause")
         {
             //pause all clients
@@ -417,7 +479,8 @@ namespace comms
         }
         else
         {
-            fill_error_reply(ctx.reply, "CLIENT subcommand must be one of LIST, GETNAME, SETNAME, KILL, PAUSE");
+            fill_error_reply(ctx.reply,
+                    "CLIENT subcommand must be one of LIST, GETNAME, SETNAME, KILL, PAUSE, ID, TRACKING, GETREDIR");
         }
         return 0;
     }
@@ -492,8 +555,14 @@ namespace comms
                 return 0;
             }
             conf_set(m_cfg.conf_props, cmd.GetArguments()[1], cmd.GetArguments()[2]);
-            WriteLockGuard<SpinRWLock> guard(m_cfg_lock);
-            m_cfg.Parse(m_cfg.conf_props);
+            {
+                WriteLockGuard<SpinRWLock> guard(m_cfg_lock);
+                m_cfg.Parse(m_cfg.conf_props);
+            }
+            if (!strcasecmp(cmd.GetArguments()[1].c_str(), "client-output-buffer-limit"))
+            {
+                UpdateClientOutputLimits();
+            }
             fill_status_reply(ctx.reply, "OK");
         }
         else if (arg0 == "add")
@@ -504,8 +573,14 @@ namespace comms
                 return 0;
             }
             conf_set(m_cfg.conf_props, cmd.GetArguments()[1], cmd.GetArguments()[2], false);
-            WriteLockGuard<SpinRWLock> guard(m_cfg_lock);
-            m_cfg.Parse(m_cfg.conf_props);
+            {
+                WriteLockGuard<SpinRWLock> guard(m_cfg_lock);
+                m_cfg.Parse(m_cfg.conf_props);
+            }
+            if (!strcasecmp(cmd.GetArguments()[1].c_str(), "client-output-buffer-limit"))
+            {
+                UpdateClientOutputLimits();
+            }
             fill_status_reply(ctx.reply, "OK");
         }
         else if (arg0 == "del")
@@ -516,8 +591,14 @@ namespace comms
                 return 0;
             }
             conf_del(m_cfg.conf_props, cmd.GetArguments()[1], cmd.GetArguments()[2]);
-            WriteLockGuard<SpinRWLock> guard(m_cfg_lock);
-            m_cfg.Parse(m_cfg.conf_props);
+            {
+                WriteLockGuard<SpinRWLock> guard(m_cfg_lock);
+                m_cfg.Parse(m_cfg.conf_props);
+            }
+            if (!strcasecmp(cmd.GetArguments()[1].c_str(), "client-output-buffer-limit"))
+            {
+                UpdateClientOutputLimits();
+            }
             fill_status_reply(ctx.reply, "OK");
         }
         else if (arg0 == "reload")
@@ -529,6 +610,7 @@ namespace comms
                 {
                     m_cfg.conf_props = props;
                     m_stat.Init();
+                    UpdateClientOutputLimits();
                     fill_status_reply(ctx.reply, "OK");
                     return 0;
                 }
@@ -558,6 +640,7 @@ namespace comms
         int err = m_kv_store->FlushDB(ctx.currentDB);
         if (err >= 0)
         {
+            InvalidateAllTrackedKeys(ctx);
             fill_ok_reply(ctx.reply);
         }
         else
@@ -572,6 +655,7 @@ namespace comms
         int err = m_kv_store->FlushAll();
         if (err >= 0)
         {
+            InvalidateAllTrackedKeys(ctx);
             fill_ok_reply(ctx.reply);
         }
         else
@@ -642,6 +726,7 @@ namespace comms
             fill_error_reply(ctx.reply, "ERR wrong number of arguments for ReplConf");
             return 0;
         }
+        bool lz4 = false;
         for (uint32 i = 0; i < cmd.GetArguments().size(); i += 2)
         {
             if (!strcasecmp(cmd.GetArguments()[i].c_str(), "listening-port"))
@@ -663,12 +748,20 @@ namespace comms
                 }
                 g_repl->GetMaster().SetSlavePort(ctx.client, port);
             }
+            else if (!strcasecmp(cmd.GetArguments()[i].c_str(), "capa"))
+            {
+                if (!strcasecmp(cmd.GetArguments()[i + 1].c_str(), "lz4"))
+                {
+                    g_repl->GetMaster().SetSlaveLZ4(ctx.client);
+                    lz4 = true;
+                }
+            }
             else if (!strcasecmp(cmd.GetArguments()[i].c_str(), "ack"))
             {
                 //do nothing
             }
         }
-        fill_status_reply(ctx.reply, "OK");
+        fill_status_reply(ctx.reply, lz4 ? "OK lz4" : "OK");
         return 0;
     }
 
@@ -172,14 +172,15 @@ OP_NAMESPACE_BEGIN
     int Comms::HMGet(Context& ctx, RedisCommandFrame& cmd)
     {
         mmkv::DataArray fs;
-        for (uint32 i = 1; i < cmd.GetArguments().size(); i++)
+        fs.reserve(cmd.GetArgumentCount() - 1);
+        for (uint32 i = 1; i < cmd.GetArgumentCount(); i++)
         {
-            fs.push_back(cmd.GetArguments()[i]);
+            fs.push_back(ArgumentData(cmd.GetArgumentSlice(i)));
         }
         ctx.reply.type = REDIS_REPLY_ARRAY;
         mmkv::StringArrayResult results(ReplyResultStringAlloc, &ctx.reply);
         mmkv::BooleanArray get_flags;
-        int err = m_kv_store->HMGet(ctx.currentDB, cmd.GetArguments()[0], fs, results, &get_flags);
+        int err = m_kv_store->HMGet(ctx.currentDB, ArgumentData(cmd.GetArgumentSlice(0)), fs, results, &get_flags);
         if (err < 0)
         {
             FillErrorReply(ctx, err);
@@ -198,24 +199,25 @@ OP_NAMESPACE_BEGIN
     }
     int Comms::HMSet(Context& ctx, RedisCommandFrame& cmd)
     {
-        if((cmd.GetArguments().size() - 1) % 2 != 0)
+        if((cmd.GetArgumentCount() - 1) % 2 != 0)
         {
             FillErrorReply(ctx, mmkv::ERR_INVALID_ARGS);
             return 0;
         }
         mmkv::DataPairArray kvs;
-        for (uint32 i = 1; i < cmd.GetArguments().size(); i += 2)
+        kvs.reserve((cmd.GetArgumentCount() - 1) / 2);
+        for (uint32 i = 1; i < cmd.GetArgumentCount(); i += 2)
         {
             mmkv::DataPair kv;
-            kv.first = cmd.GetArguments()[i];
-            kv.second = cmd.GetArguments()[i + 1];
+            kv.first = ArgumentData(cmd.GetArgumentSlice(i));
+            kv.second = ArgumentData(cmd.GetArgumentSlice(i + 1));
             kvs.push_back(kv);
         }
-        int err = m_kv_store->HMSet(ctx.currentDB, cmd.GetArguments()[0], kvs);
+        int err = m_kv_store->HMSet(ctx.currentDB, ArgumentData(cmd.GetArgumentSlice(0)), kvs);
         if (err >= 0)
         {
             fill_ok_reply(ctx.reply);
-            FireKeyChangedEvent(ctx, cmd.GetArguments()[0]);
+            FireKeyChangedEvent(ctx, cmd.GetArgumentSlice(0));
         }
         else
         {
@@ -34,17 +34,18 @@ OP_NAMESPACE_BEGIN
     int Comms::SAdd(Context& ctx, RedisCommandFrame& cmd)
     {
         mmkv::DataArray fs;
-        for (uint32 i = 1; i < cmd.GetArguments().size(); i++)
+        fs.reserve(cmd.GetArgumentCount() - 1);
+        for (uint32 i = 1; i < cmd.GetArgumentCount(); i++)
         {
-            fs.push_back(cmd.GetArguments()[i]);
+            fs.push_back(ArgumentData(cmd.GetArgumentSlice(i)));
         }
-        int err = m_kv_store->SAdd(ctx.currentDB, cmd.GetArguments()[0], fs);
+        int err = m_kv_store->SAdd(ctx.currentDB, ArgumentData(cmd.GetArgumentSlice(0)), fs);
         if (err >= 0)
         {
             fill_int_reply(ctx.reply, err);
             if (err > 0)
             {
-                FireKeyChangedEvent(ctx, cmd.GetArguments()[0]);
+                FireKeyChangedEvent(ctx, cmd.GetArgumentSlice(0));
             }
         }
         else
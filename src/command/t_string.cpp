@@ -51,13 +51,14 @@ OP_NAMESPACE_BEGIN
         ctx.reply.type = REDIS_REPLY_ARRAY;
         mmkv::StringArrayResult results(ReplyResultStringAlloc, &ctx.reply);
         mmkv::DataArray keys;
-        for (uint32 i = 0; i < cmd.GetArguments().size(); i++)
+        keys.reserve(cmd.GetArgumentCount());
+        for (uint32 i = 0; i < cmd.GetArgumentCount(); i++)
         {
-            keys.push_back(cmd.GetArguments()[i]);
+            keys.push_back(ArgumentData(cmd.GetArgumentSlice(i)));
         }
         mmkv::BooleanArray get_flags;
         m_kv_store->MGet(ctx.currentDB, keys, results, &get_flags);
-        for (uint32 i = 0; i < cmd.GetArguments().size(); i++)
+        for (uint32 i = 0; i < keys.size(); i++)
         {
            if(!get_flags[i])
            {
@@ -108,17 +109,18 @@ OP_NAMESPACE_BEGIN
 
     int Comms::MSet(Context& ctx, RedisCommandFrame& cmd)
     {
-        if (cmd.GetArguments().size() % 2 != 0)
+        if (cmd.GetArgumentCount() % 2 != 0)
         {
             fill_error_reply(ctx.reply, "wrong number of arguments for MSET");
             return 0;
         }
         mmkv::DataPairArray kvs;
-        for (uint32 i = 0; i < cmd.GetArguments().size(); i += 2)
+        kvs.reserve(cmd.GetArgumentCount() / 2);
+        for (uint32 i = 0; i < cmd.GetArgumentCount(); i += 2)
         {
             mmkv::DataPair kv;
-            kv.first = cmd.GetArguments()[i];
-            kv.second = cmd.GetArguments()[i + 1];
+            kv.first = ArgumentData(cmd.GetArgumentSlice(i));
+            kv.second = ArgumentData(cmd.GetArgumentSlice(i + 1));
             kvs.push_back(kv);
         }
         bool data_changed = false;
@@ -139,9 +141,9 @@ OP_NAMESPACE_BEGIN
         }
         if (data_changed)
         {
-            for (uint32 i = 0; i < cmd.GetArguments().size(); i += 2)
+            for (uint32 i = 0; i < cmd.GetArgumentCount(); i += 2)
             {
-                FireKeyChangedEvent(ctx, cmd.GetArguments()[i]);
+                FireKeyChangedEvent(ctx, cmd.GetArgumentSlice(i));
             }
         }
         return 0;
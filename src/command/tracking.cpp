@@ -0,0 +1,567 @@
+/*
+ *Copyright (c) 2013-2014, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ *
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "comms.hpp"
+
+namespace comms
+{
+    static const char* kInvalidateChannel = "__redis__:invalidate";
+
+    TrackingTable::TrackingTable() :
+            m_total_keys(0), m_total_prefixes(0), m_clients(0)
+    {
+    }
+
+    TrackingTable::Shard& TrackingTable::GetShard(const WatchKey& key)
+    {
+        /* FNV-1a */
+        uint32 hash = 2166136261U ^ key.db;
+        for (size_t i = 0; i < key.key.size(); i++)
+        {
+            hash ^= (uint8) key.key[i];
+            hash *= 16777619U;
+        }
+        return m_shards[hash % kShards];
+    }
+
+    void TrackingTable::AddClient()
+    {
+        atomic_add_uint32(&m_clients, 1);
+    }
+
+    void TrackingTable::RemoveClient()
+    {
+        atomic_sub_uint32(&m_clients, 1);
+    }
+
+    void TrackingTable::Track(uint32 client, const TrackingTarget& target, const WatchKey& key, uint64 max_keys,
+            TrackingInvalidationArray& evicted)
+    {
+        Shard& shard = GetShard(key);
+        LockGuard<SpinMutexLock> guard(shard.lock);
+        TrackedKeyTable::iterator found = shard.keys.find(key);
+        if (found == shard.keys.end())
+        {
+            uint64 shard_max_keys = max_keys / kShards;
+            if (max_keys > 0 && (uint64) shard.keys.size() >= (shard_max_keys > 0 ? shard_max_keys : 1))
+            {
+                TrackedKeyTable::iterator victim = shard.keys.begin();
+                TrackingClientTable::iterator cit = victim->second.begin();
+                while (cit != victim->second.end())
+                {
+                    evicted.push_back(TrackingInvalidation(cit->first, cit->second, victim->first));
+                    cit++;
+                }
+                shard.keys.erase(victim);
+                atomic_sub_uint64(&m_total_keys, 1);
+            }
+            found = shard.keys.insert(TrackedKeyTable::value_type(key, TrackingClientTable())).first;
+            atomic_add_uint64(&m_total_keys, 1);
+        }
+        found->second[client] = target;
+    }
+
+    void TrackingTable::AddPrefix(uint32 client, const TrackingTarget& target, const std::string& prefix)
+    {
+        WriteLockGuard<SpinRWLock> guard(m_prefixes_lock);
+        TrackingClientTable& clients = m_prefixes[prefix];
+        if (clients.empty())
+        {
+            atomic_add_uint64(&m_total_prefixes, 1);
+        }
+        clients[client] = target;
+    }
+
+    void TrackingTable::RemovePrefix(uint32 client, const std::string& prefix)
+    {
+        WriteLockGuard<SpinRWLock> guard(m_prefixes_lock);
+        PrefixTable::iterator found = m_prefixes.find(prefix);
+        if (found != m_prefixes.end())
+        {
+            found->second.erase(client);
+            if (found->second.empty())
+            {
+                m_prefixes.erase(found);
+                atomic_sub_uint64(&m_total_prefixes, 1);
+            }
+        }
+    }
+
+    void TrackingTable::Invalidate(const WatchKey& key, TrackingInvalidationArray& invalidations)
+    {
+        if (m_total_keys > 0)
+        {
+            Shard& shard = GetShard(key);
+            LockGuard<SpinMutexLock> guard(shard.lock);
+            TrackedKeyTable::iterator found = shard.keys.find(key);
+            if (found != shard.keys.end())
+            {
+                TrackingClientTable::iterator cit = found->second.begin();
+                while (cit != found->second.end())
+                {
+                    invalidations.push_back(TrackingInvalidation(cit->first, cit->second, key));
+                    cit++;
+                }
+                shard.keys.erase(found);
+                atomic_sub_uint64(&m_total_keys, 1);
+            }
+        }
+        if (m_total_prefixes > 0)
+        {
+            ReadLockGuard<SpinRWLock> guard(m_prefixes_lock);
+            PrefixTable::iterator it = m_prefixes.begin();
+            while (it != m_prefixes.end())
+            {
+                if (key.key.compare(0, it->first.size(), it->first) == 0)
+                {
+                    TrackingClientTable::iterator cit = it->second.begin();
+                    while (cit != it->second.end())
+                    {
+                        invalidations.push_back(TrackingInvalidation(cit->first, cit->second, key));
+                        cit++;
+                    }
+                }
+                it++;
+            }
+        }
+    }
+
+    void TrackingTable::InvalidateAll(TrackingInvalidationArray& invalidations)
+    {
+        TrackingClientTable clients;
+        for (uint32 i = 0; i < kShards; i++)
+        {
+            Shard& shard = m_shards[i];
+            LockGuard<SpinMutexLock> guard(shard.lock);
+            TrackedKeyTable::iterator it = shard.keys.begin();
+            while (it != shard.keys.end())
+            {
+                clients.insert(it->second.begin(), it->second.end());
+                it++;
+            }
+            atomic_sub_uint64(&m_total_keys, shard.keys.size());
+            shard.keys.clear();
+        }
+        {
+            ReadLockGuard<SpinRWLock> guard(m_prefixes_lock);
+            PrefixTable::iterator it = m_prefixes.begin();
+            while (it != m_prefixes.end())
+            {
+                clients.insert(it->second.begin(), it->second.end());
+                it++;
+            }
+        }
+        TrackingClientTable::iterator cit = clients.begin();
+        while (cit != clients.end())
+        {
+            invalidations.push_back(TrackingInvalidation(cit->first, cit->second));
+            cit++;
+        }
+    }
+
+    struct TrackingMessage
+    {
+            uint32 client;
+            uint32 target;
+            RedisReply reply;
+    };
+
+    /*
+     * Posts the callback to the loop currently owning the connection, returns false if the connection is gone.
+     */
+    bool Comms::AsyncIOClient(uint32 id, ChannelAsyncIOCallback* cb, void* data)
+    {
+        LockGuard<SpinMutexLock> guard(m_clients_lock);
+        ContextTable::iterator found = m_clients.find(id);
+        if (found == m_clients.end() || NULL == found->second->client)
+        {
+            return false;
+        }
+        found->second->client->GetService().AsyncIO(id, cb, data);
+        return true;
+    }
+
+    /*
+     * Runs on the loop of the tracking client: the keys it read stay in the table after
+     * CLIENT TRACKING OFF, so the message is dropped unless it still tracks into the same target.
+     */
+    void Comms::CheckTrackingClientCallback(Channel* ch, void* data)
+    {
+        TrackingMessage* msg = (TrackingMessage*) data;
+        TrackingContext* tracking = NULL;
+        if (NULL != ch)
+        {
+            LockGuard<SpinMutexLock> guard(g_db->m_clients_lock);
+            ContextTable::iterator found = g_db->m_clients.find(ch->GetID());
+            if (found != g_db->m_clients.end())
+            {
+                tracking = found->second->tracking;
+            }
+        }
+        if (NULL == tracking || tracking->target.id != msg->target)
+        {
+            DELETE(msg);
+            return;
+        }
+        if (g_db->AsyncIOClient(msg->target, WriteInvalidationCallback, msg))
+        {
+            return;
+        }
+        if (!tracking->redir_broken)
+        {
+            /* RESP2 has no out of band reply to tell the client itself */
+            tracking->redir_broken = true;
+            WARN_LOG("Tracking client %u lost its REDIRECT connection %u, invalidations are dropped.", msg->client,
+                    msg->target);
+        }
+        DELETE(msg);
+    }
+
+    /*
+     * Runs on the loop of the REDIRECT connection, which only gets the message while it's
+     * subscribed to '__redis__:invalidate', anything else would be read as the reply of its next command.
+     */
+    void Comms::WriteInvalidationCallback(Channel* ch, void* data)
+    {
+        TrackingMessage* msg = (TrackingMessage*) data;
+        bool subscribed = false;
+        if (NULL != ch)
+        {
+            LockGuard<SpinMutexLock> guard(g_db->m_clients_lock);
+            ContextTable::iterator found = g_db->m_clients.find(ch->GetID());
+            if (found != g_db->m_clients.end() && NULL != found->second->pubsub)
+            {
+                subscribed = found->second->pubsub->pubsub_channels.count(kInvalidateChannel) > 0;
+            }
+        }
+        if (subscribed && !ch->Write(msg->reply))
+        {
+            ch->Close();
+        }
+        DELETE(msg);
+    }
+
+    /*
+     * Invalidation messages are delivered as pubsub messages of '__redis__:invalidate' to the REDIRECT
+     * connection, a NULL key means all keys of the client are invalidated(flushdb/flushall). Each
+     * message goes through the loop of the tracking client first, see CheckTrackingClientCallback.
+     */
+    void Comms::SendInvalidations(Context& ctx, const TrackingInvalidationArray& invalidations, bool flush)
+    {
+        uint32 self = NULL != ctx.client ? ctx.client->GetID() : 0;
+        bool noloop = NULL != ctx.tracking && ctx.tracking->noloop;
+        for (size_t i = 0; i < invalidations.size(); i++)
+        {
+            const TrackingInvalidation& inv = invalidations[i];
+            if (noloop && inv.client == self)
+            {
+                continue;
+            }
+            TrackingMessage* msg = NULL;
+            NEW(msg, TrackingMessage);
+            msg->client = inv.client;
+            msg->target = inv.target.id;
+            RedisReply& r1 = msg->reply.AddMember();
+            RedisReply& r2 = msg->reply.AddMember();
+            RedisReply& r3 = msg->reply.AddMember();
+            fill_str_reply(r1, "message");
+            fill_str_reply(r2, kInvalidateChannel);
+            if (flush)
+            {
+                r3.type = REDIS_REPLY_NIL;
+            }
+            else
+            {
+                fill_str_reply(r3.AddMember(), inv.key.key);
+            }
+            if (!AsyncIOClient(inv.client, CheckTrackingClientCallback, msg))
+            {
+                DELETE(msg);
+            }
+        }
+    }
+
+    /*
+     * Number of leading arguments which are keys read by the command, -1 means all arguments.
+     */
+    static int tracked_key_count(RedisCommandType type)
+    {
+        switch (type)
+        {
+            case REDIS_CMD_MGET:
+            case REDIS_CMD_SDIFF:
+            case REDIS_CMD_SINTER:
+            case REDIS_CMD_SUNION:
+            case REDIS_CMD_PFCOUNT:
+            {
+                return -1;
+            }
+            case REDIS_CMD_GET:
+            case REDIS_CMD_EXISTS:
+            case REDIS_CMD_TTL:
+            case REDIS_CMD_PTTL:
+            case REDIS_CMD_TYPE:
+            case REDIS_CMD_BITCOUNT:
+            case REDIS_CMD_GETBIT:
+            case REDIS_CMD_GETRANGE:
+            case REDIS_CMD_STRLEN:
+            case REDIS_CMD_HEXISTS:
+            case REDIS_CMD_HGET:
+            case REDIS_CMD_HGETALL:
+            case REDIS_CMD_HKEYS:
+            case REDIS_CMD_HLEN:
+            case REDIS_CMD_HVALS:
+            case REDIS_CMD_HMGET:
+            case REDIS_CMD_HSTRLEN:
+            case REDIS_CMD_SCARD:
+            case REDIS_CMD_SISMEMBER:
+            case REDIS_CMD_SMEMBERS:
+            case REDIS_CMD_ZCARD:
+            case REDIS_CMD_ZCOUNT:
+            case REDIS_CMD_ZRANGE:
+            case REDIS_CMD_ZRANGEBYSCORE:
+            case REDIS_CMD_ZRANK:
+            case REDIS_CMD_ZREVRANGE:
+            case REDIS_CMD_ZREVRANGEBYSCORE:
+            case REDIS_CMD_ZREVRANK:
+            case REDIS_CMD_ZSCORE:
+            case REDIS_CMD_ZLEXCOUNT:
+            case REDIS_CMD_ZRANGEBYLEX:
+            case REDIS_CMD_ZREVRANGEBYLEX:
+            case REDIS_CMD_LINDEX:
+            case REDIS_CMD_LLEN:
+            case REDIS_CMD_LRANGE:
+            {
+                return 1;
+            }
+            default:
+            {
+                return 0;
+            }
+        }
+    }
+
+    /*
+     * Called before the command reads the keys, so a write racing with the read always finds them tracked.
+     */
+    void Comms::TrackKeys(Context& ctx, DBID db, RedisCommandFrame& cmd)
+    {
+        if (NULL == ctx.tracking || ctx.tracking->bcast || NULL == ctx.client)
+        {
+            return;
+        }
+        int count = tracked_key_count(cmd.GetType());
+        if (0 == count)
+        {
+            return;
+        }
+        size_t argc = cmd.GetArgumentCount();
+        if (count > 0 && (size_t) count < argc)
+        {
+            argc = count;
+        }
+        uint32 client = ctx.client->GetID();
+        TrackingInvalidationArray evicted;
+        for (size_t i = 0; i < argc; i++)
+        {
+            ArgumentSlice key = cmd.GetArgumentSlice(i);
+            m_tracking.Track(client, ctx.tracking->target, WatchKey(db, std::string(key.data, key.len)),
+                    m_cfg.tracking_table_max_keys, evicted);
+        }
+        if (!evicted.empty())
+        {
+            SendInvalidations(ctx, evicted, false);
+        }
+    }
+
+    void Comms::InvalidateTrackedKey(Context& ctx, DBID db, const std::string& key)
+    {
+        if (m_tracking.Empty())
+        {
+            return;
+        }
+        TrackingInvalidationArray invalidations;
+        m_tracking.Invalidate(WatchKey(db, key), invalidations);
+        if (!invalidations.empty())
+        {
+            SendInvalidations(ctx, invalidations, false);
+        }
+    }
+
+    void Comms::InvalidateAllTrackedKeys(Context& ctx)
+    {
+        if (m_tracking.Empty())
+        {
+            return;
+        }
+        TrackingInvalidationArray invalidations;
+        m_tracking.InvalidateAll(invalidations);
+        SendInvalidations(ctx, invalidations, true);
+    }
+
+    void Comms::DisableTracking(Context& ctx)
+    {
+        if (NULL == ctx.tracking)
+        {
+            return;
+        }
+        uint32 client = ctx.client->GetID();
+        StringSet::iterator it = ctx.tracking->prefixes.begin();
+        while (it != ctx.tracking->prefixes.end())
+        {
+            m_tracking.RemovePrefix(client, *it);
+            it++;
+        }
+        /*
+         * keys read by the client are left in the table until invalidated or evicted, their
+         * messages are dropped by CheckTrackingClientCallback.
+         */
+        ctx.ClearTracking();
+        m_tracking.RemoveClient();
+    }
+
+    /*
+     * CLIENT TRACKING ON|OFF [REDIRECT id] [BCAST] [PREFIX prefix ...] [NOLOOP]
+     */
+    int Comms::ClientTracking(Context& ctx, RedisCommandFrame& cmd)
+    {
+        const ArgumentArray& args = cmd.GetArguments();
+        if (args.size() < 2)
+        {
+            fill_error_reply(ctx.reply, "wrong number of arguments for 'client tracking'");
+            return 0;
+        }
+        bool on = false;
+        if (!strcasecmp(args[1].c_str(), "on"))
+        {
+            on = true;
+        }
+        else if (strcasecmp(args[1].c_str(), "off"))
+        {
+            fill_error_reply(ctx.reply, "syntax error");
+            return 0;
+        }
+        if (!on)
+        {
+            DisableTracking(ctx);
+            fill_ok_reply(ctx.reply);
+            return 0;
+        }
+        uint32 redirect = 0;
+        bool bcast = false;
+        bool noloop = false;
+        StringSet prefixes;
+        for (size_t i = 2; i < args.size(); i++)
+        {
+            if (!strcasecmp(args[i].c_str(), "redirect") && i + 1 < args.size())
+            {
+                if (!string_touint32(args[i + 1], redirect) || 0 == redirect)
+                {
+                    fill_error_reply(ctx.reply, "Invalid client ID");
+                    return 0;
+                }
+                i++;
+            }
+            else if (!strcasecmp(args[i].c_str(), "bcast"))
+            {
+                bcast = true;
+            }
+            else if (!strcasecmp(args[i].c_str(), "noloop"))
+            {
+                noloop = true;
+            }
+            else if (!strcasecmp(args[i].c_str(), "prefix") && i + 1 < args.size())
+            {
+                prefixes.insert(args[i + 1]);
+                i++;
+            }
+            else
+            {
+                fill_error_reply(ctx.reply, "syntax error");
+                return 0;
+            }
+        }
+        if (!prefixes.empty() && !bcast)
+        {
+            fill_error_reply(ctx.reply, "PREFIX option requires BCAST mode to be enabled");
+            return 0;
+        }
+        /*
+         * without RESP3 the invalidations can't be mixed into the replies of the client, they're
+         * only sent to another connection subscribed to '__redis__:invalidate'.
+         */
+        TrackingTarget target(ctx.client->GetID());
+        if (0 == redirect || redirect == target.id)
+        {
+            fill_error_reply(ctx.reply, "CLIENT TRACKING requires REDIRECT to another connection without RESP3");
+            return 0;
+        }
+        {
+            LockGuard<SpinMutexLock> guard(m_clients_lock);
+            ContextTable::iterator found = m_clients.find(redirect);
+            if (found == m_clients.end())
+            {
+                fill_error_reply(ctx.reply, "The client ID you want redirect to does not exist");
+                return 0;
+            }
+            target.id = redirect;
+        }
+        if (NULL != ctx.tracking && ctx.tracking->bcast != bcast)
+        {
+            fill_error_reply(ctx.reply, "You can't switch BCAST mode on/off before disabling tracking");
+            return 0;
+        }
+        if (NULL == ctx.tracking)
+        {
+            m_tracking.AddClient();
+        }
+        TrackingContext& tracking = ctx.GetTracking();
+        tracking.target = target;
+        tracking.redir_broken = false;
+        tracking.bcast = bcast;
+        tracking.noloop = noloop;
+        if (bcast)
+        {
+            if (prefixes.empty())
+            {
+                /* the empty prefix matches all keys */
+                prefixes.insert("");
+            }
+            StringSet::iterator it = prefixes.begin();
+            while (it != prefixes.end())
+            {
+                m_tracking.AddPrefix(ctx.client->GetID(), target, *it);
+                tracking.prefixes.insert(*it);
+                it++;
+            }
+        }
+        fill_ok_reply(ctx.reply);
+        return 0;
+    }
+}
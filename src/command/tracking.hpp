@@ -0,0 +1,111 @@
+/*
+ *Copyright (c) 2013-2014, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ *
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TRACKING_HPP_
+#define TRACKING_HPP_
+
+#include "common/common.hpp"
+#include "thread/spin_rwlock.hpp"
+#include "thread/spin_mutex_lock.hpp"
+#include "context.hpp"
+#include <vector>
+
+namespace comms
+{
+    struct TrackingInvalidation
+    {
+            uint32 client;  //tracking client id
+            TrackingTarget target;
+            WatchKey key;
+            TrackingInvalidation(uint32 c = 0, const TrackingTarget& t = TrackingTarget(), const WatchKey& k =
+                    WatchKey()) :
+                    client(c), target(t), key(k)
+            {
+            }
+    };
+    typedef std::vector<TrackingInvalidation> TrackingInvalidationArray;
+
+    /*
+     * Keys read by tracking clients and prefixes registered by broadcasting clients.
+     * The keys table is split into shards with their own locks, so that key changes
+     * from different threads do not contend on one lock, and it's bounded by 'max_keys',
+     * the evicted keys are invalidated as if they were modified.
+     */
+    class TrackingTable
+    {
+        private:
+            static const uint32 kShards = 64;
+            typedef TreeMap<uint32, TrackingTarget>::Type TrackingClientTable;
+            typedef TreeMap<WatchKey, TrackingClientTable>::Type TrackedKeyTable;
+            struct Shard
+            {
+                    SpinMutexLock lock;
+                    TrackedKeyTable keys;
+            };
+            Shard m_shards[kShards];
+            volatile uint64 m_total_keys;
+
+            typedef TreeMap<std::string, TrackingClientTable>::Type PrefixTable;
+            PrefixTable m_prefixes;
+            SpinRWLock m_prefixes_lock;
+            volatile uint64 m_total_prefixes;
+
+            volatile uint32 m_clients;
+
+            Shard& GetShard(const WatchKey& key);
+        public:
+            TrackingTable();
+            bool Empty() const
+            {
+                return 0 == m_clients;
+            }
+            void AddClient();
+            void RemoveClient();
+            uint32 Clients() const
+            {
+                return m_clients;
+            }
+            uint64 TotalKeys() const
+            {
+                return m_total_keys;
+            }
+            uint64 TotalPrefixes() const
+            {
+                return m_total_prefixes;
+            }
+
+            void Track(uint32 client, const TrackingTarget& target, const WatchKey& key, uint64 max_keys,
+                    TrackingInvalidationArray& evicted);
+            void AddPrefix(uint32 client, const TrackingTarget& target, const std::string& prefix);
+            void RemovePrefix(uint32 client, const std::string& prefix);
+            void Invalidate(const WatchKey& key, TrackingInvalidationArray& invalidations);
+            void InvalidateAll(TrackingInvalidationArray& invalidations);
+    };
+}
+
+#endif /* TRACKING_HPP_ */
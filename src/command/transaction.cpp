@@ -89,6 +89,10 @@ namespace comms
                 transc_ctx.reply.Clear();
                 transc_ctx.data_change = false;
                 transc_ctx.current_cmd = &(*it);
+                if (NULL != ctx.tracking)
+                {
+                    TrackKeys(ctx, transc_ctx.currentDB, *it);
+                }
                 DoCall(transc_ctx, *setting, *it);
                 r.Clone(transc_ctx.reply);
                 if (transc_ctx.data_change && !ctx.flags.no_wal)
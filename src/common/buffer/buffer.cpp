@@ -28,6 +28,7 @@
  */
 
 #include "buffer.hpp"
+#include "util/scan_helper.hpp"
 #include <sys/uio.h>
 #include <errno.h>
 #include <string.h>
@@ -142,6 +143,13 @@ int Buffer::IndexOf(const void* data, size_t len, size_t start, size_t end)
 	{
 		return -1;
 	}
+	const char* pattern = (const char*) data;
+	if (len == 1 || (len == 2 && pattern[0] == '\r' && pattern[1] == '\n'))
+	{
+		const char* p = len == 1 ? find_char(m_buffer + start, end - start, pattern[0]) :
+				find_crlf(m_buffer + start, end - start);
+		return NULL == p ? -1 : p - m_buffer;
+	}
 
 	char first = ((const char*) data)[0];
 	size_t start_idx = start;
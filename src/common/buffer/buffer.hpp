@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string>
+#include "buffer/buffer_pool.hpp"
 
 namespace comms
 {
@@ -60,19 +61,43 @@ namespace comms
             size_t m_write_idx;
             size_t m_read_idx;
             bool m_in_heap;
+            bool m_pooled;
+            inline char* AllocateStorage(size_t size, size_t& capacity)
+            {
+                if (m_pooled)
+                {
+                    return BufferPool::Allocate(size, capacity);
+                }
+                capacity = size;
+                return (char*) malloc(size);
+            }
+            inline void FreeStorage()
+            {
+                if (NULL != m_buffer && m_in_heap)
+                {
+                    if (m_pooled)
+                    {
+                        BufferPool::Release(m_buffer, m_buffer_len);
+                    }
+                    else
+                    {
+                        free(m_buffer);
+                    }
+                }
+            }
         public:
             static const int BUFFER_MAX_READ = 8192;
             static const size_t DEFAULT_BUFFER_SIZE = 32;
             inline Buffer() :
-                    m_buffer(0), m_buffer_len(0), m_write_idx(0), m_read_idx(0), m_in_heap(true)
+                    m_buffer(0), m_buffer_len(0), m_write_idx(0), m_read_idx(0), m_in_heap(true), m_pooled(false)
             {
             }
             inline Buffer(char* value, size_t off, size_t len) :
-                    m_buffer(value), m_buffer_len(len), m_write_idx(off + len), m_read_idx(off), m_in_heap(false)
+                    m_buffer(value), m_buffer_len(len), m_write_idx(off + len), m_read_idx(off), m_in_heap(false), m_pooled(false)
             {
             }
             inline Buffer(size_t size) :
-                    m_buffer(0), m_buffer_len(0), m_write_idx(0), m_read_idx(0), m_in_heap(true)
+                    m_buffer(0), m_buffer_len(0), m_write_idx(0), m_read_idx(0), m_in_heap(true), m_pooled(false)
             {
                 EnsureWritableBytes(size);
             }
@@ -89,6 +114,26 @@ namespace comms
                 m_write_idx = len;
                 return true;
             }
+            /*
+             * Pooled buffers take their storage from the thread's BufferPool, and give it
+             * back on Release(), it should be called once the buffer is drained.
+             */
+            inline void SetPooled(bool pooled)
+            {
+                if (pooled != m_pooled)
+                {
+                    Release();
+                    m_pooled = pooled;
+                }
+            }
+            inline void Release()
+            {
+                FreeStorage();
+                m_buffer = NULL;
+                m_buffer_len = 0;
+                m_read_idx = m_write_idx = 0;
+                m_in_heap = true;
+            }
             inline size_t GetReadIndex() const
             {
                 return m_read_idx;
@@ -144,9 +189,10 @@ namespace comms
                 uint32_t readableBytes = ReadableBytes();
                 uint32_t total = Capacity();
                 char* newSpace = NULL;
+                size_t newCapacity = 0;
                 if (readableBytes > 0)
                 {
-                    newSpace = (char*) malloc(readableBytes);
+                    newSpace = AllocateStorage(readableBytes, newCapacity);
                     if (NULL == newSpace)
                     {
                         return 0;
@@ -157,13 +203,10 @@ namespace comms
                 {
                     return 0;
                 }
-                if (NULL != m_buffer && m_in_heap)
-                {
-                    free(m_buffer);
-                }
+                FreeStorage();
                 m_read_idx = 0;
                 m_write_idx = readableBytes;
-                m_buffer_len = readableBytes;
+                m_buffer_len = newCapacity;
                 m_buffer = newSpace;
                 m_in_heap = true;
                 return total - readableBytes;
@@ -190,7 +233,7 @@ namespace comms
                     char* tmp = NULL;
 
                     //tmp = (char*) realloc(m_buffer, newCapacity);
-                    tmp = (char*) malloc(newCapacity);
+                    tmp = AllocateStorage(newCapacity, newCapacity);
                     if (NULL != tmp)
                     {
                         if (growzero)
@@ -201,10 +244,7 @@ namespace comms
                         {
                             memcpy(tmp, m_buffer, Capacity());
                         }
-                        if (m_in_heap && NULL != m_buffer)
-                        {
-                            free(m_buffer);
-                        }
+                        FreeStorage();
                         m_in_heap = true;
                         m_buffer = tmp;
                         m_buffer_len = newCapacity;
@@ -378,10 +418,7 @@ namespace comms
             }
             inline ~Buffer()
             {
-                if (m_buffer != NULL && m_in_heap)
-                {
-                    free(m_buffer);
-                }
+                FreeStorage();
             }
 
     };
@@ -0,0 +1,137 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "buffer_pool.hpp"
+#include "thread/thread_local.hpp"
+#include "util/atomic.hpp"
+#include <stdlib.h>
+#include <vector>
+
+using namespace comms;
+
+static const size_t kSizeClasses = 11; /* 1KB << 0 ... 1KB << 10 */
+/* bytes each size class may cache per thread */
+static const size_t kMaxCachedBytesPerClass = 2 * 1024 * 1024;
+
+static volatile uint64_t g_pooled_bytes = 0;
+static volatile uint64_t g_used_bytes = 0;
+
+struct BufferFreeLists
+{
+        std::vector<char*> blocks[kSizeClasses];
+        ~BufferFreeLists()
+        {
+            for (size_t i = 0; i < kSizeClasses; i++)
+            {
+                for (size_t j = 0; j < blocks[i].size(); j++)
+                {
+                    free(blocks[i][j]);
+                }
+                atomic_sub_uint64(&g_pooled_bytes, (BufferPool::kMinBlockSize << i) * blocks[i].size());
+            }
+        }
+};
+static ThreadLocal<BufferFreeLists> g_free_lists;
+
+static inline int size_class(size_t size)
+{
+    int idx = 0;
+    size_t block = BufferPool::kMinBlockSize;
+    while (block < size)
+    {
+        block <<= 1;
+        idx++;
+    }
+    return idx;
+}
+
+char* BufferPool::Allocate(size_t size, size_t& capacity)
+{
+    if (size > kMaxBlockSize)
+    {
+        capacity = size;
+        char* block = (char*) malloc(size);
+        if (NULL != block)
+        {
+            atomic_add_uint64(&g_used_bytes, capacity);
+        }
+        return block;
+    }
+    int idx = size_class(size);
+    capacity = kMinBlockSize << idx;
+    std::vector<char*>& blocks = g_free_lists.GetValue().blocks[idx];
+    char* block = NULL;
+    if (!blocks.empty())
+    {
+        block = blocks.back();
+        blocks.pop_back();
+        atomic_sub_uint64(&g_pooled_bytes, capacity);
+    }
+    else
+    {
+        block = (char*) malloc(capacity);
+        if (NULL == block)
+        {
+            return NULL;
+        }
+    }
+    atomic_add_uint64(&g_used_bytes, capacity);
+    return block;
+}
+
+void BufferPool::Release(char* block, size_t capacity)
+{
+    if (NULL == block)
+    {
+        return;
+    }
+    atomic_sub_uint64(&g_used_bytes, capacity);
+    if (capacity >= kMinBlockSize && capacity <= kMaxBlockSize && 0 == (capacity & (capacity - 1)))
+    {
+        int idx = size_class(capacity);
+        std::vector<char*>& blocks = g_free_lists.GetValue().blocks[idx];
+        if ((blocks.size() + 1) * capacity <= kMaxCachedBytesPerClass || blocks.empty())
+        {
+            blocks.push_back(block);
+            atomic_add_uint64(&g_pooled_bytes, capacity);
+            return;
+        }
+    }
+    free(block);
+}
+
+uint64_t BufferPool::PooledBytes()
+{
+    return g_pooled_bytes;
+}
+
+uint64_t BufferPool::UsedBytes()
+{
+    return g_used_bytes;
+}
@@ -0,0 +1,59 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BUFFER_POOL_HPP_
+#define BUFFER_POOL_HPP_
+#include <stdint.h>
+#include <stddef.h>
+
+namespace comms
+{
+    /*
+     * Per-thread free lists of power-of-two sized blocks (1KB - 1MB) backing pooled Buffers.
+     * Connections return their buffers here once the buffers are drained, so idle connections
+     * hold no buffer memory and busy ones reuse blocks without touching malloc.
+     */
+    class BufferPool
+    {
+        public:
+            static const size_t kMinBlockSize = 1024;
+            static const size_t kMaxBlockSize = 1024 * 1024;
+            /*
+             * Returns a block of at least 'size' bytes, the real size is stored in 'capacity'.
+             */
+            static char* Allocate(size_t size, size_t& capacity);
+            static void Release(char* block, size_t capacity);
+            /* bytes cached in all threads' free lists */
+            static uint64_t PooledBytes();
+            /* bytes held by pooled buffers */
+            static uint64_t UsedBytes();
+    };
+}
+
+#endif /* BUFFER_POOL_HPP_ */
@@ -0,0 +1,94 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SHARED_SEGMENT_HPP_
+#define SHARED_SEGMENT_HPP_
+#include "common.hpp"
+#include "util/atomic.hpp"
+#include <string>
+#include <vector>
+
+namespace comms
+{
+    /*
+     * Refcounted immutable bytes. A large payload is adopted from a std::string
+     * by swapping, then it could be referenced by several output queues and is
+     * written to sockets without being copied into their buffers.
+     */
+    class SharedSegment
+    {
+        private:
+            std::string m_data;
+            volatile uint32_t m_ref;
+            ~SharedSegment()
+            {
+            }
+        public:
+            SharedSegment(std::string& data) :
+                    m_ref(1)
+            {
+                m_data.swap(data);
+            }
+            inline const char* Data() const
+            {
+                return m_data.data();
+            }
+            inline size_t Size() const
+            {
+                return m_data.size();
+            }
+            inline void Retain()
+            {
+                atomic_add_uint32(&m_ref, 1);
+            }
+            inline void Release()
+            {
+                if (0 == atomic_sub_uint32(&m_ref, 1))
+                {
+                    delete this;
+                }
+            }
+    };
+
+    /*
+     * A shared payload to be sent after 'offset' readable bytes of an accompanying Buffer.
+     */
+    struct BufferSegment
+    {
+            size_t offset;
+            SharedSegment* segment;
+            BufferSegment(size_t off = 0, SharedSegment* seg = NULL) :
+                    offset(off), segment(seg)
+            {
+            }
+    };
+    typedef std::vector<BufferSegment> BufferSegmentArray;
+}
+
+#endif /* SHARED_SEGMENT_HPP_ */
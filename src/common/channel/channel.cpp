@@ -38,12 +38,60 @@
 #endif
 #include "thread/spin_mutex_lock.hpp"
 #include "thread/lock_guard.hpp"
+#include "util/time_helper.hpp"
 
 using namespace comms;
 
-static volatile uint32 kChannelIDSeed = 0;
+/*
+ * Slots of destroyed channels are reused oldest first, and only once more than
+ * kMinFreeChannelSlots are free, so a slot's generation wraps after at least
+ * 1024 * kMinFreeChannelSlots channels were closed.
+ */
+static const size_t kMinFreeChannelSlots = 4096;
+static uint32 g_channel_slot_seed = 0;
+static std::deque<uint32> g_free_channel_slots;
+static std::vector<uint16> g_channel_slot_generations;
+static uint64 g_channel_slot_exhausted = 0;
 static SpinMutexLock g_channel_id_mutex;
 
+/*
+ * INVALID_CHANNEL_ID if every slot is owned by a live channel.
+ */
+static uint32 alloc_channel_slot()
+{
+    LockGuard<SpinMutexLock> guard(g_channel_id_mutex);
+    uint32 slot;
+    if (g_free_channel_slots.size() > kMinFreeChannelSlots
+            || (g_channel_slot_seed == MAX_CHANNEL_SLOTS && !g_free_channel_slots.empty()))
+    {
+        slot = g_free_channel_slots.front();
+        g_free_channel_slots.pop_front();
+        g_channel_slot_generations[slot] = (g_channel_slot_generations[slot] + 1) & CHANNEL_GENERATION_MASK;
+    }
+    else
+    {
+        if (g_channel_slot_seed == MAX_CHANNEL_SLOTS)
+        {
+            if (0 == (g_channel_slot_exhausted++ & 1023))
+            {
+                ERROR_LOG("No free channel slot left for %u live channels, %llu channels refused.", MAX_CHANNEL_SLOTS,
+                        (unsigned long long) g_channel_slot_exhausted);
+            }
+            return INVALID_CHANNEL_ID;
+        }
+        slot = g_channel_slot_seed++;
+        g_channel_slot_generations.push_back(0);
+    }
+    return ((uint32) g_channel_slot_generations[slot] << CHANNEL_SLOT_BITS) | slot;
+}
+
+static void free_channel_slot(uint32 slot)
+{
+    LockGuard<SpinMutexLock> guard(g_channel_id_mutex);
+    g_free_channel_slots.push_back(slot);
+}
+static const int kMaxWriteIOV = 64;
+
 void Channel::IOEventCallback(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask)
 {
     Channel* channel = (Channel*) clientData;
@@ -67,19 +115,14 @@ Channel::Channel(Channel* parent, ChannelService& service) :
                 -1), m_pipeline_initializor(
         NULL), m_pipeline_initailizor_user_data(NULL), m_pipeline_finallizer(
         NULL), m_pipeline_finallizer_user_data(NULL), m_detached(false), m_close_after_write(false), m_block_read(
-                false), m_file_sending(
-        NULL), m_attach(NULL), m_attach_destructor(NULL)
+                false), m_batch_writing(false), m_flush_pending(false), m_read_yielded(false), m_read_frames(0), m_soft_limit_time(0), m_output_segments_buffered(0), m_output_segments_bytes(0), m_file_sending(
+        NULL), m_attach(NULL), m_attach_destructor(NULL), m_read_cost(0), m_last_read_cost(0), m_completion_io(false), m_completion_resume(
+                false)
 {
-
-    {
-        LockGuard<SpinMutexLock> guard(g_channel_id_mutex);
-        if (kChannelIDSeed == MAX_CHANNEL_ID)
-        {
-            kChannelIDSeed = 0;
-        }
-        kChannelIDSeed++;
-        m_id = kChannelIDSeed;
-    }
+    m_inputBuffer.SetPooled(true);
+    m_outputBuffer.SetPooled(true);
+    //the channel's type is added to the low bits when it's created by ChannelService
+    m_id = alloc_channel_slot();
     if (NULL != parent)
     {
         m_parent_id = parent->GetID();
@@ -99,6 +142,10 @@ int Channel::GetReadFD()
 bool Channel::AttachFD()
 {
     int fd = GetReadFD();
+    if (fd != -1 && m_options.edge_triggered)
+    {
+        aeSetFileEventEdge(GetService().GetRawEventLoop(), fd, 1);
+    }
     if (fd
             != -1&& aeCreateFileEvent(GetService().GetRawEventLoop(), fd, AE_READABLE, Channel::IOEventCallback, this) == AE_ERR)
     {
@@ -107,6 +154,16 @@ bool Channel::AttachFD()
         return false;
     }
     m_detached = false;
+    if (m_completion_resume)
+    {
+        //moved from another loop, the bytes it had received wait in the input buffer
+        m_completion_resume = false;
+        EnableCompletionIO();
+        if (m_inputBuffer.Readable())
+        {
+            YieldRead();
+        }
+    }
     return true;
 }
 
@@ -118,6 +175,10 @@ bool Channel::AttachFD(int fd)
         ERROR_LOG("Failed to attach FD since current fd is not -1");
         return false;
     }
+    if (m_options.edge_triggered)
+    {
+        aeSetFileEventEdge(GetService().GetRawEventLoop(), fd, 1);
+    }
     if (aeCreateFileEvent(GetService().GetRawEventLoop(), fd, AE_READABLE, Channel::IOEventCallback, this) == AE_ERR)
     {
         ::close(fd);
@@ -136,6 +197,8 @@ bool Channel::SetIOEventCallback(ChannelIOEventCallback* cb, int mask, void* dat
         ERROR_LOG("Channel::SetIOEventCallback should be invoked after detached.");
         return false;
     }
+    //the callback does its own I/O on the fd
+    DrainCompletionIO();
     int rd_fd = GetReadFD();
     int wr_fd = GetWriteFD();
 
@@ -201,10 +264,106 @@ int Channel::HandleIOError(int err)
     return -1;
 }
 
+void Channel::EnableCompletionIO()
+{
+    m_completion_io = NULL == m_file_sending
+            && aeSetFileEventCompletion(GetService().GetRawEventLoop(), m_fd, 1) == AE_OK;
+}
+
+/*
+ * Take the socket out of completion mode before it's handed to another loop or to raw
+ * callbacks: wait for the sends in flight and move the received bytes to the input buffer.
+ */
+void Channel::DrainCompletionIO()
+{
+    if (!m_completion_io)
+    {
+        return;
+    }
+    aeEventLoop* loop = GetService().GetRawEventLoop();
+    if (aeDrainFileEventCompletion(loop, m_fd, 1000) != AE_OK)
+    {
+        WARN_LOG("Timeout to drain the completion I/O of channel:%u, %llu bytes not sent.", m_id,
+                (unsigned long long) aeGetPendingBytes(loop, m_fd, AE_WRITABLE));
+    }
+    size_t queued = aeGetPendingBytes(loop, m_fd, AE_READABLE);
+    if (queued > 0)
+    {
+        m_inputBuffer.EnsureWritableBytes(queued);
+        int ret = aeRead(loop, m_fd, (char*) m_inputBuffer.GetRawWriteBuffer(), queued);
+        if (ret > 0)
+        {
+            m_inputBuffer.AdvanceWriteIndex(ret);
+        }
+    }
+    aeForgetFileEvent(loop, m_fd);
+    m_completion_io = false;
+}
+
+bool Channel::HasQueuedOutput()
+{
+    return m_completion_io && aeGetPendingBytes(GetService().GetRawEventLoop(), GetWriteFD(), AE_WRITABLE) > 0;
+}
+
+int Channel::ReadFromFD(Buffer* buffer, int& err)
+{
+    if (!m_completion_io)
+    {
+        return buffer->ReadFD(GetReadFD(), err);
+    }
+    aeEventLoop* loop = GetService().GetRawEventLoop();
+    size_t queued = aeGetPendingBytes(loop, m_fd, AE_READABLE);
+    buffer->EnsureWritableBytes(queued > 0 ? queued : 16384);
+    int ret = aeRead(loop, m_fd, (char*) buffer->GetRawWriteBuffer(), buffer->WriteableBytes());
+    if (ret < 0)
+    {
+        err = errno;
+    }
+    else
+    {
+        buffer->AdvanceWriteIndex(ret);
+    }
+    return ret;
+}
+
+int Channel::WriteToFD(Buffer* buffer, int& err)
+{
+    if (!m_completion_io)
+    {
+        return buffer->WriteFD(GetWriteFD(), err);
+    }
+    if (!buffer->Readable())
+    {
+        return 0;
+    }
+    struct iovec iov;
+    iov.iov_base = (void*) buffer->GetRawReadBuffer();
+    iov.iov_len = buffer->ReadableBytes();
+    int ret = WritevToFD(&iov, 1, err);
+    if (ret > 0)
+    {
+        buffer->AdvanceReadIndex(ret);
+    }
+    return ret;
+}
+
+int Channel::WritevToFD(const struct iovec* iov, int iovcnt, int& err)
+{
+    int ret =
+            m_completion_io ?
+                    aeWritev(GetService().GetRawEventLoop(), GetWriteFD(), iov, iovcnt) :
+                    ::writev(GetWriteFD(), iov, iovcnt);
+    if (ret < 0)
+    {
+        err = errno;
+    }
+    return ret;
+}
+
 int32 Channel::ReadNow(Buffer* buffer)
 {
     int err;
-    int ret = buffer->ReadFD(GetReadFD(), err);
+    int ret = ReadFromFD(buffer, err);
     if (ret < 0)
     {
         if (IO_ERR_RW_RETRIABLE(err))
@@ -291,6 +450,48 @@ void Channel::CreateFlushTimerTask()
     }
 }
 
+/*
+ * Called before output is queued, closes the channel and returns false if queuing 'appending'
+ * bytes would exceed the hard limit, or the output has been above the soft limit for too long.
+ * The reply is not queued partially, the peer sees the connection closed instead of a broken stream.
+ */
+bool Channel::CheckOutputLimit(size_t appending)
+{
+    size_t pending = PendingOutputBytes() + appending;
+    const char* limit = NULL;
+    if (m_options.max_write_buffer_size > 0 && pending > (uint32) m_options.max_write_buffer_size)
+    {
+        limit = "hard";
+    }
+    else if (m_options.soft_write_buffer_size > 0 && pending > (uint32) m_options.soft_write_buffer_size)
+    {
+        uint64 now = get_current_epoch_millis();
+        if (0 == m_soft_limit_time)
+        {
+            m_soft_limit_time = now;
+            GetService().m_soft_limited_channels.push_back(m_id);
+        }
+        else if (now - m_soft_limit_time >= (uint64) m_options.soft_write_buffer_seconds * 1000)
+        {
+            limit = "soft";
+        }
+    }
+    else
+    {
+        m_soft_limit_time = 0;
+    }
+    if (NULL == limit)
+    {
+        return true;
+    }
+    WARN_LOG("Close channel:%u since output buffer with %llu bytes exceed %s limit.", m_id, (unsigned long long) pending,
+            limit);
+    GetService().m_output_limit_closed++;
+    m_outputBuffer.Clear();
+    DoClose(false);
+    return false;
+}
+
 int32 Channel::WriteNow(Buffer* buffer)
 {
     if (NULL != m_file_sending)
@@ -300,22 +501,35 @@ int32 Channel::WriteNow(Buffer* buffer)
     }
     uint32 buf_len = NULL != buffer ? buffer->ReadableBytes() : 0;
 
-    if (m_outputBuffer.Readable())
+    if (m_batch_writing)
     {
-        if (m_options.max_write_buffer_size > 0) //write buffer size limit enable
+        if (!CheckOutputLimit(buf_len))
         {
-            uint32 write_buffer_size = m_outputBuffer.ReadableBytes();
-            if (write_buffer_size > (uint32) m_options.max_write_buffer_size
-                    || (write_buffer_size + buf_len) > (uint32) m_options.max_write_buffer_size)
-            {
-                //overflow
-                WARN_LOG("Channel:%u write buffer exceed limit:%d", m_id, m_options.max_write_buffer_size);
-                return 0;
-            }
+            return 0;
+        }
+        //flushed by FlushBatchWrite after current read event processed
+        m_outputBuffer.Write(buffer, buf_len);
+        return buf_len;
+    }
+    if (m_options.flush_before_sleep)
+    {
+        if (!CheckOutputLimit(buf_len))
+        {
+            return 0;
+        }
+        m_outputBuffer.Write(buffer, buf_len);
+        ScheduleLoopFlush();
+        return buf_len;
+    }
+    if (HasPendingOutput())
+    {
+        if (!CheckOutputLimit(buf_len))
+        {
+            return 0;
         }
         m_outputBuffer.Write(buffer, buf_len);
         if (m_options.user_write_buffer_water_mark > 0
-                && m_outputBuffer.ReadableBytes() < m_options.user_write_buffer_water_mark)
+                && PendingOutputBytes() < m_options.user_write_buffer_water_mark)
         {
             CreateFlushTimerTask();
         }
@@ -338,6 +552,10 @@ int32 Channel::WriteNow(Buffer* buffer)
         bool enable_writing = IsEnableWriting();
         if (buf_len < m_options.user_write_buffer_water_mark || enable_writing || m_options.async_write)
         {
+            if (!CheckOutputLimit(buf_len))
+            {
+                return 0;
+            }
             m_outputBuffer.Write(buffer, buf_len);
             if (!enable_writing)
             {
@@ -352,7 +570,7 @@ int32 Channel::WriteNow(Buffer* buffer)
             return buf_len;
         }
         int err;
-        int ret = buffer->WriteFD(GetWriteFD(), err);
+        int ret = WriteToFD(buffer, err);
         if (ret < 0)
         {
             if (IO_ERR_RW_RETRIABLE(err))
@@ -362,6 +580,10 @@ int32 Channel::WriteNow(Buffer* buffer)
                     //no write buffer allowed
                     return 0;
                 }
+                if (!CheckOutputLimit(buf_len))
+                {
+                    return 0;
+                }
                 m_outputBuffer.Write(buffer, buf_len);
                 EnableWriting();
                 return buf_len;
@@ -379,6 +601,10 @@ int32 Channel::WriteNow(Buffer* buffer)
         {
             if ((size_t) ret < buf_len)
             {
+                if (!CheckOutputLimit(buf_len - ret))
+                {
+                    return 0;
+                }
                 m_outputBuffer.Write(buffer, buf_len - ret);
                 EnableWriting();
             }
@@ -387,6 +613,295 @@ int32 Channel::WriteNow(Buffer* buffer)
     }
 }
 
+void Channel::FlushBatchWrite()
+{
+    if (IsClosed() || !HasPendingOutput() || IsEnableWriting())
+    {
+        return;
+    }
+    if (m_options.flush_before_sleep)
+    {
+        ScheduleLoopFlush();
+        return;
+    }
+    if (m_options.user_write_buffer_water_mark > 0
+            && PendingOutputBytes() < m_options.user_write_buffer_water_mark)
+    {
+        CreateFlushTimerTask();
+        return;
+    }
+    FlushPendingOutput();
+}
+
+void Channel::ScheduleLoopFlush()
+{
+    if (!m_flush_pending && !IsEnableWriting())
+    {
+        m_flush_pending = true;
+        GetService().AddFlushChannel(this);
+    }
+}
+
+void Channel::FlushPendingOutput()
+{
+    if (IsClosed() || !HasPendingOutput() || IsEnableWriting())
+    {
+        return;
+    }
+    if (m_options.async_write)
+    {
+        EnableWriting();
+        return;
+    }
+    if (DoFlush() && !IsClosed() && HasPendingOutput())
+    {
+        EnableWriting();
+    }
+}
+
+int32 Channel::WriteSegments(Buffer* buffer, const BufferSegmentArray& segments)
+{
+    if (segments.empty())
+    {
+        return WriteNow(buffer);
+    }
+    if (NULL != m_file_sending)
+    {
+        WARN_LOG("Can NOT write fd since channel is sending file.");
+        return 0;
+    }
+    size_t total = buffer->ReadableBytes();
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        total += segments[i].segment->Size();
+    }
+    if (!CheckOutputLimit(total))
+    {
+        return 0;
+    }
+    if (m_batch_writing || HasPendingOutput() || IsEnableWriting() || m_options.async_write
+            || m_options.user_write_buffer_water_mark > 0 || m_options.flush_before_sleep)
+    {
+        QueueOutput(buffer, segments, 0);
+        if (!m_batch_writing)
+        {
+            FlushBatchWrite();
+        }
+        return total;
+    }
+
+    struct iovec iov[kMaxWriteIOV];
+    int iovcnt = 0;
+    const char* raw = buffer->GetRawReadBuffer();
+    size_t pos = 0;
+    for (size_t i = 0; i < segments.size() && iovcnt < kMaxWriteIOV; i++)
+    {
+        if (segments[i].offset > pos)
+        {
+            iov[iovcnt].iov_base = (void*) (raw + pos);
+            iov[iovcnt].iov_len = segments[i].offset - pos;
+            iovcnt++;
+            pos = segments[i].offset;
+            if (iovcnt == kMaxWriteIOV)
+            {
+                break;
+            }
+        }
+        iov[iovcnt].iov_base = (void*) segments[i].segment->Data();
+        iov[iovcnt].iov_len = segments[i].segment->Size();
+        iovcnt++;
+    }
+    if (iovcnt < kMaxWriteIOV && pos < buffer->ReadableBytes())
+    {
+        iov[iovcnt].iov_base = (void*) (raw + pos);
+        iov[iovcnt].iov_len = buffer->ReadableBytes() - pos;
+        iovcnt++;
+    }
+    int err;
+    int ret = WritevToFD(iov, iovcnt, err);
+    if (ret < 0)
+    {
+        if (IO_ERR_RW_RETRIABLE(err))
+        {
+            if (m_options.max_write_buffer_size == 0)
+            {
+                //no write buffer allowed
+                return 0;
+            }
+            QueueOutput(buffer, segments, 0);
+            EnableWriting();
+            return total;
+        }
+        else
+        {
+            return HandleIOError(err);
+        }
+    }
+    else if (ret == 0)
+    {
+        return HandleExceptionEvent(CHANNEL_EVENT_EOF);
+    }
+    if ((size_t) ret < total)
+    {
+        QueueOutput(buffer, segments, ret);
+        EnableWriting();
+    }
+    return total;
+}
+
+void Channel::QueueSegment(SharedSegment* segment, size_t offset)
+{
+    OutputSegment out;
+    out.buffered = m_outputBuffer.ReadableBytes() - m_output_segments_buffered;
+    out.segment = segment;
+    out.offset = offset;
+    segment->Retain();
+    m_output_segments.push_back(out);
+    m_output_segments_buffered += out.buffered;
+    m_output_segments_bytes += segment->Size() - offset;
+}
+
+/*
+ * Append the buffer bytes and the payloads to the output queue in stream order,
+ * the first 'skip' bytes of the stream were already written.
+ */
+void Channel::QueueOutput(Buffer* buffer, const BufferSegmentArray& segments, size_t skip)
+{
+    const char* raw = buffer->GetRawReadBuffer();
+    size_t pos = 0;
+    for (size_t i = 0; i <= segments.size(); i++)
+    {
+        size_t end = i < segments.size() ? segments[i].offset : buffer->ReadableBytes();
+        size_t len = end - pos;
+        if (skip >= len)
+        {
+            skip -= len;
+        }
+        else
+        {
+            m_outputBuffer.Write(raw + pos + skip, len - skip);
+            skip = 0;
+        }
+        pos = end;
+        if (i == segments.size())
+        {
+            break;
+        }
+        SharedSegment* segment = segments[i].segment;
+        if (skip >= segment->Size())
+        {
+            skip -= segment->Size();
+            continue;
+        }
+        QueueSegment(segment, skip);
+        skip = 0;
+    }
+    buffer->AdvanceReadIndex(buffer->ReadableBytes());
+}
+
+void Channel::ConsumeOutput(size_t len)
+{
+    while (len > 0 && !m_output_segments.empty())
+    {
+        OutputSegment& out = m_output_segments.front();
+        if (out.buffered > 0)
+        {
+            size_t n = len < out.buffered ? len : out.buffered;
+            m_outputBuffer.AdvanceReadIndex(n);
+            out.buffered -= n;
+            m_output_segments_buffered -= n;
+            len -= n;
+            if (out.buffered > 0)
+            {
+                return;
+            }
+        }
+        size_t rest = out.segment->Size() - out.offset;
+        if (len < rest)
+        {
+            out.offset += len;
+            m_output_segments_bytes -= len;
+            return;
+        }
+        len -= rest;
+        m_output_segments_bytes -= rest;
+        out.segment->Release();
+        m_output_segments.pop_front();
+    }
+    m_outputBuffer.AdvanceReadIndex(len);
+}
+
+void Channel::ClearOutputSegments()
+{
+    while (!m_output_segments.empty())
+    {
+        m_output_segments.front().segment->Release();
+        m_output_segments.pop_front();
+    }
+    m_output_segments_buffered = 0;
+    m_output_segments_bytes = 0;
+}
+
+bool Channel::FlushOutputSegments()
+{
+    struct iovec iov[kMaxWriteIOV];
+    int iovcnt = 0;
+    const char* raw = m_outputBuffer.GetRawReadBuffer();
+    size_t pos = 0;
+    std::deque<OutputSegment>::iterator it = m_output_segments.begin();
+    while (it != m_output_segments.end() && iovcnt < kMaxWriteIOV)
+    {
+        if (it->buffered > 0)
+        {
+            iov[iovcnt].iov_base = (void*) (raw + pos);
+            iov[iovcnt].iov_len = it->buffered;
+            iovcnt++;
+            pos += it->buffered;
+            if (iovcnt == kMaxWriteIOV)
+            {
+                break;
+            }
+        }
+        iov[iovcnt].iov_base = (void*) (it->segment->Data() + it->offset);
+        iov[iovcnt].iov_len = it->segment->Size() - it->offset;
+        iovcnt++;
+        it++;
+    }
+    if (iovcnt < kMaxWriteIOV && pos < m_outputBuffer.ReadableBytes())
+    {
+        iov[iovcnt].iov_base = (void*) (raw + pos);
+        iov[iovcnt].iov_len = m_outputBuffer.ReadableBytes() - pos;
+        iovcnt++;
+    }
+    int err;
+    int ret = WritevToFD(iov, iovcnt, err);
+    if (ret < 0)
+    {
+        if (IO_ERR_RW_RETRIABLE(err))
+        {
+            return true;
+        }
+        else
+        {
+            return HandleIOError(err);
+        }
+    }
+    else if (ret == 0)
+    {
+        return HandleExceptionEvent(CHANNEL_EVENT_EOF);
+    }
+    ConsumeOutput(ret);
+    if (!HasPendingOutput())
+    {
+        m_outputBuffer.Release();
+    }
+    else
+    {
+        m_outputBuffer.DiscardReadedBytes();
+    }
+    return true;
+}
+
 bool Channel::DoConfigure(const ChannelOptions& options)
 {
     if (options.user_write_buffer_water_mark > 0)
@@ -408,6 +923,11 @@ bool Channel::DoClose()
 {
     if (-1 != m_fd)
     {
+        if (m_completion_io)
+        {
+            aeForgetFileEvent(GetService().GetRawEventLoop(), m_fd);
+            m_completion_io = false;
+        }
         int ret = ::close(m_fd);
         if (ret < 0)
         {
@@ -423,11 +943,15 @@ bool Channel::DoClose()
 bool Channel::DoFlush()
 {
     //TRACE_LOG("Flush %u bytes for channel.", m_outputBuffer.ReadableBytes());
+    if (!m_output_segments.empty())
+    {
+        return FlushOutputSegments();
+    }
     if (m_outputBuffer.Readable())
     {
         uint32 send_buf_len = m_outputBuffer.ReadableBytes();
         int err;
-        int ret = m_outputBuffer.WriteFD(GetWriteFD(), err);
+        int ret = WriteToFD(&m_outputBuffer, err);
         if (ret < 0)
         {
             if (IO_ERR_RW_RETRIABLE(err))
@@ -445,9 +969,16 @@ bool Channel::DoFlush()
         {
             return HandleExceptionEvent(CHANNEL_EVENT_EOF);
         }
-        m_outputBuffer.DiscardReadedBytes();
-        m_outputBuffer.Compact(
-                m_options.user_write_buffer_water_mark > 0 ? m_options.user_write_buffer_water_mark * 2 : 8192);
+        if (!m_outputBuffer.Readable())
+        {
+            m_outputBuffer.Release();
+        }
+        else
+        {
+            m_outputBuffer.DiscardReadedBytes();
+            m_outputBuffer.Compact(
+                    m_options.user_write_buffer_water_mark > 0 ? m_options.user_write_buffer_water_mark * 2 : 8192);
+        }
         if ((uint32) ret < send_buf_len)
         {
             //EnableWriting();
@@ -460,8 +991,8 @@ bool Channel::DoFlush()
     }
     else
     {
-        m_outputBuffer.Compact(
-                m_options.user_write_buffer_water_mark > 0 ? m_options.user_write_buffer_water_mark : 8192);
+        //give the drained buffer back to the pool
+        m_outputBuffer.Release();
         return true;
     }
 
@@ -487,8 +1018,19 @@ bool Channel::DoConnect(Address* remote)
 void Channel::OnRead()
 {
     int32 len = 0;
+    Buffer* input = &m_inputBuffer;
+    m_read_frames = 0;
+    if (m_options.edge_triggered && !m_block_read)
+    {
+        ReadUntilAgain();
+        return;
+    }
     if (m_block_read)
     {
+        if (m_completion_io && aeGetPendingBytes(GetService().GetRawEventLoop(), m_fd, AE_READABLE) > 0)
+        {
+            return;
+        }
         //just test error
         char buffer[32];
         len = ::recv(GetReadFD(), buffer, sizeof(buffer), MSG_PEEK | MSG_DONTWAIT);
@@ -513,14 +1055,17 @@ void Channel::OnRead()
     }
     else
     {
-        m_inputBuffer.DiscardReadedBytes();
-        len = ReadNow(&m_inputBuffer);
+        len = ReadInput(input);
     }
     if (len > 0)
     {
         //TRACE_LOG(
         //        "DataReceived with %d bytes in channel %u.", m_inputBuffer.ReadableBytes(), GetID());
-        fire_message_received<Buffer>(this, &m_inputBuffer, NULL);
+        DispatchInput(input);
+    }
+    if (!m_inputBuffer.Readable())
+    {
+        m_inputBuffer.Release();
     }
     else
     {
@@ -529,6 +1074,116 @@ void Channel::OnRead()
     }
 }
 
+int32 Channel::ReadInput(Buffer*& input)
+{
+    if (!m_inputBuffer.Readable())
+    {
+        input = GetService().AcquireSharedReadBuffer();
+        if (NULL != input)
+        {
+            int32 len = ReadNow(input);
+            if (len <= 0)
+            {
+                GetService().ReleaseSharedReadBuffer();
+            }
+            return len;
+        }
+    }
+    //bytes left by previous read events must be processed first, the shared buffer
+    //may also be held by an outer dispatch which re-entered the event loop
+    input = &m_inputBuffer;
+    m_inputBuffer.DiscardReadedBytes();
+    return ReadNow(&m_inputBuffer);
+}
+
+void Channel::DispatchInput(Buffer* input)
+{
+    ChannelService& serv = GetService();
+    m_batch_writing = m_options.batch_write;
+    if (m_service->RebalanceEnabled())
+    {
+        uint64 start = get_current_epoch_micros();
+        fire_message_received<Buffer>(this, input, NULL);
+        m_read_cost += get_current_epoch_micros() - start;
+    }
+    else
+    {
+        fire_message_received<Buffer>(this, input, NULL);
+    }
+    if (input != &m_inputBuffer)
+    {
+        if (input->Readable())
+        {
+            m_inputBuffer.Write(input, input->ReadableBytes());
+        }
+        serv.ReleaseSharedReadBuffer();
+    }
+    if (m_batch_writing)
+    {
+        m_batch_writing = false;
+        FlushBatchWrite();
+    }
+}
+
+void Channel::ReadUntilAgain()
+{
+    uint32 bytes = 0;
+    while (!m_read_yielded && !IsClosed())
+    {
+        Buffer* input = NULL;
+        int32 len = ReadInput(input);
+        if (len <= 0)
+        {
+            //EAGAIN, or the channel is closed
+            break;
+        }
+        DispatchInput(input);
+        bytes += len;
+        if (m_options.max_read_bytes > 0 && bytes >= m_options.max_read_bytes)
+        {
+            //no new edge comes for the bytes left in the socket, resume reading them later
+            YieldRead();
+        }
+    }
+    if (!m_inputBuffer.Readable())
+    {
+        m_inputBuffer.Release();
+    }
+}
+
+void Channel::YieldRead()
+{
+    if (!m_read_yielded && !IsClosed())
+    {
+        m_read_yielded = true;
+        GetService().AddResumeChannel(this);
+    }
+}
+
+void Channel::ResumeRead()
+{
+    m_read_frames = 0;
+    if (IsClosed() || m_detached)
+    {
+        return;
+    }
+    Buffer* input = NULL;
+    if (!m_inputBuffer.Readable())
+    {
+        input = GetService().AcquireSharedReadBuffer();
+    }
+    if (NULL == input)
+    {
+        input = &m_inputBuffer;
+    }
+    //decode the frames left by the yielded read event
+    DispatchInput(input);
+    if (m_options.edge_triggered && !m_read_yielded && !IsClosed())
+    {
+        ReadUntilAgain();
+    }
+}
+
 void Channel::OnWrite()
 {
     if (!DoFlush())
@@ -544,7 +1199,11 @@ void Channel::OnWrite()
             return;
         }
     }
-    if (m_outputBuffer.Readable())
+    if (0 != m_soft_limit_time && PendingOutputBytes() <= (uint32) m_options.soft_write_buffer_size)
+    {
+        m_soft_limit_time = 0;
+    }
+    if (HasPendingOutput() || HasQueuedOutput())
     {
         return;
     }
@@ -580,6 +1239,10 @@ void Channel::OnWrite()
 
         if (m_file_sending->file_rest_len == 0)
         {
+            if (m_completion_io)
+            {
+                aeSetFileEventCompletion(GetService().GetRawEventLoop(), m_fd, 1);
+            }
             if (NULL != m_file_sending->on_complete)
             {
                 IOCallback* cb = m_file_sending->on_complete;
@@ -595,7 +1258,7 @@ void Channel::OnWrite()
         }
     }
     fire_channel_writable(this);
-    if (!m_outputBuffer.Readable() && m_options.auto_disable_writing)
+    if (!HasPendingOutput() && m_options.auto_disable_writing)
     {
         DisableWriting();
     }
@@ -604,6 +1267,11 @@ void Channel::OnWrite()
 int Channel::SendFile(const SendFileSetting& setting)
 {
     m_file_sending = new SendFileSetting(setting);
+    if (m_completion_io)
+    {
+        //sendfile() goes around the ring, the bytes queued in it are sent first(see OnWrite)
+        aeSetFileEventCompletion(GetService().GetRawEventLoop(), m_fd, 0);
+    }
     EnableWriting();
     return 0;
 }
@@ -694,6 +1362,7 @@ bool Channel::DoClose(bool inDestructor)
         }
     }
     DELETE(m_file_sending);
+    ClearOutputSegments();
     if (!m_has_removed && !inDestructor)
     {
         m_has_removed = true;
@@ -704,7 +1373,7 @@ bool Channel::DoClose(bool inDestructor)
 
 bool Channel::Close()
 {
-    if (m_outputBuffer.Readable() && GetWriteFD() > 0)
+    if ((HasPendingOutput() || HasQueuedOutput()) && GetWriteFD() > 0)
     {
         EnableWriting();
         m_close_after_write = true;
@@ -735,4 +1404,8 @@ Channel::~Channel()
     {
         m_attach_destructor(m_attach);
     }
+    if (INVALID_CHANNEL_ID != m_id)
+    {
+        free_channel_slot(CHANNEL_ID_SLOT(m_id));
+    }
 }
@@ -32,9 +32,12 @@
 #include "common.hpp"
 #include "channel/redis/ae.h"
 #include "buffer/buffer_helper.hpp"
+#include "buffer/shared_segment.hpp"
 #include "channel/channel_pipeline.hpp"
+#include "channel/channel_slot_table.hpp"
 #include "util/helpers.hpp"
 #include <map>
+#include <deque>
 
 /* delayed ack (quick_ack) */
 #ifndef HAVE_TCP_QUICKACK
@@ -59,7 +62,6 @@
 #define SIGNAL_CHANNEL_ID_BIT_MASK 7
 #define SOFT_SIGNAL_CHANNEL_ID_BIT_MASK 8
 #define INOTIFY_CHANNEL_ID_BIT_MASK 9
-#define MAX_CHANNEL_ID 0xFFFFFFF
 
 #define IS_TCP_CHANNEL(id) ((id&0xF) == TCP_CLIENT_SOCKET_CHANNEL_ID_BIT_MASK || (id&0xF) == TCP_SERVER_SOCKET_CHANNEL_ID_BIT_MASK)
 #define IS_UDP_CHANNEL(id) ((id&0xF) == UDP_SOCKET_CHANNEL_ID_BIT_MASK)
@@ -96,13 +98,47 @@ namespace comms
             uint32 user_write_buffer_water_mark;
             uint32 user_write_buffer_flush_timeout_mills;
             int32 max_write_buffer_size;  //-1: means unlimit 0: disable
+            /*
+             * Output buffer limits, the channel is closed once its pending output exceeds
+             * max_write_buffer_size(hard limit), or stays above soft_write_buffer_size for
+             * soft_write_buffer_seconds, 0 disables the soft limit.
+             */
+            int32 soft_write_buffer_size;
+            uint32 soft_write_buffer_seconds;
             bool auto_disable_writing;
             bool async_write;
+            /*
+             * Buffer all writes issued while handling one read event, and flush them
+             * with one write after the event has been processed(pipelined requests).
+             */
+            bool batch_write;
+            /*
+             * Queue output and flush it once per loop iteration, right before the loop
+             * goes back to sleep, so all writes of one iteration leave with one syscall.
+             */
+            bool flush_before_sleep;
+            /*
+             * Set on a server socket: max micros its worker loops spin polling for events
+             * before blocking, and whether sockets also set SO_BUSY_POLL to that value.
+             */
+            uint32 busy_poll;
+            bool socket_busy_poll;
+            /*
+             * Read fairness: frames decoded(max_read_frames) & bytes read in edge triggered
+             * mode(max_read_bytes) per read event, 0 means unlimited. A channel running out
+             * of budget yields and goes on with the rest in the next loop iteration.
+             */
+            uint32 max_read_frames;
+            uint32 max_read_bytes;
+            /* register the fd edge triggered(epoll only) and read until EAGAIN */
+            bool edge_triggered;
 
             ChannelOptions() :
                     receive_buffer_size(0), send_buffer_size(0), tcp_nodelay(true), keep_alive(0), reuse_address(true), user_write_buffer_water_mark(
-                            0), user_write_buffer_flush_timeout_mills(0), max_write_buffer_size(-1), auto_disable_writing(
-                            true),async_write(false)
+                            0), user_write_buffer_flush_timeout_mills(0), max_write_buffer_size(-1), soft_write_buffer_size(0), soft_write_buffer_seconds(
+                            0), auto_disable_writing(
+                            true),async_write(false), batch_write(false), flush_before_sleep(false), busy_poll(0), socket_busy_poll(
+                            false), max_read_frames(0), max_read_bytes(0), edge_triggered(false)
             {
             }
     };
@@ -178,11 +214,42 @@ namespace comms
             bool m_detached;
             bool m_close_after_write;
             bool m_block_read;
+            bool m_batch_writing;
+            bool m_flush_pending;
+            bool m_read_yielded;
+            uint32 m_read_frames;
+            uint64 m_soft_limit_time; /* when the output went above the soft limit, 0 if below */
+
+            /*
+             * Shared payloads queued behind the output buffer, 'buffered' is the number of
+             * output buffer bytes which must be sent before the payload.
+             */
+            struct OutputSegment
+            {
+                    size_t buffered;
+                    SharedSegment* segment;
+                    size_t offset;
+            };
+            std::deque<OutputSegment> m_output_segments;
+            size_t m_output_segments_buffered;
+            size_t m_output_segments_bytes;
 
             SendFileSetting* m_file_sending;
             void* m_attach;
             AttachDestructor* m_attach_destructor;
 
+            /* micros spent handling read events, rolled into m_last_read_cost every load sample */
+            uint64 m_read_cost;
+            uint64 m_last_read_cost;
+
+            /*
+             * The socket is in completion mode(io_uring backend): its reads & writes go through
+             * the event loop, which holds the received bytes and the written bytes not sent yet.
+             * 'resume' switches it back on once the channel is attached to its new loop.
+             */
+            bool m_completion_io;
+            bool m_completion_resume;
+
             Channel(Channel* parent, ChannelService& factory);
 
             void Run();
@@ -193,6 +260,11 @@ namespace comms
 
             virtual void OnRead();
             virtual void OnWrite();
+            bool CheckOutputLimit(size_t appending);
+            int32 ReadInput(Buffer*& input);
+            void DispatchInput(Buffer* input);
+            void ReadUntilAgain();
+            void ResumeRead();
 
             virtual bool DoConfigure(const ChannelOptions& options);
             virtual bool DoOpen();
@@ -207,6 +279,21 @@ namespace comms
 
             void CancelFlushTimerTask();
             void CreateFlushTimerTask();
+            void FlushBatchWrite();
+            void ScheduleLoopFlush();
+            void FlushPendingOutput();
+
+            void QueueSegment(SharedSegment* segment, size_t offset);
+            void QueueOutput(Buffer* buffer, const BufferSegmentArray& segments, size_t skip);
+            void ConsumeOutput(size_t len);
+            void ClearOutputSegments();
+            bool FlushOutputSegments();
+
+            void EnableCompletionIO();
+            void DrainCompletionIO();
+            int ReadFromFD(Buffer* buffer, int& err);
+            int WriteToFD(Buffer* buffer, int& err);
+            int WritevToFD(const struct iovec* iov, int iovcnt, int& err);
 
             friend class ChannelService;
         public:
@@ -231,7 +318,20 @@ namespace comms
 
             inline uint32 WritableBytes()
             {
-                return m_outputBuffer.ReadableBytes();
+                return PendingOutputBytes();
+            }
+
+            inline bool HasPendingOutput() const
+            {
+                return m_outputBuffer.Readable() || !m_output_segments.empty();
+            }
+
+            /* written bytes the event loop has not sent yet, completion mode only */
+            bool HasQueuedOutput();
+
+            inline size_t PendingOutputBytes() const
+            {
+                return m_outputBuffer.ReadableBytes() + m_output_segments_bytes;
             }
 
             inline const Buffer& GetOutputBuffer() const
@@ -239,6 +339,31 @@ namespace comms
                 return m_outputBuffer;
             }
 
+            /*
+             * Return the output buffer if current channel is in batch writing(processing a read event),
+             * encoders could encode message into it directly, it would be flushed after the read event.
+             */
+            inline Buffer* GetBatchWriteBuffer()
+            {
+                if (!m_batch_writing || NULL != m_file_sending)
+                {
+                    return NULL;
+                }
+                if (m_options.max_write_buffer_size > 0
+                        && PendingOutputBytes() > (uint32) m_options.max_write_buffer_size)
+                {
+                    return NULL;
+                }
+                return &m_outputBuffer;
+            }
+
+            /*
+             * Write the buffer's readable bytes with shared payloads inserted at the segments' offsets,
+             * the payloads are handed to writev() directly and only referenced if they could not be
+             * sent at once.
+             */
+            int32 WriteSegments(Buffer* buffer, const BufferSegmentArray& segments);
+
             inline uint32 ReadableBytes()
             {
                 return m_inputBuffer.ReadableBytes();
@@ -303,6 +428,16 @@ namespace comms
             void EnableWriting();
             void DisableWriting();
 
+            /*
+             * Called by frame decoders once per decoded frame, false when the read budget
+             * of the current read event is used up.
+             */
+            inline bool TakeReadBudget()
+            {
+                return 0 == m_options.max_read_frames || ++m_read_frames < m_options.max_read_frames;
+            }
+            void YieldRead();
+
             inline void BlockRead()
             {
                 m_block_read = true;
@@ -310,6 +445,11 @@ namespace comms
             inline void UnblockRead()
             {
                 m_block_read = false;
+                if (m_options.edge_triggered)
+                {
+                    //bytes arrived while blocked raise no new edge
+                    YieldRead();
+                }
             }
 
             inline void SetChannelPipelineInitializor(ChannelPipelineInitializer* initializor, void* data = NULL)
@@ -31,14 +31,39 @@
 #include "util/helpers.hpp"
 #include "util/datagram_packet.hpp"
 #include "buffer/buffer_helper.hpp"
+#include "thread/thread_local.hpp"
 #include <list>
+#include <time.h>
 
 using namespace comms;
 
+static const size_t kSharedReadBufferSize = 65536;
+/* forward async I/O of a migrated channel for this long, producers look its loop up per task */
+static const uint64 kMigratedChannelForwardMicros = 10 * 1000 * 1000;
+/* AsyncIO tasks run per loop iteration, the rest waits for the next one so socket I/O is not starved */
+static const uint32 kAsyncIOBudget = 1024;
+
+struct ChannelMigration
+{
+        ChannelService* source;
+        ChannelService* target;
+        uint32 gap;
+        Channel* channel;
+};
+
+/* The service whose loop runs in the current thread */
+static ThreadLocal<ChannelService*> g_loop_service(false);
+
 ChannelService::ChannelService(uint32 setsize) :
         m_setsize(setsize), m_eventLoop(NULL), m_timer(NULL), m_signal_channel(
-        NULL), m_self_soft_signal_channel(NULL), m_running(false), m_thread_pool_size(1), m_tid(0), m_user_cb(NULL), m_user_cb_data(
-        NULL), m_user_routine(NULL), m_user_routine_data(NULL),m_pool_index(0)
+        NULL), m_self_soft_signal_channel(NULL), m_async_io_batch(NULL), m_async_io_cursor(0), m_async_io_draining(
+        false), m_async_io_pending(0), m_async_io_batches(0), m_async_io_tasks(0), m_async_io_budget_exhausted(0), m_running(
+        false), m_thread_pool_size(1), m_tid(0), m_read_buffer_inuse(false), m_user_cb(NULL), m_user_cb_data(
+        NULL), m_user_routine(NULL), m_user_routine_data(NULL), m_migration_filter(NULL), m_migration_filter_data(
+        NULL), m_rebalance_threshold(0), m_rebalance_period(1), m_rebalance_ticks(0), m_cpu_time(0), m_load_sample_time(
+        0), m_load_sample_period(0), m_cpu_usage(0), m_channels(0), m_migrated_in(0), m_migrated_out(0), m_busy_poll_max(
+        0), m_busy_poll_budget(0), m_wakeup_time(0), m_spin_time(0), m_block_time(0), m_output_limit_closed(0), m_refused_channels(0), m_pool_index(
+        0)
 {
     m_eventLoop = aeCreateEventLoop(m_setsize);
     m_self_soft_signal_channel = NewSoftSignalChannel();
@@ -49,6 +74,7 @@ ChannelService::ChannelService(uint32 setsize) :
 
         m_self_soft_signal_channel->Register(WAKEUP, this);
         m_self_soft_signal_channel->Register(CHANNEL_ASNC_IO, this);
+        m_self_soft_signal_channel->Register(CHANNEL_READ_RESUME, this);
     }
 }
 
@@ -63,6 +89,24 @@ void ChannelService::RegisterUserRoutineCallback(UserRoutineCallback* cb, void*
     m_user_routine_data = data;
 }
 
+void ChannelService::RegisterMigrationFilter(ChannelMigrationFilter* filter, void* data)
+{
+    m_migration_filter = filter;
+    m_migration_filter_data = data;
+}
+
+void ChannelService::SetRebalance(uint32 threshold_percent, uint32 period_seconds)
+{
+    m_rebalance_threshold = threshold_percent;
+    m_rebalance_period = period_seconds > 0 ? period_seconds : 1;
+}
+
+void ChannelService::SetBusyPoll(uint32 max_micros)
+{
+    m_busy_poll_max = max_micros;
+    m_busy_poll_budget = max_micros;
+}
+
 void ChannelService::FireUserEvent(uint32 ev)
 {
     if (NULL != m_self_soft_signal_channel)
@@ -91,6 +135,11 @@ uint32 ChannelService::GetThreadPoolSize()
     return m_thread_pool_size;
 }
 
+void ChannelService::SetThreadPoolAffinity(const std::vector<int>& cpus)
+{
+    m_thread_pool_cpus = cpus;
+}
+
 ChannelService& ChannelService::GetNextChannelService()
 {
     static uint32 idx = 0;
@@ -168,15 +217,12 @@ void ChannelService::OnSoftSignal(uint32 soft_signo, uint32 appendinfo)
         }
         case CHANNEL_ASNC_IO:
         {
-            ChannelAsyncIOContext ctx;
-            while (m_async_io_queue.Pop(ctx))
-            {
-                if (NULL != ctx.cb)
-                {
-                    Channel* ch = GetChannel(ctx.channel_id);
-                    ctx.cb(ch, ctx.data);
-                }
-            }
+            DrainAsyncIO();
+            break;
+        }
+        case CHANNEL_READ_RESUME:
+        {
+            ResumeChannels();
             break;
         }
         default:
@@ -210,11 +256,7 @@ bool ChannelService::EventSunk(ChannelPipeline* pipeline, MessageEvent<DatagramP
 
 Channel* ChannelService::GetChannel(uint32_t channelID)
 {
-    if (m_channel_table.count(channelID) > 0)
-    {
-        return m_channel_table[channelID];
-    }
-    return NULL;
+    return m_channel_table.get(channelID);
 }
 
 bool ChannelService::DetachChannel(Channel* ch, bool remove)
@@ -223,6 +265,12 @@ bool ChannelService::DetachChannel(Channel* ch, bool remove)
     ch->DetachFD();
     if (remove)
     {
+        if (ch->m_completion_io)
+        {
+            //the loop holding its ring requests is left, resumed by AttachFD() in the new one
+            ch->DrainCompletionIO();
+            ch->m_completion_resume = true;
+        }
         m_channel_table.erase(ch->GetID());
     }
     return true;
@@ -235,7 +283,7 @@ Channel* ChannelService::AttachChannel(Channel* ch, bool transfer_service_only)
     {
         ch->m_service = this;
         ch->AttachFD();
-        m_channel_table[ch->GetID()] = ch;
+        m_channel_table.set(ch->GetID(), ch);
         return ch;
     }
     if (m_channel_table.count(ch->GetID()) > 0)
@@ -305,6 +353,25 @@ Channel* ChannelService::CloneChannel(Channel* ch)
 
 void ChannelService::StartSubPool()
 {
+    std::vector<ServerSocketChannel*> reuse_port_holders;
+    std::vector<ServerSocketChannel*> busy_poll_servers;
+    ChannelTable::iterator cit = m_channel_table.begin();
+    while (cit != m_channel_table.end())
+    {
+        if ((cit->first & 0xF) == TCP_SERVER_SOCKET_CHANNEL_ID_BIT_MASK)
+        {
+            ServerSocketChannel* server = (ServerSocketChannel*) cit->second;
+            if (server->IsReusePortHolder())
+            {
+                reuse_port_holders.push_back(server);
+            }
+            if (server->m_options.busy_poll > 0)
+            {
+                busy_poll_servers.push_back(server);
+            }
+        }
+        cit++;
+    }
     if (m_thread_pool_size > 1)
     {
         struct LaunchThread: public Thread
@@ -326,12 +393,50 @@ void ChannelService::StartSubPool()
             s->m_pool_index = i + 1;
             s->RegisterUserRoutineCallback(m_user_routine, m_user_routine_data);
             s->RegisterUserEventCallback(m_user_cb, m_user_cb_data);
+            s->RegisterMigrationFilter(m_migration_filter, m_migration_filter_data);
+            s->SetRebalance(m_rebalance_threshold, m_rebalance_period);
+            for (uint32 j = 0; j < busy_poll_servers.size(); j++)
+            {
+                uint32 busy_poll = busy_poll_servers[j]->m_options.busy_poll;
+                if (busy_poll_servers[j]->ServesPoolIndex(i, m_thread_pool_size) && busy_poll > s->m_busy_poll_max)
+                {
+                    s->SetBusyPoll(busy_poll);
+                }
+            }
             m_sub_pool.push_back(s);
-            LaunchThread* launch = new LaunchThread(s);
-            launch->Start();
+        }
+        for (uint32 i = 0; i < reuse_port_holders.size(); i++)
+        {
+            reuse_port_holders[i]->OpenReusePortListeners(m_sub_pool);
+        }
+        for (uint32 i = 0; i < m_sub_pool.size(); i++)
+        {
+            LaunchThread* launch = new LaunchThread(m_sub_pool[i]);
+            ThreadOptions options;
+            if (!m_thread_pool_cpus.empty())
+            {
+                options.cpus.push_back(m_thread_pool_cpus[i % m_thread_pool_cpus.size()]);
+            }
+            launch->Start(options);
             m_sub_pool_ts.push_back(launch);
         }
     }
+    else
+    {
+        /* No worker to spread connections to, accept on this loop. */
+        std::vector<ChannelService*> empty;
+        for (uint32 i = 0; i < reuse_port_holders.size(); i++)
+        {
+            reuse_port_holders[i]->OpenReusePortListeners(empty);
+        }
+        for (uint32 i = 0; i < busy_poll_servers.size(); i++)
+        {
+            if (busy_poll_servers[i]->m_options.busy_poll > m_busy_poll_max)
+            {
+                SetBusyPoll(busy_poll_servers[i]->m_options.busy_poll);
+            }
+        }
+    }
 }
 
 void ChannelService::Start()
@@ -342,13 +447,198 @@ void ChannelService::Start()
         GetTimer().Schedule(this, 1000, 1000);
         m_running = true;
         m_tid = Thread::CurrentThreadID();
-        aeMain(m_eventLoop);
+        /* allocated by the loop thread itself, so the pages come from its numa node */
+        m_read_buffer.EnsureWritableBytes(kSharedReadBufferSize);
+        g_loop_service.SetValue(this);
+        aeSetBeforeSleepProc(m_eventLoop, ChannelService::BeforeSleepCallback);
+        if (m_busy_poll_max > 0)
+        {
+            aeSetAfterSleepProc(m_eventLoop, ChannelService::AfterSleepCallback);
+            BusyPollMain();
+        }
+        else
+        {
+            aeMain(m_eventLoop);
+        }
+        FlushAsyncIOOutbox();
+        g_loop_service.SetValue(NULL);
+    }
+}
+
+void ChannelService::BeforeSleepCallback(struct aeEventLoop* eventLoop)
+{
+    ChannelService* serv = g_loop_service.GetValue();
+    if (NULL != serv && serv->m_eventLoop == eventLoop)
+    {
+        serv->BeforeSleep();
     }
 }
 
+void ChannelService::AfterSleepCallback(struct aeEventLoop* eventLoop)
+{
+    ChannelService* serv = g_loop_service.GetValue();
+    if (NULL != serv && serv->m_eventLoop == eventLoop)
+    {
+        serv->m_wakeup_time = get_current_epoch_micros();
+    }
+}
+
+void ChannelService::BusyPollMain()
+{
+    m_eventLoop->stop = 0;
+    while (!m_eventLoop->stop)
+    {
+        BeforeSleep();
+        uint64 start = get_current_epoch_micros();
+        uint64 now = start;
+        bool fired = false;
+        if (m_busy_poll_budget > 0)
+        {
+            while (!m_eventLoop->stop)
+            {
+                if (aeProcessEvents(m_eventLoop, AE_ALL_EVENTS | AE_DONT_WAIT) > 0)
+                {
+                    fired = true;
+                    break;
+                }
+                now = get_current_epoch_micros();
+                if (now - start >= m_busy_poll_budget)
+                {
+                    break;
+                }
+            }
+            m_spin_time += (fired ? m_wakeup_time : now) - start;
+        }
+        if (!fired && !m_eventLoop->stop)
+        {
+            /* timers fired while spinning may have queued output */
+            BeforeSleep();
+            uint64 block_start = get_current_epoch_micros();
+            aeProcessEvents(m_eventLoop, AE_ALL_EVENTS);
+            if (m_wakeup_time > block_start)
+            {
+                m_block_time += m_wakeup_time - block_start;
+            }
+        }
+        if (!fired)
+        {
+            UpdateBusyPollBudget(m_wakeup_time > start ? m_wakeup_time - start : 0);
+        }
+    }
+}
+
+void ChannelService::UpdateBusyPollBudget(uint64 idle)
+{
+    /*
+     * Called when the loop had to block. An event arriving soon after means a longer
+     * spin would have caught it, so grow the budget; a long sleep means the traffic
+     * is sparse and spinning only burns cpu, so shrink it.
+     */
+    if (idle <= m_busy_poll_max)
+    {
+        uint32 budget = m_busy_poll_budget > 0 ? m_busy_poll_budget * 2 : m_busy_poll_max / 8 + 1;
+        m_busy_poll_budget = budget > m_busy_poll_max ? m_busy_poll_max : budget;
+    }
+    else
+    {
+        m_busy_poll_budget /= 2;
+        if (m_busy_poll_budget <= m_busy_poll_max / 8)
+        {
+            m_busy_poll_budget = 0;
+        }
+    }
+}
+
+void ChannelService::BeforeSleep()
+{
+    FlushChannels();
+    FlushAsyncIOOutbox();
+}
+
+void ChannelService::AddFlushChannel(Channel* ch)
+{
+    m_flush_channels.push_back(ch->GetID());
+}
+
+void ChannelService::FlushChannels()
+{
+    if (!m_flushing_channels.empty())
+    {
+        /* re-entered through Continue() from a close handler, the outer flush goes on */
+        return;
+    }
+    /* flushing may close channels and queue writes to others, flush those too before sleeping */
+    while (!m_flush_channels.empty())
+    {
+        m_flushing_channels.swap(m_flush_channels);
+        for (size_t i = 0; i < m_flushing_channels.size(); i++)
+        {
+            Channel* ch = GetChannel(m_flushing_channels[i]);
+            if (NULL != ch && ch->m_flush_pending)
+            {
+                ch->m_flush_pending = false;
+                ch->FlushPendingOutput();
+            }
+        }
+        m_flushing_channels.clear();
+    }
+}
+
+void ChannelService::AddResumeChannel(Channel* ch)
+{
+    m_resume_channels.push_back(ch->GetID());
+    /* the soft signal keeps the loop from sleeping while input is left unprocessed */
+    if (NULL != m_self_soft_signal_channel)
+    {
+        m_self_soft_signal_channel->FireSoftSignal(CHANNEL_READ_RESUME, 0);
+    }
+}
+
+void ChannelService::ResumeChannels()
+{
+    if (m_resume_channels.empty())
+    {
+        return;
+    }
+    /* channels yielding again are resumed after other ready events got their turn */
+    m_resuming_channels.swap(m_resume_channels);
+    for (size_t i = 0; i < m_resuming_channels.size(); i++)
+    {
+        Channel* ch = GetChannel(m_resuming_channels[i]);
+        if (NULL != ch && ch->m_read_yielded)
+        {
+            ch->m_read_yielded = false;
+            ch->ResumeRead();
+        }
+    }
+    m_resuming_channels.clear();
+}
+
+void ChannelService::CheckSoftLimitedChannels()
+{
+    /* a slow reader may never write again, the soft limit must expire without new output */
+    size_t kept = 0;
+    for (size_t i = 0; i < m_soft_limited_channels.size(); i++)
+    {
+        Channel* ch = GetChannel(m_soft_limited_channels[i]);
+        if (NULL == ch || 0 == ch->m_soft_limit_time || !ch->CheckOutputLimit(0))
+        {
+            continue;
+        }
+        if (0 != ch->m_soft_limit_time)
+        {
+            m_soft_limited_channels[kept++] = ch->GetID();
+        }
+    }
+    m_soft_limited_channels.resize(kept);
+}
+
 void ChannelService::Continue()
 {
     aeProcessEvents(m_eventLoop, AE_FILE_EVENTS | AE_DONT_WAIT);
+    /* the caller may run for long, replies and tasks queued so far must not wait for it to return */
+    FlushChannels();
+    FlushAsyncIOOutbox();
 }
 
 void ChannelService::Stop()
@@ -395,15 +685,32 @@ SignalChannel& ChannelService::GetSignalChannel()
     return *m_signal_channel;
 }
 
+/*
+ * Tag the id of a new channel with its type and index it, false if it got no slot.
+ */
+bool ChannelService::AddNewChannel(Channel* ch, uint32 type)
+{
+    if (INVALID_CHANNEL_ID == ch->m_id)
+    {
+        m_refused_channels++;
+        return false;
+    }
+    ch->m_id = (ch->m_id << 4) + type;
+    m_channel_table.set(ch->m_id, ch);
+    return true;
+}
+
 TimerChannel* ChannelService::NewTimerChannel()
 {
     TimerChannel* ch = NULL;
     NEW(ch, TimerChannel(*this));
     if (NULL != ch)
     {
-        Channel* c = ch;
-        c->m_id = (((c->m_id) << 4) + TIMER_CHANNEL_ID_BIT_MASK);
-        m_channel_table[c->m_id] = c;
+        if (!AddNewChannel(ch, TIMER_CHANNEL_ID_BIT_MASK))
+        {
+            DELETE(ch);
+            return NULL;
+        }
         //ch->GetPipeline().Attach(ch, this);
     }
     return ch;
@@ -415,9 +722,11 @@ SignalChannel* ChannelService::NewSignalChannel()
     NEW(ch, SignalChannel(*this));
     if (NULL != ch)
     {
-        Channel* c = ch;
-        c->m_id = (((c->m_id) << 4) + SIGNAL_CHANNEL_ID_BIT_MASK);
-        m_channel_table[c->m_id] = c;
+        if (!AddNewChannel(ch, SIGNAL_CHANNEL_ID_BIT_MASK))
+        {
+            DELETE(ch);
+            return NULL;
+        }
         //ch->GetPipeline().Attach(ch, this);
     }
     ch->Open();
@@ -430,9 +739,11 @@ SoftSignalChannel* ChannelService::NewSoftSignalChannel()
     NEW(ch, SoftSignalChannel(*this));
     if (NULL != ch)
     {
-        Channel* c = ch;
-        c->m_id = (((c->m_id) << 4) + SOFT_SIGNAL_CHANNEL_ID_BIT_MASK);
-        m_channel_table[c->m_id] = c;
+        if (!AddNewChannel(ch, SOFT_SIGNAL_CHANNEL_ID_BIT_MASK))
+        {
+            DELETE(ch);
+            return NULL;
+        }
         //ch->GetPipeline().Attach(ch, this);
     }
     ch->Open();
@@ -445,9 +756,11 @@ ClientSocketChannel* ChannelService::NewClientSocketChannel()
     NEW(ch, ClientSocketChannel(*this));
     if (NULL != ch)
     {
-        Channel* c = ch;
-        c->m_id = (((c->m_id) << 4) + TCP_CLIENT_SOCKET_CHANNEL_ID_BIT_MASK);
-        m_channel_table[c->m_id] = c;
+        if (!AddNewChannel(ch, TCP_CLIENT_SOCKET_CHANNEL_ID_BIT_MASK))
+        {
+            DELETE(ch);
+            return NULL;
+        }
         ch->GetPipeline().Attach(ch);
     }
     return ch;
@@ -458,9 +771,11 @@ ServerSocketChannel* ChannelService::NewServerSocketChannel()
     NEW(ch, ServerSocketChannel(*this));
     if (NULL != ch)
     {
-        Channel* c = ch;
-        c->m_id = (((c->m_id) << 4) + TCP_SERVER_SOCKET_CHANNEL_ID_BIT_MASK);
-        m_channel_table[c->m_id] = c;
+        if (!AddNewChannel(ch, TCP_SERVER_SOCKET_CHANNEL_ID_BIT_MASK))
+        {
+            DELETE(ch);
+            return NULL;
+        }
         ch->GetPipeline().Attach(ch);
     }
     return ch;
@@ -472,9 +787,11 @@ PipeChannel* ChannelService::NewPipeChannel(int readFd, int writeFD)
     NEW(ch, PipeChannel(*this, readFd, writeFD));
     if (NULL != ch)
     {
-        Channel* c = ch;
-        c->m_id = (((c->m_id) << 4) + FIFO_CHANNEL_ID_BIT_MASK);
-        m_channel_table[c->m_id] = c;
+        if (!AddNewChannel(ch, FIFO_CHANNEL_ID_BIT_MASK))
+        {
+            DELETE(ch);
+            return NULL;
+        }
         ch->GetPipeline().Attach(ch);
     }
     return ch;
@@ -485,9 +802,11 @@ DatagramChannel* ChannelService::NewDatagramSocketChannel()
     NEW(ch, DatagramChannel(*this));
     if (NULL != ch)
     {
-        Channel* c = ch;
-        c->m_id = (((c->m_id) << 4) + UDP_SOCKET_CHANNEL_ID_BIT_MASK);
-        m_channel_table[c->m_id] = c;
+        if (!AddNewChannel(ch, UDP_SOCKET_CHANNEL_ID_BIT_MASK))
+        {
+            DELETE(ch);
+            return NULL;
+        }
         ch->GetPipeline().Attach(ch);
     }
     return ch;
@@ -500,7 +819,8 @@ void ChannelService::RemoveChannel(Channel* ch)
         if (NULL != m_self_soft_signal_channel)
         {
             m_remove_queue.push_back(ch->GetID());
-            m_self_soft_signal_channel->FireSoftSignal(CHANNEL_REMOVE, ch->GetID());
+            /* the ids are in m_remove_queue, one signal drains all of them */
+            m_self_soft_signal_channel->FireSoftSignal(CHANNEL_REMOVE, 0);
         }
     }
 }
@@ -534,18 +854,326 @@ void ChannelService::DeleteChannel(Channel* ch)
 void ChannelService::Run()
 {
     VerifyRemoveQueue();
+    UpdateLoadStats();
+    ExpireMigratedChannels();
+    CheckSoftLimitedChannels();
     Routine();
 }
 
+void ChannelService::UpdateLoadStats()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    uint64 cpu_time = (uint64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    uint64 now = get_current_epoch_micros();
+    if (m_load_sample_time > 0 && now > m_load_sample_time)
+    {
+        m_load_sample_period = now - m_load_sample_time;
+        m_cpu_usage = (uint32) ((cpu_time - m_cpu_time) * 100 / m_load_sample_period);
+    }
+    m_cpu_time = cpu_time;
+    m_load_sample_time = now;
+    m_channels = m_channel_table.size();
+    if (!RebalanceEnabled())
+    {
+        return;
+    }
+    if (m_pool_index > 0)
+    {
+        ChannelTable::iterator it = m_channel_table.begin();
+        while (it != m_channel_table.end())
+        {
+            Channel* ch = it->second;
+            ch->m_last_read_cost = ch->m_read_cost;
+            ch->m_read_cost = 0;
+            it++;
+        }
+    }
+    else if (m_sub_pool.size() > 1)
+    {
+        Rebalance();
+    }
+}
+
+void ChannelService::Rebalance()
+{
+    ChannelService* hot = m_sub_pool[0];
+    ChannelService* cold = m_sub_pool[0];
+    for (size_t i = 1; i < m_sub_pool.size(); i++)
+    {
+        if (m_sub_pool[i]->m_cpu_usage > hot->m_cpu_usage)
+        {
+            hot = m_sub_pool[i];
+        }
+        if (m_sub_pool[i]->m_cpu_usage < cold->m_cpu_usage)
+        {
+            cold = m_sub_pool[i];
+        }
+    }
+    uint32 gap = hot->m_cpu_usage - cold->m_cpu_usage;
+    if (gap < m_rebalance_threshold)
+    {
+        m_rebalance_ticks = 0;
+        return;
+    }
+    m_rebalance_ticks++;
+    if (m_rebalance_ticks < m_rebalance_period)
+    {
+        return;
+    }
+    m_rebalance_ticks = 0;
+    ChannelMigration* migration = new ChannelMigration;
+    migration->source = hot;
+    migration->target = cold;
+    migration->gap = gap;
+    migration->channel = NULL;
+    hot->AsyncIO(0, MigrateHotChannelCallback, migration);
+}
+
+bool ChannelService::CanMigrate(Channel* ch)
+{
+    if ((ch->GetID() & 0xF) != TCP_CLIENT_SOCKET_CHANNEL_ID_BIT_MASK)
+    {
+        return false;
+    }
+    /*
+     * Only move a channel between commands: nothing queued to write, no pending
+     * flush(timer or loop) and no fd detached by the upper layer.
+     */
+    if (ch->m_detached || ch->m_has_removed || ch->m_block_read || ch->m_flush_timertask_id != -1 || ch->m_flush_pending
+            || ch->m_read_yielded || NULL != ch->m_file_sending || ch->HasPendingOutput() || ch->HasQueuedOutput())
+    {
+        return false;
+    }
+    if (NULL != m_migration_filter && !m_migration_filter(ch, m_migration_filter_data))
+    {
+        return false;
+    }
+    return true;
+}
+
+void ChannelService::MigrateHotChannel(ChannelService* target, uint32 gap)
+{
+    if (0 == m_load_sample_period)
+    {
+        return;
+    }
+    /*
+     * Moving a channel costing c percent narrows the gap by 2c, pick the one
+     * which leaves the smallest gap and never swaps the hot & cold roles.
+     */
+    Channel* candidate = NULL;
+    uint32 best = gap;
+    ChannelTable::iterator it = m_channel_table.begin();
+    while (it != m_channel_table.end())
+    {
+        Channel* ch = it->second;
+        it++;
+        uint32 cost = (uint32) (ch->m_last_read_cost * 100 / m_load_sample_period);
+        if (0 == cost || cost >= gap)
+        {
+            continue;
+        }
+        uint32 left = gap > 2 * cost ? gap - 2 * cost : 2 * cost - gap;
+        if (left < best && CanMigrate(ch))
+        {
+            best = left;
+            candidate = ch;
+        }
+    }
+    if (NULL == candidate)
+    {
+        return;
+    }
+    DEBUG_LOG("Migrate channel:%u from loop %u to loop %u", candidate->GetID(), m_pool_index, target->m_pool_index);
+    DetachChannel(candidate, true);
+    candidate->m_last_read_cost = 0;
+    m_migrated_out++;
+    MigratedChannel& moved = m_migrated_channels[candidate->GetID()];
+    moved.target = target;
+    moved.time = get_current_epoch_micros();
+    ChannelMigration* migration = new ChannelMigration;
+    migration->source = this;
+    migration->target = target;
+    migration->gap = gap;
+    migration->channel = candidate;
+    target->AsyncIO(0, AttachMigratedChannelCallback, migration);
+}
+
+void ChannelService::MigrateHotChannelCallback(Channel* ch, void* data)
+{
+    ChannelMigration* migration = (ChannelMigration*) data;
+    migration->source->MigrateHotChannel(migration->target, migration->gap);
+    delete migration;
+}
+
+void ChannelService::AttachMigratedChannelCallback(Channel* ch, void* data)
+{
+    ChannelMigration* migration = (ChannelMigration*) data;
+    /* the channel may be coming back, it must not be forwarded away from here any more */
+    migration->target->m_migrated_channels.erase(migration->channel->GetID());
+    migration->target->AttachChannel(migration->channel, true);
+    migration->target->m_migrated_in++;
+    delete migration;
+}
+
+void ChannelService::ExpireMigratedChannels()
+{
+    if (m_migrated_channels.empty())
+    {
+        return;
+    }
+    uint64 now = get_current_epoch_micros();
+    MigratedChannelTable::iterator it = m_migrated_channels.begin();
+    while (it != m_migrated_channels.end())
+    {
+        if (now - it->second.time >= kMigratedChannelForwardMicros)
+        {
+            m_migrated_channels.erase(it++);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+void ChannelService::GetLoadStats(ChannelLoadStats& stats)
+{
+    stats.cpu_usage = m_cpu_usage;
+    stats.channels = m_channels;
+    stats.migrated_in = m_migrated_in;
+    stats.migrated_out = m_migrated_out;
+    stats.busy_poll = m_busy_poll_budget;
+    stats.spin_time = m_spin_time;
+    stats.block_time = m_block_time;
+    stats.output_limit_closed = m_output_limit_closed;
+    stats.refused_channels = m_refused_channels;
+}
+
 void ChannelService::AsyncIO(const ChannelAsyncIOContext& ctx)
 {
-    m_async_io_queue.Push(ctx);
+    ChannelService* producer = g_loop_service.GetValue();
+    if (NULL == producer)
+    {
+        /* not issued from a loop thread, there is no iteration to batch over */
+        AsyncIOBatch* batch = new AsyncIOBatch(1, ctx);
+        PublishAsyncIO(batch);
+        return;
+    }
+    AsyncIOOutboxArray& outbox = producer->m_async_io_outbox;
+    for (size_t i = 0; i < outbox.size(); i++)
+    {
+        if (outbox[i].target == this)
+        {
+            outbox[i].batch->push_back(ctx);
+            return;
+        }
+    }
+    AsyncIOOutbox box;
+    box.target = this;
+    box.batch = new AsyncIOBatch;
+    box.batch->push_back(ctx);
+    outbox.push_back(box);
+}
+
+void ChannelService::PublishAsyncIO(AsyncIOBatch* batch)
+{
+    atomic_add_uint64(&m_async_io_pending, batch->size());
+    m_async_io_queue.Push(batch);
     if (NULL != m_self_soft_signal_channel)
     {
         m_self_soft_signal_channel->FireSoftSignal(CHANNEL_ASNC_IO, 1);
     }
 }
 
+void ChannelService::FlushAsyncIOOutbox()
+{
+    for (size_t i = 0; i < m_async_io_outbox.size(); i++)
+    {
+        m_async_io_outbox[i].target->PublishAsyncIO(m_async_io_outbox[i].batch);
+    }
+    m_async_io_outbox.clear();
+}
+
+void ChannelService::DrainAsyncIO()
+{
+    if (m_async_io_draining)
+    {
+        /* re-entered from a task through Continue(), the outer drain goes on */
+        return;
+    }
+    m_async_io_draining = true;
+    uint32 budget = kAsyncIOBudget;
+    while (budget > 0)
+    {
+        if (NULL == m_async_io_batch)
+        {
+            if (!m_async_io_queue.Pop(m_async_io_batch))
+            {
+                m_async_io_batch = NULL;
+                break;
+            }
+            m_async_io_cursor = 0;
+            m_async_io_batches++;
+        }
+        while (budget > 0 && m_async_io_cursor < m_async_io_batch->size())
+        {
+            ChannelAsyncIOContext& ctx = (*m_async_io_batch)[m_async_io_cursor++];
+            budget--;
+            if (NULL != ctx.cb)
+            {
+                Channel* ch = GetChannel(ctx.channel_id);
+                if (NULL == ch && 0 != ctx.channel_id && !m_migrated_channels.empty())
+                {
+                    MigratedChannelTable::iterator found = m_migrated_channels.find(ctx.channel_id);
+                    if (found != m_migrated_channels.end())
+                    {
+                        /* queued behind the attach task of the channel on its new loop */
+                        found->second.target->AsyncIO(ctx);
+                        continue;
+                    }
+                }
+                ctx.cb(ch, ctx.data);
+            }
+        }
+        if (m_async_io_cursor == m_async_io_batch->size())
+        {
+            delete m_async_io_batch;
+            m_async_io_batch = NULL;
+        }
+    }
+    uint32 done = kAsyncIOBudget - budget;
+    m_async_io_tasks += done;
+    uint64_t left = atomic_sub_uint64(&m_async_io_pending, done);
+    m_async_io_draining = false;
+    if (0 == budget && left > 0)
+    {
+        m_async_io_budget_exhausted++;
+        if (NULL != m_self_soft_signal_channel)
+        {
+            m_self_soft_signal_channel->FireSoftSignal(CHANNEL_ASNC_IO, 1);
+        }
+    }
+}
+
+void ChannelService::GetAsyncIOStats(ChannelAsyncIOStats& stats)
+{
+    stats.pending = m_async_io_pending;
+    stats.batches = m_async_io_batches;
+    stats.tasks = m_async_io_tasks;
+    stats.budget_exhausted = m_async_io_budget_exhausted;
+}
+
+ChannelService* ChannelService::GetSubPoolService(uint32 idx)
+{
+    if (idx >= m_sub_pool.size())
+    {
+        return NULL;
+    }
+    return m_sub_pool[idx];
+}
+
 void ChannelService::AttachAcceptedChannel(SocketChannel *ch)
 {
     if (IsInLoopThread())
@@ -567,7 +1195,7 @@ void ChannelService::AttachAcceptedChannel(SocketChannel *ch)
                 void Run()
                 {
                     sch->m_service = serv;
-                    sch->m_service->m_channel_table[sch->GetID()] = sch;
+                    sch->m_service->m_channel_table.set(sch->GetID(), sch);
                     sch->OnAccepted();
                     delete this;
                 }
@@ -618,17 +1246,21 @@ void ChannelService::CloseAllChannelFD(std::set<Channel*>& exceptions)
 
 void ChannelService::CloseAllChannels(bool fireCloseEvent)
 {
-    ChannelTable tmp = m_channel_table;
-    ChannelTable::iterator it = tmp.begin();
-    while (it != tmp.end())
+    std::vector<Channel*> channels;
+    ChannelTable::iterator it = m_channel_table.begin();
+    while (it != m_channel_table.end())
     {
-        Channel* ch = it->second;
+        channels.push_back(it->second);
+        it++;
+    }
+    for (size_t i = 0; i < channels.size(); i++)
+    {
+        Channel* ch = channels[i];
         if (fireCloseEvent)
         {
             ch->Close();
         }
         DeleteChannel(ch);
-        it++;
     }
     m_channel_table.clear();
 }
@@ -644,6 +1276,16 @@ void ChannelService::AsyncIO(uint32 id, ChannelAsyncIOCallback* cb, void* data)
 
 ChannelService::~ChannelService()
 {
+    for (size_t i = 0; i < m_async_io_outbox.size(); i++)
+    {
+        delete m_async_io_outbox[i].batch;
+    }
+    AsyncIOBatch* batch = NULL;
+    while (m_async_io_queue.Pop(batch))
+    {
+        delete batch;
+    }
+    delete m_async_io_batch;
     CloseAllChannels(false);
     aeDeleteEventLoop(m_eventLoop);
 }
@@ -59,11 +59,46 @@ namespace comms
         WAKEUP = 2,
         USER_DEFINED = 3,
         CHANNEL_ASNC_IO = 4,
+        CHANNEL_READ_RESUME = 5,
+    };
+
+    struct ChannelAsyncIOStats
+    {
+            uint64 pending; /* published to the loop, not run yet */
+            uint64 batches;
+            uint64 tasks;
+            uint64 budget_exhausted; /* drains stopped by the per iteration budget */
+            ChannelAsyncIOStats() :
+                    pending(0), batches(0), tasks(0), budget_exhausted(0)
+            {
+            }
+    };
+
+    struct ChannelLoadStats
+    {
+            uint32 cpu_usage; /* percent of one core used by the loop thread in the last tick */
+            uint32 channels; /* channels in the loop, including its internal ones */
+            uint64 migrated_in;
+            uint64 migrated_out;
+            uint32 busy_poll; /* current spin budget in micros, 0 if the loop blocks right away */
+            uint64 spin_time; /* micros spent spinning for events */
+            uint64 block_time; /* micros spent blocked in the multiplexing api */
+            uint64 output_limit_closed; /* channels closed for exceeding their output buffer limits */
+            uint64 refused_channels; /* channels(accepted connections) refused since no channel slot was free */
+            ChannelLoadStats() :
+                    cpu_usage(0), channels(0), migrated_in(0), migrated_out(0), busy_poll(0), spin_time(0), block_time(
+                            0), output_limit_closed(0), refused_channels(0)
+            {
+            }
     };
 
     class ChannelService;
     typedef void UserEventCallback(ChannelService* serv, uint32 ev, void* data);
     typedef void UserRoutineCallback(ChannelService* serv, uint32 idx, void* data);
+    /*
+     * Invoked in the channel's loop thread, return false if the channel can not move to another loop now.
+     */
+    typedef bool ChannelMigrationFilter(Channel* ch, void* data);
     /**
      * event loop service
      */
@@ -73,11 +108,29 @@ namespace comms
             typedef std::list<uint32> RemoveChannelQueue;
             //typedef zmq::ypipe_t<Runnable*, 10> TaskList;
             typedef SPSCQueue<Runnable*> TaskList;
-            typedef TreeMap<uint32, Channel*>::Type ChannelTable;
+            typedef ChannelSlotTable<Channel*> ChannelTable;
             typedef std::vector<ChannelService*> ChannelServicePool;
             typedef std::vector<Thread*> ThreadVector;
+            struct MigratedChannel
+            {
+                    ChannelService* target;
+                    uint64 time;
+            };
+            typedef TreeMap<uint32, MigratedChannel>::Type MigratedChannelTable;
 
-            typedef MPSCQueue<ChannelAsyncIOContext> AsyncIOQueue;
+            /*
+             * AsyncIO tasks travel between loops in batches: a loop thread appends the
+             * tasks it issues to one batch per target loop, and publishes the batches
+             * once per loop iteration(before sleeping).
+             */
+            typedef std::vector<ChannelAsyncIOContext> AsyncIOBatch;
+            typedef MPSCQueue<AsyncIOBatch*> AsyncIOQueue;
+            struct AsyncIOOutbox
+            {
+                    ChannelService* target;
+                    AsyncIOBatch* batch;
+            };
+            typedef std::vector<AsyncIOOutbox> AsyncIOOutboxArray;
             ChannelTable m_channel_table;
             uint32 m_setsize;
             aeEventLoop* m_eventLoop;
@@ -86,10 +139,27 @@ namespace comms
             SoftSignalChannel* m_self_soft_signal_channel;
             RemoveChannelQueue m_remove_queue;
             AsyncIOQueue m_async_io_queue;
+            AsyncIOOutboxArray m_async_io_outbox;
+            /* ids of channels whose output is flushed before the loop sleeps */
+            std::vector<uint32> m_flush_channels;
+            std::vector<uint32> m_flushing_channels;
+            /* ids of channels which yielded reading with unprocessed input */
+            std::vector<uint32> m_resume_channels;
+            std::vector<uint32> m_resuming_channels;
+            /* ids of channels whose output stays above the soft limit, checked once per second */
+            std::vector<uint32> m_soft_limited_channels;
+            AsyncIOBatch* m_async_io_batch; /* batch being drained, may span several iterations */
+            size_t m_async_io_cursor;
+            bool m_async_io_draining;
+            volatile uint64_t m_async_io_pending;
+            uint64 m_async_io_batches;
+            uint64 m_async_io_tasks;
+            uint64 m_async_io_budget_exhausted;
 
             bool m_running;
 
             uint32 m_thread_pool_size;
+            std::vector<int> m_thread_pool_cpus;
             ChannelServicePool m_sub_pool;
             ThreadVector m_sub_pool_ts;
 
@@ -97,12 +167,57 @@ namespace comms
 
             TaskList m_pending_tasks;
 
+            /*
+             * All channels of this loop read into this buffer, only the bytes left
+             * unconsumed after the read event are copied into the channel's own buffer.
+             * It is held while the bytes are dispatched, a dispatch re-entering the loop
+             * through Continue() makes the nested reads fall back to the channels' own buffers.
+             */
+            Buffer m_read_buffer;
+            bool m_read_buffer_inuse;
+
             UserEventCallback* m_user_cb;
             void* m_user_cb_data;
 
             UserRoutineCallback* m_user_routine;
             void* m_user_routine_data;
 
+            ChannelMigrationFilter* m_migration_filter;
+            void* m_migration_filter_data;
+
+            /*
+             * Loop load, sampled by Run() once per second. The parent moves one hot channel
+             * from the busiest worker to the idlest one when their cpu usage differs by more
+             * than m_rebalance_threshold percent for m_rebalance_period ticks in a row.
+             */
+            uint32 m_rebalance_threshold;
+            uint32 m_rebalance_period;
+            uint32 m_rebalance_ticks;
+            uint64 m_cpu_time;
+            uint64 m_load_sample_time;
+            uint64 m_load_sample_period;
+            volatile uint32_t m_cpu_usage;
+            volatile uint32_t m_channels;
+            volatile uint64_t m_migrated_in;
+            volatile uint64_t m_migrated_out;
+            /*
+             * Channels moved out of this loop, async I/O posted here by producers which
+             * looked up the old loop is forwarded to their new one for a while.
+             */
+            MigratedChannelTable m_migrated_channels;
+
+            /*
+             * Busy poll: the loop polls without timeout for up to m_busy_poll_budget micros
+             * before blocking, the budget adapts to how long the loop sleeps when it blocks.
+             */
+            uint32 m_busy_poll_max;
+            volatile uint32_t m_busy_poll_budget;
+            uint64 m_wakeup_time;
+            volatile uint64_t m_spin_time;
+            volatile uint64_t m_block_time;
+            volatile uint64_t m_output_limit_closed;
+            volatile uint64_t m_refused_channels;
+
             /*
              * parent's index is 0
              * children's index is [1-n]
@@ -134,6 +249,7 @@ namespace comms
             TimerChannel* NewTimerChannel();
             SignalChannel* NewSignalChannel();
 
+            bool AddNewChannel(Channel* ch, uint32 type);
             Channel* CloneChannel(Channel* ch);
             void DeleteChannel(Channel* ch);
             void RemoveChannel(Channel* ch);
@@ -141,12 +257,55 @@ namespace comms
             void StartSubPool();
             void AttachAcceptedChannel(SocketChannel *ch);
             void AsyncIO(const ChannelAsyncIOContext& ctx);
+            void PublishAsyncIO(AsyncIOBatch* batch);
+            void FlushAsyncIOOutbox();
+            void AddFlushChannel(Channel* ch);
+            void FlushChannels();
+            void AddResumeChannel(Channel* ch);
+            void ResumeChannels();
+            void CheckSoftLimitedChannels();
+            void DrainAsyncIO();
+            void BeforeSleep();
+            static void BeforeSleepCallback(struct aeEventLoop* eventLoop);
+            static void AfterSleepCallback(struct aeEventLoop* eventLoop);
+            void BusyPollMain();
+            void UpdateBusyPollBudget(uint64 idle);
             void Routine();
+            void UpdateLoadStats();
+            void ExpireMigratedChannels();
+            void Rebalance();
+            bool CanMigrate(Channel* ch);
+            void MigrateHotChannel(ChannelService* target, uint32 gap);
+            static void MigrateHotChannelCallback(Channel* ch, void* data);
+            static void AttachMigratedChannelCallback(Channel* ch, void* data);
+            bool RebalanceEnabled() const
+            {
+                return m_rebalance_threshold > 0;
+            }
+            Buffer* AcquireSharedReadBuffer()
+            {
+                if (m_read_buffer_inuse)
+                {
+                    return NULL;
+                }
+                m_read_buffer_inuse = true;
+                m_read_buffer.Clear();
+                return &m_read_buffer;
+            }
+            void ReleaseSharedReadBuffer()
+            {
+                m_read_buffer.Clear();
+                m_read_buffer_inuse = false;
+            }
 
         public:
             ChannelService(uint32 setsize = 10240);
             void SetThreadPoolSize(uint32 size);
             uint32 GetThreadPoolSize();
+            /*
+             * Worker i is pinned to cpus[i % cpus.size()], must be set before Start()
+             */
+            void SetThreadPoolAffinity(const std::vector<int>& cpus);
             ChannelService& GetNextChannelService();
             ChannelService& GetIdlestChannelService(uint32 min , uint32 max);
             uint32 GetPoolIndex()
@@ -187,6 +346,21 @@ namespace comms
             void RegisterUserRoutineCallback(UserRoutineCallback* cb, void* data);
             void FireUserEvent(uint32 ev);
             void AsyncIO(uint32 id, ChannelAsyncIOCallback* cb, void* data);
+            void GetAsyncIOStats(ChannelAsyncIOStats& stats);
+            void RegisterMigrationFilter(ChannelMigrationFilter* filter, void* data);
+            /*
+             * threshold_percent 0 disables rebalancing, must be set before Start()
+             */
+            void SetRebalance(uint32 threshold_percent, uint32 period_seconds);
+            void GetLoadStats(ChannelLoadStats& stats);
+            /*
+             * max spin time in micros before the loop blocks, 0 disables, must be set before Start()
+             */
+            void SetBusyPoll(uint32 max_micros);
+            /*
+             * idx in [0, GetThreadPoolSize()), NULL if the pool is not started
+             */
+            ChannelService* GetSubPoolService(uint32 idx);
             ~ChannelService();
     };
 }
@@ -0,0 +1,252 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CHANNEL_SLOT_TABLE_HPP_
+#define CHANNEL_SLOT_TABLE_HPP_
+#include "common.hpp"
+#include <string.h>
+
+/*
+ * Channel ids are laid out as [generation:10][slot:18][type:4]. A slot is owned by one live
+ * channel process wide(see Channel::Channel), a table indexed by slot never sees two live
+ * channels in one entry, and the generation makes a stale id miss the entry's new owner.
+ * A channel created while all the slots are owned gets INVALID_CHANNEL_ID and is refused.
+ */
+#define CHANNEL_SLOT_BITS 18
+#define MAX_CHANNEL_SLOTS (1U << CHANNEL_SLOT_BITS)
+#define CHANNEL_ID_SLOT(id) (((id) >> 4) & (MAX_CHANNEL_SLOTS - 1))
+#define CHANNEL_GENERATION_MASK 0x3FF
+#define INVALID_CHANNEL_ID 0xFFFFFFFFU
+
+namespace comms
+{
+    /*
+     * O(1) map from channel id to T, indexed by the id's slot. Entries live in fixed size chunks
+     * which are never moved or freed before the table, so a get() from another thread reads a
+     * valid entry, and finds the id it asked for or misses.
+     */
+    template<typename T>
+    class ChannelSlotTable
+    {
+        public:
+            struct Entry
+            {
+                    volatile uint32 first;
+                    T second;
+                    Entry() :
+                            first(0), second()
+                    {
+                    }
+            };
+        private:
+            static const uint32 kChunkBits = 12;
+            static const uint32 kChunkSize = 1U << kChunkBits;
+            static const uint32 kMaxChunks = MAX_CHANNEL_SLOTS >> kChunkBits;
+            Entry* m_chunks[kMaxChunks];
+            uint32 m_chunk_count;
+            volatile size_t m_size;
+
+            Entry* GetEntry(uint32 id) const
+            {
+                uint32 slot = CHANNEL_ID_SLOT(id);
+                uint32 chunk = slot >> kChunkBits;
+                if (chunk >= m_chunk_count)
+                {
+                    return NULL;
+                }
+                return m_chunks[chunk] + (slot & (kChunkSize - 1));
+            }
+            ChannelSlotTable(const ChannelSlotTable&);
+            ChannelSlotTable& operator=(const ChannelSlotTable&);
+        public:
+            class iterator
+            {
+                private:
+                    const ChannelSlotTable* m_table;
+                    uint32 m_slot;
+                    void Skip()
+                    {
+                        uint32 max = m_table->m_chunk_count << kChunkBits;
+                        while (m_slot < max && 0 == m_table->m_chunks[m_slot >> kChunkBits][m_slot & (kChunkSize - 1)].first)
+                        {
+                            m_slot++;
+                        }
+                        if (m_slot > max)
+                        {
+                            m_slot = max;
+                        }
+                    }
+                public:
+                    iterator(const ChannelSlotTable* table, uint32 slot) :
+                            m_table(table), m_slot(slot)
+                    {
+                        Skip();
+                    }
+                    Entry* operator->() const
+                    {
+                        return m_table->m_chunks[m_slot >> kChunkBits] + (m_slot & (kChunkSize - 1));
+                    }
+                    Entry& operator*() const
+                    {
+                        return *(operator->());
+                    }
+                    iterator& operator++()
+                    {
+                        m_slot++;
+                        Skip();
+                        return *this;
+                    }
+                    iterator operator++(int)
+                    {
+                        iterator tmp = *this;
+                        ++(*this);
+                        return tmp;
+                    }
+                    bool operator==(const iterator& other) const
+                    {
+                        return m_slot == other.m_slot;
+                    }
+                    bool operator!=(const iterator& other) const
+                    {
+                        return m_slot != other.m_slot;
+                    }
+            };
+
+            ChannelSlotTable() :
+                    m_chunk_count(0), m_size(0)
+            {
+                memset(m_chunks, 0, sizeof(m_chunks));
+            }
+            iterator begin() const
+            {
+                return iterator(this, 0);
+            }
+            iterator end() const
+            {
+                return iterator(this, m_chunk_count << kChunkBits);
+            }
+            /*
+             * First entry at or after the slot of 'id', in slot order.
+             */
+            iterator lower_bound(uint32 id) const
+            {
+                return iterator(this, std::min(CHANNEL_ID_SLOT(id), m_chunk_count << kChunkBits));
+            }
+            iterator find(uint32 id) const
+            {
+                Entry* e = GetEntry(id);
+                if (NULL == e || e->first != id)
+                {
+                    return end();
+                }
+                return iterator(this, CHANNEL_ID_SLOT(id));
+            }
+            T get(uint32 id) const
+            {
+                Entry* e = GetEntry(id);
+                if (NULL == e || e->first != id)
+                {
+                    return T();
+                }
+                T value = e->second;
+                return e->first == id ? value : T();
+            }
+            size_t count(uint32 id) const
+            {
+                Entry* e = GetEntry(id);
+                return NULL != e && e->first == id ? 1 : 0;
+            }
+            size_t size() const
+            {
+                return m_size;
+            }
+            bool empty() const
+            {
+                return 0 == m_size;
+            }
+            void set(uint32 id, const T& value)
+            {
+                uint32 chunk = CHANNEL_ID_SLOT(id) >> kChunkBits;
+                while (m_chunk_count <= chunk)
+                {
+                    NEW(m_chunks[m_chunk_count], Entry[kChunkSize]);
+                    __sync_synchronize();
+                    m_chunk_count++;
+                }
+                Entry* e = GetEntry(id);
+                if (0 == e->first)
+                {
+                    m_size++;
+                }
+                e->first = 0;
+                __sync_synchronize();
+                e->second = value;
+                __sync_synchronize();
+                e->first = id;
+            }
+            size_t erase(uint32 id)
+            {
+                Entry* e = GetEntry(id);
+                if (NULL == e || e->first != id)
+                {
+                    return 0;
+                }
+                e->first = 0;
+                __sync_synchronize();
+                e->second = T();
+                m_size--;
+                return 1;
+            }
+            void erase(const iterator& it)
+            {
+                erase(it->first);
+            }
+            void clear()
+            {
+                for (uint32 i = 0; i < m_chunk_count; i++)
+                {
+                    for (uint32 j = 0; j < kChunkSize; j++)
+                    {
+                        m_chunks[i][j].first = 0;
+                        m_chunks[i][j].second = T();
+                    }
+                }
+                m_size = 0;
+            }
+            ~ChannelSlotTable()
+            {
+                for (uint32 i = 0; i < m_chunk_count; i++)
+                {
+                    DELETE_A(m_chunks[i]);
+                }
+            }
+    };
+}
+
+#endif /* CHANNEL_SLOT_TABLE_HPP_ */
@@ -149,6 +149,7 @@ namespace comms
 			public:
 				FrameDecoder()
 				{
+					m_cumulation.SetPooled(true);
 				}
 				void MessageReceived(ChannelHandlerContext& ctx,
 						MessageEvent<Buffer>& e)
@@ -168,6 +169,10 @@ namespace comms
 							m_cumulation.Write(input, input->ReadableBytes());
 						}
 					}
+					if (!m_cumulation.Readable())
+					{
+						m_cumulation.Release();
+					}
 				}
 				void ChannelClosed(ChannelHandlerContext& ctx,
 						ChannelStateEvent& e)
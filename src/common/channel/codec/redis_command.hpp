@@ -32,6 +32,7 @@
 
 #include <deque>
 #include <string>
+#include <vector>
 
 namespace comms
 {
@@ -221,6 +222,22 @@ namespace comms
 
         class RedisCommandDecoder;
         typedef std::deque<std::string> ArgumentArray;
+
+        /*
+         * A view of one argument inside the decode buffer, valid only while the
+         * frame is being processed in the decoder's call stack.
+         */
+        struct ArgumentSlice
+        {
+                const char* data;
+                size_t len;
+                ArgumentSlice(const char* d = NULL, size_t l = 0) :
+                        data(d), len(l)
+                {
+                }
+        };
+        typedef std::vector<ArgumentSlice> ArgumentSliceArray;
+
         class RedisCommandFrame
         {
             private:
@@ -228,7 +245,14 @@ namespace comms
                 bool m_is_inline;
                 bool m_cmd_seted;
                 std::string m_cmd;
-                ArgumentArray m_args;
+                mutable ArgumentArray m_args;
+                /*
+                 * Decoded frames keep their arguments as slices into the input buffer,
+                 * 'm_args' is only filled when someone asks for std::string arguments.
+                 */
+                ArgumentSliceArray m_slices;
+                bool m_sliced;
+                mutable bool m_args_filled;
                 /*
                  * Used to save temp protocol data
                  */
@@ -237,9 +261,14 @@ namespace comms
                 {
                     const char* str = buf.GetRawReadBuffer();
                     buf.AdvanceReadIndex(len);
+                    FillNextArgument(str, len);
+                }
+                inline void FillNextArgument(const char* str, size_t len)
+                {
                     if (m_cmd_seted)
                     {
-                        m_args.push_back(std::string(str, len));
+                        m_slices.push_back(ArgumentSlice(str, len));
+                        m_sliced = true;
                     }
                     else
                     {
@@ -247,21 +276,65 @@ namespace comms
                         m_cmd_seted = true;
                     }
                 }
+                inline void FillArguments() const
+                {
+                    if (m_sliced && !m_args_filled)
+                    {
+                        m_args.clear();
+                        for (size_t i = 0; i < m_slices.size(); i++)
+                        {
+                            m_args.push_back(std::string(m_slices[i].data, m_slices[i].len));
+                        }
+                        m_args_filled = true;
+                    }
+                }
+                inline void ClearSlices()
+                {
+                    m_slices.clear();
+                    m_sliced = false;
+                    m_args_filled = false;
+                }
                 friend class RedisCommandDecoder;
             public:
                 RedisCommandFrame(const std::string& cmd = "") :
-                        type(REDIS_CMD_INVALID), m_is_inline(false), m_cmd_seted(false), m_cmd(cmd)
+                        type(REDIS_CMD_INVALID), m_is_inline(false), m_cmd_seted(false), m_cmd(cmd), m_sliced(false), m_args_filled(
+                                false)
                 {
                 }
                 RedisCommandFrame(ArgumentArray& cmd) :
-                        type(REDIS_CMD_INVALID), m_is_inline(false), m_cmd_seted(false)
+                        type(REDIS_CMD_INVALID), m_is_inline(false), m_cmd_seted(false), m_sliced(false), m_args_filled(false)
                 {
                     m_cmd = cmd.front();
                     cmd.pop_front();
                     m_args = cmd;
                 }
+                /*
+                 * Copies always own their arguments since they may outlive the decode buffer
+                 * (transaction queue, slowlog, rewritten commands).
+                 */
+                RedisCommandFrame(const RedisCommandFrame& other) :
+                        type(other.type), m_is_inline(other.m_is_inline), m_cmd_seted(other.m_cmd_seted), m_cmd(
+                                other.m_cmd), m_args(other.GetArguments()), m_sliced(false), m_args_filled(false), m_raw_msg(
+                                other.m_raw_msg)
+                {
+                }
+                RedisCommandFrame& operator=(const RedisCommandFrame& other)
+                {
+                    if (this != &other)
+                    {
+                        type = other.type;
+                        m_is_inline = other.m_is_inline;
+                        m_cmd_seted = other.m_cmd_seted;
+                        m_cmd = other.m_cmd;
+                        m_args = other.GetArguments();
+                        ClearSlices();
+                        m_raw_msg = other.m_raw_msg;
+                    }
+                    return *this;
+                }
                 void SetFullCommand(const char* fmt, ...)
                 {
+                    ClearSlices();
                     m_args.clear();
                     va_list ap;
                     va_start(ap, fmt);
@@ -320,15 +393,33 @@ namespace comms
                 }
                 const ArgumentArray& GetArguments() const
                 {
+                    FillArguments();
                     return m_args;
                 }
                 ArgumentArray& GetMutableArguments()
                 {
+                    FillArguments();
+                    ClearSlices();
                     return m_args;
                 }
                 void AddArg(const std::string& arg)
                 {
-                    m_args.push_back(arg);
+                    GetMutableArguments().push_back(arg);
+                }
+                inline size_t GetArgumentCount() const
+                {
+                    return m_sliced ? m_slices.size() : m_args.size();
+                }
+                /*
+                 * Zero copy access for hot paths, index must be less than GetArgumentCount().
+                 */
+                inline ArgumentSlice GetArgumentSlice(uint32 index) const
+                {
+                    if (m_sliced)
+                    {
+                        return m_slices[index];
+                    }
+                    return ArgumentSlice(m_args[index].data(), m_args[index].size());
                 }
                 const std::string& GetCommand() const
                 {
@@ -345,6 +436,7 @@ namespace comms
                 }
                 const std::string* GetArgument(uint32 index) const
                 {
+                    FillArguments();
                     if (index >= m_args.size())
                     {
                         return NULL;
@@ -353,6 +445,7 @@ namespace comms
                 }
                 std::string ToString() const
                 {
+                    FillArguments();
                     std::string cmd;
                     cmd.append(m_cmd).append(" ");
                     for (uint32 i = 0; i < m_args.size(); i++)
@@ -370,6 +463,7 @@ namespace comms
                     m_cmd_seted = false;
                     m_cmd.clear();
                     m_args.clear();
+                    ClearSlices();
                 }
                 ~RedisCommandFrame()
                 {
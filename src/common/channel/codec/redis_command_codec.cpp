@@ -31,6 +31,7 @@
 #include "channel/all_includes.hpp"
 #include "redis_command_codec.hpp"
 #include "util/exception/api_exception.hpp"
+#include "util/scan_helper.hpp"
 
 #include <limits.h>
 
@@ -41,187 +42,194 @@ using namespace comms;
 /* Client request types */
 static const uint32 REDIS_REQ_INLINE = 1;
 static const uint32 REDIS_REQ_MULTIBULK = 2;
-static const char* kCRLF = "\r\n";
+static const int64 kMaxBulkLen = 512 * 1024 * 1024;
+/* Same threshold redis uses to preallocate big arguments */
+static const int kBigArgLength = 32 * 1024;
 
-int RedisCommandDecoder::ProcessInlineBuffer(Buffer& buffer, RedisCommandFrame& frame)
+int RedisCommandDecoder::ProcessInlineBuffer(Buffer& buffer, DecodeState& state, RedisCommandFrame& frame)
 {
-    int index = buffer.IndexOf(kCRLF, 2);
-    if (-1 == index)
+    const char* raw = buffer.GetRawReadBuffer();
+    size_t readable = buffer.ReadableBytes();
+    const char* crlf = find_crlf(raw + state.offset, readable - state.offset);
+    if (NULL == crlf)
     {
+        /*
+         * Skip the scanned bytes next time, except the last one which may be a split '\r'.
+         */
+        if (readable > 1)
+        {
+            state.offset = readable - 1;
+        }
         return 0;
     }
-    while (true)
+    state.offset = 0;
+    const char* p = raw;
+    while (p < crlf)
     {
-        char ch;
-        if (!buffer.ReadByte(ch))
-        {
-            break;
-        }
-        if (ch == ' ')
+        if (*p == ' ')
         {
+            p++;
             continue;
         }
-        buffer.AdvanceReadIndex(-1);
-        int current = buffer.GetReadIndex();
-        if (current == index)
-        {
-            buffer.AdvanceReadIndex(2); //skip "\r\n"
-            break;
-        }
-        int space_index = buffer.IndexOf(" ", 1, current, index);
-        if (-1 == space_index)
-        {
-            break;
-        }
-        frame.FillNextArgument(buffer, space_index - current);
-        buffer.AdvanceReadIndex(1); //skip space char
-    }
-    int current = buffer.GetReadIndex();
-    if (current < index)
-    {
-        frame.FillNextArgument(buffer, index - current);
-        buffer.AdvanceReadIndex(2); //skip "\r\n"
+        const char* space = find_char(p, crlf - p, ' ');
+        const char* arg_end = NULL == space ? crlf : space;
+        frame.FillNextArgument(p, arg_end - p);
+        p = arg_end;
     }
+    buffer.AdvanceReadIndex(crlf + 2 - raw);
     return 1;
 }
 
-static inline int readBulkLen(Buffer& buffer, int& len)
+int RedisCommandDecoder::ProcessMultibulkBuffer(Buffer& buffer, DecodeState& state, RedisCommandFrame& frame,
+        std::string& err)
 {
-    char *eptr = NULL;
     const char* raw = buffer.GetRawReadBuffer();
-    int tmp = strtol(raw, &eptr, 10);
-    if ((eptr - raw) > (buffer.ReadableBytes() - 2))
-    {
-        return 0;
-    }
-    if (*eptr != '\r' || *(eptr + 1) != '\n')
-    {
-        return -1;
-    }
-    len = tmp;
-    buffer.AdvanceReadIndex(eptr - raw + 2);
-    return 1;
-}
-
-int RedisCommandDecoder::ProcessMultibulkBuffer(Buffer& buffer, RedisCommandFrame& frame, std::string& err)
-{
-    if (buffer.ReadableBytes() < 3)  //at least  '0\r\n'
+    size_t readable = buffer.ReadableBytes();
+    if (state.multibulklen < 0)
     {
-        return 0;
-    }
-    int multibulklen = 0;
-    int read_len_ret = readBulkLen(buffer, multibulklen);
-    if (read_len_ret == 0)
-    {
-        return 0;
-    }
-    else if (read_len_ret < 0)
-    {
-        err = "Protocol error: expected CRLF at bulk length end";
-        return -1;
-    }
-    if (multibulklen > 512 * 1024 * 1024)
-    {
-        err = "Protocol error: invalid multibulk length";
-        return -1;
-    }
-    int parsed_args = 0;
-    while (parsed_args < multibulklen)
-    {
-        if (buffer.ReadableBytes() < 4)  //at least '$0\r\n'
-        {
-            return 0;
-        }
-        char expected = 0;
-        buffer.ReadByte(expected);
-        if (expected != '$')
-        {
-            char temp[100];
-            sprintf(temp, "Protocol error: expected '$', , got '%c'", buffer.GetRawReadBuffer()[0]);
-            //THROW_DECODE_EX(temp);
-            err = temp;
-            return -1;
-        }
-        int arglen = 0;
-        read_len_ret = readBulkLen(buffer, arglen);
+        int64 multibulklen = 0;
+        size_t consumed = 0;
+        int read_len_ret = parse_crlf_decimal(raw + 1, readable - 1, multibulklen, consumed);
         if (read_len_ret == 0)
         {
             return 0;
         }
         else if (read_len_ret < 0)
         {
-            err = "Protocol error: bulk length can not be negative";
+            err = "Protocol error: expected CRLF at bulk length end";
             return -1;
         }
-        if (arglen > 512 * 1024 * 1024)
+        if (multibulklen > kMaxBulkLen)
         {
-            err = "Protocol error: invalid bulk length";
+            err = "Protocol error: invalid multibulk length";
             return -1;
         }
-        if (buffer.ReadableBytes() < (arglen + 2))
+        state.multibulklen = multibulklen < 0 ? 0 : (int) multibulklen;
+        state.offset = 1 + consumed;
+        state.args.reserve(state.multibulklen < 1024 ? state.multibulklen : 1024);
+    }
+    while (state.parsed_args < state.multibulklen)
+    {
+        if (state.bulklen < 0)
+        {
+            if (state.offset >= readable)
+            {
+                return 0;
+            }
+            if (raw[state.offset] != '$')
+            {
+                char temp[100];
+                sprintf(temp, "Protocol error: expected '$', got '%c'", raw[state.offset]);
+                err = temp;
+                return -1;
+            }
+            int64 arglen = 0;
+            size_t consumed = 0;
+            int read_len_ret = parse_crlf_decimal(raw + state.offset + 1, readable - state.offset - 1, arglen,
+                    consumed);
+            if (read_len_ret == 0)
+            {
+                return 0;
+            }
+            else if (read_len_ret < 0 || arglen < 0)
+            {
+                err = "Protocol error: invalid bulk length";
+                return -1;
+            }
+            if (arglen > kMaxBulkLen)
+            {
+                err = "Protocol error: invalid bulk length";
+                return -1;
+            }
+            state.bulklen = (int) arglen;
+            state.offset += 1 + consumed;
+            if (state.bulklen >= kBigArgLength)
+            {
+                /*
+                 * Let the cumulation buffer be sized for the whole argument up front.
+                 */
+                state.expected_bytes = state.offset + state.bulklen + 2;
+            }
+        }
+        if (readable < state.offset + state.bulklen + 2)
         {
             return 0;
         }
-        if (buffer.GetRawReadBuffer()[arglen] != '\r' || buffer.GetRawReadBuffer()[arglen + 1] != '\n')
+        if (raw[state.offset + state.bulklen] != '\r' || raw[state.offset + state.bulklen + 1] != '\n')
         {
             err = "Protocol error: expected CRLF at bulk length end";
             return -1;
         }
-        frame.FillNextArgument(buffer, arglen);
-        buffer.AdvanceReadIndex(2);
-        parsed_args++;
+        state.args.push_back(std::make_pair(state.offset, (size_t) state.bulklen));
+        state.offset += state.bulklen + 2;
+        state.bulklen = -1;
+        state.expected_bytes = 0;
+        state.parsed_args++;
+    }
+    for (size_t i = 0; i < state.args.size(); i++)
+    {
+        frame.FillNextArgument(raw + state.args[i].first, state.args[i].second);
     }
+    buffer.AdvanceReadIndex(state.offset);
+    state.Reset();
     return 1;
 }
 
-bool RedisCommandDecoder::Decode(Buffer& buffer, RedisCommandFrame& msg, std::string& err)
+bool RedisCommandDecoder::Decode(Buffer& buffer, DecodeState& state, RedisCommandFrame& msg, std::string& err)
 {
-    while (buffer.GetRawReadBuffer()[0] == '\r' || buffer.GetRawReadBuffer()[0] == '\n')
+    if (!state.Pending())
+    {
+        while (buffer.Readable() && (buffer.GetRawReadBuffer()[0] == '\r' || buffer.GetRawReadBuffer()[0] == '\n'))
+        {
+            buffer.AdvanceReadIndex(1);
+        }
+    }
+    if (!buffer.Readable())
     {
-        buffer.AdvanceReadIndex(1);
+        return false;
     }
     size_t mark_read_index = buffer.GetReadIndex();
-    char ch;
-    if (buffer.ReadByte(ch))
+    int ret = -1;
+    if (buffer.GetRawReadBuffer()[0] == '*')
     {
-        int ret = -1;
-        if (ch == '*')
-        {
-            //reqtype = REDIS_REQ_MULTIBULK;
-            msg.m_is_inline = false;
-            ret = ProcessMultibulkBuffer(buffer, msg, err);
-        }
-        else
-        {
-            //reqtype = REDIS_REQ_INLINE;
-            msg.m_is_inline = true;
-            buffer.AdvanceReadIndex(-1);
-            ret = ProcessInlineBuffer(buffer, msg);
-        }
-        if (ret > 0)
-        {
-            size_t raw_data_size = buffer.GetReadIndex() - mark_read_index;
-            msg.m_raw_msg.WrapReadableContent(buffer.GetRawReadBuffer() - raw_data_size, raw_data_size);
-            return true;
-        }
-        else
-        {
-            msg.Clear();
-            if (0 == ret)
-            {
-                buffer.SetReadIndex(mark_read_index);
-            }
-            return false;
-        }
+        //reqtype = REDIS_REQ_MULTIBULK;
+        msg.m_is_inline = false;
+        ret = ProcessMultibulkBuffer(buffer, state, msg, err);
+    }
+    else
+    {
+        //reqtype = REDIS_REQ_INLINE;
+        msg.m_is_inline = true;
+        ret = ProcessInlineBuffer(buffer, state, msg);
+    }
+    if (ret > 0)
+    {
+        size_t raw_data_size = buffer.GetReadIndex() - mark_read_index;
+        msg.m_raw_msg.WrapReadableContent(buffer.GetRawReadBuffer() - raw_data_size, raw_data_size);
+        return true;
+    }
+    msg.Clear();
+    if (ret < 0)
+    {
+        /*
+         * Discard the scanned bytes so the broken request is not parsed again.
+         */
+        buffer.SetReadIndex(mark_read_index + (state.offset > 0 ? state.offset : 1));
+        state.Reset();
     }
-    buffer.SetReadIndex(mark_read_index);
     return false;
 }
 
+bool RedisCommandDecoder::Decode(Buffer& buffer, RedisCommandFrame& msg, std::string& err)
+{
+    DecodeState state;
+    return Decode(buffer, state, msg, err);
+}
+
 bool RedisCommandDecoder::Decode(ChannelHandlerContext& ctx, Channel* channel, Buffer& buffer, RedisCommandFrame& msg)
 {
     std::string err;
-    bool ret = Decode(buffer, msg, err);
+    bool ret = Decode(buffer, m_state, msg, err);
     if (!ret && !err.empty())
     {
         APIException ex(err);\
@@ -235,15 +243,15 @@ bool RedisCommandDecoder::Decode(ChannelHandlerContext& ctx, Channel* channel, B
 //===================================encoder==============================
 bool RedisCommandEncoder::Encode(Buffer& buf, const RedisCommandFrame& cmd)
 {
-    buf.Printf("*%d\r\n", cmd.GetArguments().size() + 1);
+    buf.Printf("*%d\r\n", cmd.GetArgumentCount() + 1);
     buf.Printf("$%d\r\n", cmd.GetCommand().size());
     buf.Write(cmd.GetCommand().data(), cmd.GetCommand().size());
     buf.Write("\r\n", 2);
-    for (uint32 i = 0; i < cmd.GetArguments().size(); i++)
+    for (uint32 i = 0; i < cmd.GetArgumentCount(); i++)
     {
-        const std::string* arg = cmd.GetArgument(i);
-        buf.Printf("$%d\r\n", arg->size());
-        buf.Write(arg->data(), arg->size());
+        ArgumentSlice arg = cmd.GetArgumentSlice(i);
+        buf.Printf("$%d\r\n", arg.len);
+        buf.Write(arg.data, arg.len);
         buf.Write("\r\n", 2);
     }
     return true;
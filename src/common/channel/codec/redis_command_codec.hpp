@@ -32,6 +32,8 @@
 
 #include "channel/codec/stack_frame_decoder.hpp"
 #include "redis_command.hpp"
+#include <vector>
+#include <utility>
 
 namespace comms
 {
@@ -41,9 +43,48 @@ namespace comms
         class RedisCommandDecoder: public StackFrameDecoder<RedisCommandFrame>
         {
             protected:
-                static int ProcessInlineBuffer(Buffer& buffer, RedisCommandFrame& frame);
-                static int ProcessMultibulkBuffer(Buffer& buffer, RedisCommandFrame& frame,std::string& err);
+                /*
+                 * Parse progress of a partly received request. It is kept between reads so
+                 * every byte of a large request is scanned once. All offsets are relative to
+                 * the request start (the read index), which stays valid when the pending bytes
+                 * are moved into the cumulation buffer.
+                 */
+                struct DecodeState
+                {
+                        int multibulklen; /* -1 until the '*<n>' header is parsed */
+                        int parsed_args;
+                        int bulklen; /* -1 until the next '$<n>' header is parsed */
+                        size_t offset; /* bytes already scanned */
+                        size_t expected_bytes; /* bytes needed by a big bulk argument, 0 if unknown */
+                        std::vector<std::pair<size_t, size_t> > args;
+                        DecodeState()
+                        {
+                            Reset();
+                        }
+                        bool Pending() const
+                        {
+                            return multibulklen >= 0 || offset > 0;
+                        }
+                        void Reset()
+                        {
+                            multibulklen = -1;
+                            parsed_args = 0;
+                            bulklen = -1;
+                            offset = 0;
+                            expected_bytes = 0;
+                            args.clear();
+                        }
+                };
+                DecodeState m_state;
+                static int ProcessInlineBuffer(Buffer& buffer, DecodeState& state, RedisCommandFrame& frame);
+                static int ProcessMultibulkBuffer(Buffer& buffer, DecodeState& state, RedisCommandFrame& frame,
+                        std::string& err);
+                static bool Decode(Buffer& buffer, DecodeState& state, RedisCommandFrame& msg, std::string& err);
                 bool Decode(ChannelHandlerContext& ctx, Channel* channel, Buffer& buffer, RedisCommandFrame& msg);
+                size_t ExpectedFrameBytes()
+                {
+                    return m_state.expected_bytes;
+                }
                 friend class RedisMessageDecoder;
             public:
                 RedisCommandDecoder()
@@ -96,6 +96,10 @@ namespace comms
                         return m_dump_file_decoder.Decode(ctx, channel, buffer, msg.chunk);
                     }
                 }
+                size_t ExpectedFrameBytes()
+                {
+                    return m_decoder_type == REDIS_COMMAND_DECODER_TYPE ? m_cmd_decoder.ExpectedFrameBytes() : 0;
+                }
             public:
                 RedisMessageDecoder() :
                         m_decoder_type(REDIS_COMMAND_DECODER_TYPE)
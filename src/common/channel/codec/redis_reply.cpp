@@ -152,6 +152,11 @@ namespace comms
             integer = 0;
             double_value = 0;
             str.clear();
+            if (NULL != segment)
+            {
+                segment->Release();
+                segment = NULL;
+            }
             DELETE(elements);
             if (self_pool && NULL != pool)
             {
@@ -160,6 +165,10 @@ namespace comms
         }
         RedisReply::~RedisReply()
         {
+            if (NULL != segment)
+            {
+                segment->Release();
+            }
             DELETE(elements);
             if (self_pool)
             {
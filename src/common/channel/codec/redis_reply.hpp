@@ -31,6 +31,7 @@
 #define REDIS_REPLY_HPP_
 
 #include "common.hpp"
+#include "buffer/shared_segment.hpp"
 #include <deque>
 #include <vector>
 #include <string>
@@ -50,6 +51,9 @@
 #define REDIS_REPLY_STATUS_OK 2001
 #define REDIS_REPLY_STATUS_PONG 2002
 
+/* string payloads at least this long are written by reference(writev) instead of copied */
+#define REDIS_REPLY_SHARED_PAYLOAD_LENGTH (16 * 1024)
+
 namespace comms
 {
     namespace codec
@@ -78,7 +82,7 @@ namespace comms
         {
 
             public:
-                unsigned type :8;
+                unsigned type :16;
                 std::string str;
 
                 /*
@@ -89,26 +93,32 @@ namespace comms
                 long double double_value;
                 std::deque<RedisReply*>* elements;
 
+                /*
+                 * Large string payload adopted from 'str' by the encoder, it's shared by all
+                 * output queues the reply is written to instead of copied into them.
+                 */
+                SharedSegment* segment;
+
                 RedisReplyPool* pool;  //use object pool if reply is array with hundreds of elements
                 bool self_pool;
                 RedisReply() :
-                        type(0), integer(0), double_value(0), elements(NULL), pool(NULL), self_pool(
+                        type(0), integer(0), double_value(0), elements(NULL), segment(NULL), pool(NULL), self_pool(
                                 false)
                 {
                 }
                 RedisReply(uint64 v) :
                         type(REDIS_REPLY_INTEGER),  integer(v), double_value(0), elements(
-                                NULL), pool(NULL), self_pool(false)
+                                NULL), segment(NULL), pool(NULL), self_pool(false)
                 {
                 }
                 RedisReply(double v) :
                         type(REDIS_REPLY_DOUBLE),  integer(0), double_value(v), elements(
-                                NULL), pool(NULL), self_pool(false)
+                                NULL), segment(NULL), pool(NULL), self_pool(false)
                 {
                 }
                 RedisReply(const std::string& v) :
                         type(REDIS_REPLY_STRING),  str(v), integer(0), double_value(0), elements(
-                                NULL), pool(NULL), self_pool(false)
+                                NULL), segment(NULL), pool(NULL), self_pool(false)
                 {
                 }
                 void SetPool(RedisReplyPool* pool);
@@ -123,6 +133,10 @@ namespace comms
                     type = r.type;
                     integer = r.integer;
                     str = r.str;
+                    if (NULL != r.segment)
+                    {
+                        str.assign(r.segment->Data(), r.segment->Size());
+                    }
                     double_value = r.double_value;
                     if (r.elements != NULL && !r.elements->empty())
                     {
@@ -30,6 +30,7 @@
 #include "channel/all_includes.hpp"
 #include "redis_reply_codec.hpp"
 #include "buffer/buffer_helper.hpp"
+#include "util/scan_helper.hpp"
 
 #include <limits.h>
 
@@ -37,66 +38,159 @@ using comms::BufferHelper;
 using namespace comms::codec;
 using namespace comms;
 
-bool RedisReplyEncoder::Encode(Buffer& buf, RedisReply& reply)
+/*
+ * Like redis' shared bulk headers: '$<n>\r\n' and '*<n>\r\n' for short lengths and
+ * ':<n>\r\n' for small integers are formatted once at startup and memcpy'ed.
+ */
+static const int64 kSharedHeaders = 256;
+static const int64 kSharedIntegers = 10000;
+/* upper bound of a fast_dtoa() result */
+static const size_t kMaxDoubleLength = 24;
+static const size_t kSharedPayloadLength = REDIS_REPLY_SHARED_PAYLOAD_LENGTH;
+struct SharedHeader
+{
+        uint8 len;
+        char data[15];
+};
+struct SharedReplyHeaders
+{
+        SharedHeader bulk[kSharedHeaders];
+        SharedHeader multibulk[kSharedHeaders];
+        SharedHeader integer[kSharedIntegers];
+        static void Format(SharedHeader& header, char prefix, int64 v)
+        {
+            header.data[0] = prefix;
+            int len = fast_itoa(header.data + 1, sizeof(header.data) - 3, v);
+            header.data[len + 1] = '\r';
+            header.data[len + 2] = '\n';
+            header.len = len + 3;
+        }
+        SharedReplyHeaders()
+        {
+            for (int64 i = 0; i < kSharedHeaders; i++)
+            {
+                Format(bulk[i], '$', i);
+                Format(multibulk[i], '*', i);
+            }
+            for (int64 i = 0; i < kSharedIntegers; i++)
+            {
+                Format(integer[i], ':', i);
+            }
+        }
+};
+static SharedReplyHeaders g_shared_headers;
+
+static inline size_t header_length(int64 v)
+{
+    /* prefix + digits + CRLF */
+    return v < 0 ? 4 + digits10(-(uint64) v) : 3 + digits10(v);
+}
+
+static inline char* write_raw(char* p, const void* data, size_t len)
+{
+    memcpy(p, data, len);
+    return p + len;
+}
+
+static inline char* write_header(char* p, char prefix, int64 v, const SharedHeader* shared, int64 shared_count)
+{
+    if (NULL != shared && v >= 0 && v < shared_count)
+    {
+        return write_raw(p, shared[v].data, shared[v].len);
+    }
+    *p++ = prefix;
+    uint64 uv = v;
+    if (v < 0)
+    {
+        *p++ = '-';
+        uv = -uv;
+    }
+    p += fast_itoa(p, 21, uv);
+    *p++ = '\r';
+    *p++ = '\n';
+    return p;
+}
+
+static inline char* write_bulk(char* p, const char* data, size_t len)
+{
+    p = write_header(p, '$', len, g_shared_headers.bulk, kSharedHeaders);
+    p = write_raw(p, data, len);
+    *p++ = '\r';
+    *p++ = '\n';
+    return p;
+}
+
+static inline char* write_shared_bulk(char* p, SharedSegment* segment, const char* base,
+        BufferSegmentArray& segments)
+{
+    p = write_header(p, '$', segment->Size(), g_shared_headers.bulk, kSharedHeaders);
+    segments.push_back(BufferSegment(p - base, segment));
+    *p++ = '\r';
+    *p++ = '\n';
+    return p;
+}
+
+static inline bool is_shared_payload(const RedisReply& reply)
+{
+    return NULL != reply.segment || reply.str.size() >= kSharedPayloadLength;
+}
+
+/*
+ * Pre-pass over the reply tree, computes the bytes needed to encode it (exact except
+ * for doubles), so the output buffer is grown only once. Large string payloads which
+ * could be written by reference are counted in 'shared' instead of 'len'.
+ */
+static bool encoded_length(const RedisReply& reply, size_t& len, size_t& shared)
 {
     switch (reply.type)
     {
         case REDIS_REPLY_NIL:
         {
-            buf.Printf("$-1\r\n");
+            len += 5;
             break;
         }
         case REDIS_REPLY_STRING:
         {
-            if (reply.str.size() == 0)
+            if (is_shared_payload(reply))
             {
-//                if (reply.encode_empty_str_as_null)
-//                {
-//                    buf.Printf("$-1\r\n");
-//                }
-//                else
-                {
-                    buf.Printf("$0\r\n\r\n");
-                }
+                size_t size = NULL != reply.segment ? reply.segment->Size() : reply.str.size();
+                len += header_length(size) + 2;
+                shared += size;
             }
             else
             {
-                buf.Printf("$%d\r\n", reply.str.size());
-                buf.Write(reply.str.data(), reply.str.size());
-                buf.Printf("\r\n");
+                len += header_length(reply.str.size()) + reply.str.size() + 2;
             }
             break;
         }
         case REDIS_REPLY_ERROR:
+        case REDIS_REPLY_STATUS:
         {
-            buf.Printf("-%s\r\n", reply.str.c_str());
+            len += reply.str.size() + 7;
             break;
         }
         case REDIS_REPLY_INTEGER:
         {
-            buf.Printf(":%lld\r\n", reply.integer);
+            len += header_length(reply.integer);
             break;
         }
         case REDIS_REPLY_DOUBLE:
         {
-            std::string doubleStrValue;
-            fast_dtoa(reply.double_value, 9, doubleStrValue);
-            buf.Printf("$%d\r\n", doubleStrValue.size());
-            buf.Printf("%s\r\n", doubleStrValue.c_str());
+            len += header_length(kMaxDoubleLength) + kMaxDoubleLength + 2;
             break;
         }
         case REDIS_REPLY_ARRAY:
         {
             if (NULL == reply.elements)
             {
-                buf.Printf("*0\r\n");
+                len += 4;
                 break;
             }
-            buf.Printf("*%d\r\n", reply.elements->size());
-            std::deque<RedisReply*>::iterator it = reply.elements->begin();
+            len += header_length(reply.elements->size());
+            std::deque<RedisReply*>::const_iterator it = reply.elements->begin();
             while (it != reply.elements->end())
             {
-                if (!RedisReplyEncoder::Encode(buf, *(*it)))
+                if (!encoded_length(*(*it), len, shared))
                 {
                     return false;
                 }
@@ -104,42 +198,164 @@ bool RedisReplyEncoder::Encode(Buffer& buf, RedisReply& reply)
             }
             break;
         }
+        default:
+        {
+            ERROR_LOG("Recv unexpected redis reply type:%d", reply.type);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Encode the reply at 'p', if 'segments' is not NULL, large string payloads are adopted into
+ * the reply's shared segment and recorded with their offsets relative to 'base' instead of copied.
+ */
+static char* encode_reply(char* p, RedisReply& reply, const char* base, BufferSegmentArray* segments)
+{
+    switch (reply.type)
+    {
+        case REDIS_REPLY_NIL:
+        {
+            return write_raw(p, "$-1\r\n", 5);
+        }
+        case REDIS_REPLY_STRING:
+        {
+            if (NULL != segments && is_shared_payload(reply))
+            {
+                if (NULL == reply.segment)
+                {
+                    NEW(reply.segment, SharedSegment(reply.str));
+                }
+                return write_shared_bulk(p, reply.segment, base, *segments);
+            }
+            if (NULL != reply.segment)
+            {
+                return write_bulk(p, reply.segment->Data(), reply.segment->Size());
+            }
+            return write_bulk(p, reply.str.data(), reply.str.size());
+        }
+        case REDIS_REPLY_ERROR:
+        {
+            *p++ = '-';
+            p = write_raw(p, reply.str.data(), reply.str.size());
+            return write_raw(p, "\r\n", 2);
+        }
+        case REDIS_REPLY_INTEGER:
+        {
+            return write_header(p, ':', reply.integer, g_shared_headers.integer, kSharedIntegers);
+        }
+        case REDIS_REPLY_DOUBLE:
+        {
+            std::string doubleStrValue;
+            fast_dtoa(reply.double_value, 9, doubleStrValue);
+            return write_bulk(p, doubleStrValue.data(), doubleStrValue.size());
+        }
+        case REDIS_REPLY_ARRAY:
+        {
+            if (NULL == reply.elements)
+            {
+                return write_raw(p, "*0\r\n", 4);
+            }
+            p = write_header(p, '*', reply.elements->size(), g_shared_headers.multibulk, kSharedHeaders);
+            std::deque<RedisReply*>::iterator it = reply.elements->begin();
+            while (it != reply.elements->end())
+            {
+                p = encode_reply(p, *(*it), base, segments);
+                it++;
+            }
+            return p;
+        }
         case REDIS_REPLY_STATUS:
         {
             switch (reply.integer)
             {
                 case REDIS_REPLY_STATUS_OK:
                 {
-                    buf.Printf("+OK\r\n");
-                    break;
+                    return write_raw(p, "+OK\r\n", 5);
                 }
                 case REDIS_REPLY_STATUS_PONG:
                 {
-                    buf.Printf("+PONG\r\n");
-                    break;
+                    return write_raw(p, "+PONG\r\n", 7);
                 }
                 default:
                 {
-                    buf.Printf("+%s\r\n", reply.str.c_str());
-                    break;
+                    *p++ = '+';
+                    p = write_raw(p, reply.str.data(), reply.str.size());
+                    return write_raw(p, "\r\n", 2);
                 }
             }
-            break;
         }
         default:
         {
-            ERROR_LOG("Recv unexpected redis reply type:%d", reply.type);
-            return false;
+            return p;
         }
     }
+}
+
+static bool encode(Buffer& buf, RedisReply& reply, size_t len, BufferSegmentArray* segments)
+{
+    if (!buf.EnsureWritableBytes(len))
+    {
+        return false;
+    }
+    char* start = const_cast<char*>(buf.GetRawWriteBuffer());
+    char* end = encode_reply(start, reply, buf.GetRawReadBuffer(), segments);
+    buf.AdvanceWriteIndex(end - start);
     return true;
 }
 
+bool RedisReplyEncoder::Encode(Buffer& buf, RedisReply& reply)
+{
+    size_t len = 0, shared = 0;
+    if (!encoded_length(reply, len, shared))
+    {
+        return false;
+    }
+    return encode(buf, reply, len + shared, NULL);
+}
+
 bool RedisReplyEncoder::WriteRequested(ChannelHandlerContext& ctx, MessageEvent<RedisReply>& e)
 {
     RedisReply* msg = e.GetMessage();
+    size_t len = 0, shared = 0;
+    if (!encoded_length(*msg, len, shared))
+    {
+        return false;
+    }
+    if (shared > 0)
+    {
+        /*
+         * only headers are encoded, large payloads are handed to the channel by reference
+         * and written with writev() without being copied into any buffer.
+         */
+        m_buffer.Clear();
+        m_segments.clear();
+        bool ret = false;
+        if (encode(m_buffer, *msg, len, &m_segments))
+        {
+            ret = ctx.GetChannel()->WriteSegments(&m_buffer, m_segments) > 0;
+        }
+        m_segments.clear();
+        return ret;
+    }
+    Buffer* batch = ctx.GetChannel()->GetBatchWriteBuffer();
+    if (NULL != batch)
+    {
+        /*
+         * encode into channel's output buffer directly, it would be flushed once
+         * all pipelined commands in current read event processed.
+         */
+        size_t mark = batch->GetWriteIndex();
+        if (encode(*batch, *msg, len, NULL))
+        {
+            return true;
+        }
+        batch->SetWriteIndex(mark);
+        return false;
+    }
     m_buffer.Clear();
-    if (Encode(m_buffer, *msg))
+    if (encode(m_buffer, *msg, len, NULL))
     {
         return ctx.GetChannel()->Write(m_buffer);
     }
@@ -164,7 +380,9 @@ static int decode_reply(Buffer& buffer, RedisReply& msg)
         case '$':
         {
             int64 len;
-            if (!raw_toint64(buffer.GetRawReadBuffer(), crlf_index - buffer.GetReadIndex(), len))
+            size_t consumed;
+            if (parse_crlf_decimal(buffer.GetRawReadBuffer(), crlf_index + 2 - buffer.GetReadIndex(), len, consumed)
+                    <= 0)
             {
                 return -1;
             }
@@ -175,6 +393,11 @@ static int decode_reply(Buffer& buffer, RedisReply& msg)
             }
             else
             {
+                if (len < 0 || buffer.ReadableBytes() < (size_t) len + 2)
+                {
+                    buffer.SetReadIndex(mark);
+                    return len < 0 ? -1 : 0;
+                }
                 msg.type = REDIS_REPLY_STRING;
                 msg.str.assign(buffer.GetRawReadBuffer(), len);
                 buffer.SkipBytes(len + 2);
@@ -210,7 +433,9 @@ static int decode_reply(Buffer& buffer, RedisReply& msg)
         case '*':
         {
             int64 len;
-            if (!raw_toint64(buffer.GetRawReadBuffer(), crlf_index - buffer.GetReadIndex(), len))
+            size_t consumed;
+            if (parse_crlf_decimal(buffer.GetRawReadBuffer(), crlf_index + 2 - buffer.GetReadIndex(), len, consumed)
+                    <= 0)
             {
                 return -1;
             }
@@ -226,7 +451,8 @@ static int decode_reply(Buffer& buffer, RedisReply& msg)
                 }
                 else if (ret == 0)
                 {
-                    break;
+                    buffer.SetReadIndex(mark);
+                    return 0;
                 }
             }
             return 1;
@@ -248,7 +474,7 @@ RedisReplyDecoder::RedisReplyDecoder()
 bool RedisReplyDecoder::Decode(ChannelHandlerContext& ctx, Channel* channel, Buffer& buffer, RedisReply& msg)
 {
     msg.Clear();
-    while (buffer.GetRawReadBuffer()[0] == '\r' || buffer.GetRawReadBuffer()[0] == '\n')
+    while (buffer.Readable() && (buffer.GetRawReadBuffer()[0] == '\r' || buffer.GetRawReadBuffer()[0] == '\n'))
     {
         buffer.AdvanceReadIndex(1);
     }
@@ -64,6 +64,7 @@ namespace comms
 		{
 			private:
 		        Buffer m_buffer;
+		        BufferSegmentArray m_segments;
 				bool WriteRequested(ChannelHandlerContext& ctx, MessageEvent<RedisReply>& e);
 			public:
 				static bool Encode(Buffer& buf, RedisReply& reply);
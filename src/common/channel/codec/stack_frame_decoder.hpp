@@ -68,7 +68,7 @@ namespace comms
 				//bool m_unfold;
 				Buffer m_cumulation;
 				void CallDecode(ChannelHandlerContext& context,
-						Channel* channel, Buffer& cumulation)
+						Channel* channel, Buffer& cumulation, bool budgeted = true)
 				{
 					while (cumulation.Readable())
 					{
@@ -100,6 +100,13 @@ namespace comms
 						}
 
 						fire_message_received<T>(context, &msg, NULL);
+						if (budgeted && NULL != channel && !channel->TakeReadBudget()
+								&& cumulation.Readable())
+						{
+							//out of read budget, the rest frames are decoded in next loop iteration
+							channel->YieldRead();
+							break;
+						}
 					}
 				}
 				void Cleanup(ChannelHandlerContext& ctx, ChannelStateEvent& e)
@@ -111,7 +118,7 @@ namespace comms
 					}
 
 					// Make sure all frames are read before notifying a closed channel.
-					CallDecode(ctx, ctx.GetChannel(), m_cumulation);
+					CallDecode(ctx, ctx.GetChannel(), m_cumulation, false);
 
 					// Call decodeLast() finally.  Please note that decodeLast() is
 					// called even if there's nothing more to read from the buffer to
@@ -134,9 +141,28 @@ namespace comms
 				{
 					return Decode(ctx, channel, buffer, msg);
 				}
+				/*
+				 * Bytes (from the read index) the pending frame is known to need,
+				 * or 0. Lets the cumulation buffer grow once for large frames
+				 * instead of doubling and copying on every read.
+				 */
+				virtual size_t ExpectedFrameBytes()
+				{
+					return 0;
+				}
+				void ReserveCumulation(size_t incoming)
+				{
+					size_t expected = ExpectedFrameBytes();
+					size_t buffered = m_cumulation.ReadableBytes() + incoming;
+					if (expected > buffered)
+					{
+						m_cumulation.EnsureWritableBytes(expected - m_cumulation.ReadableBytes());
+					}
+				}
 			public:
 				StackFrameDecoder()
 				{
+					m_cumulation.SetPooled(true);
 				}
 				void Clear()
 				{
@@ -150,6 +176,7 @@ namespace comms
 					if (m_cumulation.Readable())
 					{
 						m_cumulation.DiscardReadedBytes();
+						ReserveCumulation(input->ReadableBytes());
 						m_cumulation.Write(input, input->ReadableBytes());
 						CallDecode(ctx, e.GetChannel(), m_cumulation);
 					} else
@@ -157,9 +184,15 @@ namespace comms
 						CallDecode(ctx, e.GetChannel(), *input);
 						if (input->Readable())
 						{
+							m_cumulation.Clear();
+							ReserveCumulation(input->ReadableBytes());
 							m_cumulation.Write(input, input->ReadableBytes());
 						}
 					}
+					if (!m_cumulation.Readable())
+					{
+						m_cumulation.Release();
+					}
 				}
 				void ChannelClosed(ChannelHandlerContext& ctx,
 						ChannelStateEvent& e)
@@ -36,6 +36,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <time.h>
+#include <strings.h>
 
 #include "ae.h"
 #include "zmalloc.h"
@@ -52,6 +53,41 @@
 #endif
 #endif
 
+/* io_uring is selected at runtime, see aeSetApiBackend() */
+#ifdef HAVE_IOURING
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_RECV_MULTISHOT)
+#include "ae_iouring.cc"
+#else
+#undef HAVE_IOURING
+#endif
+#endif
+
+/* Backend used by event loops created from now on */
+static int aeDefaultBackend = AE_BACKEND_DEFAULT;
+
+#ifdef HAVE_IOURING
+#define aeBackendCall(loop, fn, ...) \
+    ((loop)->backend == AE_BACKEND_IOURING ? aeIOUring##fn(__VA_ARGS__) : ae##fn(__VA_ARGS__))
+#else
+#define aeBackendCall(loop, fn, ...) ae##fn(__VA_ARGS__)
+#endif
+
+static int aeBackendCreate(aeEventLoop *eventLoop)
+{
+#ifdef HAVE_IOURING
+    if (eventLoop->backend == AE_BACKEND_IOURING)
+    {
+        if (aeIOUringApiCreate(eventLoop) == 0)
+            return 0;
+        /* io_uring is not usable here (old kernel, seccomp...), every
+         * following loop falls back to the compiled in backend as well. */
+        eventLoop->backend = aeDefaultBackend = AE_BACKEND_DEFAULT;
+    }
+#endif
+    return aeApiCreate(eventLoop);
+}
+
 #ifdef __MACH__
 #include <mach/clock.h>
 #include <mach/mach.h>
@@ -81,12 +117,17 @@ aeEventLoop *aeCreateEventLoop(int setsize)
 	eventLoop->stop = 0;
 	eventLoop->maxfd = -1;
 	eventLoop->beforesleep = NULL;
-    if (aeApiCreate(eventLoop) == -1) goto err;
+	eventLoop->aftersleep = NULL;
+	eventLoop->backend = aeDefaultBackend;
+    if (aeBackendCreate(eventLoop) == -1) goto err;
 
 	/* Events with mask == AE_NONE are not set. So let's initialize the
 	 * vector with it. */
     for (i = 0; i < setsize; i++)
+    {
 		eventLoop->events[i].mask = AE_NONE;
+		eventLoop->events[i].edge = 0;
+    }
 	return eventLoop;
 err:
     if (eventLoop) {
@@ -99,7 +140,7 @@ err:
 
 void aeDeleteEventLoop(aeEventLoop *eventLoop)
 {
-	aeApiFree(eventLoop);
+	aeBackendCall(eventLoop, ApiFree, eventLoop);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
 	zfree(eventLoop);
@@ -116,7 +157,7 @@ int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
     if (fd >= eventLoop->setsize) return AE_ERR;
     aeFileEvent *fe = &eventLoop->events[fd];
 
-	if (aeApiAddEvent(eventLoop, fd, mask) == -1)
+	if (aeBackendCall(eventLoop, ApiAddEvent, eventLoop, fd, mask) == -1)
 		return AE_ERR;
 	fe->mask |= mask;
 	if (mask & AE_READABLE)
@@ -147,7 +188,17 @@ void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask)
 				break;
 		eventLoop->maxfd = j;
 	}
-	aeApiDelEvent(eventLoop, fd, mask);
+	aeBackendCall(eventLoop, ApiDelEvent, eventLoop, fd, mask);
+	if (fe->mask == AE_NONE)
+		fe->edge = 0;
+}
+
+/* Must be called before the first event of the fd is created, reset once all its events are deleted. */
+int aeSetFileEventEdge(aeEventLoop *eventLoop, int fd, int edge)
+{
+    if (fd >= eventLoop->setsize || eventLoop->events[fd].mask != AE_NONE) return AE_ERR;
+    eventLoop->events[fd].edge = edge;
+    return AE_OK;
 }
 
 int aeGetFileEvents(aeEventLoop *eventLoop, int fd) {
@@ -410,7 +461,9 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 				tvp = NULL; /* wait forever */
 			}
 		}
-		numevents = aeApiPoll(eventLoop, tvp);
+		numevents = aeBackendCall(eventLoop, ApiPoll, eventLoop, tvp);
+		if (eventLoop->aftersleep != NULL)
+			eventLoop->aftersleep(eventLoop);
 
 		for (j = 0; j < numevents; j++)
 		{
@@ -488,11 +541,106 @@ void aeMain(aeEventLoop *eventLoop)
 
 char *aeGetApiName(void)
 {
+#ifdef HAVE_IOURING
+	if (aeDefaultBackend == AE_BACKEND_IOURING)
+		return aeIOUringApiName();
+#endif
 	return aeApiName();
 }
 
+/* Select the multiplexing backend of the event loops created afterwards,
+ * either the compiled in one (by its name or "default") or "io_uring".
+ * Returns AE_ERR if the backend is not available in this build. */
+int aeSetApiBackend(const char *name)
+{
+	if (!strcasecmp(name, "default") || !strcasecmp(name, aeApiName()))
+	{
+		aeDefaultBackend = AE_BACKEND_DEFAULT;
+		return AE_OK;
+	}
+#ifdef HAVE_IOURING
+	if (!strcasecmp(name, "io_uring") || !strcasecmp(name, "iouring"))
+	{
+		aeDefaultBackend = AE_BACKEND_IOURING;
+		return AE_OK;
+	}
+#endif
+	return AE_ERR;
+}
+
+/* Switch a connected socket to(or back from) completion mode, AE_ERR if
+ * the backend of the loop does not support it. */
+int aeSetFileEventCompletion(aeEventLoop *eventLoop, int fd, int completion)
+{
+	if (fd >= eventLoop->setsize) return AE_ERR;
+#ifdef HAVE_IOURING
+	if (eventLoop->backend == AE_BACKEND_IOURING)
+		return aeIOUringSetCompletion(eventLoop, fd, completion);
+#endif
+	return completion ? AE_ERR : AE_OK;
+}
+
+/* Leave completion mode and wait for the in flight I/O of the fd, which
+ * is about to be handed to another loop. The bytes already received are
+ * still returned by aeRead(), AE_ERR if the wait timed out. */
+int aeDrainFileEventCompletion(aeEventLoop *eventLoop, int fd, long long milliseconds)
+{
+	if (fd >= eventLoop->setsize) return AE_ERR;
+#ifdef HAVE_IOURING
+	if (eventLoop->backend == AE_BACKEND_IOURING)
+		return aeIOUringDrain(eventLoop, fd, milliseconds);
+#endif
+	return AE_OK;
+}
+
+/* Must be called before an fd switched to completion mode is closed or
+ * handed to another loop, what it still holds is dropped. */
+void aeForgetFileEvent(aeEventLoop *eventLoop, int fd)
+{
+	if (fd >= eventLoop->setsize) return;
+#ifdef HAVE_IOURING
+	if (eventLoop->backend == AE_BACKEND_IOURING)
+		aeIOUringForget(eventLoop, fd);
+#endif
+}
+
+ssize_t aeRead(aeEventLoop *eventLoop, int fd, void *buf, size_t len)
+{
+#ifdef HAVE_IOURING
+	if (eventLoop->backend == AE_BACKEND_IOURING && fd < eventLoop->setsize)
+		return aeIOUringRead(eventLoop, fd, buf, len);
+#endif
+	return read(fd, buf, len);
+}
+
+ssize_t aeWritev(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt)
+{
+#ifdef HAVE_IOURING
+	if (eventLoop->backend == AE_BACKEND_IOURING && fd < eventLoop->setsize)
+		return aeIOUringWritev(eventLoop, fd, iov, iovcnt);
+#endif
+	return writev(fd, iov, iovcnt);
+}
+
+/* Received bytes not read yet(AE_READABLE) or written bytes not sent yet
+ * (AE_WRITABLE) held by the loop for an fd in completion mode. */
+size_t aeGetPendingBytes(aeEventLoop *eventLoop, int fd, int mask)
+{
+#ifdef HAVE_IOURING
+	if (eventLoop->backend == AE_BACKEND_IOURING && fd < eventLoop->setsize)
+		return aeIOUringPending(eventLoop, fd, mask);
+#endif
+	return 0;
+}
+
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop,
         aeBeforeSleepProc *beforesleep)
 {
 	eventLoop->beforesleep = beforesleep;
 }
+
+void aeSetAfterSleepProc(aeEventLoop *eventLoop,
+        aeAfterSleepProc *aftersleep)
+{
+	eventLoop->aftersleep = aftersleep;
+}
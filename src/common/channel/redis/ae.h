@@ -32,12 +32,20 @@
 #ifndef __AE_H__
 #define __AE_H__
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #ifdef __linux__
 #define HAVE_EPOLL 1
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IOURING 1
+#endif
+#endif
 #endif
 
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
@@ -60,6 +68,10 @@ extern "C" {
 
 #define AE_NOMORE -1
 
+/* Multiplexing backends, see aeSetApiBackend() */
+#define AE_BACKEND_DEFAULT 0 /* epoll, kqueue or select, chosen at compile time */
+#define AE_BACKEND_IOURING 1
+
 /* Macros */
 #define AE_NOTUSED(V) ((void) V)
 
@@ -70,10 +82,12 @@ typedef void aeFileProc(struct aeEventLoop *eventLoop, int fd, void *clientData,
 typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *clientData);
 typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
 typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
+typedef void aeAfterSleepProc(struct aeEventLoop *eventLoop);
 
 /* File event structure */
 typedef struct aeFileEvent {
     int mask; /* one of AE_(READABLE|WRITABLE) */
+    int edge; /* edge triggered while not writable, honoured by the epoll backend only */
     aeFileProc *rfileProc;
     aeFileProc *wfileProc;
     void *clientData;
@@ -106,7 +120,9 @@ typedef struct aeEventLoop {
     aeTimeEvent *timeEventHead;
     int stop;
     void *apidata; /* This is used for polling API specific data */
+    int backend; /* one of AE_BACKEND_* */
     aeBeforeSleepProc *beforesleep;
+    aeAfterSleepProc *aftersleep; /* called once the multiplexing api returns */
 } aeEventLoop;
 
 /* Prototypes */
@@ -117,6 +133,7 @@ int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
         aeFileProc *proc, void *clientData);
 void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask);
 int aeGetFileEvents(aeEventLoop *eventLoop, int fd);
+int aeSetFileEventEdge(aeEventLoop *eventLoop, int fd, int edge);
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc);
@@ -129,7 +146,19 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
 char *aeGetApiName(void);
+int aeSetApiBackend(const char *name);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
+void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeAfterSleepProc *aftersleep);
+
+/* Completion based socket I/O, only available with the io_uring backend.
+ * Once enabled for an fd its reads and writes must go through aeRead() and
+ * aeWritev(), which fall back to read()/writev() for the other fds. */
+int aeSetFileEventCompletion(aeEventLoop *eventLoop, int fd, int completion);
+int aeDrainFileEventCompletion(aeEventLoop *eventLoop, int fd, long long milliseconds);
+void aeForgetFileEvent(aeEventLoop *eventLoop, int fd);
+ssize_t aeRead(aeEventLoop *eventLoop, int fd, void *buf, size_t len);
+ssize_t aeWritev(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt);
+size_t aeGetPendingBytes(aeEventLoop *eventLoop, int fd, int mask);
 
 #ifdef __cplusplus
 }
@@ -63,9 +63,12 @@ static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask)
         ee.events |= EPOLLIN;
     if (mask & AE_WRITABLE)
         ee.events |= EPOLLOUT;
+    /* Writers flush a bounded amount per event without draining the socket
+     * buffer, so the fd is level triggered while output is pending. */
+    if (eventLoop->events[fd].edge && !(mask & AE_WRITABLE))
+        ee.events |= EPOLLET;
     ee.data.u64 = 0; /* avoid valgrind warning */
     ee.data.fd = fd;
-    //ee.events |= EPOLLET;
     if (epoll_ctl(state->epfd, op, fd, &ee) == -1)
         return -1;
     return 0;
@@ -82,6 +85,8 @@ static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask)
         ee.events |= EPOLLIN;
     if (mask & AE_WRITABLE)
         ee.events |= EPOLLOUT;
+    if (eventLoop->events[fd].edge && !(mask & AE_WRITABLE))
+        ee.events |= EPOLLET;
     ee.data.u64 = 0; /* avoid valgrind warning */
     ee.data.fd = fd;
     if (mask != AE_NONE)
@@ -0,0 +1,1086 @@
+/* Released under the BSD license. See the COPYING file for more info. */
+
+/* io_uring backend.
+ *
+ * Sockets switched to completion mode with aeSetFileEventCompletion() are not
+ * polled at all.  A multishot IORING_OP_RECV fills buffers taken from a ring
+ * provided to the kernel, aeRead() copies them out, and the bytes given to
+ * aeWritev() are copied to a per fd buffer sent with IORING_OP_SEND.  Such an
+ * fd is reported readable while received bytes are queued and writable once
+ * everything written has been sent.
+ *
+ * Every other fd owns at most one one-shot IORING_OP_POLL_ADD request,
+ * re-armed against the current socket state after firing, which keeps the
+ * level triggered semantics the rest of the event loop relies on.
+ *
+ * Requests are only recorded while the fired events are handled: the recv
+ * and poll (re)arms, cancellations and the sends of a whole loop iteration
+ * are submitted together with the wait in a single io_uring_enter() call, so
+ * a pipelined batch costs no read, write or epoll_ctl syscall. */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <endian.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+#define AE_IOURING_SQ_ENTRIES 1024
+#define AE_IOURING_MAX_CQ_ENTRIES 65536
+#define AE_IOURING_BUF_SIZE 16384 /* provided recv buffers, shared by the fds of a loop */
+#define AE_IOURING_BUF_COUNT 1024
+#define AE_IOURING_MAX_QUEUED_BUFS 16 /* recv pauses while an fd holds that many unread buffers */
+#define AE_IOURING_SEND_LIMIT (256 * 1024) /* unsent bytes per fd before aeWritev() says EAGAIN */
+#define AE_IOURING_SEND_KEEP (64 * 1024) /* larger send buffers are freed once drained */
+
+/* user_data: generation << 32 | fd << 2 | request kind */
+#define AE_IOURING_POLL 0
+#define AE_IOURING_RECV 1
+#define AE_IOURING_SEND 2
+#define AE_IOURING_IGNORE 3 /* cancellations and poll removals */
+#define aeIOUringData(kind, fd, gen) (((uint64_t) (gen) << 32) | ((uint64_t) (uint32_t) (fd) << 2) | (kind))
+
+/* sq_flags telling completions are waiting for an io_uring_enter() */
+#ifdef IORING_SQ_TASKRUN
+#define AE_IOURING_SQ_GETEVENTS (IORING_SQ_CQ_OVERFLOW | IORING_SQ_TASKRUN)
+#else
+#define AE_IOURING_SQ_GETEVENTS IORING_SQ_CQ_OVERFLOW
+#endif
+
+typedef struct aeIOUringBuf
+{
+    int next; /* next queued buffer of the same fd, -1 for the last one */
+    int len;
+    int off; /* bytes already read */
+} aeIOUringBuf;
+
+/* Send buffer of a forgotten fd, freed once the kernel is done with it */
+typedef struct aeIOUringOrphan
+{
+    uint64_t data;
+    char *buf;
+    struct aeIOUringOrphan *next;
+} aeIOUringOrphan;
+
+typedef struct aeIOUringFd
+{
+    int wanted; /* mask requested by the event loop */
+    int armed; /* mask of the poll request currently in the kernel */
+    int fired; /* mask reported by the poll request, not delivered yet */
+    int dirty; /* queued in the dirty list */
+    int ready; /* queued in the ready list */
+    uint32_t gen; /* tags the armed poll request, stale completions are dropped */
+
+    int completion; /* recv & send are completed by the ring */
+    int starved; /* no provided buffer was left, polled and read directly meanwhile */
+    int recv_armed; /* a multishot recv is in the kernel */
+    int recv_cancel; /* and its cancellation was requested */
+    int eof;
+    int err; /* errno of a failed recv or send */
+    uint32_t life; /* tags recv & send requests, bumped when the fd is forgotten */
+    int head; /* received buffers not read yet, oldest first */
+    int tail;
+    int nqueued;
+    size_t queued; /* bytes left in them */
+    char *send; /* send[send_off, send_len) is handed to the kernel */
+    size_t send_len;
+    size_t send_off;
+    size_t send_cap;
+    int send_inflight;
+    char *pend; /* written meanwhile, sent once the in flight bytes are */
+    size_t pend_len;
+    size_t pend_cap;
+} aeIOUringFd;
+
+typedef struct aeIOUringState
+{
+    int ringfd;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_flags;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail; /* includes requests not yet published */
+    unsigned sq_pending; /* published but not yet submitted */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    int setsize;
+    aeIOUringFd *fds;
+    int *dirty;
+    int ndirty;
+    int *ready; /* fds which may have events to report */
+    int nready;
+    int *starved;
+    int nstarved;
+    struct io_uring_buf_ring *br; /* NULL if completion mode is not available */
+    char *bufs;
+    aeIOUringBuf *bufinfo;
+    uint16_t br_tail;
+    int nobufs; /* a recv ran out of provided buffers */
+    int no_multishot; /* the kernel rejected multishot recv */
+    aeIOUringOrphan *orphans;
+} aeIOUringState;
+
+static void aeIOUringUnmap(aeIOUringState *state)
+{
+    if (state->sqes != NULL && state->sqes != MAP_FAILED)
+        munmap(state->sqes, state->sqes_size);
+    if (state->cq_ring != NULL && state->cq_ring != MAP_FAILED && state->cq_ring != state->sq_ring)
+        munmap(state->cq_ring, state->cq_ring_size);
+    if (state->sq_ring != NULL && state->sq_ring != MAP_FAILED)
+        munmap(state->sq_ring, state->sq_ring_size);
+    if (state->ringfd != -1)
+        close(state->ringfd);
+}
+
+static int aeIOUringSetup(aeIOUringState *state, int setsize)
+{
+    struct io_uring_params p;
+    unsigned cq_entries = (unsigned) setsize * 2;
+    unsigned j;
+    char *sq;
+    char *cq;
+
+    if (cq_entries > AE_IOURING_MAX_CQ_ENTRIES)
+        cq_entries = AE_IOURING_MAX_CQ_ENTRIES;
+    if (cq_entries < AE_IOURING_SQ_ENTRIES * 2)
+        cq_entries = AE_IOURING_SQ_ENTRIES * 2;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+#ifdef IORING_SETUP_COOP_TASKRUN
+    /* Completions are only reaped in io_uring_enter() anyway, no need for
+     * the kernel to interrupt the loop thread to run them (5.19+). */
+    p.flags |= IORING_SETUP_COOP_TASKRUN;
+#ifdef IORING_SETUP_TASKRUN_FLAG
+    p.flags |= IORING_SETUP_TASKRUN_FLAG;
+#endif
+#endif
+    p.cq_entries = cq_entries;
+    state->ringfd = syscall(__NR_io_uring_setup, AE_IOURING_SQ_ENTRIES, &p);
+#ifdef IORING_SETUP_COOP_TASKRUN
+    if (state->ringfd < 0 && errno == EINVAL)
+    {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+        state->ringfd = syscall(__NR_io_uring_setup, AE_IOURING_SQ_ENTRIES, &p);
+    }
+#endif
+    if (state->ringfd < 0)
+    {
+        state->ringfd = -1;
+        return -1;
+    }
+    /* Timed waits need EXT_ARG, and fired events must never be dropped. */
+    if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP))
+        return -1;
+
+    state->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    state->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (state->cq_ring_size > state->sq_ring_size)
+            state->sq_ring_size = state->cq_ring_size;
+        state->cq_ring_size = state->sq_ring_size;
+    }
+    state->sq_ring = mmap(NULL, state->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            state->ringfd, IORING_OFF_SQ_RING);
+    if (state->sq_ring == MAP_FAILED)
+        return -1;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        state->cq_ring = state->sq_ring;
+    }
+    else
+    {
+        state->cq_ring = mmap(NULL, state->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                state->ringfd, IORING_OFF_CQ_RING);
+        if (state->cq_ring == MAP_FAILED)
+            return -1;
+    }
+    state->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL, state->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, state->ringfd,
+            IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED)
+        return -1;
+
+    sq = state->sq_ring;
+    cq = state->cq_ring;
+    state->sq_head = (unsigned *) (sq + p.sq_off.head);
+    state->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    state->sq_flags = (unsigned *) (sq + p.sq_off.flags);
+    state->sq_mask = *(unsigned *) (sq + p.sq_off.ring_mask);
+    state->sq_entries = p.sq_entries;
+    state->sq_local_tail = *state->sq_tail;
+    /* Slots are used in ring order, so the index array is the identity. */
+    for (j = 0; j < p.sq_entries; j++)
+        ((unsigned *) (sq + p.sq_off.array))[j] = j;
+    state->cq_head = (unsigned *) (cq + p.cq_off.head);
+    state->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    state->cq_mask = *(unsigned *) (cq + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void aeIOUringMarkDirty(aeIOUringState *state, int fd)
+{
+    if (!state->fds[fd].dirty)
+    {
+        state->fds[fd].dirty = 1;
+        state->dirty[state->ndirty++] = fd;
+    }
+}
+
+static void aeIOUringMarkReady(aeIOUringState *state, int fd)
+{
+    if (!state->fds[fd].ready)
+    {
+        state->fds[fd].ready = 1;
+        state->ready[state->nready++] = fd;
+    }
+}
+
+/* Give a recv buffer back to the kernel. */
+static void aeIOUringRecycle(aeIOUringState *state, int bid)
+{
+    struct io_uring_buf *buf = &state->br->bufs[state->br_tail & (AE_IOURING_BUF_COUNT - 1)];
+    int j;
+
+    buf->addr = (uint64_t) (uintptr_t) (state->bufs + (size_t) bid * AE_IOURING_BUF_SIZE);
+    buf->len = AE_IOURING_BUF_SIZE;
+    buf->bid = bid;
+    state->br_tail++;
+    __atomic_store_n(&state->br->tail, state->br_tail, __ATOMIC_RELEASE);
+    if (state->nobufs)
+    {
+        /* the starved fds get their recv back */
+        state->nobufs = 0;
+        for (j = 0; j < state->nstarved; j++)
+        {
+            state->fds[state->starved[j]].starved = 0;
+            aeIOUringMarkDirty(state, state->starved[j]);
+        }
+        state->nstarved = 0;
+    }
+}
+
+/* Register the provided recv buffers, completion mode stays unavailable if
+ * the kernel does not take them (older than 5.19). */
+static void aeIOUringSetupBuffers(aeIOUringState *state)
+{
+    struct io_uring_buf_reg reg;
+    size_t br_size = AE_IOURING_BUF_COUNT * sizeof(struct io_uring_buf);
+    void *br;
+    void *bufs;
+    int j;
+
+    br = mmap(NULL, br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED)
+        return;
+    bufs = mmap(NULL, (size_t) AE_IOURING_BUF_COUNT * AE_IOURING_BUF_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs == MAP_FAILED)
+    {
+        munmap(br, br_size);
+        return;
+    }
+    state->bufinfo = zmalloc(sizeof(aeIOUringBuf) * AE_IOURING_BUF_COUNT);
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) br;
+    reg.ring_entries = AE_IOURING_BUF_COUNT;
+    reg.bgid = 0;
+    if (state->bufinfo == NULL || syscall(__NR_io_uring_register, state->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        zfree(state->bufinfo);
+        state->bufinfo = NULL;
+        munmap(bufs, (size_t) AE_IOURING_BUF_COUNT * AE_IOURING_BUF_SIZE);
+        munmap(br, br_size);
+        return;
+    }
+    state->br = br;
+    state->bufs = bufs;
+    state->br_tail = 0;
+    for (j = 0; j < AE_IOURING_BUF_COUNT; j++)
+        aeIOUringRecycle(state, j);
+}
+
+static void aeIOUringFree(aeIOUringState *state)
+{
+    int j;
+
+    aeIOUringUnmap(state);
+    if (state->br != NULL)
+    {
+        munmap(state->bufs, (size_t) AE_IOURING_BUF_COUNT * AE_IOURING_BUF_SIZE);
+        munmap(state->br, AE_IOURING_BUF_COUNT * sizeof(struct io_uring_buf));
+    }
+    if (state->fds != NULL)
+    {
+        for (j = 0; j < state->setsize; j++)
+        {
+            zfree(state->fds[j].send);
+            zfree(state->fds[j].pend);
+        }
+    }
+    while (state->orphans != NULL)
+    {
+        aeIOUringOrphan *orphan = state->orphans;
+
+        state->orphans = orphan->next;
+        zfree(orphan->buf);
+        zfree(orphan);
+    }
+    zfree(state->bufinfo);
+    zfree(state->fds);
+    zfree(state->dirty);
+    zfree(state->ready);
+    zfree(state->starved);
+    zfree(state);
+}
+
+static int aeIOUringApiCreate(aeEventLoop *eventLoop)
+{
+    aeIOUringState *state = zmalloc(sizeof(aeIOUringState));
+    int j;
+
+    if (!state) return -1;
+    memset(state, 0, sizeof(aeIOUringState));
+    state->ringfd = -1;
+    state->setsize = eventLoop->setsize;
+    state->fds = zmalloc(sizeof(aeIOUringFd) * eventLoop->setsize);
+    state->dirty = zmalloc(sizeof(int) * eventLoop->setsize);
+    state->ready = zmalloc(sizeof(int) * eventLoop->setsize);
+    state->starved = zmalloc(sizeof(int) * eventLoop->setsize);
+    if (state->fds)
+        memset(state->fds, 0, sizeof(aeIOUringFd) * eventLoop->setsize);
+    if (!state->fds || !state->dirty || !state->ready || !state->starved
+            || aeIOUringSetup(state, eventLoop->setsize) == -1)
+    {
+        aeIOUringFree(state);
+        return -1;
+    }
+    for (j = 0; j < eventLoop->setsize; j++)
+        state->fds[j].head = state->fds[j].tail = -1;
+    aeIOUringSetupBuffers(state);
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static void aeIOUringApiFree(aeEventLoop *eventLoop)
+{
+    aeIOUringFree(eventLoop->apidata);
+}
+
+/* Submit the published requests, optionally waiting for a completion. */
+static int aeIOUringEnter(aeIOUringState *state, unsigned min_complete, struct timeval *tvp)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags = 0;
+    void *argp = NULL;
+    size_t argsz = 0;
+    int ret;
+
+    __atomic_store_n(state->sq_tail, state->sq_local_tail, __ATOMIC_RELEASE);
+    if (min_complete > 0 || (__atomic_load_n(state->sq_flags, __ATOMIC_RELAXED) & AE_IOURING_SQ_GETEVENTS))
+        flags |= IORING_ENTER_GETEVENTS;
+    if (min_complete > 0 && tvp != NULL)
+    {
+        memset(&arg, 0, sizeof(arg));
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec * 1000;
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+    ret = syscall(__NR_io_uring_enter, state->ringfd, state->sq_pending, min_complete, flags, argp, argsz);
+    if (ret < 0)
+    {
+        if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            return 0;
+        return -1;
+    }
+    state->sq_pending -= (unsigned) ret > state->sq_pending ? state->sq_pending : (unsigned) ret;
+    return 0;
+}
+
+static struct io_uring_sqe *aeIOUringGetSqe(aeIOUringState *state)
+{
+    struct io_uring_sqe *sqe;
+
+    if (state->sq_local_tail - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE) >= state->sq_entries)
+    {
+        /* Ring is full, push what we have to the kernel first. */
+        aeIOUringEnter(state, 0, NULL);
+        if (state->sq_local_tail - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE) >= state->sq_entries)
+            return NULL;
+    }
+    sqe = &state->sqes[state->sq_local_tail & state->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    state->sq_local_tail++;
+    state->sq_pending++;
+    return sqe;
+}
+
+static size_t aeIOUringUnsent(aeIOUringFd *f)
+{
+    return f->send_len - f->send_off + f->pend_len;
+}
+
+/* Events the fd has to report, before masking with the wanted ones. */
+static int aeIOUringReadyMask(aeIOUringFd *f)
+{
+    int mask = f->fired;
+
+    if (f->nqueued > 0 || f->eof || f->err)
+        mask |= AE_READABLE;
+    if (f->err)
+        mask |= AE_WRITABLE;
+    else if (aeIOUringUnsent(f) > 0)
+        mask &= ~AE_WRITABLE;
+    else if (f->completion)
+        mask |= AE_WRITABLE;
+    return mask;
+}
+
+/* Events a poll request has to be armed for. */
+static int aeIOUringPollMask(aeIOUringFd *f)
+{
+    if (f->completion)
+        return f->starved ? (f->wanted & AE_READABLE) : AE_NONE;
+    /* Writable is reported once the bytes queued by aeWritev() are sent. */
+    if (aeIOUringUnsent(f) > 0)
+        return f->wanted & ~AE_WRITABLE;
+    return f->wanted;
+}
+
+static void aeIOUringArm(aeIOUringState *state, int fd, int mask)
+{
+    aeIOUringFd *f = &state->fds[fd];
+    struct io_uring_sqe *sqe = aeIOUringGetSqe(state);
+    uint32_t events = 0;
+
+    if (sqe == NULL)
+        return;
+    if (mask & AE_READABLE)
+        events |= POLLIN;
+    if (mask & AE_WRITABLE)
+        events |= POLLOUT;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16);
+#endif
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = aeIOUringData(AE_IOURING_POLL, fd, f->gen);
+    f->armed = mask;
+}
+
+static void aeIOUringDisarm(aeIOUringState *state, int fd)
+{
+    aeIOUringFd *f = &state->fds[fd];
+    struct io_uring_sqe *sqe = aeIOUringGetSqe(state);
+
+    if (sqe != NULL)
+    {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = aeIOUringData(AE_IOURING_POLL, fd, f->gen);
+        sqe->user_data = AE_IOURING_IGNORE;
+    }
+    f->armed = AE_NONE;
+    f->gen++;
+}
+
+static void aeIOUringArmRecv(aeIOUringState *state, int fd)
+{
+    aeIOUringFd *f = &state->fds[fd];
+    struct io_uring_sqe *sqe = aeIOUringGetSqe(state);
+
+    if (sqe == NULL)
+        return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = aeIOUringData(AE_IOURING_RECV, fd, f->life);
+    f->recv_armed = 1;
+    f->recv_cancel = 0;
+}
+
+static void aeIOUringCancelRecv(aeIOUringState *state, int fd)
+{
+    aeIOUringFd *f = &state->fds[fd];
+    struct io_uring_sqe *sqe = aeIOUringGetSqe(state);
+
+    if (sqe == NULL)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = aeIOUringData(AE_IOURING_RECV, fd, f->life);
+    sqe->user_data = AE_IOURING_IGNORE;
+    f->recv_cancel = 1;
+}
+
+static void aeIOUringSubmitSend(aeIOUringState *state, int fd)
+{
+    aeIOUringFd *f = &state->fds[fd];
+    struct io_uring_sqe *sqe = aeIOUringGetSqe(state);
+
+    if (sqe == NULL)
+        return;
+    if (f->send_off == f->send_len)
+    {
+        /* everything in flight was sent, the pending bytes go next */
+        char *buf = f->send;
+        size_t cap = f->send_cap;
+
+        f->send = f->pend;
+        f->send_cap = f->pend_cap;
+        f->send_len = f->pend_len;
+        f->send_off = 0;
+        f->pend = buf;
+        f->pend_cap = cap;
+        f->pend_len = 0;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) (f->send + f->send_off);
+    sqe->len = f->send_len - f->send_off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = aeIOUringData(AE_IOURING_SEND, fd, f->life);
+    f->send_inflight = 1;
+}
+
+/* Turn the recorded changes of an fd into requests.  A poll request armed
+ * for more events than wanted is left alone: when it fires for an unwanted
+ * event only, it is simply re-armed with the current mask. */
+static void aeIOUringFlushFd(aeIOUringState *state, int fd)
+{
+    aeIOUringFd *f = &state->fds[fd];
+    int poll;
+
+    f->dirty = 0;
+    if (f->completion && (f->wanted & AE_READABLE) && !f->eof && !f->err
+            && f->nqueued < AE_IOURING_MAX_QUEUED_BUFS)
+    {
+        if (f->recv_armed)
+        {
+            /* a cancelled recv is re-armed once its last completion is in */
+        }
+        else if (state->nobufs)
+        {
+            if (!f->starved)
+            {
+                f->starved = 1;
+                state->starved[state->nstarved++] = fd;
+            }
+        }
+        else
+        {
+            aeIOUringArmRecv(state, fd);
+        }
+    }
+    else if (f->recv_armed && !f->recv_cancel)
+    {
+        aeIOUringCancelRecv(state, fd);
+    }
+    if (!f->send_inflight && !f->err && aeIOUringUnsent(f) > 0)
+        aeIOUringSubmitSend(state, fd);
+
+    poll = aeIOUringPollMask(f);
+    if (f->armed != AE_NONE && (poll == AE_NONE || (poll & ~f->armed)))
+        aeIOUringDisarm(state, fd);
+    if (poll != AE_NONE && f->armed == AE_NONE)
+        aeIOUringArm(state, fd, poll);
+    if (aeIOUringReadyMask(f) & f->wanted)
+        aeIOUringMarkReady(state, fd);
+}
+
+static void aeIOUringFlushDirty(aeIOUringState *state)
+{
+    int j;
+
+    for (j = 0; j < state->ndirty; j++)
+        aeIOUringFlushFd(state, state->dirty[j]);
+    state->ndirty = 0;
+}
+
+static int aeIOUringApiAddEvent(aeEventLoop *eventLoop, int fd, int mask)
+{
+    aeIOUringState *state = eventLoop->apidata;
+    aeIOUringFd *f = &state->fds[fd];
+
+    mask |= f->wanted;
+    if (mask == f->wanted)
+        return 0;
+    f->wanted = mask;
+    aeIOUringMarkDirty(state, fd);
+    return 0;
+}
+
+static void aeIOUringApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask)
+{
+    aeIOUringState *state = eventLoop->apidata;
+    aeIOUringFd *f = &state->fds[fd];
+
+    f->wanted &= ~delmask;
+    /* Drop the poll request right away, the fd is probably about to be
+     * closed and its number reused by the next accept. */
+    if (f->wanted == AE_NONE && f->armed != AE_NONE)
+        aeIOUringDisarm(state, fd);
+    aeIOUringMarkDirty(state, fd);
+}
+
+static void aeIOUringPollDone(aeIOUringState *state, int fd, uint32_t gen, int res)
+{
+    aeIOUringFd *f = &state->fds[fd];
+
+    if (gen != f->gen || f->armed == AE_NONE)
+        return;
+    /* One-shot request completed, re-armed by the next flush. */
+    f->armed = AE_NONE;
+    f->gen++;
+    aeIOUringMarkDirty(state, fd);
+    if (res == -ECANCELED)
+        return;
+    if (res < 0 || (res & (POLLHUP | POLLERR)))
+    {
+        f->fired |= AE_READABLE | AE_WRITABLE;
+    }
+    else
+    {
+        if (res & POLLIN)
+            f->fired |= AE_READABLE;
+        if (res & POLLOUT)
+            f->fired |= AE_WRITABLE;
+    }
+    aeIOUringMarkReady(state, fd);
+}
+
+static void aeIOUringRecvDone(aeIOUringState *state, int fd, uint32_t life, int res, unsigned flags)
+{
+    aeIOUringFd *f = &state->fds[fd];
+    int bid = (flags & IORING_CQE_F_BUFFER) ? (int) (flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+    if (life != f->life)
+    {
+        if (bid >= 0)
+            aeIOUringRecycle(state, bid);
+        return;
+    }
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        f->recv_armed = 0;
+        f->recv_cancel = 0;
+        aeIOUringMarkDirty(state, fd);
+    }
+    if (res > 0 && bid >= 0)
+    {
+        aeIOUringBuf *buf = &state->bufinfo[bid];
+
+        buf->next = -1;
+        buf->len = res;
+        buf->off = 0;
+        if (f->tail == -1)
+            f->head = bid;
+        else
+            state->bufinfo[f->tail].next = bid;
+        f->tail = bid;
+        f->queued += res;
+        if (++f->nqueued >= AE_IOURING_MAX_QUEUED_BUFS)
+            aeIOUringMarkDirty(state, fd);
+    }
+    else
+    {
+        if (bid >= 0)
+            aeIOUringRecycle(state, bid);
+        if (res == 0)
+            f->eof = 1;
+        else if (res == -ENOBUFS)
+            state->nobufs = 1;
+        else if (res == -EINVAL || res == -EOPNOTSUPP)
+        {
+            /* no multishot recv before Linux 6.0, the fd is polled instead */
+            state->no_multishot = 1;
+            f->completion = 0;
+        }
+        else if (res != -ECANCELED)
+            f->err = -res;
+    }
+    aeIOUringMarkReady(state, fd);
+}
+
+static void aeIOUringSendDone(aeIOUringState *state, uint64_t data, int fd, uint32_t life, int res)
+{
+    aeIOUringFd *f = &state->fds[fd];
+
+    if (life != f->life || !f->send_inflight)
+    {
+        aeIOUringOrphan **link = &state->orphans;
+
+        while (*link != NULL)
+        {
+            aeIOUringOrphan *orphan = *link;
+
+            if (orphan->data == data)
+            {
+                *link = orphan->next;
+                zfree(orphan->buf);
+                zfree(orphan);
+                break;
+            }
+            link = &orphan->next;
+        }
+        return;
+    }
+    f->send_inflight = 0;
+    if (res < 0)
+    {
+        /* the connection is broken, the bytes not sent yet are dropped */
+        f->err = -res;
+        f->send_off = f->send_len = 0;
+        f->pend_len = 0;
+    }
+    else
+    {
+        f->send_off += res;
+    }
+    if (f->send_off == f->send_len)
+    {
+        f->send_off = f->send_len = 0;
+        if (f->pend_len == 0 && f->send_cap > AE_IOURING_SEND_KEEP)
+        {
+            zfree(f->send);
+            f->send = NULL;
+            f->send_cap = 0;
+        }
+    }
+    aeIOUringMarkDirty(state, fd);
+    aeIOUringMarkReady(state, fd);
+}
+
+static void aeIOUringReap(aeIOUringState *state)
+{
+    unsigned head = *state->cq_head;
+    unsigned tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &state->cqes[head & state->cq_mask];
+        uint64_t data = cqe->user_data;
+        int fd = (int) ((uint32_t) data >> 2);
+        uint32_t gen = (uint32_t) (data >> 32);
+
+        head++;
+        if (fd >= state->setsize)
+            continue;
+        switch (data & 3)
+        {
+            case AE_IOURING_POLL:
+                aeIOUringPollDone(state, fd, gen, cqe->res);
+                break;
+            case AE_IOURING_RECV:
+                aeIOUringRecvDone(state, fd, gen, cqe->res, cqe->flags);
+                break;
+            case AE_IOURING_SEND:
+                aeIOUringSendDone(state, data, fd, gen, cqe->res);
+                break;
+            default:
+                break;
+        }
+    }
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int aeIOUringApiPoll(aeEventLoop *eventLoop, struct timeval *tvp)
+{
+    aeIOUringState *state = eventLoop->apidata;
+    int numevents = 0;
+    int j, kept;
+
+    aeIOUringFlushDirty(state);
+    /* Fds still holding received bytes, or free to write, are reported
+     * again like a level triggered poll would, so the loop must not block. */
+    for (j = 0, kept = 0; j < state->nready; j++)
+    {
+        int fd = state->ready[j];
+        aeIOUringFd *f = &state->fds[fd];
+
+        if (aeIOUringReadyMask(f) & f->wanted)
+        {
+            state->ready[kept++] = fd;
+        }
+        else
+        {
+            f->ready = 0;
+            f->fired = AE_NONE;
+        }
+    }
+    state->nready = kept;
+    if (state->nready == 0 && *state->cq_head == __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE)
+            && (tvp == NULL || tvp->tv_sec > 0 || tvp->tv_usec > 0))
+    {
+        aeIOUringEnter(state, 1, tvp);
+    }
+    else if (state->sq_pending > 0 || (__atomic_load_n(state->sq_flags, __ATOMIC_RELAXED) & AE_IOURING_SQ_GETEVENTS))
+    {
+        aeIOUringEnter(state, 0, NULL);
+    }
+    aeIOUringReap(state);
+
+    for (j = 0; j < state->nready; j++)
+    {
+        int fd = state->ready[j];
+        aeIOUringFd *f = &state->fds[fd];
+        int mask = aeIOUringReadyMask(f) & f->wanted;
+
+        f->fired = AE_NONE;
+        if (mask == AE_NONE)
+            continue;
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    return numevents;
+}
+
+static int aeIOUringSetCompletion(aeEventLoop *eventLoop, int fd, int completion)
+{
+    aeIOUringState *state = eventLoop->apidata;
+    aeIOUringFd *f = &state->fds[fd];
+
+    if (completion && (state->br == NULL || state->no_multishot))
+        return AE_ERR;
+    if (f->completion != completion)
+    {
+        f->completion = completion;
+        aeIOUringMarkDirty(state, fd);
+    }
+    return AE_OK;
+}
+
+static long long aeIOUringMillis(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Leave completion mode and wait for the recv to be cancelled and the
+ * queued bytes to be sent, before the fd is handed to another loop.  The
+ * received bytes can still be read with aeRead(). */
+static int aeIOUringDrain(aeEventLoop *eventLoop, int fd, long long milliseconds)
+{
+    aeIOUringState *state = eventLoop->apidata;
+    aeIOUringFd *f = &state->fds[fd];
+    long long deadline = aeIOUringMillis() + milliseconds;
+
+    f->completion = 0;
+    aeIOUringMarkDirty(state, fd);
+    for (;;)
+    {
+        struct timeval tv;
+
+        aeIOUringFlushDirty(state);
+        if (!f->recv_armed && !f->send_inflight && aeIOUringUnsent(f) == 0)
+            return AE_OK;
+        if (aeIOUringMillis() >= deadline)
+            return AE_ERR;
+        tv.tv_sec = 0;
+        tv.tv_usec = 10000;
+        aeIOUringEnter(state, 1, &tv);
+        aeIOUringReap(state);
+    }
+}
+
+/* The fd is about to be closed or handed over: cancel its requests and
+ * drop what it still holds. */
+static void aeIOUringForget(aeEventLoop *eventLoop, int fd)
+{
+    aeIOUringState *state = eventLoop->apidata;
+    aeIOUringFd *f = &state->fds[fd];
+
+    if (f->recv_armed || f->send_inflight)
+    {
+        struct io_uring_sqe *sqe = aeIOUringGetSqe(state);
+
+        if (sqe != NULL)
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = AE_IOURING_IGNORE;
+        }
+        if (f->send_inflight)
+        {
+            aeIOUringOrphan *orphan = zmalloc(sizeof(aeIOUringOrphan));
+
+            orphan->data = aeIOUringData(AE_IOURING_SEND, fd, f->life);
+            orphan->buf = f->send;
+            orphan->next = state->orphans;
+            state->orphans = orphan;
+            f->send = NULL;
+            f->send_cap = 0;
+        }
+        /* Submit right away, the requests hold the socket open and its fd
+         * number may be reused once closed. */
+        aeIOUringEnter(state, 0, NULL);
+    }
+    while (f->head != -1)
+    {
+        int bid = f->head;
+
+        f->head = state->bufinfo[bid].next;
+        aeIOUringRecycle(state, bid);
+    }
+    zfree(f->send);
+    zfree(f->pend);
+    f->send = f->pend = NULL;
+    f->send_len = f->send_off = f->send_cap = 0;
+    f->pend_len = f->pend_cap = 0;
+    f->send_inflight = 0;
+    f->completion = 0;
+    f->recv_armed = f->recv_cancel = 0;
+    f->eof = f->err = 0;
+    f->tail = -1;
+    f->nqueued = 0;
+    f->queued = 0;
+    f->life++;
+}
+
+static ssize_t aeIOUringRead(aeEventLoop *eventLoop, int fd, void *buf, size_t len)
+{
+    aeIOUringState *state = eventLoop->apidata;
+    aeIOUringFd *f = &state->fds[fd];
+    size_t n = 0;
+
+    if (f->nqueued == 0)
+    {
+        if (f->err)
+        {
+            errno = f->err;
+            return -1;
+        }
+        if (f->eof)
+            return 0;
+        if (!f->recv_armed && (!f->completion || f->starved))
+            return read(fd, buf, len);
+        errno = EAGAIN;
+        return -1;
+    }
+    while (n < len && f->head != -1)
+    {
+        int bid = f->head;
+        aeIOUringBuf *b = &state->bufinfo[bid];
+        size_t c = b->len - b->off;
+
+        if (c > len - n)
+            c = len - n;
+        memcpy((char *) buf + n, state->bufs + (size_t) bid * AE_IOURING_BUF_SIZE + b->off, c);
+        n += c;
+        b->off += c;
+        f->queued -= c;
+        if (b->off == b->len)
+        {
+            f->head = b->next;
+            if (f->head == -1)
+                f->tail = -1;
+            f->nqueued--;
+            aeIOUringRecycle(state, bid);
+        }
+    }
+    if (f->completion && !f->recv_armed)
+        aeIOUringMarkDirty(state, fd);
+    return n;
+}
+
+static ssize_t aeIOUringWritev(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt)
+{
+    aeIOUringState *state = eventLoop->apidata;
+    aeIOUringFd *f = &state->fds[fd];
+    size_t unsent = aeIOUringUnsent(f);
+    size_t room, n = 0;
+    int j;
+
+    if (f->err)
+    {
+        errno = f->err;
+        return -1;
+    }
+    if (!f->completion && unsent == 0)
+        return writev(fd, iov, iovcnt);
+    room = unsent < AE_IOURING_SEND_LIMIT ? AE_IOURING_SEND_LIMIT - unsent : 0;
+    if (room == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    for (j = 0; j < iovcnt; j++)
+        n += iov[j].iov_len;
+    if (n > room)
+        n = room;
+    if (f->pend_len + n > f->pend_cap)
+    {
+        size_t cap = f->pend_cap * 2 > f->pend_len + n ? f->pend_cap * 2 : f->pend_len + n;
+        char *pend = zrealloc(f->pend, cap);
+
+        if (pend == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        f->pend = pend;
+        f->pend_cap = cap;
+    }
+    room = n;
+    for (j = 0; j < iovcnt && room > 0; j++)
+    {
+        size_t c = iov[j].iov_len < room ? iov[j].iov_len : room;
+
+        memcpy(f->pend + f->pend_len, iov[j].iov_base, c);
+        f->pend_len += c;
+        room -= c;
+    }
+    aeIOUringMarkDirty(state, fd);
+    return n;
+}
+
+static size_t aeIOUringPending(aeEventLoop *eventLoop, int fd, int mask)
+{
+    aeIOUringState *state = eventLoop->apidata;
+    aeIOUringFd *f = &state->fds[fd];
+
+    return mask == AE_READABLE ? f->queued : aeIOUringUnsent(f);
+}
+
+static char *aeIOUringApiName(void)
+{
+    return "io_uring";
+}
@@ -31,15 +31,27 @@
 #include "util/helpers.hpp"
 #include <errno.h>
 #include <string.h>
+#include <algorithm>
 using namespace comms;
 
 SoftSignalChannel::SoftSignalChannel(ChannelService& factory) :
-        PipeChannel(factory, -1, -1), m_thread_safe(true)
+        PipeChannel(factory, -1, -1), m_thread_safe(true), m_signalled(0)
 {
 }
 
 bool SoftSignalChannel::DoOpen()
 {
+#ifdef HAVE_EVENTFD
+    if (-1 == m_read_fd)
+    {
+        /* read & written through the same fd, see FireSoftSignal */
+        m_read_fd = eventfd(0, EFD_NONBLOCK);
+        if (-1 == m_read_fd)
+        {
+            WARN_LOG("Failed to create eventfd for soft signal channel:%s", strerror(errno));
+        }
+    }
+#endif
     if (!PipeChannel::DoOpen())
     {
         return false;
@@ -51,10 +63,23 @@ bool SoftSignalChannel::DoOpen()
 
 void SoftSignalChannel::MessageReceived(ChannelHandlerContext& ctx, MessageEvent<uint64>& e)
 {
-    uint64 v = *(e.GetMessage());
-    uint32 signo = v & 0xFFFFFFFF;
-    uint32 info = ((v >> 32) & 0xFFFFFFFF);
-    FireSignalReceived(signo, info);
+    /*
+     * The message is only the wakeup(eventfd counter), the signals are in the queue.
+     * Clear the flag before taking the queue, a signal queued after this point
+     * wakes the loop again.
+     */
+    atomic_cmp_set_uint32(&m_signalled, 1, 0);
+    m_lock.Lock();
+    m_firing_signals.swap(m_pending_signals);
+    m_lock.Unlock();
+    for (size_t i = 0; i < m_firing_signals.size(); i++)
+    {
+        uint64 v = m_firing_signals[i];
+        uint32 signo = v & 0xFFFFFFFF;
+        uint32 info = ((v >> 32) & 0xFFFFFFFF);
+        FireSignalReceived(signo, info);
+    }
+    m_firing_signals.clear();
 }
 
 void SoftSignalChannel::FireSignalReceived(uint32 signo, uint32 append_info)
@@ -94,7 +119,20 @@ int SoftSignalChannel::FireSoftSignal(uint32 signo, uint32 info)
 //    {
 //        m_lock.Unlock();
 //    }
-    int ret = ::write(GetWriteFD(), &v, sizeof(v));
+    m_lock.Lock();
+    if (std::find(m_pending_signals.begin(), m_pending_signals.end(), v) == m_pending_signals.end())
+    {
+        m_pending_signals.push_back(v);
+    }
+    m_lock.Unlock();
+    if (!atomic_cmp_set_uint32(&m_signalled, 0, 1))
+    {
+        /* the loop is already woken and has not drained the queue yet */
+        return sizeof(v);
+    }
+    uint64 wakeup = 1;
+    int fd = -1 != GetWriteFD() ? GetWriteFD() : GetReadFD();
+    int ret = ::write(fd, &wakeup, sizeof(wakeup));
     return ret;
 }
 
@@ -32,6 +32,7 @@
 #include "channel/fifo/fifo_channel.hpp"
 #include "channel/codec/int_frame_decoder.hpp"
 #include "thread/spin_mutex_lock.hpp"
+#include "util/atomic.hpp"
 #include <vector>
 #include <string>
 
@@ -46,14 +47,24 @@ namespace comms
 			}
 	};
 
+	/*
+	 * Signals fired from any thread are queued and the loop is woken through an
+	 * eventfd(a pipe if eventfd is not available). The fd is only written by the
+	 * producer which sets 'm_signalled', so a burst of signals costs one wakeup,
+	 * and identical signals queued before the loop drains them are delivered once.
+	 */
 	class SoftSignalChannel: public PipeChannel, public ChannelUpstreamHandler<uint64>
 	{
 		private:
 			typedef TreeMap<uint32, std::vector<SoftSignalHandler*> >::Type SignalHandlerMap;
+			typedef std::vector<uint64> SignalQueue;
 			SignalHandlerMap m_hander_map;
 			comms::codec::UInt64FrameDecoder m_decoder;
 			bool m_thread_safe;
 			SpinMutexLock m_lock;
+			SignalQueue m_pending_signals;
+			SignalQueue m_firing_signals;
+			volatile uint32_t m_signalled;
 
 			SoftSignalChannel(ChannelService& factory);
 			bool DoOpen();
@@ -37,8 +37,12 @@
 
 using namespace comms;
 
+/* Bound the accepts done in one read event so a reconnect storm can not starve the loop. */
+static const int kMaxAcceptsPerCall = 1000;
+
 ServerSocketChannel::ServerSocketChannel(ChannelService& factory) :
-        SocketChannel(factory), m_connected_socks(0), m_pool_min(0), m_pool_max(0)
+        SocketChannel(factory), m_connected_socks(0), m_pool_min(0), m_pool_max(0), m_reuse_port(false), m_listening(
+                false), m_reuse_port_holder(NULL), m_reuse_port_listeners(0)
 {
 }
 
@@ -129,6 +133,16 @@ bool ServerSocketChannel::DoBind(Address* local)
             WARN_LOG("Failed to set SO_REUSEADDR for socket.");
         }
     }
+    if (m_reuse_port)
+    {
+#ifdef SO_REUSEPORT
+        if (addr.IsUnix() || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) != 0)
+#endif
+        {
+            WARN_LOG("SO_REUSEPORT is not available for %s, accept on a single listener.", m_adress_str.c_str());
+            m_reuse_port = false;
+        }
+    }
     //setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void*) &on, sizeof(on));
     if (::bind(fd, (struct sockaddr*) &(addr.GetRawSockAddr()), addr.GetRawSockAddrSize()) == -1)
     {
@@ -137,22 +151,128 @@ bool ServerSocketChannel::DoBind(Address* local)
         ::close(fd);
         return false;
     }
-    if (::listen(fd, 511) == -1)
+    m_fd = fd;
+    m_bind_address = addr;
+    if (IsReusePortHolder())
+    {
+        /*
+         * A bound but not listening socket is not part of the SO_REUSEPORT group,
+         * the worker listeners are opened once the thread pool starts.
+         */
+        return true;
+    }
+    return Listen();
+}
+
+bool ServerSocketChannel::Listen()
+{
+    if (::listen(m_fd, 511) == -1)
     { /* the magic 511 constant is from nginx */
         int e = errno;
         ERROR_LOG("Failed to listen for reason:%s", strerror(e));
-        ::close(fd);
+        ::close(m_fd);
+        m_fd = -1;
         return false;
     }
-    if (aeCreateFileEvent(GetService().GetRawEventLoop(), fd, AE_READABLE, Channel::IOEventCallback, this) == AE_ERR)
+    if (aeCreateFileEvent(GetService().GetRawEventLoop(), m_fd, AE_READABLE, Channel::IOEventCallback, this) == AE_ERR)
     {
-        ::close(fd);
+        ::close(m_fd);
+        m_fd = -1;
         return false;
     }
-    m_fd = fd;
+    m_listening = true;
     return true;
 }
 
+void ServerSocketChannel::SetReusePort(bool on)
+{
+    m_reuse_port = on;
+}
+
+bool ServerSocketChannel::IsReusePortHolder()
+{
+    return m_reuse_port && NULL == m_reuse_port_holder && !m_listening;
+}
+
+/*
+ * Same range GetIdlestChannelService() picks accepted channels from.
+ */
+bool ServerSocketChannel::ServesPoolIndex(uint32 idx, uint32 pool_size)
+{
+    if (0 == pool_size)
+    {
+        return false;
+    }
+    uint32 min = m_pool_min;
+    uint32 max = m_pool_max;
+    if (max >= pool_size)
+    {
+        max = pool_size;
+    }
+    if (min >= pool_size)
+    {
+        min = pool_size - 1;
+    }
+    if (min == max)
+    {
+        max = min + 1;
+    }
+    return idx >= min && idx < max;
+}
+
+/*
+ * Called before the worker threads are launched, so the worker services can be
+ * touched from this thread.
+ */
+void ServerSocketChannel::OpenReusePortListeners(const std::vector<ChannelService*>& pool)
+{
+    if (!IsReusePortHolder())
+    {
+        return;
+    }
+    for (uint32 i = 0; i < pool.size(); i++)
+    {
+        if (!ServesPoolIndex(i, pool.size()))
+        {
+            continue;
+        }
+        ChannelService& serv = *(pool[i]);
+        ServerSocketChannel* listener = serv.NewServerSocketChannel();
+        listener->m_reuse_port = true;
+        listener->m_reuse_port_holder = this;
+        if (!listener->Bind(&m_bind_address))
+        {
+            ERROR_LOG("Failed to open SO_REUSEPORT listener on %s for worker:%u", m_adress_str.c_str(), i);
+            serv.DeleteChannel(listener);
+            continue;
+        }
+        listener->m_adress_str = m_adress_str;
+        if (m_user_configed)
+        {
+            listener->Configure(m_options);
+        }
+        if (NULL != m_pipeline_initializor)
+        {
+            listener->SetChannelPipelineInitializor(m_pipeline_initializor, m_pipeline_initailizor_user_data);
+        }
+        if (NULL != m_pipeline_finallizer)
+        {
+            listener->SetChannelPipelineFinalizer(m_pipeline_finallizer, m_pipeline_finallizer_user_data);
+        }
+        m_reuse_port_listeners++;
+    }
+    if (0 == m_reuse_port_listeners)
+    {
+        WARN_LOG("No SO_REUSEPORT listener opened on %s, accept on a single listener.", m_adress_str.c_str());
+        m_reuse_port = false;
+        Listen();
+    }
+    else
+    {
+        INFO_LOG("Opened %u SO_REUSEPORT listeners on %s", m_reuse_port_listeners, m_adress_str.c_str());
+    }
+}
+
 uint32 ServerSocketChannel::ConnectedSockets()
 {
     return m_connected_socks;
@@ -176,7 +296,8 @@ void ServerSocketChannel::OnRead()
 {
     int fd;
     char addrbuf[128];
-    while (1)
+    int accepts = 0;
+    while (accepts++ < kMaxAcceptsPerCall)
     {
         socklen_t salen = sizeof(addrbuf);
         struct sockaddr* sa = (struct sockaddr*) addrbuf;
@@ -203,6 +324,12 @@ void ServerSocketChannel::OnRead()
             }
         }
         ClientSocketChannel * ch = GetService().NewClientSocketChannel();
+        if (NULL == ch)
+        {
+            //no channel slot left, refused(counted by the service)
+            ::close(fd);
+            continue;
+        }
 //		if (aeCreateFileEvent(serv.GetRawEventLoop(), fd, AE_READABLE,
 //				Channel::IOEventCallback, ch) == AE_ERR)
 //		{
@@ -241,7 +368,15 @@ void ServerSocketChannel::OnRead()
 //		fire_channel_open(ch);
 //		fire_channel_connected(ch);
         m_connected_socks++;
-        GetService().GetIdlestChannelService(m_pool_min, m_pool_max).AttachAcceptedChannel(ch);
+        if (NULL != m_reuse_port_holder)
+        {
+            /* The kernel already picked this worker, keep the channel on it. */
+            GetService().AttachAcceptedChannel(ch);
+        }
+        else
+        {
+            GetService().GetIdlestChannelService(m_pool_min, m_pool_max).AttachAcceptedChannel(ch);
+        }
     }
 
 }
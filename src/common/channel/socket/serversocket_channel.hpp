@@ -32,6 +32,8 @@
 
 #include "channel/socket/socket_channel.hpp"
 #include "util/socket_host_address.hpp"
+#include "util/socket_inet_address.hpp"
+#include <vector>
 
 namespace comms
 {
@@ -43,6 +45,19 @@ namespace comms
 			uint32 m_pool_min;
 			uint32 m_pool_max;
 			std::string m_adress_str;
+			SocketInetAddress m_bind_address;
+			bool m_reuse_port;
+			bool m_listening;
+			/*
+			 * Set on the per-worker SO_REUSEPORT listeners, the channel created
+			 * by the user only holds the bound address and does not listen.
+			 */
+			ServerSocketChannel* m_reuse_port_holder;
+			uint32 m_reuse_port_listeners;
+			bool Listen();
+			bool IsReusePortHolder();
+			bool ServesPoolIndex(uint32 idx, uint32 pool_size);
+			void OpenReusePortListeners(const std::vector<ChannelService*>& pool);
 			bool DoBind(Address* local);
 			bool DoConnect(Address* remote);
 			bool DoConfigure(const ChannelOptions& options);
@@ -53,6 +68,12 @@ namespace comms
 			ServerSocketChannel(ChannelService& factory);
 			uint32 ConnectedSockets();
 			void BindThreadPool(uint32 min, uint32 max);
+			/*
+			 * Must be called before Bind(). Every worker service of the bound
+			 * thread pool then accepts on its own SO_REUSEPORT listener, and the
+			 * kernel spreads connections across them without a cross-thread handoff.
+			 */
+			void SetReusePort(bool on);
 			const std::string& GetStringAddress()
 			{
 			    return m_adress_str;
@@ -121,6 +121,16 @@ bool SocketChannel::DoConfigure(const ChannelOptions& options)
         }
 #endif
     }
+#ifdef SO_BUSY_POLL
+    if (options.socket_busy_poll && options.busy_poll > 0)
+    {
+        int val = options.busy_poll;
+        if (setsockopt(m_fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) < 0)
+        {
+            WARN_LOG("setsockopt SO_BUSY_POLL: %s", strerror(errno));
+        }
+    }
+#endif
     return true;
 }
 
@@ -385,6 +395,7 @@ void SocketChannel::OnAccepted()
         return;
     }
     m_detached = false;
+    EnableCompletionIO();
     m_state = SOCK_CONNECTED;
     fire_channel_open(this);
     fire_channel_connected(this);
@@ -28,12 +28,34 @@
  */
 
 #include "thread.hpp"
+#include <sched.h>
+#include <string.h>
 
 using namespace comms;
 
+#ifdef __linux__
+static bool fill_cpu_set(const std::vector<int>& cpus, cpu_set_t& set)
+{
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < cpus.size(); i++)
+	{
+		if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+		{
+			CPU_SET(cpus[i], &set);
+		}
+	}
+	return CPU_COUNT(&set) > 0;
+}
+#endif
+
 void* Thread::ThreadFunc(void* data)
 {
 	Thread* thread = (Thread*) data;
+	/* pinned before running, so the memory the thread touches first is node local */
+	if (!thread->m_cpus.empty())
+	{
+		SetCurrentAffinity(thread->m_cpus);
+	}
 	thread->m_state = RUNNING;
 	thread->Run();
 	thread->m_state = TERMINATED;
@@ -87,10 +109,12 @@ void Thread::Start(const ThreadOptions& options)
 		{
 			pthread_attr_setstacksize(&attr, options.max_stack_size);
 		}
+		m_cpus = options.cpus;
 		if (0 != pthread_create(&m_tid, &attr, ThreadFunc, this))
 		{
 			m_state = TERMINATED;
 		}
+		pthread_attr_destroy(&attr);
 
 	}
 }
@@ -100,6 +124,20 @@ void Thread::Sleep(int64_t time, TimeUnit unit)
 	usleep(microstime(time, unit));
 }
 
+bool Thread::SetCurrentAffinity(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	if (!fill_cpu_set(cpus, set))
+	{
+		return false;
+	}
+	return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	return false;
+#endif
+}
+
 pthread_t Thread::CurrentThreadID()
 {
 	return pthread_self();
@@ -48,6 +48,8 @@ namespace comms
 	struct ThreadOptions
 	{
 			size_t max_stack_size;
+			/* cpus the thread may run on, empty means inherit the creator's affinity */
+			std::vector<int> cpus;
 			ThreadOptions() :
 					max_stack_size(8192 * 1024)
 			{
@@ -60,6 +62,7 @@ namespace comms
 			pthread_t m_tid;
 			Runnable* m_target;
 			ThreadState m_state;
+			std::vector<int> m_cpus;
 			static void* ThreadFunc(void* data);
 		public:
 			Thread(Runnable* runner = NULL);
@@ -73,6 +76,7 @@ namespace comms
 				return m_state;
 			}
 			static pthread_t CurrentThreadID();
+			static bool SetCurrentAffinity(const std::vector<int>& cpus);
 			static void Sleep(int64_t time, TimeUnit unit = MILLIS);
 	};
 }
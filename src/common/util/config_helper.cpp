@@ -116,11 +116,16 @@ namespace comms
         {
             return ignore_nonexist;
         }
-        if (string_toint64(found->second[0][0], value))
+        return conf_parse_int64(found->second[0][0], value);
+    }
+
+    bool conf_parse_int64(const std::string& str, int64& value)
+    {
+        if (string_toint64(str, value))
         {
             return true;
         }
-        std::string size_str = string_toupper(found->second[0][0]);
+        std::string size_str = string_toupper(str);
         value = atoll(size_str.c_str());
         if (size_str.find("M") == (size_str.size() - 1) || size_str.find("MB") == (size_str.size() - 2))
         {
@@ -43,6 +43,8 @@ namespace comms
 	bool parse_conf_file(const std::string& path, Properties& result,
 			const char* sep = "=");
 	bool conf_get_int64(const Properties& conf, const std::string& name, int64& value, bool ignore_nonexist = false);
+	/* integer with optional k/kb/m/mb/g/gb suffix */
+	bool conf_parse_int64(const std::string& str, int64& value);
 	bool conf_get_string(const Properties& conf, const std::string& name, std::string& value, bool ignore_nonexist = false);
 	bool conf_get_bool(const Properties& conf, const std::string& name, bool& value, bool ignore_nonexist = false);
 	bool conf_get_double(const Properties& conf, const std::string& name, double& value, bool ignore_nonexist = false);
@@ -72,6 +72,17 @@ namespace comms
         reply.str = v;
     }
 
+    void fill_shared_str_reply(RedisReply& reply, SharedSegment* segment)
+    {
+        reply.type = REDIS_REPLY_STRING;
+        segment->Retain();
+        if (NULL != reply.segment)
+        {
+            reply.segment->Release();
+        }
+        reply.segment = segment;
+    }
+
 //    void fill_value_reply(RedisReply& reply, const Data& v)
 //    {
 //        reply.type = REDIS_REPLY_STRING;
@@ -57,6 +57,10 @@ namespace comms
     void fill_double_reply(RedisReply& reply, long double v);
 
     void fill_str_reply(RedisReply& reply, const std::string& v);
+    /*
+     * reference a payload shared with other replies instead of copying it
+     */
+    void fill_shared_str_reply(RedisReply& reply, SharedSegment* segment);
 
 //    void fill_value_reply(RedisReply& reply, const Data& v);
 //    void fill_value_reply(RedisReply& reply, const Data* v);
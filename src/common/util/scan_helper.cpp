@@ -0,0 +1,251 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/scan_helper.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define COMMS_SCAN_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace comms
+{
+    const char* find_crlf_scalar(const char* s, size_t len)
+    {
+        const char* end = s + len;
+        while (s < end)
+        {
+            const char* cr = (const char*) memchr(s, '\r', end - s);
+            if (NULL == cr || cr + 1 >= end)
+            {
+                return NULL;
+            }
+            if (cr[1] == '\n')
+            {
+                return cr;
+            }
+            s = cr + 1;
+        }
+        return NULL;
+    }
+
+    const char* find_char_scalar(const char* s, size_t len, char ch)
+    {
+        return (const char*) memchr(s, ch, len);
+    }
+
+#ifdef COMMS_SCAN_X86
+    /*
+     * Both kernels compare a block with '\r' and the same block shifted by one
+     * byte with '\n', so a CRLF crossing two blocks is still found.
+     */
+    static const char* find_crlf_sse2(const char* s, size_t len)
+    {
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        size_t i = 0;
+        for (; i + 17 <= len; i += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*) (s + i));
+            __m128i b = _mm_loadu_si128((const __m128i*) (s + i + 1));
+            uint32 mask = (uint32) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf)));
+            if (mask != 0)
+            {
+                return s + i + __builtin_ctz(mask);
+            }
+        }
+        return find_crlf_scalar(s + i, len - i);
+    }
+
+    static const char* find_char_sse2(const char* s, size_t len, char ch)
+    {
+        const __m128i c = _mm_set1_epi8(ch);
+        size_t i = 0;
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*) (s + i));
+            uint32 mask = (uint32) _mm_movemask_epi8(_mm_cmpeq_epi8(a, c));
+            if (mask != 0)
+            {
+                return s + i + __builtin_ctz(mask);
+            }
+        }
+        return find_char_scalar(s + i, len - i, ch);
+    }
+
+    __attribute__((target("avx2")))
+    static const char* find_crlf_avx2(const char* s, size_t len)
+    {
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        size_t i = 0;
+        for (; i + 33 <= len; i += 32)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*) (s + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*) (s + i + 1));
+            uint32 mask = (uint32) _mm256_movemask_epi8(
+                    _mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf)));
+            if (mask != 0)
+            {
+                return s + i + __builtin_ctz(mask);
+            }
+        }
+        return find_crlf_sse2(s + i, len - i);
+    }
+
+    __attribute__((target("avx2")))
+    static const char* find_char_avx2(const char* s, size_t len, char ch)
+    {
+        const __m256i c = _mm256_set1_epi8(ch);
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*) (s + i));
+            uint32 mask = (uint32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, c));
+            if (mask != 0)
+            {
+                return s + i + __builtin_ctz(mask);
+            }
+        }
+        return find_char_sse2(s + i, len - i, ch);
+    }
+#endif
+
+    typedef const char* FindCRLFFunc(const char* s, size_t len);
+    typedef const char* FindCharFunc(const char* s, size_t len, char ch);
+
+    struct ScanKernel
+    {
+            FindCRLFFunc* crlf;
+            FindCharFunc* chr;
+            const char* name;
+    };
+
+    static ScanKernel select_scan_kernel()
+    {
+        ScanKernel kernel = { find_crlf_scalar, find_char_scalar, "scalar" };
+#ifdef COMMS_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernel.crlf = find_crlf_avx2;
+            kernel.chr = find_char_avx2;
+            kernel.name = "avx2";
+        }
+        else
+        {
+            kernel.crlf = find_crlf_sse2;
+            kernel.chr = find_char_sse2;
+            kernel.name = "sse2";
+        }
+#endif
+        return kernel;
+    }
+
+    static const ScanKernel g_scan_kernel = select_scan_kernel();
+
+    const char* find_crlf(const char* s, size_t len)
+    {
+#ifdef COMMS_SCAN_X86
+        /*
+         * RESP lines are short, most searches end in the first block, check it
+         * here before paying for the indirect call.
+         */
+        if (len >= 17)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*) s);
+            __m128i b = _mm_loadu_si128((const __m128i*) (s + 1));
+            uint32 mask = (uint32) _mm_movemask_epi8(
+                    _mm_and_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(b, _mm_set1_epi8('\n'))));
+            if (mask != 0)
+            {
+                return s + __builtin_ctz(mask);
+            }
+            return g_scan_kernel.crlf(s + 16, len - 16);
+        }
+#endif
+        return g_scan_kernel.crlf(s, len);
+    }
+
+    const char* find_char(const char* s, size_t len, char ch)
+    {
+        return g_scan_kernel.chr(s, len, ch);
+    }
+
+    const char* scan_kernel_name()
+    {
+        return g_scan_kernel.name;
+    }
+
+    int parse_crlf_decimal(const char* s, size_t len, int64& value, size_t& consumed)
+    {
+        static const size_t kMaxDigits = 18;
+        size_t i = 0;
+        bool negative = false;
+        if (len > 0 && s[0] == '-')
+        {
+            negative = true;
+            i = 1;
+        }
+        size_t start = i;
+        size_t limit = len < start + kMaxDigits ? len : start + kMaxDigits;
+        uint64 v = 0;
+        while (i < limit)
+        {
+            uint32 digit = (uint8) s[i] - '0';
+            if (digit > 9)
+            {
+                break;
+            }
+            v = v * 10 + digit;
+            i++;
+        }
+        if (i == len)
+        {
+            return 0;
+        }
+        if (i == start || s[i] != '\r')
+        {
+            return -1;
+        }
+        if (i + 1 == len)
+        {
+            return 0;
+        }
+        if (s[i + 1] != '\n')
+        {
+            return -1;
+        }
+        value = negative ? -(int64) v : (int64) v;
+        consumed = i + 2;
+        return 1;
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCAN_HELPER_HPP_
+#define SCAN_HELPER_HPP_
+#include "common.hpp"
+#include <stddef.h>
+
+namespace comms
+{
+    /*
+     * Protocol scanning kernels. find_crlf/find_char pick an AVX2 or SSE2
+     * implementation at startup on x86 and fall back to the scalar versions
+     * everywhere else.
+     */
+    const char* find_crlf(const char* s, size_t len);
+    const char* find_char(const char* s, size_t len, char ch);
+    const char* find_crlf_scalar(const char* s, size_t len);
+    const char* find_char_scalar(const char* s, size_t len, char ch);
+    const char* scan_kernel_name();
+
+    /*
+     * Parse a length header '[-]<digits>\r\n' of at most 18 digits.
+     * Return 1 and the consumed bytes (CRLF included) on success, 0 if the
+     * CRLF is not received yet, -1 on malformed input.
+     */
+    int parse_crlf_decimal(const char* s, size_t len, int64& value, size_t& consumed);
+}
+#endif /* SCAN_HELPER_HPP_ */
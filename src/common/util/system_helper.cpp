@@ -29,7 +29,9 @@
 
 #include "system_helper.hpp"
 #include "config_helper.hpp"
+#include "string_helper.hpp"
 #include <string.h>
+#include <algorithm>
 #if  __APPLE__
 #include <sys/param.h>
 #include <sys/sysctl.h>
@@ -73,6 +75,43 @@ namespace comms
 		return ret;
 	}
 
+	bool parse_cpu_list(const std::string& str, std::vector<int>& cpus)
+	{
+		cpus.clear();
+		std::vector<std::string> ranges = split_string(str, ",");
+		for (size_t i = 0; i < ranges.size(); i++)
+		{
+			std::string range = trim_string(ranges[i]);
+			if (range.empty())
+			{
+				continue;
+			}
+			uint32 first = 0, last = 0;
+			size_t pos = range.find('-');
+			if (pos == std::string::npos)
+			{
+				if (!string_touint32(range, first))
+				{
+					return false;
+				}
+				last = first;
+			}
+			else if (!string_touint32(range.substr(0, pos), first) || !string_touint32(range.substr(pos + 1), last)
+			        || first > last)
+			{
+				return false;
+			}
+			for (uint32 cpu = first; cpu <= last; cpu++)
+			{
+				if (std::find(cpus.begin(), cpus.end(), (int) cpu) == cpus.end())
+				{
+					cpus.push_back((int) cpu);
+				}
+			}
+		}
+		return !cpus.empty();
+	}
+
 #if defined(HAVE_PROC_STAT)
 #include <unistd.h>
 #include <sys/types.h>
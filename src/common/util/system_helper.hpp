@@ -35,11 +35,16 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <string>
+#include <vector>
 #include "common.hpp"
 
 namespace comms
 {
     uint32 available_processors();
+    /*
+     * Parse a cpu list like "0-3,8,10-11", duplicates are dropped.
+     */
+    bool parse_cpu_list(const std::string& str, std::vector<int>& cpus);
     size_t mem_rss_size();
     size_t mem_shr_size();
 }
@@ -0,0 +1,143 @@
+/*
+ *Copyright (c) 2013-2014, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ * 
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ * 
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ * 
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS 
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF 
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TOKEN_BUCKET_HPP_
+#define TOKEN_BUCKET_HPP_
+#include "common.hpp"
+#include "util/time_helper.hpp"
+
+namespace comms
+{
+    /*
+     * Token bucket refilled continuously with 'rate' tokens per second up to 'burst' tokens,
+     * not thread safe. Tokens are kept in millionths so refilling by elapsed micros is exact.
+     */
+    class TokenBucket
+    {
+        private:
+            int64 m_rate;
+            int64 m_burst;
+            int64 m_tokens; /* in millionths of token, negative while in debt */
+            uint64 m_refill_time;
+            void Refill(uint64 now)
+            {
+                if (now <= m_refill_time)
+                {
+                    return;
+                }
+                uint64 elapsed = now - m_refill_time;
+                m_refill_time = now;
+                int64 cap = m_burst * 1000000;
+                if (elapsed >= (uint64) ((cap - m_tokens) / m_rate + 1))
+                {
+                    m_tokens = cap;
+                }
+                else
+                {
+                    m_tokens += (int64) elapsed * m_rate;
+                }
+            }
+        public:
+            TokenBucket() :
+                    m_rate(0), m_burst(0), m_tokens(0), m_refill_time(0)
+            {
+            }
+            /*
+             * 0 rate means unlimited, burst defaults to one second of tokens.
+             */
+            void SetRate(int64 rate, int64 burst = 0)
+            {
+                if (rate == m_rate && (burst > 0 ? burst : rate) == m_burst)
+                {
+                    return;
+                }
+                m_rate = rate > 0 ? rate : 0;
+                m_burst = burst > 0 ? burst : m_rate;
+                m_tokens = m_burst * 1000000;
+                m_refill_time = get_current_epoch_micros();
+            }
+            int64 GetRate() const
+            {
+                return m_rate;
+            }
+            bool Unlimited() const
+            {
+                return 0 == m_rate;
+            }
+            /*
+             * Whether TryTake() would succeed now, nothing is taken.
+             */
+            bool HasToken(uint64 now)
+            {
+                if (0 == m_rate)
+                {
+                    return true;
+                }
+                Refill(now);
+                return m_tokens >= 1000000;
+            }
+            /*
+             * Take one token if there is any.
+             */
+            bool TryTake(uint64 now)
+            {
+                if (0 == m_rate)
+                {
+                    return true;
+                }
+                Refill(now);
+                if (m_tokens < 1000000)
+                {
+                    return false;
+                }
+                m_tokens -= 1000000;
+                return true;
+            }
+            /*
+             * Take one token even if the bucket is empty, return the micros to wait until the
+             * debt is paid back, 0 if there was a token.
+             */
+            uint64 Take(uint64 now)
+            {
+                if (0 == m_rate)
+                {
+                    return 0;
+                }
+                Refill(now);
+                m_tokens -= 1000000;
+                if (m_tokens >= 0)
+                {
+                    return 0;
+                }
+                return (uint64) ((-m_tokens + m_rate - 1) / m_rate);
+            }
+    };
+}
+
+#endif /* TOKEN_BUCKET_HPP_ */
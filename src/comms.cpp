@@ -77,7 +77,7 @@ OP_NAMESPACE_BEGIN
                 { "slowlog", REDIS_CMD_SLOWLOG, &Comms::SlowLog, 1, 2, "r", 0, 0, 0 },
                 { "dbsize", REDIS_CMD_DBSIZE, &Comms::DBSize, 0, 0, "r", 0, 0, 0 },
                 { "config", REDIS_CMD_CONFIG, &Comms::Config, 1, 3, "ar", 0, 0, 0 },
-                { "client", REDIS_CMD_CLIENT, &Comms::Client, 1, 3, "ar", 0, 0, 0 },
+                { "client", REDIS_CMD_CLIENT, &Comms::Client, 1, -1, "ar", 0, 0, 0 },
                 { "flushdb", REDIS_CMD_FLUSHDB, &Comms::FlushDB, 0, 0, "w", 0, 0, 0 },
                 { "flushall", REDIS_CMD_FLUSHALL, &Comms::FlushAll, 0, 0, "w", 0, 0, 0 },
                 { "time", REDIS_CMD_TIME, &Comms::Time, 0, 0, "ar", 0, 0, 0 },
@@ -289,6 +289,85 @@ OP_NAMESPACE_BEGIN
         }
     }
 
+    /*
+     * Only idle clients without state bound to their loop may move to another worker.
+     */
+    bool Comms::ClientMigrationFilter(Channel* ch, void* data)
+    {
+        Comms* db = (Comms*) data;
+        LockGuard<SpinMutexLock> guard(db->m_clients_lock);
+        ContextTable::iterator found = db->m_clients.find(ch->GetID());
+        if (found == db->m_clients.end())
+        {
+            return false;
+        }
+        Context* ctx = found->second;
+        if (ctx->processing || ctx->wal_sync_waits > 0 || NULL != ctx->transc || NULL != ctx->pubsub || NULL != ctx->block || NULL != ctx->tracking
+                || NULL != ctx->lua)
+        {
+            return false;
+        }
+        return NULL == ctx->watch_keys || ctx->watch_keys->empty();
+    }
+
+    /*
+     * Apply the output buffer limits of the client's class, called when a client connects,
+     * enters/leaves pubsub mode or turns into a slave.
+     */
+    void Comms::SetClientOutputClass(Channel* client, ClientOutputClass klass)
+    {
+        const ClientOutputBufferLimit& limit = m_cfg.client_output_buffer_limits[klass];
+        ChannelOptions& options = client->GetWritableOptions();
+        options.max_write_buffer_size = limit.hard_limit > 0 ? (int32) std::min(limit.hard_limit, (int64) INT32_MAX) : -1;
+        options.soft_write_buffer_size = limit.soft_limit > 0 ? (int32) std::min(limit.soft_limit, (int64) INT32_MAX) : 0;
+        options.soft_write_buffer_seconds = limit.soft_seconds > 0 ? (uint32) limit.soft_seconds : 0;
+    }
+
+    void Comms::UpdateClientOutputClassCallback(Channel* ch, void* data)
+    {
+        if (NULL == ch)
+        {
+            return;
+        }
+        bool pubsub = false;
+        {
+            LockGuard<SpinMutexLock> guard(g_db->m_clients_lock);
+            ContextTable::iterator found = g_db->m_clients.find(ch->GetID());
+            if (found == g_db->m_clients.end())
+            {
+                return;
+            }
+            pubsub = NULL != found->second->pubsub;
+        }
+        g_db->SetClientOutputClass(ch, pubsub ? CLIENT_OUTPUT_PUBSUB : CLIENT_OUTPUT_NORMAL);
+    }
+
+    void Comms::UpdateSlaveOutputClassCallback(Channel* ch, void* data)
+    {
+        g_repl->GetMaster().UpdateSlaveOutputLimits();
+    }
+
+    /*
+     * Re-apply the output buffer limits to the connected clients after a config change,
+     * each client on its own loop, the slaves on the replication thread.
+     */
+    void Comms::UpdateClientOutputLimits()
+    {
+        {
+            LockGuard<SpinMutexLock> guard(m_clients_lock);
+            ContextTable::iterator it = m_clients.begin();
+            while (it != m_clients.end())
+            {
+                if (NULL != it->second->client)
+                {
+                    it->second->client->GetService().AsyncIO(it->first, UpdateClientOutputClassCallback, NULL);
+                }
+                it++;
+            }
+        }
+        m_repl.GetIOServ().AsyncIO(0, UpdateSlaveOutputClassCallback, NULL);
+    }
+
     void Comms::RewriteClientCommand(Context& ctx, RedisCommandFrame& cmd)
     {
         if (NULL != ctx.current_cmd)
@@ -363,12 +442,32 @@ OP_NAMESPACE_BEGIN
             }
             worker_count += m_cfg.thread_pool_sizes[i];
         }
+        if (aeSetApiBackend(m_cfg.event_loop_backend.c_str()) != AE_OK)
+        {
+            WARN_LOG("Event loop backend '%s' is not supported, use '%s' instead.", m_cfg.event_loop_backend.c_str(),
+                    aeGetApiName());
+        }
         m_service = new ChannelService(m_cfg.max_clients + 32);
+        if (strcasecmp(m_cfg.event_loop_backend.c_str(), aeGetApiName()))
+        {
+            INFO_LOG("Event loops run on the '%s' backend.", aeGetApiName());
+        }
         m_service->SetThreadPoolSize(worker_count);
+        m_service->SetThreadPoolAffinity(m_cfg.worker_cpus);
+        if (m_cfg.loop_rebalance_threshold > 0)
+        {
+            m_service->RegisterMigrationFilter(ClientMigrationFilter, this);
+            m_service->SetRebalance(m_cfg.loop_rebalance_threshold, m_cfg.loop_rebalance_period);
+        }
         m_service->RegisterUserEventCallback(LUAInterpreter::ScriptEventCallback, this);
         ChannelOptions ops;
         ops.tcp_nodelay = true;
         ops.reuse_address = true;
+        ops.batch_write = m_cfg.pipeline_batch_write;
+        ops.flush_before_sleep = m_cfg.flush_before_sleep;
+        ops.max_read_frames = m_cfg.max_read_commands > 0 ? m_cfg.max_read_commands : 0;
+        ops.max_read_bytes = m_cfg.max_read_bytes > 0 ? m_cfg.max_read_bytes : 0;
+        ops.edge_triggered = m_cfg.tcp_edge_triggered;
         if (m_cfg.tcp_keepalive > 0)
         {
             ops.keep_alive = m_cfg.tcp_keepalive;
@@ -399,6 +498,7 @@ OP_NAMESPACE_BEGIN
                 }
                 SocketHostAddress socket_address(ss[0], port);
                 server = m_service->NewServerSocketChannel();
+                server->SetReusePort(m_cfg.listen_reuseport);
 
                 if (!server->Bind(&socket_address))
                 {
@@ -410,6 +510,8 @@ OP_NAMESPACE_BEGIN
                     m_cfg.primary_port = port;
                 }
             }
+            ops.busy_poll = m_cfg.busy_polls[i];
+            ops.socket_busy_poll = m_cfg.busy_poll_socket;
             server->Configure(ops);
             server->SetChannelPipelineInitializor(RedisRequestHandler::PipelineInit, this);
             server->SetChannelPipelineFinalizer(RedisRequestHandler::PipelineDestroy, NULL);
@@ -431,6 +533,11 @@ OP_NAMESPACE_BEGIN
                 string_join_container(m_cfg.listen_addresses, ",").c_str());
 
         m_starttime = time(NULL);
+        /* after the repl & cron threads are created, they do not inherit this affinity */
+        if (!m_cfg.main_cpus.empty() && !Thread::SetCurrentAffinity(m_cfg.main_cpus))
+        {
+            WARN_LOG("Failed to set cpu affinity of the main thread.");
+        }
         m_service->Start();
         sexit: m_cron.StopSelf();
         DELETE(m_service);
@@ -468,13 +575,20 @@ OP_NAMESPACE_BEGIN
         if (!key.empty())
         {
             AbortWatchKey(db, key);
+            InvalidateTrackedKey(ctx, db, key);
         }
         return 0;
     }
 
+    int Comms::FireKeyChangedEvent(Context& ctx, const ArgumentSlice& key)
+    {
+        return FireKeyChangedEvent(ctx, ctx.currentDB, std::string(key.data, key.len));
+    }
+
     void Comms::FreeClientContext(Context& ctx)
     {
         UnwatchKeys(ctx);
+        DisableTracking(ctx);
         UnsubscribeAll(ctx, false);
         PUnsubscribeAll(ctx, false);
         ClearBlockKeys(ctx);
@@ -486,7 +600,7 @@ OP_NAMESPACE_BEGIN
     void Comms::AddClientContext(Context& ctx)
     {
         LockGuard<SpinMutexLock> guard(m_clients_lock);
-        m_clients[ctx.client->GetID()] = &ctx;
+        m_clients.set(ctx.client->GetID(), &ctx);
     }
 
     RedisReplyPool& Comms::GetRedisReplyPool()
@@ -498,6 +612,10 @@ OP_NAMESPACE_BEGIN
     {
         uint64 start_time = get_current_epoch_micros();
         ctx.last_interaction_ustime = start_time;
+        if (NULL != ctx.tracking)
+        {
+            TrackKeys(ctx, ctx.currentDB, args);
+        }
         int ret = (this->*(setting.handler))(ctx, args);
         uint64 stop_time = get_current_epoch_micros();
         ctx.last_interaction_ustime = stop_time;
@@ -543,6 +661,67 @@ OP_NAMESPACE_BEGIN
             }
     };
 
+    /*
+     * Take a token from the client's and the listener's buckets. Without tokens the command is
+     * rejected with ERR_OVERLOAD('qps-limit-action error'), or it runs on credit and the client
+     * stops reading until the buckets are paid back.
+     */
+    int Comms::CheckQPSLimit(Context& ctx)
+    {
+        ServerStatistics* stat = ctx.server_stat;
+        if (ctx.ops_bucket.Unlimited() && stat->ops_bucket.Unlimited())
+        {
+            return 0;
+        }
+        uint64 now = get_current_epoch_micros();
+        uint64 wait = 0;
+        bool reject = false;
+        if (m_cfg.qps_limit_error)
+        {
+            /*
+             * A rejected command takes no token from either bucket: the client's bucket is
+             * only used by this connection's thread, its token is taken once the listener
+             * granted one.
+             */
+            reject = !ctx.ops_bucket.HasToken(now);
+            if (!reject)
+            {
+                LockGuard<SpinMutexLock> guard(stat->ops_bucket_lock);
+                reject = !stat->ops_bucket.TryTake(now);
+            }
+            if (!reject)
+            {
+                ctx.ops_bucket.TryTake(now);
+            }
+        }
+        else
+        {
+            wait = ctx.ops_bucket.Take(now);
+            LockGuard<SpinMutexLock> guard(stat->ops_bucket_lock);
+            wait = std::max(wait, stat->ops_bucket.Take(now));
+        }
+        if (!reject && 0 == wait)
+        {
+            return 0;
+        }
+        atomic_add_uint64(&stat->overload_commands, 1);
+        if (reject)
+        {
+            return ERR_OVERLOAD;
+        }
+        /*
+         * block overloaded connection
+         */
+        if (NULL != ctx.client && !ctx.client->IsDetached())
+        {
+            ctx.client->DetachFD();
+            uint64 next = (wait + 999) / 1000;
+            ChannelService& serv = ctx.client->GetService();
+            serv.GetTimer().ScheduleHeapTask(new ResumeOverloadConnection(serv, ctx.client->GetID()), next, -1, MILLIS);
+        }
+        return 0;
+    }
+
     int Comms::Call(Context& ctx, RedisCommandFrame& args, CallFlags flags)
     {
         RedisCommandHandlerSetting* found = FindRedisCommandHandlerSetting(args);
@@ -555,22 +734,16 @@ OP_NAMESPACE_BEGIN
             return 0;
         }
         ctx.ClearState();
-        int err = m_stat.IncRecvCommands(ctx.server_address, ctx.sequence);
+        if (NULL == ctx.server_stat)
+        {
+            ctx.server_stat = m_stat.GetServerStatistics(ctx.server_address);
+        }
+        m_stat.IncRecvCommands(ctx.server_stat, ctx.sequence);
         DEBUG_LOG("Process recved cmd[%lld]:%s", ctx.sequence, args.ToString().c_str());
-        if (err == ERR_OVERLOAD)
+        if (ERR_OVERLOAD == CheckQPSLimit(ctx))
         {
-            /*
-             * block overloaded connection
-             */
-            if (NULL != ctx.client && !ctx.client->IsDetached())
-            {
-                ctx.client->DetachFD();
-                uint64 now = get_current_epoch_millis();
-                uint64 next = 1000 - (now % 1000);
-                ChannelService& serv = ctx.client->GetService();
-                ctx.client->GetService().GetTimer().ScheduleHeapTask(
-                        new ResumeOverloadConnection(serv, ctx.client->GetID()), next == 0 ? 1 : next, -1, MILLIS);
-            }
+            fill_fix_error_reply(ctx.reply, "OVERLOAD max number of queries per second reached");
+            return 0;
         }
         ctx.current_cmd = &args;
         ctx.current_cmd_type = args.GetType();
@@ -587,11 +760,11 @@ OP_NAMESPACE_BEGIN
         bool valid_cmd = true;
         if (setting.min_arity > 0)
         {
-            valid_cmd = args.GetArguments().size() >= (uint32) setting.min_arity;
+            valid_cmd = args.GetArgumentCount() >= (uint32) setting.min_arity;
         }
         if (setting.max_arity >= 0 && valid_cmd)
         {
-            valid_cmd = args.GetArguments().size() <= (uint32) setting.max_arity;
+            valid_cmd = args.GetArgumentCount() <= (uint32) setting.max_arity;
         }
 
         if (!valid_cmd)
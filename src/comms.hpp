@@ -41,6 +41,7 @@
 #include "logger.hpp"
 #include "util/redis_helper.hpp"
 #include "command/lua_scripting.hpp"
+#include "command/tracking.hpp"
 #include "replication/repl.hpp"
 #include <sparsehash/dense_hash_map>
 
@@ -135,6 +136,8 @@ OP_NAMESPACE_BEGIN
             ContextTable m_clients;
             SpinMutexLock m_clients_lock;
 
+            TrackingTable m_tracking;
+
             typedef TreeMap<std::string, std::string>::Type ScriptTable;
             ScriptTable m_lua_scripts;
             SpinMutexLock m_scripts_lock;
@@ -156,9 +159,23 @@ OP_NAMESPACE_BEGIN
             int SubscribeChannel(Context& ctx, const std::string& channel, bool notify);
             int UnsubscribeChannel(Context& ctx, const std::string& channel, bool notify);
 
+            bool AsyncIOClient(uint32 id, ChannelAsyncIOCallback* cb, void* data);
+            static void CheckTrackingClientCallback(Channel* ch, void* data);
+            static void WriteInvalidationCallback(Channel* ch, void* data);
+            void SendInvalidations(Context& ctx, const TrackingInvalidationArray& invalidations, bool flush);
+            void TrackKeys(Context& ctx, DBID db, RedisCommandFrame& cmd);
+            void InvalidateTrackedKey(Context& ctx, DBID db, const std::string& key);
+            void InvalidateAllTrackedKeys(Context& ctx);
+            void DisableTracking(Context& ctx);
+            int ClientTracking(Context& ctx, RedisCommandFrame& cmd);
+
             void TryPushSlowCommand(const RedisCommandFrame& cmd, uint64 micros);
             void FillInfoResponse(const std::string& section, std::string& info);
             void GetSlowlog(Context& ctx, uint32 len);
+            static bool ClientMigrationFilter(Channel* ch, void* data);
+            static void UpdateClientOutputClassCallback(Channel* ch, void* data);
+            static void UpdateSlaveOutputClassCallback(Channel* ch, void* data);
+            int CheckQPSLimit(Context& ctx);
 
             bool FillErrorReply(Context& ctx, int err);
 
@@ -179,6 +196,11 @@ OP_NAMESPACE_BEGIN
             int AbortWatchKey(DBID db, const std::string& key);
             int FireKeyChangedEvent(Context& ctx, const std::string& key);
             int FireKeyChangedEvent(Context& ctx, DBID db, const std::string& key);
+            int FireKeyChangedEvent(Context& ctx, const ArgumentSlice& key);
+            static inline mmkv::Data ArgumentData(const ArgumentSlice& arg)
+            {
+                return mmkv::Data(arg.data, arg.len);
+            }
 
             int Time(Context& ctx, RedisCommandFrame& cmd);
             int FlushDB(Context& ctx, RedisCommandFrame& cmd);
@@ -363,6 +385,7 @@ OP_NAMESPACE_BEGIN
             friend class LUAInterpreter;
             friend class BlockListTimeout;
             friend class WakeBlockListData;
+            friend class ParallelApplier;
         public:
             Comms();
             int Init(const CommsConfig& cfg);
@@ -388,6 +411,8 @@ OP_NAMESPACE_BEGIN
                 return *m_kv_store;
             }
             int Call(Context& ctx, RedisCommandFrame& cmd, CallFlags flags);
+            void SetClientOutputClass(Channel* client, ClientOutputClass klass);
+            void UpdateClientOutputLimits();
             static void WakeBlockedConnCallback(Channel* ch, void * data);
             ~Comms();
 
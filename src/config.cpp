@@ -30,6 +30,7 @@
 #include "util/config_helper.hpp"
 #include "util/string_helper.hpp"
 #include "util/file_helper.hpp"
+#include "util/system_helper.hpp"
 #include <errno.h>
 
 #define COMMS_AUTHPASS_MAX_LEN 512
@@ -84,6 +85,15 @@ OP_NAMESPACE_BEGIN
         conf_get_string(props, "pidfile", pidfile);
 
         conf_get_int64(props, "tcp-keepalive", tcp_keepalive);
+        conf_get_bool(props, "pipeline-batch-write", pipeline_batch_write);
+        conf_get_bool(props, "flush-before-sleep", flush_before_sleep);
+        conf_get_int64(props, "max-read-commands", max_read_commands);
+        conf_get_int64(props, "max-read-bytes", max_read_bytes);
+        conf_get_bool(props, "tcp-edge-triggered", tcp_edge_triggered);
+        conf_get_string(props, "event-loop-backend", event_loop_backend);
+        conf_get_bool(props, "listen-reuseport", listen_reuseport);
+        conf_get_int64(props, "loop-rebalance-threshold", loop_rebalance_threshold);
+        conf_get_int64(props, "loop-rebalance-period", loop_rebalance_period);
         conf_get_int64(props, "timeout", timeout);
         conf_get_int64(props, "unixsocketperm", unixsocketperm);
         conf_get_int64(props, "slowlog-log-slower-than", slowlog_log_slower_than);
@@ -144,8 +154,55 @@ OP_NAMESPACE_BEGIN
                 }
             }
         }
+        conf_get_int64(props, "client-qps-limit", client_qps_limit);
+        std::string qps_limit_action = qps_limit_error ? "error" : "delay";
+        conf_get_string(props, "qps-limit-action", qps_limit_action);
+        if (!strcasecmp(qps_limit_action.c_str(), "error"))
+        {
+            qps_limit_error = true;
+        }
+        else if (!strcasecmp(qps_limit_action.c_str(), "delay"))
+        {
+            qps_limit_error = false;
+        }
+        else
+        {
+            WARN_LOG("Invalid config 'qps-limit-action':%s", qps_limit_action.c_str());
+        }
+        Properties::const_iterator bp_it = props.find("busy-poll");
+        if (bp_it != props.end())
+        {
+            const ConfItemsArray& cs = bp_it->second;
+            for (uint32 i = 0; i < cs.size(); i++)
+            {
+                uint32 micros = 0;
+                if (cs[i].size() != 1 || !string_touint32(cs[i][0], micros))
+                {
+                    WARN_LOG("Invalid config 'busy-poll'");
+                }
+                else
+                {
+                    busy_polls.push_back((int64) micros);
+                }
+            }
+        }
+        conf_get_bool(props, "busy-poll-socket", busy_poll_socket);
+        const char* affinity_names[] = { "cpu-affinity-main", "cpu-affinity-workers", "cpu-affinity-repl",
+                "cpu-affinity-cron", "cpu-affinity-bgtask" };
+        std::vector<int>* affinity_cpus[] = { &main_cpus, &worker_cpus, &repl_cpus, &cron_cpus, &bgtask_cpus };
+        for (uint32 i = 0; i < arraysize(affinity_names); i++)
+        {
+            std::string cpus;
+            conf_get_string(props, affinity_names[i], cpus);
+            if (!cpus.empty() && !parse_cpu_list(cpus, *(affinity_cpus[i])))
+            {
+                WARN_LOG("Invalid config '%s':%s", affinity_names[i], cpus.c_str());
+                affinity_cpus[i]->clear();
+            }
+        }
         thread_pool_sizes.resize(listen_addresses.size());
         qps_limits.resize(listen_addresses.size());
+        busy_polls.resize(listen_addresses.size());
 
         conf_get_string(props, "data-dir", data_base_path);
         conf_get_string(props, "backup-dir", backup_dir);
@@ -175,10 +232,32 @@ OP_NAMESPACE_BEGIN
 
         conf_get_int64(props, "repl-backlog-size", repl_wal_size);
         conf_get_int64(props, "repl-backlog-cache-size", repl_wal_cache_size);
+        conf_get_int64(props, "repl-backlog-segment-size", repl_wal_segment_size);
         conf_get_int64(props, "repl-ping-slave-period", repl_ping_slave_period);
         conf_get_int64(props, "repl-timeout", repl_timeout);
         conf_get_int64(props, "repl-state-persist-period", repl_state_persist_period);
         conf_get_int64(props, "repl-backlog-ttl", repl_backlog_time_limit);
+        conf_get_int64(props, "wal-fsync-period", repl_wal_sync_period);
+        std::string wal_fsync;
+        if (conf_get_string(props, "wal-fsync", wal_fsync))
+        {
+            if (!strcasecmp(wal_fsync.c_str(), "always"))
+            {
+                repl_wal_fsync = WAL_FSYNC_ALWAYS;
+            }
+            else if (!strcasecmp(wal_fsync.c_str(), "everysec"))
+            {
+                repl_wal_fsync = WAL_FSYNC_EVERYSEC;
+            }
+            else if (!strcasecmp(wal_fsync.c_str(), "no"))
+            {
+                repl_wal_fsync = WAL_FSYNC_NO;
+            }
+            else
+            {
+                WARN_LOG("Invalid config 'wal-fsync':%s", wal_fsync.c_str());
+            }
+        }
         conf_get_bool(props, "repl-disable-tcp-nodelay", repl_disable_tcp_nodelay);
         conf_get_int64(props, "lua-time-limit", lua_time_limit);
 
@@ -196,6 +275,8 @@ OP_NAMESPACE_BEGIN
         conf_get_bool(props, "slave-read-only", slave_readonly);
         conf_get_bool(props, "slave-serve-stale-data", slave_serve_stale_data);
         conf_get_int64(props, "slave-priority", slave_priority);
+        conf_get_int64(props, "slave-apply-threads", slave_apply_threads);
+        conf_get_bool(props, "repl-compression", repl_compression);
         conf_get_bool(props, "slave-ignore-expire", slave_ignore_expire);
         conf_get_bool(props, "slave-ignore-del", slave_ignore_del);
 
@@ -275,8 +356,39 @@ OP_NAMESPACE_BEGIN
 
         conf_get_int64(props, "reply-pool-size", reply_pool_size);
 
-        conf_get_int64(props, "slave-client-output-buffer-limit", slave_client_output_buffer_limit);
-        conf_get_int64(props, "pubsub-client-output-buffer-limit", pubsub_client_output_buffer_limit);
+        //hard limits only, kept for old config files
+        conf_get_int64(props, "slave-client-output-buffer-limit", client_output_buffer_limits[CLIENT_OUTPUT_SLAVE].hard_limit);
+        conf_get_int64(props, "pubsub-client-output-buffer-limit", client_output_buffer_limits[CLIENT_OUTPUT_PUBSUB].hard_limit);
+        Properties::const_iterator obl_it = props.find("client-output-buffer-limit");
+        if (obl_it != props.end())
+        {
+            const ConfItemsArray& cs = obl_it->second;
+            for (uint32 i = 0; i < cs.size(); i++)
+            {
+                //'CONFIG SET' passes all the arguments in one item
+                ConfItems items = cs[i].size() == 1 ? split_string(cs[i][0], " ") : cs[i];
+                const char* class_names[] = { "normal", "pubsub", "slave" };
+                int klass = -1;
+                for (uint32 j = 0; items.size() == 4 && j < arraysize(class_names); j++)
+                {
+                    if (!strcasecmp(items[0].c_str(), class_names[j]))
+                    {
+                        klass = j;
+                    }
+                }
+                ClientOutputBufferLimit limit;
+                if (klass < 0 || !conf_parse_int64(items[1], limit.hard_limit)
+                        || !conf_parse_int64(items[2], limit.soft_limit) || !string_toint64(items[3], limit.soft_seconds))
+                {
+                    WARN_LOG("Invalid config 'client-output-buffer-limit'");
+                }
+                else
+                {
+                    client_output_buffer_limits[klass] = limit;
+                }
+            }
+        }
+        conf_get_int64(props, "tracking-table-max-keys", tracking_table_max_keys);
         conf_get_int64(props, "databases", maxdb);
 
         trusted_ip.clear();
@@ -35,12 +35,54 @@
 
 OP_NAMESPACE_BEGIN
 
+    enum ClientOutputClass
+    {
+        CLIENT_OUTPUT_NORMAL = 0,
+        CLIENT_OUTPUT_PUBSUB = 1,
+        CLIENT_OUTPUT_SLAVE = 2,
+        CLIENT_OUTPUT_CLASS_COUNT = 3,
+    };
+
+    enum WALFsyncPolicy
+    {
+        WAL_FSYNC_NO = 0,
+        WAL_FSYNC_EVERYSEC = 1,
+        WAL_FSYNC_ALWAYS = 2,
+    };
+
+    /*
+     * 'client-output-buffer-limit <class> <hard limit> <soft limit> <soft seconds>', 0 disables a limit
+     */
+    struct ClientOutputBufferLimit
+    {
+            int64 hard_limit;
+            int64 soft_limit;
+            int64 soft_seconds;
+            ClientOutputBufferLimit(int64 hard = 0, int64 soft = 0, int64 seconds = 0) :
+                    hard_limit(hard), soft_limit(soft), soft_seconds(seconds)
+            {
+            }
+    };
+
     struct CommsConfig
     {
             bool daemonize;
             StringArray listen_addresses;
             Int64Array thread_pool_sizes;
             Int64Array qps_limits;
+            int64 client_qps_limit;
+            bool qps_limit_error; /* 'qps-limit-action error', reply -OVERLOAD instead of delaying reads */
+            Int64Array busy_polls;
+            bool busy_poll_socket;
+
+            /*
+             * cpu sets of each thread class, empty means not pinned
+             */
+            std::vector<int> main_cpus;
+            std::vector<int> worker_cpus;
+            std::vector<int> repl_cpus;
+            std::vector<int> cron_cpus;
+            std::vector<int> bgtask_cpus;
 
             int64 unixsocketperm;
             int64 max_clients;
@@ -60,13 +102,17 @@ OP_NAMESPACE_BEGIN
             int64 repl_timeout;
             int64 repl_wal_cache_size;
             int64 repl_wal_size;
+            int64 repl_wal_segment_size; /* the backlog is kept in preallocated files of this size */
             int64 repl_state_persist_period;
             int64 repl_backlog_time_limit;
             int64 repl_wal_sync_period;
+            WALFsyncPolicy repl_wal_fsync; /* 'wal-fsync', 'always' replies to writes only after their batch is synced */
             bool slave_cleardb_before_fullresync;
             bool slave_readonly;
             bool slave_serve_stale_data;
             int64 slave_priority;
+            int64 slave_apply_threads;
+            bool repl_compression;
 
             int64 lua_time_limit;
 
@@ -97,13 +143,24 @@ OP_NAMESPACE_BEGIN
 
             uint32 primary_port;
 
-            int64 slave_client_output_buffer_limit;
-            int64 pubsub_client_output_buffer_limit;
+            ClientOutputBufferLimit client_output_buffer_limits[CLIENT_OUTPUT_CLASS_COUNT];
 
             bool slave_ignore_expire;
             bool slave_ignore_del;
             bool repl_disable_tcp_nodelay;
 
+            bool pipeline_batch_write;
+            bool flush_before_sleep;
+            int64 max_read_commands;
+            int64 max_read_bytes;
+            bool tcp_edge_triggered;
+            std::string event_loop_backend;
+            bool listen_reuseport;
+            int64 loop_rebalance_threshold;
+            int64 loop_rebalance_period;
+
+            int64 tracking_table_max_keys;
+
             std::string masterauth;
 
             std::string conf_path;
@@ -114,16 +171,23 @@ OP_NAMESPACE_BEGIN
             mmkv::OpenOptions mmkv_options;
 
             CommsConfig() :
-                    daemonize(false), unixsocketperm(755), max_clients(10000), tcp_keepalive(0), timeout(0), slowlog_log_slower_than(
+                    daemonize(false), client_qps_limit(0), qps_limit_error(false), busy_poll_socket(false), unixsocketperm(755), max_clients(10000), tcp_keepalive(0), timeout(0), slowlog_log_slower_than(
                             10000), slowlog_max_len(128), repl_data_dir("./repl"), backup_dir("./backup"), snapshot_filename(
                             "dump.rdb"), backup_redis_format(false), repl_ping_slave_period(10), repl_timeout(60), repl_wal_cache_size(
-                            100 * 1024 * 1024), repl_wal_size(1 * 1024 * 1024 * 1024), repl_state_persist_period(1), repl_backlog_time_limit(
-                            3600), slave_cleardb_before_fullresync(true), slave_readonly(true), slave_serve_stale_data(
-                            true), slave_priority(100), lua_time_limit(0), master_port(0), loglevel("INFO"), hll_sparse_max_bytes(
-                            3000), reply_pool_size(5000), primary_port(0), slave_client_output_buffer_limit(
-                            256 * 1024 * 1024), pubsub_client_output_buffer_limit(32 * 1024 * 1024), slave_ignore_expire(
-                            false), slave_ignore_del(false), repl_disable_tcp_nodelay(false), maxdb(16)
+                            100 * 1024 * 1024), repl_wal_size(1 * 1024 * 1024 * 1024), repl_wal_segment_size(
+                            64 * 1024 * 1024), repl_state_persist_period(1), repl_backlog_time_limit(
+                            3600), repl_wal_sync_period(1), repl_wal_fsync(WAL_FSYNC_EVERYSEC), slave_cleardb_before_fullresync(true), slave_readonly(true), slave_serve_stale_data(
+                            true), slave_priority(100), slave_apply_threads(0), repl_compression(false), lua_time_limit(0), master_port(0), loglevel("INFO"), hll_sparse_max_bytes(
+                            3000), reply_pool_size(5000), primary_port(0), slave_ignore_expire(
+                            false), slave_ignore_del(false), repl_disable_tcp_nodelay(false), pipeline_batch_write(
+                            true), flush_before_sleep(false), max_read_commands(0), max_read_bytes(0), tcp_edge_triggered(
+                            false), event_loop_backend("epoll"), listen_reuseport(false), loop_rebalance_threshold(
+                            0), loop_rebalance_period(5), tracking_table_max_keys(1000000), maxdb(16)
             {
+                client_output_buffer_limits[CLIENT_OUTPUT_PUBSUB] = ClientOutputBufferLimit(32 * 1024 * 1024,
+                        8 * 1024 * 1024, 60);
+                client_output_buffer_limits[CLIENT_OUTPUT_SLAVE] = ClientOutputBufferLimit(256 * 1024 * 1024,
+                        64 * 1024 * 1024, 60);
             }
             bool Parse(const Properties& props);
             uint32 PrimayPort();
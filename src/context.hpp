@@ -32,10 +32,13 @@
 #include "common/common.hpp"
 #include "thread/thread_local.hpp"
 #include "channel/all_includes.hpp"
+#include "util/token_bucket.hpp"
 
 using namespace comms::codec;
 OP_NAMESPACE_BEGIN
 
+    struct ServerStatistics;
+
     struct WatchKey
     {
             DBID db;
@@ -100,6 +103,32 @@ OP_NAMESPACE_BEGIN
             StringSet pubsub_patterns;
     };
 
+    /*
+     * The REDIRECT connection receiving invalidation messages of a tracking client.
+     * Only the channel id is kept, the connection may be migrated to another loop at any time.
+     */
+    struct TrackingTarget
+    {
+            uint32 id;
+            TrackingTarget(uint32 i = 0) :
+                    id(i)
+            {
+            }
+    };
+
+    struct TrackingContext
+    {
+            TrackingTarget target;
+            bool bcast;
+            bool noloop;
+            bool redir_broken;  //logged once the REDIRECT connection is gone
+            StringSet prefixes;
+            TrackingContext() :
+                    bcast(false), noloop(false), redir_broken(false)
+            {
+            }
+    };
+
     struct LUAContext
     {
             uint64 lua_time_start;
@@ -119,12 +148,15 @@ OP_NAMESPACE_BEGIN
             PubSubContext* pubsub;
             LUAContext* lua;
             ListBlockContext* block;
+            TrackingContext* tracking;
 
             Channel* client;
             DBID currentDB;
             RedisReply reply;
 
             std::string server_address;
+            ServerStatistics* server_stat; /* stats slot of server_address, resolved on first command */
+            TokenBucket ops_bucket; /* 'client-qps-limit' */
             bool authenticated;
 
             bool data_change;
@@ -138,16 +170,17 @@ OP_NAMESPACE_BEGIN
 
             bool processing;
             bool close_after_processed;
+            uint32 wal_sync_waits; /* batches of written commands not synced yet('wal-fsync always') */
             CallFlags flags;
             WatchKeySet* watch_keys;
             int64 sequence;  //recv command sequence in the server, start from 1
 
             bool abort_exec;
             Context() :
-                    transc(NULL), pubsub(NULL), lua(NULL), block(NULL), client(
-                    NULL), currentDB(0), authenticated(true), data_change(false), write_success(true), current_cmd(
+                    transc(NULL), pubsub(NULL), lua(NULL), block(NULL), tracking(NULL), client(
+                    NULL), currentDB(0), server_stat(NULL), authenticated(true), data_change(false), write_success(true), current_cmd(
                     NULL), current_cmd_type(REDIS_CMD_INVALID), born_time(0), last_interaction_ustime(0), processing(
-                            false), close_after_processed(false), watch_keys(NULL), sequence(0),abort_exec(false)
+                            false), close_after_processed(false), wal_sync_waits(0), watch_keys(NULL), sequence(0),abort_exec(false)
             {
             }
             TranscContext& GetTransc()
@@ -182,6 +215,14 @@ OP_NAMESPACE_BEGIN
                 }
                 return *block;
             }
+            TrackingContext& GetTracking()
+            {
+                if (NULL == tracking)
+                {
+                    tracking = new TrackingContext;
+                }
+                return *tracking;
+            }
             WatchKeySet& GetWatchKeySet()
             {
                 if (NULL == watch_keys)
@@ -211,6 +252,10 @@ OP_NAMESPACE_BEGIN
             {
                 DELETE(block);
             }
+            void ClearTracking()
+            {
+                DELETE(tracking);
+            }
             void ClearWatchKeySet()
             {
                 DELETE(watch_keys);
@@ -235,6 +280,7 @@ OP_NAMESPACE_BEGIN
                 ClearPubsub();
                 ClearLua();
                 ClearBlockContext();
+                ClearTracking();
                 DELETE(watch_keys);
             }
             ~Context()
@@ -245,7 +291,7 @@ OP_NAMESPACE_BEGIN
 
     typedef TreeSet<Context*>::Type ContextSet;
     typedef std::deque<Context*> ContextDeque;
-    typedef TreeMap<uint32, Context*>::Type ContextTable;
+    typedef ChannelSlotTable<Context*> ContextTable;
 
     struct RedisCursor
     {
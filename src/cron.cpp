@@ -108,6 +108,11 @@ OP_NAMESPACE_BEGIN
                     }
                     it++;
                 }
+                if (it == g_db->m_clients.end())
+                {
+                    //clients are kept in slot order, new ones may take slots already checked
+                    last_check_id = 0;
+                }
             }
     };
 
@@ -129,8 +134,10 @@ OP_NAMESPACE_BEGIN
         m_misc_cron.serv.GetTimer().ScheduleHeapTask(new ConnectionTimeout, 100, 100, MILLIS);
         m_misc_cron.serv.GetTimer().ScheduleHeapTask(new TrackOpsTask, 1, 1, SECONDS);
 
-        m_db_cron.Start();
-        m_misc_cron.Start();
+        ThreadOptions options;
+        options.cpus = g_db->GetConfig().cron_cpus;
+        m_db_cron.Start(options);
+        m_misc_cron.Start(options);
     }
 
     void CronManager::StopSelf()
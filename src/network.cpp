@@ -61,6 +61,13 @@ OP_NAMESPACE_BEGIN
         ChannelService& serv = m_ctx.client->GetService();
         uint32 channel_id = ctx.GetChannel()->GetID();
         m_ctx.processing = true;
+        /* the connection may have been moved to another worker, use that thread's pool */
+        RedisReplyPool& reply_pool = m_db->GetRedisReplyPool();
+        if (m_ctx.reply.pool != &reply_pool)
+        {
+            reply_pool.SetMaxSize((uint32) (m_db->GetConfig().reply_pool_size));
+            m_ctx.reply.SetPool(&reply_pool);
+        }
         m_ctx.reply.pool->Clear();
         m_ctx.current_cmd = NULL;
         CallFlags flags;
@@ -69,15 +76,30 @@ OP_NAMESPACE_BEGIN
             //slave must NOT write WAL
             flags.no_wal = 1;
         }
+        bool sync_wal = !flags.no_wal && m_db->GetConfig().repl_wal_fsync == WAL_FSYNC_ALWAYS;
+        uint64 staged = sync_wal ? g_repl->StagedWALCount() : 0;
         int ret = m_db->Call(m_ctx, *cmd, flags);
         if (m_delete_after_processing)
         {
             delete this;
             return;
         }
+        if (sync_wal && g_repl->StagedWALCount() != staged)
+        {
+            m_ctx.wal_sync_waits++;
+            g_repl->WaitWALSync(m_ctx.client);
+        }
         if (ret >= 0 && m_ctx.reply.type != 0)
         {
-            m_ctx.client->Write(m_ctx.reply);
+            if (m_ctx.wal_sync_waits > 0)
+            {
+                /* keep the replies in order behind the ones waiting for the sync */
+                RedisReplyEncoder::Encode(m_held_replies, m_ctx.reply);
+            }
+            else
+            {
+                m_ctx.client->Write(m_ctx.reply);
+            }
         }
         if (ret < 0 && serv.GetChannel(channel_id) != NULL)
         {
@@ -93,10 +115,49 @@ OP_NAMESPACE_BEGIN
             }
         }
     }
+    void RedisRequestHandler::WALSyncedCallback(Channel* ch, void* data)
+    {
+        if (NULL == ch)
+        {
+            return;
+        }
+        RedisRequestHandler* handler = (RedisRequestHandler*) ch->GetPipeline().Get("handler");
+        if (NULL == handler || 0 == handler->m_ctx.wal_sync_waits)
+        {
+            return;
+        }
+        handler->m_ctx.wal_sync_waits--;
+        if (0 == handler->m_ctx.wal_sync_waits && handler->m_held_replies.Readable())
+        {
+            ch->Write(handler->m_held_replies);
+            handler->m_held_replies.Clear();
+        }
+    }
+    /*
+     * The writes of the held replies may not be durable, the client is closed without them.
+     */
+    void RedisRequestHandler::WALSyncFailedCallback(Channel* ch, void* data)
+    {
+        if (NULL == ch)
+        {
+            return;
+        }
+        RedisRequestHandler* handler = (RedisRequestHandler*) ch->GetPipeline().Get("handler");
+        if (NULL == handler || 0 == handler->m_ctx.wal_sync_waits)
+        {
+            return;
+        }
+        handler->m_ctx.wal_sync_waits = 0;
+        handler->m_held_replies.Clear();
+        ch->Close();
+    }
     void RedisRequestHandler::ChannelClosed(ChannelHandlerContext& ctx, ChannelStateEvent& e)
     {
         m_db->FreeClientContext(m_ctx);
-        m_db->GetStatistics().IncAcceptedClient(m_ctx.server_address, -1);
+        if (NULL != m_ctx.server_stat)
+        {
+            m_db->GetStatistics().IncAcceptedClient(m_ctx.server_stat, -1);
+        }
     }
     void RedisRequestHandler::ChannelConnected(ChannelHandlerContext& ctx, ChannelStateEvent& e)
     {
@@ -111,13 +172,21 @@ OP_NAMESPACE_BEGIN
             m_ctx.authenticated = false;
         }
         uint32 parent_id = ctx.GetChannel()->GetParentID();
-        ServerSocketChannel* server_socket = (ServerSocketChannel*) m_db->GetChannelService().GetChannel(parent_id);
+        /* SO_REUSEPORT listeners live on the same worker as the channels they accept. */
+        ServerSocketChannel* server_socket = (ServerSocketChannel*) ctx.GetChannel()->GetService().GetChannel(parent_id);
+        if (NULL == server_socket)
+        {
+            server_socket = (ServerSocketChannel*) m_db->GetChannelService().GetChannel(parent_id);
+        }
         m_ctx.server_address = server_socket->GetStringAddress();
-        m_db->GetStatistics().IncAcceptedClient(m_ctx.server_address, 1);
+        m_ctx.server_stat = m_db->GetStatistics().GetServerStatistics(m_ctx.server_address);
+        m_ctx.ops_bucket.SetRate(m_db->GetConfig().client_qps_limit);
+        m_db->GetStatistics().IncAcceptedClient(m_ctx.server_stat, 1);
         m_db->AddClientContext(m_ctx);
 
         //client ip white list
         ReadLockGuard<SpinRWLock> guard(m_db->m_cfg_lock);
+        m_db->SetClientOutputClass(ctx.GetChannel(), CLIENT_OUTPUT_NORMAL);
         if (!m_db->GetConfig().trusted_ip.empty())
         {
             const Address* remote = ctx.GetChannel()->GetRemoteAddress();
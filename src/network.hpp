@@ -41,6 +41,7 @@ OP_NAMESPACE_BEGIN
         private:
             Comms* m_db;
             Context m_ctx;
+            Buffer m_held_replies; /* encoded replies waiting for the WAL sync */
             bool m_delete_after_processing;
             //void ExceptionCaught(ChannelHandlerContext& ctx, ExceptionEvent& e);
             void MessageReceived(ChannelHandlerContext& ctx, MessageEvent<RedisCommandFrame>& e);
@@ -53,6 +54,8 @@ OP_NAMESPACE_BEGIN
             }
             static void PipelineInit(ChannelPipeline* pipeline, void* data);
             static void PipelineDestroy(ChannelPipeline* pipeline, void* data);
+            static void WALSyncedCallback(Channel* ch, void* data);
+            static void WALSyncFailedCallback(Channel* ch, void* data);
     };
 OP_NAMESPACE_END
 #endif /* NETWORK_HPP_ */
@@ -9,6 +9,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include "repl.hpp"
+#include "repl_compress.hpp"
 
 #define MAX_SEND_CACHE_SIZE 8192
 
@@ -31,11 +32,13 @@ namespace comms
             uint32 acktime;
             uint32 port;
             int repldbfd;
+            int walfd;  //wal segment being sent with sendfile, pinned until done
             bool isRedisSlave;
+            bool lz4;  //stream after the psync reply is sent in lz4 frames
             SyncState state;
             SlaveConn() :
-                    conn(NULL), sync_offset(0), ack_offset(0), sync_cksm(0), acktime(0), port(0), repldbfd(-1), isRedisSlave(
-                            false), state(SYNC_STATE_INVALID)
+                    conn(NULL), sync_offset(0), ack_offset(0), sync_cksm(0), acktime(0), port(0), repldbfd(-1), walfd(-1), isRedisSlave(
+                            false), lz4(false), state(SYNC_STATE_INVALID)
             {
             }
             std::string GetAddress()
@@ -58,7 +61,7 @@ namespace comms
     };
 
     Master::Master() :
-            m_repl_noslaves_since(0)
+            m_repl_noslaves_since(0), m_lz4_raw_bytes(0), m_lz4_wire_bytes(0)
     {
     }
 
@@ -240,7 +243,14 @@ namespace comms
         fstat(setting.fd, &st);
         Buffer header;
         header.Printf("$%llu\r\n", st.st_size);
-        slave->conn->Write(header);
+        WriteSlave(slave, header.GetRawReadBuffer(), header.ReadableBytes());
+        if (slave->lz4)
+        {
+            //compressed chunk by chunk in ChannelWritable instead of sendfile
+            slave->repldbfd = setting.fd;
+            SendSnapshotChunk(slave);
+            return;
+        }
 
         setting.file_rest_len = st.st_size;
         setting.on_complete = OnSnapshotFileSendComplete;
@@ -250,11 +260,51 @@ namespace comms
         slave->conn->SendFile(setting);
     }
 
+    void Master::SendSnapshotChunk(SlaveConn* slave)
+    {
+        char buf[REPL_LZ4_FRAME_SIZE];
+        ssize_t n = read(slave->repldbfd, buf, sizeof(buf));
+        if (n > 0)
+        {
+            WriteSlave(slave, buf, n);
+            slave->conn->EnableWriting();
+            return;
+        }
+        if (n < 0)
+        {
+            int err = errno;
+            ERROR_LOG("Failed to read snapshot file for reason:%s", strerror(err));
+            OnSnapshotFileSendFailure(slave);
+            slave->conn->Close();
+            return;
+        }
+        OnSnapshotFileSendComplete(slave);
+        SyncWAL(slave);
+    }
+
+    /*
+     * Write the replication stream after the psync reply to a slave, in lz4 frames if the slave
+     * asked for them.
+     */
+    void Master::WriteSlave(SlaveConn* slave, const char* data, size_t len)
+    {
+        if (!slave->lz4)
+        {
+            Buffer msg(const_cast<char*>(data), 0, len);
+            slave->conn->Write(msg);
+            return;
+        }
+        Buffer frames;
+        lz4_frame_encode(data, len, frames);
+        m_lz4_raw_bytes += len;
+        m_lz4_wire_bytes += frames.ReadableBytes();
+        slave->conn->Write(frames);
+    }
+
     static int send_wal_toslave(const void* log, size_t loglen, void* data)
     {
         SlaveConn* slave = (SlaveConn*) data;
-        Buffer msg((char*) log, 0, loglen);
-        slave->conn->Write(msg);
+        g_repl->GetMaster().WriteSlave(slave, (const char*) log, loglen);
         slave->sync_offset += loglen;
         //INFO_LOG("####%d %d %d", loglen, slave->sync_offset, g_repl->WALEndOffset());
         if (slave->sync_offset == g_repl->WALEndOffset())
@@ -269,8 +319,56 @@ namespace comms
         return 0;
     }
 
+    static void OnWALFileSendComplete(void* data)
+    {
+        SlaveConn* slave = (SlaveConn*) data;
+        swal_segment_unpin(g_repl->GetWAL(), slave->walfd);
+        slave->walfd = -1;
+        slave->conn->GetWritableOptions().auto_disable_writing = slave->sync_offset == g_repl->WALEndOffset();
+    }
+
+    static void OnWALFileSendFailure(void* data)
+    {
+        SlaveConn* slave = (SlaveConn*) data;
+        swal_segment_unpin(g_repl->GetWAL(), slave->walfd);
+        slave->walfd = -1;
+    }
+
+    /*
+     * Send the wal of a lagging slave straight from the segment file, so that it is not copied
+     * into the connection's output buffer. The segment stays pinned while sending, so it's not
+     * recycled even if it falls out of the backlog. Returns -1 if the region can not be sent
+     * this way.
+     */
+    static int send_wal_file_toslave(SlaveConn* slave)
+    {
+        int fd;
+        size_t pos, len;
+        if (0 != swal_segment_region(g_repl->GetWAL(), slave->sync_offset, &fd, &pos, &len))
+        {
+            return -1;
+        }
+        SendFileSetting setting;
+        setting.fd = fd;
+        setting.file_offset = pos;
+        setting.file_rest_len = len;
+        setting.on_complete = OnWALFileSendComplete;
+        setting.on_failure = OnWALFileSendFailure;
+        setting.data = slave;
+        slave->walfd = setting.fd;
+        slave->sync_offset += len;
+        slave->conn->GetWritableOptions().auto_disable_writing = false;
+        slave->conn->SendFile(setting);
+        return 0;
+    }
+
     void Master::SyncWAL(SlaveConn* slave)
     {
+        if (slave->walfd >= 0)
+        {
+            //continued by ChannelWritable once the file region is sent
+            return;
+        }
         if (slave->sync_offset < g_repl->WALStartOffset() || slave->sync_offset > g_repl->WALEndOffset())
         {
             slave->conn->Close();
@@ -280,6 +378,22 @@ namespace comms
         }
         if (slave->sync_offset < g_repl->WALEndOffset())
         {
+            /*
+             * slaves at the tail are fed from the in-memory cache, the ones lagging behind it from
+             * the segment files.
+             */
+            uint64 lag = g_repl->WALEndOffset() - slave->sync_offset;
+            if (slave->lz4)
+            {
+                //compressed per batch, so never sent from the files directly
+                swal_replay(g_repl->GetWAL(), slave->sync_offset, REPL_LZ4_FRAME_SIZE, send_wal_toslave, slave);
+                return;
+            }
+            if (lag > MAX_SEND_CACHE_SIZE && lag > (uint64) g_db->GetConfig().repl_wal_cache_size
+                    && 0 == send_wal_file_toslave(slave))
+            {
+                return;
+            }
             swal_replay(g_repl->GetWAL(), slave->sync_offset, MAX_SEND_CACHE_SIZE, send_wal_toslave, slave);
         }
     }
@@ -287,7 +401,6 @@ namespace comms
     void Master::SyncWAL()
     {
         SlaveConnTable::iterator it = m_slaves.begin();
-        bool no_lag_slave = true;
         while (it != m_slaves.end())
         {
             if (it->second != NULL)
@@ -297,21 +410,11 @@ namespace comms
                     if (it->second->sync_offset != g_repl->WALStartOffset())
                     {
                         SyncWAL(it->second);
-                        no_lag_slave = false;
                     }
                 }
-                else
-                {
-                    no_lag_slave = false;
-                }
-
             }
             it++;
         }
-        if (no_lag_slave)
-        {
-            swal_clear_replay_cache(g_repl->GetWAL());
-        }
     }
 
     int Master::CreateSnapshot(bool is_redis_type)
@@ -402,6 +505,11 @@ namespace comms
         if (found != m_slaves.end())
         {
             WARN_LOG("Slave %s closed.", found->second->GetAddress().c_str());
+            if (found->second->lz4 && found->second->repldbfd >= 0)
+            {
+                //snapshot sent by SendSnapshotChunk
+                OnSnapshotFileSendFailure(found->second);
+            }
             found->second = NULL;
         }
     }
@@ -418,6 +526,10 @@ namespace comms
                         g_repl->WALEndOffset(), slave->state);
                 SyncWAL(slave);
             }
+            else if (NULL != slave && slave->state == SYNC_STATE_SYNCING_SNAPSHOT && slave->lz4 && slave->repldbfd >= 0)
+            {
+                SendSnapshotChunk(slave);
+            }
         }
         else
         {
@@ -490,6 +602,7 @@ namespace comms
         slave->conn->SetChannelPipelineInitializor(slave_pipeline_init, NULL);
         slave->conn->SetChannelPipelineFinalizer(slave_pipeline_finallize, NULL);
         slave->conn->GetWritableOptions().auto_disable_writing = false;
+        g_db->SetClientOutputClass(slave->conn, CLIENT_OUTPUT_SLAVE);
         SyncSlave(slave);
     }
 
@@ -613,6 +726,24 @@ namespace comms
         GetSlaveConn(slave).port = port;
     }
 
+    void Master::SetSlaveLZ4(Channel* slave)
+    {
+        GetSlaveConn(slave).lz4 = true;
+    }
+
+    void Master::UpdateSlaveOutputLimits()
+    {
+        SlaveConnTable::iterator it = m_slaves.begin();
+        while (it != m_slaves.end())
+        {
+            if (NULL != it->second)
+            {
+                g_db->SetClientOutputClass(it->second->conn, CLIENT_OUTPUT_SLAVE);
+            }
+            it++;
+        }
+    }
+
     Master::~Master()
     {
     }
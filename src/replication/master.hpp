@@ -55,6 +55,8 @@ namespace comms
         private:
             SlaveConnTable m_slaves;
             time_t m_repl_noslaves_since;
+            volatile uint64 m_lz4_raw_bytes;
+            volatile uint64 m_lz4_wire_bytes;
 
             void OnHeartbeat();
 
@@ -69,6 +71,7 @@ namespace comms
 
             void SyncWAL(SlaveConn* slave);
             void SendSnapshotToSlave(SlaveConn* slave);
+            void SendSnapshotChunk(SlaveConn* slave);
             int CreateSnapshot(bool is_redis_type);
             static int DumpRDBRoutine(void* cb);
         public:
@@ -77,6 +80,13 @@ namespace comms
             void AddSlave(SlaveConn* slave);
             void AddSlave(Channel* slave, RedisCommandFrame& cmd);
             void SetSlavePort(Channel* slave, uint32 port);
+            void SetSlaveLZ4(Channel* slave);
+            void UpdateSlaveOutputLimits();
+            void WriteSlave(SlaveConn* slave, const char* data, size_t len);
+            int64 LZ4SavedBytes() const
+            {
+                return (int64) m_lz4_raw_bytes - (int64) m_lz4_wire_bytes;
+            }
             size_t ConnectedSlaves();
             void SyncWAL();
             void FullResyncSlaves(bool is_redis_type);
@@ -0,0 +1,286 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ *
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "parallel_applier.hpp"
+#include "comms.hpp"
+#include "repl.hpp"
+#include "util/atomic.hpp"
+
+namespace comms
+{
+    ParallelApplier::ApplyThread::ApplyThread(ParallelApplier* applier) :
+            m_applier(applier), m_sleeping(false), m_running(true)
+    {
+        m_ctx.server_address = MASTER_SERVER_ADDRESS_NAME;
+        m_ctx.client = NULL;
+    }
+
+    void ParallelApplier::ApplyThread::Push(ApplyTask* task)
+    {
+        m_queue.Push(task);
+        __sync_synchronize();
+        if (m_sleeping)
+        {
+            m_lock.Lock();
+            m_lock.Notify();
+            m_lock.Unlock();
+        }
+    }
+
+    void ParallelApplier::ApplyThread::Run()
+    {
+        while (m_running)
+        {
+            ApplyTask* task = NULL;
+            if (!m_queue.Pop(task))
+            {
+                m_lock.Lock();
+                m_sleeping = true;
+                __sync_synchronize();
+                if (!m_queue.Pop(task))
+                {
+                    m_lock.Wait(100);
+                }
+                m_sleeping = false;
+                m_lock.Unlock();
+                if (NULL == task)
+                {
+                    continue;
+                }
+            }
+            CallFlags flags;
+            flags.no_wal = 1;
+            m_ctx.currentDB = task->db;
+            g_db->Call(m_ctx, task->cmd, flags);
+            __sync_synchronize();
+            task->applied = true;
+            m_applier->TaskApplied();
+        }
+    }
+
+    void ParallelApplier::ApplyThread::Stop()
+    {
+        m_running = false;
+        m_lock.Lock();
+        m_lock.Notify();
+        m_lock.Unlock();
+        Join();
+    }
+
+    ParallelApplier::ParallelApplier() :
+            m_inflight_bytes(0), m_unapplied(0), m_commit_posted(0)
+    {
+    }
+
+    int ParallelApplier::Init(uint32 threads)
+    {
+        for (uint32 i = 0; i < threads; i++)
+        {
+            ApplyThread* thread = NULL;
+            NEW(thread, ApplyThread(this));
+            thread->Start();
+            m_threads.push_back(thread);
+        }
+        INFO_LOG("Apply synced commands with %u threads.", threads);
+        return 0;
+    }
+
+    /*
+     * Returns the index of the thread to apply the command, or -1 if the command must be applied
+     * by the replication thread after all commands before it.
+     */
+    int ParallelApplier::Route(Context& ctx, RedisCommandFrame& cmd)
+    {
+        if (ctx.InTransc() || cmd.GetArguments().empty())
+        {
+            return -1;
+        }
+        Comms::RedisCommandHandlerSetting* setting = g_db->FindRedisCommandHandlerSetting(cmd);
+        if (NULL == setting || !(setting->flags & COMMS_CMD_WRITE))
+        {
+            return -1;
+        }
+        switch (cmd.GetType())
+        {
+            case REDIS_CMD_BITOP:
+            case REDIS_CMD_MSET:
+            case REDIS_CMD_MSETNX:
+            case REDIS_CMD_SDIFFSTORE:
+            case REDIS_CMD_SINTERSTORE:
+            case REDIS_CMD_SUNIONSTORE:
+            case REDIS_CMD_SMOVE:
+            case REDIS_CMD_ZINTERSTORE:
+            case REDIS_CMD_ZUNIONSTORE:
+            case REDIS_CMD_RPOPLPUSH:
+            case REDIS_CMD_BRPOPLPUSH:
+            case REDIS_CMD_BLPOP:
+            case REDIS_CMD_BRPOP:
+            case REDIS_CMD_MOVE:
+            case REDIS_CMD_RENAME:
+            case REDIS_CMD_RENAMENX:
+            case REDIS_CMD_SORT:
+            case REDIS_CMD_PFMERGE:
+            case REDIS_CMD_PFCOUNT:
+            {
+                return -1;
+            }
+            case REDIS_CMD_DEL:
+            {
+                if (cmd.GetArguments().size() > 1)
+                {
+                    return -1;
+                }
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+        const std::string& key = cmd.GetArguments()[0];
+        uint32 hash = 5381 + (uint32) ctx.currentDB;
+        for (size_t i = 0; i < key.size(); i++)
+        {
+            hash = ((hash << 5) + hash) + (unsigned char) key[i]; /* hash * 33 + c */
+        }
+        return hash % m_threads.size();
+    }
+
+    void ParallelApplier::Serial(Context& ctx, RedisCommandFrame& cmd)
+    {
+        CallFlags flags;
+        flags.no_wal = 1;
+        g_db->Call(ctx, cmd, flags);
+        g_repl->UpdateDataOffsetCksm(cmd.GetRawProtocolData());
+    }
+
+    void ParallelApplier::Apply(Context& ctx, RedisCommandFrame& cmd)
+    {
+        int idx = Enabled() ? Route(ctx, cmd) : -1;
+        if (idx < 0)
+        {
+            Drain();
+            Serial(ctx, cmd);
+            return;
+        }
+        /*
+         * the decoded frame may point into the wal cache or the connection buffer, so the task owns
+         * a copy of the arguments and the raw data.
+         */
+        ArgumentArray args(cmd.GetArguments());
+        args.push_front(cmd.GetCommand());
+        ApplyTask* task = NULL;
+        NEW(task, ApplyTask(args, ctx.currentDB));
+        const Buffer& raw = cmd.GetRawProtocolData();
+        task->raw.Write(raw.GetRawReadBuffer(), raw.ReadableBytes());
+        m_inflight.push_back(task);
+        m_inflight_bytes += raw.ReadableBytes();
+        atomic_add_uint32(&m_unapplied, 1);
+        m_threads[idx]->Push(task);
+    }
+
+    /*
+     * Called by an apply thread once a task is applied: wakes up a Drain() waiting for the last
+     * task, and has the replication thread commit the offset, one callback pending at most.
+     */
+    void ParallelApplier::TaskApplied()
+    {
+        if (0 == atomic_sub_uint32(&m_unapplied, 1))
+        {
+            m_applied_lock.Lock();
+            m_applied_lock.Notify();
+            m_applied_lock.Unlock();
+        }
+        if (atomic_cmp_set_uint32(&m_commit_posted, 0, 1))
+        {
+            g_repl->GetIOServ().AsyncIO(0, CommitCallback, this);
+        }
+    }
+
+    void ParallelApplier::CommitCallback(Channel*, void* data)
+    {
+        ParallelApplier* applier = (ParallelApplier*) data;
+        applier->m_commit_posted = 0;
+        __sync_synchronize();
+        applier->Commit();
+    }
+
+    /*
+     * Moves the data offset&cksm over the applied prefix of the routed commands, so that the
+     * offset acked to the master never covers a command not applied yet.
+     */
+    void ParallelApplier::Commit()
+    {
+        while (!m_inflight.empty())
+        {
+            ApplyTask* task = m_inflight.front();
+            if (!task->applied)
+            {
+                break;
+            }
+            g_repl->UpdateDataOffsetCksm(task->raw);
+            m_inflight_bytes -= task->raw.ReadableBytes();
+            m_inflight.pop_front();
+            DELETE(task);
+        }
+    }
+
+    void ParallelApplier::Drain()
+    {
+        m_applied_lock.Lock();
+        while (m_unapplied > 0)
+        {
+            m_applied_lock.Wait();
+        }
+        m_applied_lock.Unlock();
+        Commit();
+    }
+
+    void ParallelApplier::Stop()
+    {
+        for (size_t i = 0; i < m_threads.size(); i++)
+        {
+            m_threads[i]->Stop();
+            DELETE(m_threads[i]);
+        }
+        m_threads.clear();
+        while (!m_inflight.empty())
+        {
+            DELETE(m_inflight.front());
+            m_inflight.pop_front();
+        }
+        m_inflight_bytes = 0;
+        m_unapplied = 0;
+    }
+
+    ParallelApplier::~ParallelApplier()
+    {
+        Stop();
+    }
+}
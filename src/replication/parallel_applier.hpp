@@ -0,0 +1,113 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ *
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PARALLEL_APPLIER_HPP_
+#define PARALLEL_APPLIER_HPP_
+#include "channel/all_includes.hpp"
+#include "thread/thread.hpp"
+#include "thread/thread_mutex_lock.hpp"
+#include "util/concurrent_queue.hpp"
+#include "context.hpp"
+#include <deque>
+#include <vector>
+
+using namespace comms::codec;
+
+namespace comms
+{
+    /*
+     * Applies the commands synced from the master on several threads. Commands are routed by
+     * the hash of their key, so the ones on one key keep the master's order. Commands with no
+     * single key(multi-key commands, SELECT, MULTI/EXEC, EVAL...) are barriers run by the
+     * replication thread once everything before them is applied.
+     */
+    class ParallelApplier
+    {
+        private:
+            struct ApplyTask
+            {
+                    RedisCommandFrame cmd;
+                    DBID db;
+                    Buffer raw;  //raw protocol data in the wal
+                    volatile bool applied;
+                    ApplyTask(ArgumentArray& args, DBID id) :
+                            cmd(args), db(id), applied(false)
+                    {
+                    }
+            };
+            class ApplyThread: public Thread
+            {
+                private:
+                    ParallelApplier* m_applier;
+                    SPSCQueue<ApplyTask*> m_queue;
+                    ThreadMutexLock m_lock;
+                    volatile bool m_sleeping;
+                    volatile bool m_running;
+                    Context m_ctx;
+                    void Run();
+                public:
+                    ApplyThread(ParallelApplier* applier);
+                    void Push(ApplyTask* task);
+                    void Stop();
+            };
+            typedef std::deque<ApplyTask*> ApplyTaskQueue;
+            typedef std::vector<ApplyThread*> ApplyThreadArray;
+            ApplyThreadArray m_threads;
+            ApplyTaskQueue m_inflight;  //routed tasks in wal order, owned by the replication thread
+            uint64 m_inflight_bytes;
+            volatile uint32_t m_unapplied;  //routed tasks the apply threads haven't finished
+            volatile uint32_t m_commit_posted;
+            ThreadMutexLock m_applied_lock;  //notified when m_unapplied drops to 0
+            int Route(Context& ctx, RedisCommandFrame& cmd);
+            void Serial(Context& ctx, RedisCommandFrame& cmd);
+            void TaskApplied();
+            static void CommitCallback(Channel*, void* data);
+        public:
+            ParallelApplier();
+            int Init(uint32 threads);
+            bool Enabled() const
+            {
+                return !m_threads.empty();
+            }
+            /*
+             * Bytes of the wal routed to the apply threads but not counted in the data offset yet.
+             */
+            uint64 InflightBytes() const
+            {
+                return m_inflight_bytes;
+            }
+            void Apply(Context& ctx, RedisCommandFrame& cmd);
+            void Commit();
+            void Drain();
+            void Stop();
+            ~ParallelApplier();
+    };
+}
+
+#endif /* PARALLEL_APPLIER_HPP_ */
@@ -5,6 +5,7 @@
  *      Author: wangqiying
  */
 #include "comms.hpp"
+#include "network.hpp"
 #include "redis/crc64.h"
 
 #define SERVER_KEY_SIZE 40
@@ -26,7 +27,7 @@ namespace comms
     };
 
     ReplicationService::ReplicationService() :
-            m_wal(NULL)
+            m_wal(NULL), m_local_staging(false), m_wal_seq(0), m_wal_iov_select_db(0), m_wal_retry(false)
     {
         g_repl = this;
     }
@@ -43,6 +44,10 @@ namespace comms
         {
             FlushSyncWAL();
         }
+        if (m_wal_retry)
+        {
+            DrainWAL();
+        }
     }
     int ReplicationService::Init()
     {
@@ -50,6 +55,7 @@ namespace comms
         options->create_ifnotexist = true;
         options->user_meta_size = 4096;
         options->max_file_size = g_db->GetConfig().repl_wal_size;
+        options->segment_size = g_db->GetConfig().repl_wal_segment_size;
         options->ring_cache_size = g_db->GetConfig().repl_wal_cache_size;
         options->cksm_func = crc64;
         options->log_prefix = "comms";
@@ -60,6 +66,12 @@ namespace comms
             ERROR_LOG("Failed to init wal log with err code:%d", err);
             return err;
         }
+        if (swal_open_dropped_len(m_wal) > 0)
+        {
+            WARN_LOG("Dropped %llu bytes of the wal backlog which could not be kept in %lld bytes segments, slaves behind offset:%llu need a full resync.",
+                    (unsigned long long) swal_open_dropped_len(m_wal), g_db->GetConfig().repl_wal_segment_size,
+                    (unsigned long long) swal_start_offset(m_wal));
+        }
         ReplMeta* meta = (ReplMeta*) swal_user_meta(m_wal);
         if (meta->serverkey[0] == 0)
         {
@@ -83,12 +95,17 @@ namespace comms
                 }
         };
         GetTimer().ScheduleHeapTask(new RoutineTask(this), 100, 100, MILLIS);
-        Start();
+        ThreadOptions thread_options;
+        thread_options.cpus = g_db->GetConfig().repl_cpus;
+        Start(thread_options);
         return 0;
     }
     void ReplicationService::FlushSyncWAL()
     {
-        swal_sync(m_wal);
+        if (g_db->GetConfig().repl_wal_fsync != WAL_FSYNC_NO)
+        {
+            swal_sync(m_wal);
+        }
         swal_sync_meta(m_wal);
     }
     swal_t* ReplicationService::GetWAL()
@@ -132,35 +149,225 @@ namespace comms
         return len;
     }
 
-    struct ReplCommand
+    ReplicationService::WALStaging* ReplicationService::GetLocalStaging()
     {
-            DBID db;
-            Buffer cmdbuf;
-    };
+        WALStaging*& staging = m_local_staging.GetValue();
+        if (NULL == staging)
+        {
+            staging = new WALStaging;
+            LockGuard<SpinMutexLock> guard(m_stagings_lock);
+            m_stagings.push_back(staging);
+        }
+        return staging;
+    }
 
-    void ReplicationService::WriteWALCallback(Channel*, void* data)
+    /*
+     * Called with the staging locked, only the first command of a batch wakes up the replication thread.
+     */
+    void ReplicationService::NotifyStaging(WALStaging* staging)
     {
-        ReplCommand* cmd = (ReplCommand*) data;
-        g_repl->WriteWAL(cmd->db, cmd->cmdbuf);
-        DELETE(cmd);
-        g_repl->GetMaster().SyncWAL();
+        if (!staging->notified)
+        {
+            staging->notified = true;
+            m_io_serv.AsyncIO(0, DrainWALCallback, NULL);
+        }
     }
 
     int ReplicationService::WriteWAL(DBID db, RedisCommandFrame& cmd)
     {
-        ReplCommand* repl_cmd = new ReplCommand;
-        repl_cmd->db = db;
-        const Buffer& raw_protocol = cmd.GetRawProtocolData();
-        if (raw_protocol.Readable())
+        WALStaging* staging = GetLocalStaging();
         {
-            repl_cmd->cmdbuf.Write(raw_protocol.GetRawReadBuffer(), raw_protocol.ReadableBytes());
+            LockGuard<SpinMutexLock> guard(staging->lock);
+            Buffer& cmds = staging->front->cmds;
+            size_t mark = cmds.ReadableBytes();
+            const Buffer& raw_protocol = cmd.GetRawProtocolData();
+            if (raw_protocol.Readable())
+            {
+                cmds.Write(raw_protocol.GetRawReadBuffer(), raw_protocol.ReadableBytes());
+            }
+            else
+            {
+                RedisCommandEncoder::Encode(cmds, cmd);
+            }
+            WALStagedCommand staged;
+            staged.db = db;
+            staged.len = cmds.ReadableBytes() - mark;
+            staged.seq = atomic_add_uint64(&m_wal_seq, 1);
+            staging->front->index.push_back(staged);
+            NotifyStaging(staging);
         }
-        else
+        staging->staged++;
+        return 0;
+    }
+
+    /*
+     * Number of commands staged by the calling thread, a caller compares it before/after a call
+     * to know if the call wrote the WAL.
+     */
+    uint64 ReplicationService::StagedWALCount()
+    {
+        return GetLocalStaging()->staged;
+    }
+
+    /*
+     * Release the client's held replies once everything it staged so far is synced, the waiter
+     * may land in a later batch than its commands which is still synced after them.
+     */
+    void ReplicationService::WaitWALSync(Channel* client)
+    {
+        WALStaging* staging = GetLocalStaging();
+        LockGuard<SpinMutexLock> guard(staging->lock);
+        WALSyncWaiter waiter;
+        waiter.serv = &(client->GetService());
+        waiter.channel_id = client->GetID();
+        staging->front->waiters.push_back(waiter);
+        NotifyStaging(staging);
+    }
+
+    void ReplicationService::DrainWALCallback(Channel*, void* data)
+    {
+        g_repl->DrainWAL();
+    }
+
+    /*
+     * Take the staged commands of all workers as one batch, in the order they were staged.
+     * Every staging is locked while the batches are swapped, so the batch holds exactly the
+     * commands stamped before the swap, and the per-worker batches are merged by stamp.
+     */
+    void ReplicationService::CollectWAL()
+    {
         {
-            RedisCommandEncoder::Encode(repl_cmd->cmdbuf, cmd);
+            LockGuard<SpinMutexLock> guard(m_stagings_lock);
+            m_draining = m_stagings;
         }
-        m_io_serv.AsyncIO(0, WriteWALCallback, repl_cmd);
-        return 0;
+        for (size_t i = 0; i < m_draining.size(); i++)
+        {
+            m_draining[i]->lock.Lock();
+        }
+        for (size_t i = 0; i < m_draining.size(); i++)
+        {
+            WALStaging* staging = m_draining[i];
+            std::swap(staging->front, staging->back);
+            staging->notified = false;
+        }
+        for (size_t i = m_draining.size(); i > 0; i--)
+        {
+            m_draining[i - 1]->lock.Unlock();
+        }
+        bool gen_select = g_db->GetConfig().master_host.empty();
+        DBID select_db = ((ReplMeta*) swal_user_meta(m_wal))->select_db;
+        m_wal_iov.clear();
+        m_drain_cursors.assign(m_draining.size(), WALDrainCursor());
+        while (true)
+        {
+            size_t next = m_draining.size();
+            uint64 next_seq = 0;
+            for (size_t i = 0; i < m_draining.size(); i++)
+            {
+                const WALStagingBatch* batch = m_draining[i]->back;
+                size_t index = m_drain_cursors[i].index;
+                if (index < batch->index.size() && (next == m_draining.size() || batch->index[index].seq < next_seq))
+                {
+                    next = i;
+                    next_seq = batch->index[index].seq;
+                }
+            }
+            if (next == m_draining.size())
+            {
+                break;
+            }
+            WALDrainCursor& cursor = m_drain_cursors[next];
+            const WALStagingBatch* batch = m_draining[next]->back;
+            const WALStagedCommand& staged = batch->index[cursor.index];
+            if (gen_select && select_db != staged.db)
+            {
+                std::string& select = m_select_cmds[staged.db];
+                if (select.empty())
+                {
+                    Buffer buf;
+                    buf.Printf("select %u\r\n", staged.db);
+                    select.assign(buf.GetRawReadBuffer(), buf.ReadableBytes());
+                }
+                struct iovec select_iov = { const_cast<char*>(select.data()), select.size() };
+                m_wal_iov.push_back(select_iov);
+                select_db = staged.db;
+            }
+            char* cmd = const_cast<char*>(batch->cmds.GetRawReadBuffer()) + cursor.offset;
+            if (!m_wal_iov.empty() && (char*) m_wal_iov.back().iov_base + m_wal_iov.back().iov_len == cmd)
+            {
+                m_wal_iov.back().iov_len += staged.len;
+            }
+            else
+            {
+                struct iovec cmd_iov = { cmd, staged.len };
+                m_wal_iov.push_back(cmd_iov);
+            }
+            cursor.offset += staged.len;
+            cursor.index++;
+        }
+        m_wal_iov_select_db = select_db;
+    }
+
+    /*
+     * Write the collected batch with a single writev() into the WAL, one fsync for 'wal-fsync always'
+     * and one notification to the slaves. A batch failing to be written is kept, with its clients'
+     * replies held, and written again by the routine before any later command. The commands
+     * staged while it was retried are collected right after it is written, their workers were
+     * notified already and post no new routine.
+     */
+    void ReplicationService::DrainWAL()
+    {
+        bool retried = false;
+        do
+        {
+            retried = m_wal_retry;
+            if (!retried)
+            {
+                CollectWAL();
+            }
+            bool synced = true;
+            if (!m_wal_iov.empty())
+            {
+                if (0 != swal_appendv(m_wal, &m_wal_iov[0], m_wal_iov.size()))
+                {
+                    if (!m_wal_retry)
+                    {
+                        ERROR_LOG("Failed to append %u logs to wal with err:%s", m_wal_iov.size(), strerror(errno));
+                    }
+                    m_wal_retry = true;
+                    return;
+                }
+                if (m_wal_retry)
+                {
+                    INFO_LOG("Appended %u logs to wal after failures.", m_wal_iov.size());
+                    m_wal_retry = false;
+                }
+                ((ReplMeta*) swal_user_meta(m_wal))->select_db = m_wal_iov_select_db;
+                if (g_db->GetConfig().repl_wal_fsync == WAL_FSYNC_ALWAYS && 0 != swal_sync(m_wal))
+                {
+                    /* the dirty pages may be dropped by a failed fsync, do not retry it */
+                    ERROR_LOG("Failed to sync wal with err:%s", strerror(errno));
+                    synced = false;
+                }
+            }
+            for (size_t i = 0; i < m_draining.size(); i++)
+            {
+                WALStagingBatch* batch = m_draining[i]->back;
+                for (size_t j = 0; j < batch->waiters.size(); j++)
+                {
+                    WALSyncWaiter& waiter = batch->waiters[j];
+                    waiter.serv->AsyncIO(waiter.channel_id,
+                            synced ? RedisRequestHandler::WALSyncedCallback : RedisRequestHandler::WALSyncFailedCallback,
+                            NULL);
+                }
+                batch->Clear();
+            }
+            if (!m_wal_iov.empty())
+            {
+                m_master.SyncWAL();
+            }
+        }
+        while (retried);
     }
 
     static int cksm_callback(const void* log, size_t loglen, void* data)
@@ -227,7 +434,10 @@ namespace comms
     }
     ReplicationService::~ReplicationService()
     {
-
+        for (size_t i = 0; i < m_stagings.size(); i++)
+        {
+            DELETE(m_stagings[i]);
+        }
     }
 }
 
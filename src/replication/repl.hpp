@@ -11,12 +11,15 @@
 #include "thread/thread.hpp"
 #include "thread/thread_mutex.hpp"
 #include "thread/lock_guard.hpp"
+#include "thread/spin_mutex_lock.hpp"
+#include "thread/thread_local.hpp"
 #include "util/concurrent_queue.hpp"
 #include "master.hpp"
 #include "slave.hpp"
 #include "snapshot.hpp"
 #include "swal.h"
 #include <map>
+#include <vector>
 
 using namespace comms::codec;
 
@@ -25,13 +28,80 @@ namespace comms
     class ReplicationService: public Thread
     {
         private:
+            struct WALStagedCommand
+            {
+                    DBID db;
+                    uint32 len;
+                    uint64 seq; /* staging order across all workers */
+            };
+            struct WALSyncWaiter
+            {
+                    ChannelService* serv;
+                    uint32 channel_id;
+            };
+            struct WALStagingBatch
+            {
+                    Buffer cmds;
+                    std::vector<WALStagedCommand> index;
+                    std::vector<WALSyncWaiter> waiters;
+                    void Clear()
+                    {
+                        cmds.Clear();
+                        index.clear();
+                        waiters.clear();
+                    }
+            };
+            /*
+             * Write commands of one worker thread. The worker appends to the front batch, the
+             * replication thread swaps it with the back one and drains it with the other workers'.
+             */
+            struct WALStaging
+            {
+                    SpinMutexLock lock;
+                    WALStagingBatch batches[2];
+                    WALStagingBatch* front;
+                    WALStagingBatch* back;
+                    bool notified;
+                    uint64 staged;  //only accessed by the worker
+                    WALStaging() :
+                            front(batches), back(batches + 1), notified(false), staged(0)
+                    {
+                    }
+            };
+            typedef std::vector<WALStaging*> WALStagingArray;
+            struct WALDrainCursor
+            {
+                    size_t index;
+                    size_t offset;
+                    WALDrainCursor() :
+                            index(0), offset(0)
+                    {
+                    }
+            };
+            typedef std::vector<WALDrainCursor> WALDrainCursorArray;
+            typedef std::map<DBID, std::string> SelectCommandTable;
+
             swal_t* m_wal;
             Master m_master;
             Slave m_slave;
             ChannelService m_io_serv;
+            ThreadLocal<WALStaging*> m_local_staging;
+            WALStagingArray m_stagings;
+            SpinMutexLock m_stagings_lock;
+            WALStagingArray m_draining;
+            WALDrainCursorArray m_drain_cursors;
+            volatile uint64_t m_wal_seq;
+            std::vector<struct iovec> m_wal_iov;
+            DBID m_wal_iov_select_db; /* 'select_db' of the meta once m_wal_iov is written */
+            bool m_wal_retry; /* m_wal_iov failed to be written, the batches are kept until it is */
+            SelectCommandTable m_select_cmds;
             void Run();
             void ReCreateWAL();
-            static void WriteWALCallback(Channel*, void* data);
+            WALStaging* GetLocalStaging();
+            void NotifyStaging(WALStaging* staging);
+            static void DrainWALCallback(Channel*, void* data);
+            void CollectWAL();
+            void DrainWAL();
             int WriteWAL(DBID db, const Buffer& cmd);
             int WriteWAL(const Buffer& cmd);
             void Routine();
@@ -61,6 +131,8 @@ namespace comms
             const char* GetServerKey();
             void SetServerKey(const std::string& str);
             int WriteWAL(DBID db, RedisCommandFrame& cmd);
+            uint64 StagedWALCount();
+            void WaitWALSync(Channel* client);
             bool IsValidOffsetCksm(int64_t offset, uint64_t cksm);
             uint64_t WALStartOffset();
             uint64_t WALEndOffset();
@@ -0,0 +1,176 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ *
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "repl_compress.hpp"
+#include "logger.hpp"
+#include <lz4.h>
+
+namespace comms
+{
+    static inline void encode_frame_len(char* p, uint32 len)
+    {
+        p[0] = (char) (len & 0xFF);
+        p[1] = (char) ((len >> 8) & 0xFF);
+        p[2] = (char) ((len >> 16) & 0xFF);
+        p[3] = (char) ((len >> 24) & 0xFF);
+    }
+
+    static inline uint32 decode_frame_len(const char* p)
+    {
+        const unsigned char* u = (const unsigned char*) p;
+        return (uint32) u[0] | ((uint32) u[1] << 8) | ((uint32) u[2] << 16) | ((uint32) u[3] << 24);
+    }
+
+    void lz4_frame_encode(const char* data, size_t len, Buffer& out)
+    {
+        while (len > 0)
+        {
+            size_t n = len > REPL_LZ4_FRAME_SIZE ? REPL_LZ4_FRAME_SIZE : len;
+            out.EnsureWritableBytes(REPL_LZ4_FRAME_HEADER_SIZE + n);
+            char* header = const_cast<char*>(out.GetRawWriteBuffer());
+            char* payload = header + REPL_LZ4_FRAME_HEADER_SIZE;
+            //only keep the compressed data if it is smaller
+            int clen = LZ4_compress_default(data, payload, n, n - 1);
+            if (clen <= 0)
+            {
+                memcpy(payload, data, n);
+                clen = 0;
+            }
+            encode_frame_len(header, n);
+            encode_frame_len(header + 4, clen);
+            out.AdvanceWriteIndex(REPL_LZ4_FRAME_HEADER_SIZE + (clen > 0 ? clen : n));
+            data += n;
+            len -= n;
+        }
+    }
+
+    /*
+     * Returns 1 if a frame is decoded into the plain buffer, 0 if more data is needed, -1 for an
+     * invalid frame.
+     */
+    int LZ4RedisMessageDecoder::DecodeFrame(Buffer& wire)
+    {
+        if (wire.ReadableBytes() < REPL_LZ4_FRAME_HEADER_SIZE)
+        {
+            return 0;
+        }
+        uint32 rawlen = decode_frame_len(wire.GetRawReadBuffer());
+        uint32 clen = decode_frame_len(wire.GetRawReadBuffer() + 4);
+        if (0 == rawlen || rawlen > REPL_LZ4_FRAME_SIZE || clen >= rawlen)
+        {
+            return -1;
+        }
+        size_t payload_len = clen > 0 ? clen : rawlen;
+        if (wire.ReadableBytes() < REPL_LZ4_FRAME_HEADER_SIZE + payload_len)
+        {
+            return 0;
+        }
+        m_plain.DiscardReadedBytes();
+        m_plain.EnsureWritableBytes(rawlen);
+        const char* payload = wire.GetRawReadBuffer() + REPL_LZ4_FRAME_HEADER_SIZE;
+        char* dst = const_cast<char*>(m_plain.GetRawWriteBuffer());
+        if (clen > 0)
+        {
+            if (LZ4_decompress_safe(payload, dst, clen, rawlen) != (int) rawlen)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            memcpy(dst, payload, rawlen);
+        }
+        m_plain.AdvanceWriteIndex(rawlen);
+        wire.AdvanceReadIndex(REPL_LZ4_FRAME_HEADER_SIZE + payload_len);
+        m_raw_bytes += rawlen;
+        m_wire_bytes += REPL_LZ4_FRAME_HEADER_SIZE + payload_len;
+        return 1;
+    }
+
+    bool LZ4RedisMessageDecoder::Decode(ChannelHandlerContext& ctx, Channel* channel, Buffer& buffer, RedisMessage& msg)
+    {
+        if (!m_lz4)
+        {
+            return RedisMessageDecoder::Decode(ctx, channel, buffer, msg);
+        }
+        while (true)
+        {
+            if (m_plain.Readable())
+            {
+                size_t rest = m_plain.ReadableBytes();
+                if (RedisMessageDecoder::Decode(ctx, channel, m_plain, msg))
+                {
+                    return true;
+                }
+                if (rest != m_plain.ReadableBytes())
+                {
+                    //discarded some data
+                    continue;
+                }
+            }
+            int ret = DecodeFrame(buffer);
+            if (ret < 0)
+            {
+                ERROR_LOG("Invalid lz4 frame from master.");
+                buffer.Clear();
+                m_plain.Clear();
+                channel->Close();
+                return false;
+            }
+            if (0 == ret)
+            {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    void LZ4RedisMessageDecoder::MessageReceived(ChannelHandlerContext& ctx, MessageEvent<Buffer>& e)
+    {
+        RedisMessageDecoder::MessageReceived(ctx, e);
+        /*
+         * the last frame taken from the wire may hold more messages than the ones decoded in the
+         * loop over the wire data.
+         */
+        while (m_lz4 && m_plain.Readable())
+        {
+            size_t rest = m_plain.ReadableBytes();
+            RedisMessage msg;
+            if (!RedisMessageDecoder::Decode(ctx, e.GetChannel(), m_plain, msg))
+            {
+                if (rest == m_plain.ReadableBytes())
+                {
+                    break;
+                }
+                continue;
+            }
+            fire_message_received<RedisMessage>(ctx, &msg, NULL);
+        }
+    }
+}
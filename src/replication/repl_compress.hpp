@@ -0,0 +1,89 @@
+/*
+ *Copyright (c) 2013-2013, yinqiwen <yinqiwen@gmail.com>
+ *All rights reserved.
+ *
+ *Redistribution and use in source and binary forms, with or without
+ *modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Redis nor the names of its contributors may be used
+ *    to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ *THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ *THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REPL_COMPRESS_HPP_
+#define REPL_COMPRESS_HPP_
+#include "channel/all_includes.hpp"
+
+using namespace comms::codec;
+
+/*
+ * With the 'lz4' replication capability, everything the master sends after the psync reply is
+ * cut into frames: [raw len][compressed len][payload], both lengths are little endian uint32,
+ * and the payload is stored as is if it does not compress(compressed len is 0).
+ */
+#define REPL_LZ4_FRAME_SIZE 65536
+#define REPL_LZ4_FRAME_HEADER_SIZE 8
+
+namespace comms
+{
+    void lz4_frame_encode(const char* data, size_t len, Buffer& out);
+
+    /*
+     * Decodes the redis messages from master, through the lz4 frames once they are enabled.
+     * Offsets&checksums of the wal are counted over the decompressed stream as before.
+     */
+    class LZ4RedisMessageDecoder: public RedisMessageDecoder
+    {
+        private:
+            bool m_lz4;
+            Buffer m_plain;
+            volatile uint64 m_raw_bytes;
+            volatile uint64 m_wire_bytes;
+            int DecodeFrame(Buffer& wire);
+        protected:
+            bool Decode(ChannelHandlerContext& ctx, Channel* channel, Buffer& buffer, RedisMessage& msg);
+            size_t ExpectedFrameBytes()
+            {
+                return m_lz4 ? 0 : RedisMessageDecoder::ExpectedFrameBytes();
+            }
+        public:
+            LZ4RedisMessageDecoder() :
+                    m_lz4(false), m_raw_bytes(0), m_wire_bytes(0)
+            {
+            }
+            void EnableLZ4()
+            {
+                m_lz4 = true;
+            }
+            void Clear()
+            {
+                RedisMessageDecoder::Clear();
+                m_plain.Clear();
+                m_lz4 = false;
+            }
+            int64 SavedBytes() const
+            {
+                return (int64) m_raw_bytes - (int64) m_wire_bytes;
+            }
+            void MessageReceived(ChannelHandlerContext& ctx, MessageEvent<Buffer>& e);
+    };
+}
+
+#endif /* REPL_COMPRESS_HPP_ */
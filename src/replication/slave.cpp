@@ -73,6 +73,10 @@ namespace comms
                 }
         };
         g_repl->GetTimer().ScheduleHeapTask(new RoutineTask(this), 1, 1, SECONDS);
+        if (g_db->GetConfig().slave_apply_threads > 0)
+        {
+            m_applier.Init(g_db->GetConfig().slave_apply_threads);
+        }
         return 0;
     }
 
@@ -82,6 +86,15 @@ namespace comms
         return 0;
     }
 
+    /*
+     * Offset of the wal already handed to the applier, the data offset lags behind it by the
+     * commands still being applied.
+     */
+    uint64_t Slave::DispatchedOffset()
+    {
+        return g_repl->DataOffset() + m_applier.InflightBytes();
+    }
+
     void Slave::ReplayWAL()
     {
         if (m_status.state != SLAVE_STATE_SYNCED)
@@ -89,9 +102,8 @@ namespace comms
             //can not replay wal in non synced state
             return;
         }
-        if (g_repl->DataOffset() == g_repl->WALEndOffset())
+        if (DispatchedOffset() == g_repl->WALEndOffset())
         {
-            swal_clear_replay_cache(g_repl->GetWAL());
             return;
         }
         if (m_status.replaying_wal)
@@ -99,7 +111,7 @@ namespace comms
             return;
         }
         m_status.replaying_wal = true;
-        swal_replay(g_repl->GetWAL(), g_repl->DataOffset(), -1, slave_replay_wal, NULL);
+        swal_replay(g_repl->GetWAL(), DispatchedOffset(), -1, slave_replay_wal, NULL);
         m_status.replaying_wal = false;
     }
 
@@ -115,10 +127,7 @@ namespace comms
             {
                 break;
             }
-            CallFlags flags;
-            flags.no_wal = 1;
-            g_db->Call(m_slave_ctx, msg, flags);
-            g_repl->UpdateDataOffsetCksm(msg.GetRawProtocolData());
+            m_applier.Apply(m_slave_ctx, msg);
             g_repl->GetIOServ().Continue();
         }
     }
@@ -150,12 +159,9 @@ namespace comms
         int len = g_repl->WriteWAL(cmd.GetRawProtocolData());
         DEBUG_LOG("Recv master inline:%d cmd %s with len:%d at %lld %lld at state:%d", cmd.IsInLine(), cmd.ToString().c_str(), len,
                 g_repl->DataOffset(), g_repl->WALEndOffset(), m_status.state);
-        if (!write_wal_only && g_repl->DataOffset() + len == g_repl->WALEndOffset())
+        if (!write_wal_only && DispatchedOffset() + len == g_repl->WALEndOffset())
         {
-            CallFlags flags;
-            flags.no_wal = 1;
-            g_db->Call(m_slave_ctx, cmd, flags);
-            g_repl->UpdateDataOffsetCksm(cmd.GetRawProtocolData());
+            m_applier.Apply(m_slave_ctx, cmd);
             return;
         }
         ReplayWAL();
@@ -166,6 +172,7 @@ namespace comms
         {
             return;
         }
+        m_applier.Commit();
         ReplayWAL();
         uint32 now = time(NULL);
         if (NULL == m_client)
@@ -256,7 +263,14 @@ namespace comms
                     m_status.server_support_psync = true;
                 }
                 Buffer replconf;
-                replconf.Printf("replconf listening-port %u\r\n", g_db->GetConfig().PrimayPort());
+                if (!m_status.server_is_redis && g_db->GetConfig().repl_compression)
+                {
+                    replconf.Printf("replconf listening-port %u capa lz4\r\n", g_db->GetConfig().PrimayPort());
+                }
+                else
+                {
+                    replconf.Printf("replconf listening-port %u\r\n", g_db->GetConfig().PrimayPort());
+                }
                 ch->Write(replconf);
                 m_status.state = SLAVE_STATE_WAITING_REPLCONF_REPLY;
                 break;
@@ -269,6 +283,12 @@ namespace comms
                     ch->Close();
                     return;
                 }
+                //masters accepting the capability reply 'OK lz4'
+                m_status.server_support_lz4 = reply.str.find("lz4") != std::string::npos;
+                if (m_status.server_support_lz4)
+                {
+                    INFO_LOG("[Slave]Master accepted lz4 compressed replication stream.");
+                }
                 if (m_status.server_support_psync)
                 {
                     Buffer sync;
@@ -333,11 +353,19 @@ namespace comms
                     }
                     m_status.state = SLAVE_STATE_WAITING_SNAPSHOT;
                     m_decoder.SwitchToDumpFileDecoder();
+                    if (m_status.server_support_lz4)
+                    {
+                        m_decoder.EnableLZ4();
+                    }
                     break;
                 }
                 else if (!strcasecmp(ss[0].c_str(), "CONTINUE"))
                 {
                     m_decoder.SwitchToCommandDecoder();
+                    if (m_status.server_support_lz4)
+                    {
+                        m_decoder.EnableLZ4();
+                    }
                     m_status.state = SLAVE_STATE_SYNCED;
                     break;
                 }
@@ -392,6 +420,7 @@ namespace comms
              * set wal offset&cksm to make sure that this slave could accept&save synced commands when loading snapshot file.
              */
             g_repl->SetServerKey(random_hex_string(40));
+            m_applier.Drain();
             g_repl->ResetWALOffsetCksm(m_status.cached_master_repl_offset, m_status.cached_master_repl_cksm);
             if (g_db->GetConfig().slave_cleardb_before_fullresync)
             {
@@ -442,6 +471,7 @@ namespace comms
         INFO_LOG("[Slave]Replication connection closed.");
         m_lastinteraction = m_master_link_down_time = time(NULL);
         m_client = NULL;
+        m_applier.Drain();
         m_slave_ctx.Clear();
         m_status.Clear();
     }
@@ -464,6 +494,11 @@ namespace comms
             return 0;
         }
         m_client = g_repl->GetIOServ().NewClientSocketChannel();
+        if (NULL == m_client)
+        {
+            //no channel slot left, retried by the routine
+            return -1;
+        }
 
         m_decoder.Clear();
         m_client->GetPipeline().AddLast("decoder", &m_decoder);
@@ -33,6 +33,8 @@
 #include "util/mmap.hpp"
 #include "context.hpp"
 #include "snapshot.hpp"
+#include "parallel_applier.hpp"
+#include "repl_compress.hpp"
 
 using namespace comms::codec;
 
@@ -45,6 +47,7 @@ namespace comms
     {
             bool server_is_redis;
             bool server_support_psync;
+            bool server_support_lz4;
             uint32_t state;
             std::string cached_master_runid;
             int64 cached_master_repl_offset;
@@ -55,6 +58,7 @@ namespace comms
             {
                 server_is_redis = false;
                 server_support_psync = false;
+                server_support_lz4 = false;
                 state = 0;
                 cached_master_runid.clear();
                 cached_master_repl_offset = 0;
@@ -62,7 +66,7 @@ namespace comms
                 snapshot.Close();
             }
             SlaveStatus() :
-                    server_is_redis(false), server_support_psync(false), state(0), cached_master_repl_offset(0), cached_master_repl_cksm(
+                    server_is_redis(false), server_support_psync(false), server_support_lz4(false), state(0), cached_master_repl_offset(0), cached_master_repl_cksm(
                             0),replaying_wal(false)
             {
             }
@@ -74,10 +78,11 @@ namespace comms
             Channel* m_client;
             uint32 m_cmd_recved_time;
             uint32 m_master_link_down_time;
-            RedisMessageDecoder m_decoder;
+            LZ4RedisMessageDecoder m_decoder;
             NullRedisReplyEncoder m_encoder;
             SlaveStatus m_status;
             Context m_slave_ctx;
+            ParallelApplier m_applier;
             time_t m_routine_ts;
             time_t m_lastinteraction;
 
@@ -92,6 +97,7 @@ namespace comms
             void InfoMaster();
             int ConnectMaster();
             void ReplayWAL();
+            uint64_t DispatchedOffset();
         public:
             Slave();
             int Init();
@@ -104,6 +110,10 @@ namespace comms
             {
                 return m_status;
             }
+            int64 LZ4SavedBytes() const
+            {
+                return m_decoder.SavedBytes();
+            }
     };
 }
 
@@ -379,6 +379,16 @@ namespace comms
         }
         return ret;
     }
+    /*
+     * Snapshot & backup threads run on their own cpus, away from the event loops.
+     */
+    static ThreadOptions BGTaskThreadOptions()
+    {
+        ThreadOptions options;
+        options.cpus = g_db->GetConfig().bgtask_cpus;
+        return options;
+    }
+
     int Snapshot::BGSave(SnapshotType format)
     {
         if (g_snapshot_state.snapshot_saving[format])
@@ -401,7 +411,7 @@ namespace comms
                 }
         };
         BGTask* task = new BGTask(format);
-        task->Start();
+        task->Start(BGTaskThreadOptions());
         return 0;
     }
     uint32 Snapshot::LastSave()
@@ -1518,7 +1528,7 @@ namespace comms
                 }
         };
         SaveTask task(file);
-        task.Start();
+        task.Start(BGTaskThreadOptions());
         while (!task.done)
         {
             Thread::Sleep(100, MILLIS);
@@ -1552,7 +1562,7 @@ namespace comms
                 }
         };
         LoadTask task(file);
-        task.Start();
+        task.Start(BGTaskThreadOptions());
         while (!task.done)
         {
             Thread::Sleep(100, MILLIS);
@@ -26,6 +26,9 @@
  *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
  *THE POSSIBILITY OF SUCH DAMAGE.
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "swal.h"
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -33,28 +36,89 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 #define SWAL_META_SIZE 1024
+#define SWAL_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024LL)
+#define SWAL_MAX_SPARE_SEGMENTS 2
+#define SWAL_NO_SEGMENT ((size_t) -1)
+#define SWAL_IMPORT_BUF_SIZE (1024 * 1024)
+#ifdef IOV_MAX
+#define SWAL_IOV_MAX IOV_MAX
+#else
+#define SWAL_IOV_MAX 1024
+#endif
 
 typedef struct swal_meta_t
 {
     size_t log_start_offset;
     size_t log_end_offset;
-    size_t log_file_pos;
+    size_t log_file_pos;  //unused since the log is segmented
     uint64_t cksm;
+    size_t segment_size;  //0 for logs written as one circular file
 } swal_meta_t;
 
+/*
+ * A segment holds the log offsets [index * segment_size, (index + 1) * segment_size).
+ */
+typedef struct swal_segment_t
+{
+    size_t index;
+    int fd;
+    char* mmap_buf;  //mapped by the first replay reading it, kept until the segment is recycled
+    int pins;  //regions being sent from the file, it's not recycled until they are done
+    char* retired_path;  //spare name of a segment which fell out of the log while pinned
+} swal_segment_t;
+
+typedef struct swal_spare_t
+{
+    char* path;
+    struct swal_spare_t* next;
+} swal_spare_t;
+
 struct swal_t
 {
     char* dir;
+    char* file_prefix;
     swal_meta_t* meta;
     swal_options_t options;
-    int fd;
-    void* mmap_buf;
+    size_t segment_size;
+    swal_segment_t* segments;  //live segments ordered by index, the last one is being written
+    size_t segment_count;
+    size_t segment_capacity;
+    size_t sync_index;  //first segment which may hold unsynced logs
+    swal_segment_t* retired;  //pinned segments out of the log
+    size_t retired_count;
+    size_t open_dropped_len;
     char* ring_cache;
     size_t ring_cache_start_offset;
     size_t ring_cache_idx;
+
+    /*
+     * The preallocator thread prepares the segment after the one being written, from a
+     * recycled segment file if there is a spare one, so appends never wait for the disk to
+     * allocate a file.
+     */
+    pthread_t prealloc_thread;
+    pthread_mutex_t prealloc_lock;
+    pthread_cond_t prealloc_cond;
+    int prealloc_started;
+    int prealloc_running;
+    int prealloc_busy;
+    int busy_fd;  //segment file being allocated, already opened under prealloc_lock
+    size_t busy_index;
+    int busy_claimed;  //the writer took the busy segment before it was allocated
+    size_t prealloc_want;
+    int ready_fd;
+    size_t ready_index;
+    swal_spare_t* spares;
+    size_t spare_count;
+    size_t spare_seq;
 };
 
 swal_options_t* swal_options_create()
@@ -63,6 +127,7 @@ swal_options_t* swal_options_create()
     memset(options, 0, sizeof(swal_options_t));
     options->create_ifnotexist = 1;
     options->max_file_size = 1 * 1024 * 1024 * 1024LL;  //default 1G
+    options->segment_size = SWAL_DEFAULT_SEGMENT_SIZE;
     options->user_meta_size = 0;
     options->ring_cache_size = 0;
     return options;
@@ -75,44 +140,558 @@ void swal_options_destroy(swal_options_t* options)
     }
 }
 
-static int open_wal_logfile(swal_t* wal)
+static void segment_path(swal_t* wal, size_t index, char* path)
 {
-    if (wal->fd > 0)
+    sprintf(path, "%s/%s.%zu.log", wal->dir, wal->file_prefix, index);
+}
+
+/*
+ * Open the file of a segment, renamed from a spare one if given.
+ */
+static int open_segment_file(swal_t* wal, size_t index, const char* spare)
+{
+    char path[strlen(wal->dir) + 1024];
+    segment_path(wal, index, path);
+    if (NULL != spare)
     {
-        return 0;
+        rename(spare, path);
+    }
+    return open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+}
+
+/*
+ * Make sure all the blocks of a segment file are allocated, the data already written are
+ * kept.
+ */
+static int allocate_segment(swal_t* wal, int fd)
+{
+    struct stat file_st;
+    memset(&file_st, 0, sizeof(file_st));
+    fstat(fd, &file_st);
+    if (file_st.st_size < wal->segment_size)
+    {
+        int err = -1;
+#if defined(__linux__)
+        err = fallocate(fd, 0, 0, wal->segment_size);
+#endif
+        if (0 != err && -1 == ftruncate(fd, wal->segment_size))
+        {
+            return -1;
+        }
     }
-    char file_path[strlen(wal->dir) + 1024];
-    if (NULL != wal->options.log_prefix)
+    return 0;
+}
+
+static int prepare_segment(swal_t* wal, size_t index, const char* spare)
+{
+    int fd = open_segment_file(wal, index, spare);
+    if (fd >= 0 && 0 != allocate_segment(wal, fd))
     {
-        sprintf(file_path, "%s/%s.swal.log", wal->dir, wal->options.log_prefix);
+        close(fd);
+        return -1;
     }
-    else
+    return fd;
+}
+
+/*
+ * called with prealloc_lock held
+ */
+static void push_spare(swal_t* wal, char* path)
+{
+    swal_spare_t* spare = (swal_spare_t*) malloc(sizeof(swal_spare_t));
+    if (NULL == spare)
     {
-        sprintf(file_path, "%s/swal.log", wal->dir);
+        unlink(path);
+        free(path);
+        return;
     }
+    spare->path = path;
+    spare->next = wal->spares;
+    wal->spares = spare;
+    wal->spare_count++;
+}
+static swal_spare_t* pop_spare(swal_t* wal)
+{
+    swal_spare_t* spare = wal->spares;
+    if (NULL != spare)
+    {
+        wal->spares = spare->next;
+        wal->spare_count--;
+    }
+    return spare;
+}
+static void free_spare(swal_spare_t* spare)
+{
+    if (NULL != spare)
+    {
+        free(spare->path);
+        free(spare);
+    }
+}
+
+/*
+ * Move a segment file out of the way under a spare name, it's reused by a segment prepared
+ * later or removed by the preallocator thread. Called with prealloc_lock held.
+ */
+static void spare_segment_file(swal_t* wal, const char* path)
+{
+    char spare_path[strlen(wal->dir) + 1024];
+    sprintf(spare_path, "%s/%s.%zu.spare", wal->dir, wal->file_prefix, wal->spare_seq++);
+    if (0 != rename(path, spare_path))
+    {
+        unlink(path);
+        return;
+    }
+    char* dup = strdup(spare_path);
+    if (NULL != dup)
+    {
+        push_spare(wal, dup);
+    }
+}
+
+static void* prealloc_routine(void* data)
+{
+    swal_t* wal = (swal_t*) data;
+    pthread_mutex_lock(&wal->prealloc_lock);
+    while (wal->prealloc_running)
+    {
+        if (wal->spare_count > SWAL_MAX_SPARE_SEGMENTS)
+        {
+            swal_spare_t* spare = pop_spare(wal);
+            pthread_mutex_unlock(&wal->prealloc_lock);
+            unlink(spare->path);
+            free_spare(spare);
+            pthread_mutex_lock(&wal->prealloc_lock);
+            continue;
+        }
+        if (wal->ready_fd < 0 && SWAL_NO_SEGMENT != wal->prealloc_want)
+        {
+            /*
+             * the file is renamed and opened under the lock, so the writer can take it
+             * while it's being allocated instead of waiting
+             */
+            size_t index = wal->prealloc_want;
+            swal_spare_t* spare = pop_spare(wal);
+            int fd = open_segment_file(wal, index, NULL != spare ? spare->path : NULL);
+            free_spare(spare);
+            wal->prealloc_busy = 1;
+            wal->busy_fd = fd;
+            wal->busy_index = index;
+            wal->busy_claimed = 0;
+            pthread_mutex_unlock(&wal->prealloc_lock);
+            if (fd >= 0 && 0 != allocate_segment(wal, fd))
+            {
+                close(fd);
+                fd = -1;
+            }
+            pthread_mutex_lock(&wal->prealloc_lock);
+            wal->prealloc_busy = 0;
+            wal->busy_fd = -1;
+            if (wal->prealloc_want == index)
+            {
+                wal->prealloc_want = SWAL_NO_SEGMENT;
+            }
+            if (wal->busy_claimed && fd >= 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+            if (fd >= 0)
+            {
+                wal->ready_fd = fd;
+                wal->ready_index = index;
+            }
+            pthread_cond_broadcast(&wal->prealloc_cond);
+            continue;
+        }
+        pthread_cond_wait(&wal->prealloc_cond, &wal->prealloc_lock);
+    }
+    pthread_mutex_unlock(&wal->prealloc_lock);
+    return NULL;
+}
+
+static swal_segment_t* push_segment(swal_t* wal, size_t index, int fd)
+{
+    if (wal->segment_count == wal->segment_capacity)
+    {
+        size_t capacity = wal->segment_capacity > 0 ? wal->segment_capacity * 2 : 8;
+        swal_segment_t* segments = (swal_segment_t*) realloc(wal->segments, capacity * sizeof(swal_segment_t));
+        if (NULL == segments)
+        {
+            return NULL;
+        }
+        wal->segments = segments;
+        wal->segment_capacity = capacity;
+    }
+    swal_segment_t* segment = wal->segments + wal->segment_count;
+    segment->index = index;
+    segment->fd = fd;
+    segment->mmap_buf = NULL;
+    segment->pins = 0;
+    segment->retired_path = NULL;
+    wal->segment_count++;
+    return segment;
+}
+
+/*
+ * Move a pinned segment out of the log, its file is renamed so the log can reuse the index and
+ * is handed to the preallocator once the last pin is gone.
+ */
+static void retire_segment(swal_t* wal, swal_segment_t* segment)
+{
+    char path[strlen(wal->dir) + 1024];
+    char spare_path[strlen(wal->dir) + 1024];
+    segment_path(wal, segment->index, path);
+    pthread_mutex_lock(&wal->prealloc_lock);
+    sprintf(spare_path, "%s/%s.%zu.spare", wal->dir, wal->file_prefix, wal->spare_seq++);
+    pthread_mutex_unlock(&wal->prealloc_lock);
+    swal_segment_t* retired = (swal_segment_t*) realloc(wal->retired,
+            (wal->retired_count + 1) * sizeof(swal_segment_t));
+    int renamed = NULL != retired && 0 == rename(path, spare_path);
+    if (!renamed)
+    {
+        /* the open fd keeps the data readable anyway */
+        unlink(path);
+    }
+    if (NULL == retired)
+    {
+        segment->pins = 0;
+        close(segment->fd);
+        segment->fd = -1;
+        return;
+    }
+    wal->retired = retired;
+    retired += wal->retired_count++;
+    *retired = *segment;
+    retired->retired_path = renamed ? strdup(spare_path) : NULL;
+}
 
-    int mode = O_CREAT | O_RDWR, permission = S_IRUSR | S_IWUSR;
-    int fd = open(file_path, mode, permission);
+static void release_segment(swal_t* wal, swal_segment_t* segment, int recycle)
+{
+    if (NULL != segment->mmap_buf)
+    {
+        munmap(segment->mmap_buf, wal->segment_size);
+        segment->mmap_buf = NULL;
+    }
+    if (recycle && segment->pins > 0)
+    {
+        retire_segment(wal, segment);
+        return;
+    }
+    if (segment->fd >= 0)
+    {
+        close(segment->fd);
+        segment->fd = -1;
+    }
+    if (recycle)
+    {
+        char path[strlen(wal->dir) + 1024];
+        segment_path(wal, segment->index, path);
+        pthread_mutex_lock(&wal->prealloc_lock);
+        spare_segment_file(wal, path);
+        pthread_cond_signal(&wal->prealloc_cond);
+        pthread_mutex_unlock(&wal->prealloc_lock);
+    }
+}
+
+/*
+ * Recycle the segments entirely before the offset, the one being written is always kept.
+ */
+static void release_segments_before(swal_t* wal, size_t offset)
+{
+    size_t n = 0;
+    while (n + 1 < wal->segment_count && (wal->segments[n].index + 1) * wal->segment_size <= offset)
+    {
+        release_segment(wal, wal->segments + n, 1);
+        n++;
+    }
+    if (n > 0)
+    {
+        memmove(wal->segments, wal->segments + n, (wal->segment_count - n) * sizeof(swal_segment_t));
+        wal->segment_count -= n;
+    }
+}
+
+static void release_all_segments(swal_t* wal, int recycle)
+{
+    size_t i;
+    for (i = 0; i < wal->segment_count; i++)
+    {
+        release_segment(wal, wal->segments + i, recycle);
+    }
+    wal->segment_count = 0;
+}
+
+static swal_segment_t* find_segment(swal_t* wal, size_t index)
+{
+    if (0 == wal->segment_count || index < wal->segments[0].index)
+    {
+        return NULL;
+    }
+    size_t i = index - wal->segments[0].index;
+    if (i < wal->segment_count && wal->segments[i].index == index)
+    {
+        return wal->segments + i;
+    }
+    return NULL;
+}
+
+/*
+ * Start writing a new segment, normally the one the preallocator thread got ready. If it's
+ * still allocating that segment the file is shared rather than waited for, the blocks not
+ * allocated yet are allocated by the writes.
+ */
+static swal_segment_t* open_write_segment(swal_t* wal, size_t index)
+{
+    int fd = -1;
+    swal_spare_t* spare = NULL;
+    pthread_mutex_lock(&wal->prealloc_lock);
+    if (wal->prealloc_busy && wal->busy_index == index && wal->busy_fd >= 0)
+    {
+        fd = dup(wal->busy_fd);
+        if (fd >= 0)
+        {
+            wal->busy_claimed = 1;
+        }
+    }
+    if (wal->ready_fd >= 0)
+    {
+        if (wal->ready_index == index)
+        {
+            fd = wal->ready_fd;
+        }
+        else
+        {
+            /* prepared before a reset moved the log */
+            close(wal->ready_fd);
+            char path[strlen(wal->dir) + 1024];
+            segment_path(wal, wal->ready_index, path);
+            spare_segment_file(wal, path);
+        }
+        wal->ready_fd = -1;
+    }
     if (fd < 0)
     {
-        return SWAL_ERR_LOG_OPEN_FAIL;
+        spare = pop_spare(wal);
     }
-    struct stat file_st;
-    memset(&file_st, 0, sizeof(file_st));
-    fstat(fd, &file_st);
-    if (file_st.st_size < wal->options.max_file_size)
+    wal->prealloc_want = index + 1;
+    pthread_cond_signal(&wal->prealloc_cond);
+    pthread_mutex_unlock(&wal->prealloc_lock);
+    if (fd < 0)
     {
-        if (-1 == ftruncate(fd, wal->options.max_file_size))
+        fd = prepare_segment(wal, index, NULL != spare ? spare->path : NULL);
+        free_spare(spare);
+        if (fd < 0)
+        {
+            return NULL;
+        }
+    }
+    swal_segment_t* segment = push_segment(wal, index, fd);
+    if (NULL == segment)
+    {
+        close(fd);
+    }
+    return segment;
+}
+
+/*
+ * Open the segments holding [log_start_offset, log_end_offset), the log starts after the
+ * last missing segment file if any.
+ */
+static int open_wal_segments(swal_t* wal)
+{
+    swal_meta_t* meta = wal->meta;
+    size_t last = meta->log_end_offset / wal->segment_size;
+    size_t index;
+    for (index = meta->log_start_offset / wal->segment_size; index <= last; index++)
+    {
+        char path[strlen(wal->dir) + 1024];
+        segment_path(wal, index, path);
+        int fd = index < last ? open(path, O_RDWR) : prepare_segment(wal, index, NULL);
+        if (fd < 0)
+        {
+            if (index == last)
+            {
+                return SWAL_ERR_LOG_OPEN_FAIL;
+            }
+            release_all_segments(wal, 0);
+            meta->log_start_offset = (index + 1) * wal->segment_size;
+            continue;
+        }
+        if (NULL == push_segment(wal, index, fd))
         {
             close(fd);
-            return SWAL_ERR_LOG_OPEN_FAIL;
+            return SWAL_ERR_MALLOC_FAIL;
         }
     }
-    lseek(fd, wal->meta->log_file_pos, SEEK_SET);
-    wal->fd = fd;
+    if (meta->log_start_offset > meta->log_end_offset)
+    {
+        meta->log_start_offset = meta->log_end_offset;
+    }
+    wal->sync_index = last;
     return 0;
 }
 
+/*
+ * Spare files and segment files out of the log(left by a reset or a crash) are handed to
+ * the preallocator thread.
+ */
+static void collect_spare_files(swal_t* wal)
+{
+    DIR* dir = opendir(wal->dir);
+    if (NULL == dir)
+    {
+        return;
+    }
+    size_t prefix_len = strlen(wal->file_prefix);
+    size_t first = wal->segments[0].index;
+    size_t last = wal->segments[wal->segment_count - 1].index;
+    swal_spare_t* stale = NULL;
+    struct dirent* ent;
+    while (NULL != (ent = readdir(dir)))
+    {
+        const char* name = ent->d_name;
+        if (strncmp(name, wal->file_prefix, prefix_len) || name[prefix_len] != '.' || name[prefix_len + 1] < '0'
+                || name[prefix_len + 1] > '9')
+        {
+            continue;
+        }
+        char* end = NULL;
+        size_t index = strtoull(name + prefix_len + 1, &end, 10);
+        int is_spare = !strcmp(end, ".spare");
+        if (!is_spare && (strcmp(end, ".log") || (index >= first && index <= last)))
+        {
+            continue;
+        }
+        char path[strlen(wal->dir) + 1024];
+        sprintf(path, "%s/%s", wal->dir, name);
+        char* dup = strdup(path);
+        if (NULL == dup)
+        {
+            continue;
+        }
+        if (is_spare)
+        {
+            if (index >= wal->spare_seq)
+            {
+                wal->spare_seq = index + 1;
+            }
+            push_spare(wal, dup);
+        }
+        else
+        {
+            /* renamed once all the spare names in use are known */
+            swal_spare_t* file = (swal_spare_t*) malloc(sizeof(swal_spare_t));
+            if (NULL == file)
+            {
+                free(dup);
+                continue;
+            }
+            file->path = dup;
+            file->next = stale;
+            stale = file;
+        }
+    }
+    closedir(dir);
+    while (NULL != stale)
+    {
+        swal_spare_t* next = stale->next;
+        spare_segment_file(wal, stale->path);
+        free_spare(stale);
+        stale = next;
+    }
+}
+
+/*
+ * Copy the backlog of a log written as one circular file into segment files, the newest
+ * max_file_size bytes at most are kept. The meta is left alone, so the copy is redone if
+ * it's interrupted.
+ */
+static int import_circular_log(swal_t* wal, const char* path)
+{
+    swal_meta_t* meta = wal->meta;
+    if (meta->log_end_offset == meta->log_start_offset)
+    {
+        return 0;
+    }
+    int old_fd = open(path, O_RDONLY);
+    if (old_fd < 0)
+    {
+        return -1;
+    }
+    struct stat file_st;
+    memset(&file_st, 0, sizeof(file_st));
+    fstat(old_fd, &file_st);
+    size_t file_size = file_st.st_size;
+    size_t start = meta->log_start_offset;
+    size_t end = meta->log_end_offset;
+    if (end - start > file_size)
+    {
+        start = end - file_size;
+    }
+    if (wal->options.max_file_size > 0 && end - start > wal->options.max_file_size)
+    {
+        start = end - wal->options.max_file_size;
+    }
+    char* buf = (char*) malloc(SWAL_IMPORT_BUF_SIZE);
+    int err = NULL == buf || 0 == file_size || meta->log_file_pos >= file_size ? -1 : 0;
+    int fd = -1;
+    size_t index = SWAL_NO_SEGMENT;
+    size_t offset = start;
+    while (0 == err && offset < end)
+    {
+        if (offset / wal->segment_size != index)
+        {
+            if (fd >= 0 && 0 != fdatasync(fd))
+            {
+                err = -1;
+            }
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            index = offset / wal->segment_size;
+            fd = prepare_segment(wal, index, NULL);
+            if (fd < 0)
+            {
+                err = -1;
+                break;
+            }
+        }
+        /* the file ends at log_file_pos with log_end_offset */
+        size_t pos = (meta->log_file_pos + file_size - (end - offset)) % file_size;
+        size_t len = end - offset;
+        if (len > file_size - pos)
+            len = file_size - pos;
+        if (len > (index + 1) * wal->segment_size - offset)
+            len = (index + 1) * wal->segment_size - offset;
+        if (len > SWAL_IMPORT_BUF_SIZE)
+            len = SWAL_IMPORT_BUF_SIZE;
+        ssize_t n = pread(old_fd, buf, len, pos);
+        if (n <= 0 || pwrite(fd, buf, n, offset % wal->segment_size) != n)
+        {
+            err = -1;
+            break;
+        }
+        offset += n;
+    }
+    if (fd >= 0)
+    {
+        if (0 == err && 0 != fdatasync(fd))
+        {
+            err = -1;
+        }
+        close(fd);
+    }
+    free(buf);
+    close(old_fd);
+    if (0 == err)
+    {
+        meta->log_start_offset = start;
+    }
+    return err;
+}
+
 int swal_open(const char* dir, const swal_options_t* options, swal_t** wal)
 {
     swal_t* wal_log = (swal_t*) malloc(sizeof(swal_t));
@@ -121,28 +700,34 @@ int swal_open(const char* dir, const swal_options_t* options, swal_t** wal)
         return SWAL_ERR_MALLOC_FAIL;
     }
     memset(wal_log, 0, sizeof(swal_t));
-    wal_log->fd = -1;
+    wal_log->ready_fd = -1;
+    wal_log->busy_fd = -1;
+    wal_log->prealloc_want = SWAL_NO_SEGMENT;
+    pthread_mutex_init(&wal_log->prealloc_lock, NULL);
+    pthread_cond_init(&wal_log->prealloc_cond, NULL);
 
     wal_log->dir = strdup(dir);
-    if (NULL == wal_log->dir)
+    wal_log->file_prefix = (char*) malloc((NULL != options->log_prefix ? strlen(options->log_prefix) : 0) + 8);
+    if (NULL == wal_log->dir || NULL == wal_log->file_prefix)
     {
         swal_close(wal_log);
         return SWAL_ERR_MALLOC_FAIL;
     }
-
-    /*
-     * open/create meta file
-     */
-    char meta_path[strlen(dir) + 1024];
     if (NULL != options->log_prefix)
     {
-        sprintf(meta_path, "%s/%s.swal.meta", dir, options->log_prefix);
+        sprintf(wal_log->file_prefix, "%s.swal", options->log_prefix);
     }
     else
     {
-        sprintf(meta_path, "%s/swal.meta", dir);
+        sprintf(wal_log->file_prefix, "swal");
     }
 
+    /*
+     * open/create meta file
+     */
+    char meta_path[strlen(dir) + 1024];
+    sprintf(meta_path, "%s/%s.meta", dir, wal_log->file_prefix);
+
     int mode = O_RDWR, permission = S_IRUSR | S_IWUSR;
     int mmap_mode = PROT_READ | PROT_WRITE;
     if (options->create_ifnotexist)
@@ -157,19 +742,56 @@ int swal_open(const char* dir, const swal_options_t* options, swal_t** wal)
     }
     if (-1 == ftruncate(meta_fd, options->user_meta_size + SWAL_META_SIZE))
     {
+        close(meta_fd);
         swal_close(wal_log);
         return SWAL_ERR_META_OPEN_FAIL;
     }
     swal_meta_t* meta = (swal_meta_t*) mmap(NULL, options->user_meta_size + SWAL_META_SIZE, mmap_mode, MAP_SHARED,
             meta_fd, 0);
+    close(meta_fd);
+    if (MAP_FAILED == (void*) meta)
+    {
+        swal_close(wal_log);
+        return SWAL_ERR_META_OPEN_FAIL;
+    }
     wal_log->meta = meta;
     wal_log->options = *options;
-    int err = open_wal_logfile(wal_log);
+    wal_log->segment_size = options->segment_size > 0 ? options->segment_size : SWAL_DEFAULT_SEGMENT_SIZE;
+    if (options->max_file_size > 0 && wal_log->segment_size > options->max_file_size)
+    {
+        wal_log->segment_size = options->max_file_size;
+    }
+    if (meta->segment_size != wal_log->segment_size)
+    {
+        /*
+         * the backlog of a log written as one circular file is copied into segments, one
+         * written with another segment size is dropped and the log goes on from the end
+         * offset
+         */
+        size_t start = meta->log_start_offset;
+        char old_path[strlen(dir) + 1024];
+        sprintf(old_path, "%s/%s.log", dir, wal_log->file_prefix);
+        int circular = 0 == meta->segment_size;
+        if (!circular || 0 != import_circular_log(wal_log, old_path))
+        {
+            meta->log_start_offset = meta->log_end_offset;
+        }
+        wal_log->open_dropped_len = meta->log_start_offset - start;
+        meta->log_file_pos = 0;
+        meta->segment_size = wal_log->segment_size;
+        msync(meta, options->user_meta_size + SWAL_META_SIZE, MS_SYNC);
+        if (circular)
+        {
+            unlink(old_path);
+        }
+    }
+    int err = open_wal_segments(wal_log);
     if (0 != err)
     {
         swal_close(wal_log);
         return err;
     }
+    collect_spare_files(wal_log);
     if (options->ring_cache_size > 0)
     {
         wal_log->ring_cache = (char*) malloc(options->ring_cache_size);
@@ -179,54 +801,40 @@ int swal_open(const char* dir, const swal_options_t* options, swal_t** wal)
             return SWAL_ERR_MALLOC_FAIL;
         }
         wal_log->ring_cache_idx = 0;
-        wal_log->ring_cache_start_offset = meta->log_start_offset;
+        /* nothing cached yet after a restart */
+        wal_log->ring_cache_start_offset = meta->log_end_offset;
+    }
+    wal_log->prealloc_running = 1;
+    wal_log->prealloc_want = meta->log_end_offset / wal_log->segment_size + 1;
+    if (0 == pthread_create(&wal_log->prealloc_thread, NULL, prealloc_routine, wal_log))
+    {
+        wal_log->prealloc_started = 1;
     }
     *wal = wal_log;
     return 0;
 }
 
+size_t swal_open_dropped_len(swal_t* wal)
+{
+    return wal->open_dropped_len;
+}
+
 void* swal_user_meta(swal_t* wal)
 {
     if (NULL == wal)
     {
-        return -1;
+        return NULL;
     }
     char* meta = (char*) wal->meta;
     return meta + SWAL_META_SIZE;
 }
 
-int swal_append(swal_t* wal, const void* log, size_t loglen)
+/*
+ * update the checksum & ring cache with a piece of log already written to the file,
+ * the end offset is moved by swal_commit() once the whole append is done
+ */
+static void swal_cache_log(swal_t* wal, const void* log, size_t loglen)
 {
-    if (NULL == wal)
-    {
-        return -1;
-    }
-    const char* p = (const char*) log;
-    size_t write_len = loglen;
-    while (write_len)
-    {
-        size_t thislen = wal->options.max_file_size - wal->meta->log_file_pos;
-        if (thislen > write_len)
-            thislen = write_len;
-        int err = write(wal->fd, p, thislen);
-        if (err < 0)
-        {
-            return err;
-        }
-        wal->meta->log_file_pos += thislen;
-        if (wal->meta->log_file_pos == wal->options.max_file_size)
-        {
-            wal->meta->log_file_pos = 0;
-            lseek(wal->fd, 0, SEEK_SET);
-        }
-        write_len -= thislen;
-        p += thislen;
-    }
-    wal->meta->log_end_offset += loglen;
-    if (wal->meta->log_end_offset - wal->meta->log_start_offset >= wal->options.max_file_size)
-    {
-        wal->meta->log_start_offset = wal->meta->log_end_offset - wal->options.max_file_size;
-    }
     if (NULL != wal->options.cksm_func)
     {
         wal->meta->cksm = wal->options.cksm_func(wal->meta->cksm, (const unsigned char*) log, loglen);
@@ -234,7 +842,7 @@ int swal_append(swal_t* wal, const void* log, size_t loglen)
     if (NULL != wal->ring_cache)
     {
         size_t len = loglen;
-        p = (const char*) log;
+        const char* p = (const char*) log;
         while (len)
         {
             size_t thislen = wal->options.ring_cache_size - wal->ring_cache_idx;
@@ -249,11 +857,119 @@ int swal_append(swal_t* wal, const void* log, size_t loglen)
             len -= thislen;
             p += thislen;
         }
+    }
+}
+
+static void swal_commit(swal_t* wal, size_t loglen)
+{
+    wal->meta->log_end_offset += loglen;
+    if (wal->meta->log_end_offset - wal->meta->log_start_offset >= wal->options.max_file_size)
+    {
+        wal->meta->log_start_offset = wal->meta->log_end_offset - wal->options.max_file_size;
+    }
+    if (NULL != wal->ring_cache)
+    {
         if (wal->meta->log_end_offset - wal->ring_cache_start_offset >= wal->options.ring_cache_size)
         {
             wal->ring_cache_start_offset = wal->meta->log_end_offset - wal->options.ring_cache_size;
         }
     }
+    release_segments_before(wal, wal->meta->log_start_offset);
+}
+
+int swal_append(swal_t* wal, const void* log, size_t loglen)
+{
+    struct iovec iov;
+    iov.iov_base = (void*) log;
+    iov.iov_len = loglen;
+    return swal_appendv(wal, &iov, 1);
+}
+
+int swal_appendv(swal_t* wal, const struct iovec* iov, int iovcnt)
+{
+    if (NULL == wal)
+    {
+        return -1;
+    }
+    struct iovec vec[SWAL_IOV_MAX];
+    size_t total = 0;
+    size_t consumed = 0; /* bytes of iov[i] already written */
+    int i = 0;
+    while (i < iovcnt)
+    {
+        /*
+         * one pwritev() per call, split at segment ends or at the iovec limit
+         */
+        size_t offset = wal->meta->log_end_offset + total;
+        size_t index = offset / wal->segment_size;
+        size_t room = wal->segment_size - offset % wal->segment_size;
+        size_t batch = 0;
+        size_t skip = consumed;
+        int cnt = 0;
+        int j = i;
+        while (j < iovcnt && cnt < SWAL_IOV_MAX && batch < room)
+        {
+            size_t len = iov[j].iov_len - skip;
+            if (len > room - batch)
+                len = room - batch;
+            if (len > 0)
+            {
+                vec[cnt].iov_base = (char*) iov[j].iov_base + skip;
+                vec[cnt].iov_len = len;
+                cnt++;
+                batch += len;
+            }
+            if (skip + len < iov[j].iov_len)
+            {
+                break;
+            }
+            j++;
+            skip = 0;
+        }
+        if (0 == cnt)
+        {
+            /* only empty iovecs left */
+            break;
+        }
+        swal_segment_t* segment = wal->segment_count > 0 ? wal->segments + wal->segment_count - 1 : NULL;
+        if (NULL == segment || segment->index != index)
+        {
+            segment = open_write_segment(wal, index);
+            if (NULL == segment)
+            {
+                return SWAL_ERR_LOG_OPEN_FAIL;
+            }
+        }
+        /* positioned writes, the bytes of a failed call are overwritten by the next one */
+        ssize_t n = pwritev(segment->fd, vec, cnt, offset % wal->segment_size);
+        if (n < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return -1;
+        }
+        total += n;
+        size_t left = n;
+        while (left > 0)
+        {
+            size_t rest = iov[i].iov_len - consumed;
+            if (left < rest)
+            {
+                consumed += left;
+                break;
+            }
+            left -= rest;
+            consumed = 0;
+            i++;
+        }
+    }
+    for (i = 0; i < iovcnt; i++)
+    {
+        swal_cache_log(wal, iov[i].iov_base, iov[i].iov_len);
+    }
+    swal_commit(wal, total);
     return 0;
 }
 int swal_sync(swal_t* wal)
@@ -262,8 +978,20 @@ int swal_sync(swal_t* wal)
     {
         return -1;
     }
-    fdatasync(wal->fd);
-    return 0;
+    size_t i;
+    int ret = 0;
+    for (i = 0; i < wal->segment_count; i++)
+    {
+        if (wal->segments[i].index >= wal->sync_index && 0 != fdatasync(wal->segments[i].fd))
+        {
+            ret = -1;
+        }
+    }
+    if (wal->segment_count > 0)
+    {
+        wal->sync_index = wal->segments[wal->segment_count - 1].index;
+    }
+    return ret;
 }
 int swal_sync_meta(swal_t* wal)
 {
@@ -277,6 +1005,10 @@ int swal_sync_meta(swal_t* wal)
 
 int swal_replay(swal_t* wal, size_t offset, int64_t limit_len, swal_replay_logfunc func, void* data)
 {
+    if (offset < wal->meta->log_start_offset || offset > wal->meta->log_end_offset)
+    {
+        return SWAL_ERR_INVALID_OFFSET;
+    }
     size_t total = wal->meta->log_end_offset - offset;
     if (limit_len > 0 && limit_len < total)
     {
@@ -286,7 +1018,6 @@ int swal_replay(swal_t* wal, size_t offset, int64_t limit_len, swal_replay_logfu
     {
         if (offset >= wal->ring_cache_start_offset)
         {
-            size_t cache_end_idx = wal->ring_cache_idx;
             size_t cache_len = wal->meta->log_end_offset - offset;
             if (wal->ring_cache_idx >= cache_len)
             {
@@ -308,57 +1039,112 @@ int swal_replay(swal_t* wal, size_t offset, int64_t limit_len, swal_replay_logfu
             return 0;
         }
     }
-    if (NULL == wal->mmap_buf)
-    {
-        wal->mmap_buf = (char*) mmap(NULL, wal->options.max_file_size, PROT_READ, MAP_SHARED, wal->fd, 0);
-    }
-    if (offset >= wal->meta->log_start_offset)
+    while (total > 0)
     {
-        size_t data_len = wal->meta->log_end_offset - offset;
-        if (wal->meta->log_file_pos >= data_len)
+        swal_segment_t* segment = find_segment(wal, offset / wal->segment_size);
+        if (NULL == segment)
         {
-            func(wal->mmap_buf + wal->meta->log_file_pos - data_len, total, data);
+            return SWAL_ERR_INVALID_OFFSET;
         }
-        else
+        if (NULL == segment->mmap_buf)
         {
-            size_t start_pos = wal->options.max_file_size - total + wal->meta->log_file_pos;
-            if (total <= wal->options.max_file_size - start_pos)
-            {
-                func(wal->mmap_buf + start_pos, total, data);
-            }
-            else
+            void* buf = mmap(NULL, wal->segment_size, PROT_READ, MAP_SHARED, segment->fd, 0);
+            if (MAP_FAILED == buf)
             {
-                func(wal->mmap_buf + start_pos, wal->options.max_file_size - start_pos, data);
-                func(wal->mmap_buf, start_pos + total - wal->options.max_file_size, data);
+                return -1;
             }
+            segment->mmap_buf = (char*) buf;
         }
-        return 0;
+        size_t pos = offset % wal->segment_size;
+        size_t len = wal->segment_size - pos;
+        if (len > total)
+            len = total;
+        func(segment->mmap_buf + pos, len, data);
+        offset += len;
+        total -= len;
     }
     return 0;
 }
 void swal_clear_replay_cache(swal_t* wal)
 {
-    if (NULL != wal->mmap_buf)
+    size_t i;
+    for (i = 0; i < wal->segment_count; i++)
     {
-        munmap(wal->mmap_buf, wal->options.max_file_size);
-        wal->mmap_buf = NULL;
+        if (NULL != wal->segments[i].mmap_buf)
+        {
+            munmap(wal->segments[i].mmap_buf, wal->segment_size);
+            wal->segments[i].mmap_buf = NULL;
+        }
+    }
+}
+int swal_segment_region(swal_t* wal, size_t offset, int* fd, size_t* pos, size_t* len)
+{
+    if (NULL == wal || offset < wal->meta->log_start_offset || offset >= wal->meta->log_end_offset)
+    {
+        return SWAL_ERR_INVALID_OFFSET;
+    }
+    swal_segment_t* segment = find_segment(wal, offset / wal->segment_size);
+    if (NULL == segment || segment->fd < 0)
+    {
+        return SWAL_ERR_INVALID_OFFSET;
+    }
+    size_t end = (segment->index + 1) * wal->segment_size;
+    if (end > wal->meta->log_end_offset)
+    {
+        end = wal->meta->log_end_offset;
+    }
+    segment->pins++;
+    *fd = segment->fd;
+    *pos = offset % wal->segment_size;
+    *len = end - offset;
+    return 0;
+}
+void swal_segment_unpin(swal_t* wal, int fd)
+{
+    size_t i;
+    for (i = 0; i < wal->segment_count; i++)
+    {
+        if (wal->segments[i].fd == fd)
+        {
+            wal->segments[i].pins--;
+            return;
+        }
+    }
+    for (i = 0; i < wal->retired_count; i++)
+    {
+        swal_segment_t* segment = wal->retired + i;
+        if (segment->fd != fd)
+        {
+            continue;
+        }
+        if (--segment->pins > 0)
+        {
+            return;
+        }
+        close(segment->fd);
+        if (NULL != segment->retired_path)
+        {
+            pthread_mutex_lock(&wal->prealloc_lock);
+            push_spare(wal, segment->retired_path);
+            pthread_cond_signal(&wal->prealloc_cond);
+            pthread_mutex_unlock(&wal->prealloc_lock);
+        }
+        *segment = wal->retired[--wal->retired_count];
+        return;
     }
 }
 int swal_reset(swal_t* wal, size_t offset, uint64_t cksm)
 {
+    release_all_segments(wal, 1);
     wal->meta->log_start_offset = offset;
     wal->meta->log_end_offset = offset;
-    wal->meta->log_file_pos = 0;
     wal->meta->cksm = cksm;
+    wal->sync_index = offset / wal->segment_size;
     if (NULL != wal->ring_cache)
     {
         wal->ring_cache_start_offset = offset;
         wal->ring_cache_idx = 0;
     }
-    if (-1 != wal->fd)
-    {
-        lseek(wal->fd, wal->meta->log_file_pos, SEEK_SET);
-    }
     return 0;
 }
 uint64_t swal_cksm(swal_t* wal)
@@ -379,10 +1165,33 @@ int swal_close(swal_t* wal)
     {
         return -1;
     }
-    if (-1 != wal->fd)
+    if (wal->prealloc_started)
+    {
+        pthread_mutex_lock(&wal->prealloc_lock);
+        wal->prealloc_running = 0;
+        pthread_cond_signal(&wal->prealloc_cond);
+        pthread_mutex_unlock(&wal->prealloc_lock);
+        pthread_join(wal->prealloc_thread, NULL);
+    }
+    if (wal->ready_fd >= 0)
     {
-        close(wal->fd);
-        wal->fd = -1;
+        /* found out of the log and reused by the next open */
+        close(wal->ready_fd);
+        wal->ready_fd = -1;
+    }
+    release_all_segments(wal, 0);
+    free(wal->segments);
+    size_t i;
+    for (i = 0; i < wal->retired_count; i++)
+    {
+        /* the spare files are found by the next open */
+        close(wal->retired[i].fd);
+        free(wal->retired[i].retired_path);
+    }
+    free(wal->retired);
+    while (NULL != wal->spares)
+    {
+        free_spare(pop_spare(wal));
     }
     if (NULL != wal->ring_cache)
     {
@@ -392,9 +1201,10 @@ int swal_close(swal_t* wal)
     {
         munmap(wal->meta, wal->options.user_meta_size + SWAL_META_SIZE);
     }
-    swal_clear_replay_cache(wal);
+    pthread_mutex_destroy(&wal->prealloc_lock);
+    pthread_cond_destroy(&wal->prealloc_cond);
+    free(wal->file_prefix);
     free(wal->dir);
     free(wal);
     return 0;
 }
-
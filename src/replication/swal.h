@@ -32,6 +32,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #define SWAL_ERR_MALLOC_FAIL  -100
 #define SWAL_ERR_META_OPEN_FAIL  -101
@@ -47,7 +48,8 @@ extern "C"
     typedef struct swal_options_t
     {
             int create_ifnotexist;
-            size_t max_file_size;
+            size_t max_file_size;  //size of the whole log
+            size_t segment_size;   //the log is kept in files of this size
             size_t user_meta_size;
             size_t ring_cache_size;
             swal_cksm_func* cksm_func;
@@ -58,14 +60,27 @@ extern "C"
 
     typedef struct swal_t swal_t;
     int swal_open(const char* dir, const swal_options_t* options, swal_t** wal);
+    /* length of the backlog swal_open() couldn't keep, when the segment size changed or
+     * a log written as one file couldn't be copied into segments */
+    size_t swal_open_dropped_len(swal_t* wal);
     void* swal_user_meta(swal_t* wal);
     int swal_append(swal_t* wal, const void* log, size_t loglen);
+    /* append a batch of logs with pwritev(), the checksum is updated over the whole batch,
+     * nothing is appended if it fails */
+    int swal_appendv(swal_t* wal, const struct iovec* iov, int iovcnt);
     int swal_sync(swal_t* wal);
     int swal_sync_meta(swal_t* wal);
 
     typedef int swal_replay_logfunc(const void* log, size_t loglen, void* data);
     int swal_replay(swal_t* wal, size_t offset, int64_t limit_len, swal_replay_logfunc func, void* data);
     void swal_clear_replay_cache(swal_t* wal);
+    /*
+     * locate the log from offset in its segment file for sendfile(), the region ends at the end of
+     * the segment or of the log, the fd is still owned by the wal. The segment is pinned: its file
+     * is neither closed nor recycled until swal_segment_unpin() with the same fd.
+     */
+    int swal_segment_region(swal_t* wal, size_t offset, int* fd, size_t* pos, size_t* len);
+    void swal_segment_unpin(swal_t* wal, int fd);
     int swal_reset(swal_t* wal, size_t offset, uint64_t cksm);
     uint64_t swal_cksm(swal_t* wal);
     size_t swal_start_offset(swal_t* wal);
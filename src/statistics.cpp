@@ -41,49 +41,58 @@ OP_NAMESPACE_BEGIN
         StringArray& servers = g_db->GetConfig().listen_addresses;
         for (uint32 i = 0; i < servers.size(); i++)
         {
-            m_server_stats[servers[i]].ops_limit = g_db->GetConfig().qps_limits[i];
+            ServerStatistics* stat = GetServerStatistics(servers[i]);
+            LockGuard<SpinMutexLock> guard(stat->ops_bucket_lock);
+            stat->ops_bucket.SetRate(g_db->GetConfig().qps_limits[i]);
         }
-        m_server_stats[MASTER_SERVER_ADDRESS_NAME].ops_limit = 0;
+        GetServerStatistics(MASTER_SERVER_ADDRESS_NAME);
     }
     void Statistics::Clear()
     {
         stat_expiredkeys = 0;
+        LockGuard<SpinMutexLock> guard(m_server_stats_lock);
         ServerStatisticsTable::iterator it = m_server_stats.begin();
         while(it != m_server_stats.end())
         {
-            it->second.Clear();
+            it->second->Clear();
             it++;
         }
     }
-    void Statistics::IncAcceptedClient(const std::string& server, int v)
+    /*
+     * Resolved once per client, the commands are counted without looking up the table.
+     */
+    ServerStatistics* Statistics::GetServerStatistics(const std::string& server)
     {
-        ServerStatistics& stat = m_server_stats[server];
-        atomic_add_uint64(&stat.connections_received, v);
+        LockGuard<SpinMutexLock> guard(m_server_stats_lock);
+        ServerStatistics*& stat = m_server_stats[server];
+        if (NULL == stat)
+        {
+            NEW(stat, ServerStatistics);
+        }
+        return stat;
     }
-    void Statistics::IncRefusedConnection(const std::string& server)
+    void Statistics::IncAcceptedClient(ServerStatistics* stat, int v)
     {
-        ServerStatistics& stat = m_server_stats[server];
-        atomic_add_uint64(&stat.refused_connections, 1);
+        atomic_add_uint64(&stat->connections_received, v);
     }
-    int Statistics::IncRecvCommands(const std::string& server, int64& seq)
+    void Statistics::IncRefusedConnection(ServerStatistics* stat)
     {
-        ServerStatistics& stat = m_server_stats[server];
-        seq = atomic_add_uint64(&stat.stat_numcommands, 1);
-        atomic_add_uint64(&stat.instantaneous_ops, 1);
-        if (stat.ops_limit > 0 && stat.instantaneous_ops >= stat.ops_limit)
-        {
-            return ERR_OVERLOAD;
-        }
-        return 0;
+        atomic_add_uint64(&stat->refused_connections, 1);
+    }
+    void Statistics::IncRecvCommands(ServerStatistics* stat, int64& seq)
+    {
+        seq = atomic_add_uint64(&stat->stat_numcommands, 1);
+        atomic_add_uint64(&stat->instantaneous_ops, 1);
     }
 
     void Statistics::TrackOperationsPerSecond()
     {
         uint64 t = get_current_epoch_millis() - m_ops_sec_last_sample_time;
+        LockGuard<SpinMutexLock> guard(m_server_stats_lock);
         ServerStatisticsTable::iterator it = m_server_stats.begin();
         while (it != m_server_stats.end())
         {
-            ServerStatistics& st = it->second;
+            ServerStatistics& st = *(it->second);
             long long ops = st.stat_numcommands - st.ops_sec_last_sample_ops;
             long long ops_sec;
             ops_sec = t > 0 ? (ops * 1000 / t) : 0;
@@ -103,20 +112,23 @@ OP_NAMESPACE_BEGIN
         uint64 total_commands_processed = 0;
         uint64 instantaneous_ops_per_sec = 0;
         uint64 refused_client = 0;
+        uint64 overload_commands = 0;
+        LockGuard<SpinMutexLock> guard(m_server_stats_lock);
         ServerStatisticsTable::iterator it = m_server_stats.begin();
         while (it != m_server_stats.end())
         {
-            ServerStatistics& st = it->second;
+            ServerStatistics& st = *(it->second);
             if (st.stat_numcommands > 0)
             {
                 total_connections_received += st.connections_received;
                 total_commands_processed += st.stat_numcommands;
                 instantaneous_ops_per_sec += st.GetOperationsPerSecond();
+                overload_commands += st.overload_commands;
                 substat.append(it->first).append(": ");
                 substat.append("connections_received=").append(stringfromll(st.connections_received)).append(" ");
                 substat.append("commands_processed=").append(stringfromll(st.stat_numcommands)).append(" ");
-                substat.append("ops_per_sec=").append(stringfromll(st.GetOperationsPerSecond())).append(
-                        "\n");
+                substat.append("ops_per_sec=").append(stringfromll(st.GetOperationsPerSecond())).append(" ");
+                substat.append("overload_commands=").append(stringfromll(st.overload_commands)).append("\n");
                 substat.append("refused_client=").append(stringfromll(st.refused_connections)).append(
                                         "\n");
             }
@@ -127,6 +139,7 @@ OP_NAMESPACE_BEGIN
         str.append("expired_keys:").append(stringfromll(stat_expiredkeys)).append("\n");
         str.append("instantaneous_ops_per_sec:").append(stringfromll(instantaneous_ops_per_sec)).append("\n");
         str.append("refused_client:").append(stringfromll(refused_client)).append("\n");
+        str.append("overload_commands:").append(stringfromll(overload_commands)).append("\n");
         str.append(substat);
         return str;
     }
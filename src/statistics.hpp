@@ -34,6 +34,7 @@
 #include "thread/spin_mutex_lock.hpp"
 #include "thread/lock_guard.hpp"
 #include "util/string_helper.hpp"
+#include "util/token_bucket.hpp"
 #define COMMS_OPS_SEC_SAMPLES 16
 OP_NAMESPACE_BEGIN
 
@@ -46,10 +47,13 @@ OP_NAMESPACE_BEGIN
             uint64 ops_sec_samples[COMMS_OPS_SEC_SAMPLES];
             volatile uint64 instantaneous_ops;
             volatile uint64 refused_connections;
-            int64 ops_limit;
+            volatile uint64 overload_commands;
+            /* listener 'qps-limit', shared by the clients of all the listener's worker loops */
+            TokenBucket ops_bucket;
+            SpinMutexLock ops_bucket_lock;
             ServerStatistics() :
                     stat_numcommands(0), ops_sec_last_sample_ops(0), ops_sec_idx(0), connections_received(0), instantaneous_ops(
-                            0),refused_connections(0), ops_limit(0)
+                            0),refused_connections(0), overload_commands(0)
             {
                 memset(ops_sec_samples, 0, sizeof(ops_sec_samples));
             }
@@ -70,6 +74,7 @@ OP_NAMESPACE_BEGIN
                 connections_received = 0;
                 instantaneous_ops = 0;
                 refused_connections = 0;
+                overload_commands = 0;
                 memset(ops_sec_samples, 0, sizeof(ops_sec_samples));
             }
     };
@@ -77,17 +82,20 @@ OP_NAMESPACE_BEGIN
     class Statistics
     {
         private:
-            typedef TreeMap<std::string, ServerStatistics>::Type ServerStatisticsTable;
+            /* entries are never freed, clients keep pointers to them */
+            typedef TreeMap<std::string, ServerStatistics*>::Type ServerStatisticsTable;
             ServerStatisticsTable m_server_stats;
+            SpinMutexLock m_server_stats_lock;
             uint64 m_ops_sec_last_sample_time;
 
         public:
             uint64_t stat_expiredkeys;
             Statistics();
             void Init();
-            void IncAcceptedClient(const std::string& server, int v);
-            void IncRefusedConnection(const std::string& server);
-            int IncRecvCommands(const std::string& server, int64& seq);
+            ServerStatistics* GetServerStatistics(const std::string& server);
+            void IncAcceptedClient(ServerStatistics* stat, int v);
+            void IncRefusedConnection(ServerStatistics* stat);
+            void IncRecvCommands(ServerStatistics* stat, int64& seq);
             void TrackOperationsPerSecond();
             const std::string& PrintStat(std::string& str);
             void Clear();
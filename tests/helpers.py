@@ -0,0 +1,41 @@
+from __future__ import with_statement
+import contextlib
+import threading
+import redis
+
+
+slow_script = """
+local i = 0
+while i < tonumber(ARGV[1]) do
+    i = i + 1
+end
+return i"""
+
+
+def new_client(r):
+    "A client with its own connection pool, connected like r"
+    pool = r.connection_pool
+    return redis.Redis(connection_pool=redis.ConnectionPool(
+        connection_class=pool.connection_class, **pool.connection_kwargs))
+
+
+def new_clients(r, count):
+    return [new_client(r) for _ in range(count)]
+
+
+@contextlib.contextmanager
+def running_slow_script(r, iterations):
+    """
+    Runs the busy looping slow_script on r in a thread, with lua-time-limit
+    lowered so the script re-enters the event loop of its connection.
+    Yields the thread, which is joined and the limit restored on exit.
+    """
+    limit = r.config_get('lua-time-limit')['lua-time-limit']
+    r.config_set('lua-time-limit', 10)
+    slow = threading.Thread(target=r.eval, args=(slow_script, 0, iterations))
+    try:
+        slow.start()
+        yield slow
+    finally:
+        slow.join()
+        r.config_set('lua-time-limit', limit)
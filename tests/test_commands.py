@@ -3,6 +3,8 @@ import binascii
 import datetime
 import pytest
 import redis
+import socket
+import threading
 import time
 
 from redis._compat import (unichr, u, b, ascii_letters, iteritems, iterkeys,
@@ -11,6 +13,7 @@ from redis.client import parse_info
 from redis import exceptions
 
 from .conftest import skip_if_server_version_lt
+from .helpers import new_client, new_clients, running_slow_script
 
 
 @pytest.fixture()
@@ -105,6 +108,51 @@ class TestRedisCommands(object):
         assert isinstance(info, dict)
         assert info['db9']['keys'] == 2
 
+    def test_info_client_output_buffer_limit(self, r):
+        stats = r.info('stats')
+        assert stats['client_output_buffer_limit_disconnections'] >= 0
+        # connections refused since every channel slot was taken
+        assert stats['rejected_connections'] == 0
+
+    def test_slow_reader_closed_by_soft_limit(self, r):
+        kwargs = r.connection_pool.connection_kwargs
+        slow = socket.create_connection((kwargs.get('host', 'localhost'),
+                                         kwargs.get('port', 6379)))
+        try:
+            slow.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+            r.set('big', b('x') * (1024 * 1024))
+            before = r.info('stats')[
+                'client_output_buffer_limit_disconnections']
+            # applies to the connections already open
+            r.config_set('client-output-buffer-limit', 'normal 0 2mb 1')
+            time.sleep(0.1)
+            slow.sendall(b('*2\r\n$3\r\nGET\r\n$3\r\nbig\r\n') * 32)
+            # no more output is queued, the soft limit expires on its own
+            time.sleep(3)
+            assert r.info('stats')[
+                'client_output_buffer_limit_disconnections'] == before + 1
+            received = 0
+            slow.settimeout(5)
+            while True:
+                try:
+                    data = slow.recv(65536)
+                except socket.error:
+                    break
+                if not data:
+                    break
+                received += len(data)
+            assert received < 32 * 1024 * 1024
+        finally:
+            slow.close()
+            r.config_set('client-output-buffer-limit', 'normal 0 0 0')
+
+    def test_info_buffer_pool(self, r):
+        r['a'] = 'x' * 100000
+        assert len(r['a']) == 100000
+        info = r.info('memory')
+        assert info['used_buffer_bytes'] >= 0
+        assert info['pooled_buffer_bytes'] >= 0
+
     def test_lastsave(self, r):
         assert isinstance(r.lastsave(), datetime.datetime)
 
@@ -335,6 +383,24 @@ class TestRedisCommands(object):
         assert r.get('integer') == b(str(integer))
         assert r.get('unicode_string').decode('utf-8') == unicode_string
 
+    def test_set_large_values(self, r):
+        # requests larger than one socket read are decoded incrementally
+        large = b('x') * (4 * 1024 * 1024)
+        assert r.set('large', large)
+        assert r.get('large') == large
+        fields = dict(('f%d' % i, b(str(i)) * 1024) for i in range(1000))
+        assert r.hmset('h', fields)
+        assert r.hget('h', 'f999') == b('999') * 1024
+
+    def test_mget_large_values(self, r):
+        # large payloads are written by reference between small replies
+        big = b('y') * (1024 * 1024)
+        r.mset({'a': big, 'b': 'small', 'c': b('z') * 20000})
+        assert r.mget('a', 'b', 'c') == [big, b('small'), b('z') * 20000]
+        with r.pipeline(transaction=False) as pipe:
+            pipe.get('a').get('b').get('c').get('a')
+            assert pipe.execute() == [big, b('small'), b('z') * 20000, big]
+
     def test_getitem_and_setitem(self, r):
         r['a'] = 'bar'
         assert r['a'] == b('bar')
@@ -1326,6 +1392,158 @@ class TestRedisCommands(object):
             [b('vodka'), b('milk'), b('gin'), b('apple juice')]
 
 
+class TestEventLoopIO(object):
+    "Tests for the event loop backends (epoll, io_uring) and socket I/O"
+
+    def test_info_multiplexing_api(self, r):
+        assert r.info('server')['multiplexing_api'] in ('epoll', 'io_uring')
+
+    def test_many_connections_large_replies(self, r):
+        # toggles write interest and reuses fds, which the io_uring backend
+        # has to re-arm on every loop iteration
+        value = b('x') * (1024 * 1024)
+        r.set('big', value)
+        for round in range(3):
+            clients = new_clients(r, 32)
+            for i, c in enumerate(clients):
+                pipe = c.pipeline(transaction=False)
+                pipe.get('big')
+                for j in range(50):
+                    pipe.incr('conn:%d' % i)
+                res = pipe.execute()
+                assert res[0] == value
+                assert res[-1] == 50 * (round + 1)
+            for c in clients:
+                c.connection_pool.disconnect()
+
+    def test_large_requests_and_pipelines(self, r):
+        # requests spanning many receive buffers of the io_uring backend and
+        # replies larger than what it queues for one send
+        value = b('v') * (4 * 1024 * 1024 + 7)
+        r.set('big:req', value)
+        assert r.strlen('big:req') == len(value)
+        pipe = r.pipeline(transaction=False)
+        for i in range(2000):
+            pipe.set('big:req:%d' % i, value[:i * 7])
+            if i % 200 == 0:
+                pipe.get('big:req')
+        res = pipe.execute()
+        assert res.count(value) == 10
+        assert r.get('big:req:1999') == value[:1999 * 7]
+
+    def test_large_multi_segment_reply(self, r):
+        # more shared payload segments than one writev takes, the rest must
+        # be flushed by later write events, also with tcp-edge-triggered
+        values = {}
+        for i in range(200):
+            values['seg:%d' % i] = b(chr(ord('a') + i % 26)) * (32 * 1024)
+        r.mset(values)
+        keys = sorted(values.keys())
+        for _ in range(3):
+            assert r.mget(keys) == [values[k] for k in keys]
+
+
+class TestAsyncIO(object):
+    "Tests for the AsyncIO tasks posted between event loops"
+
+    def test_info_async_io_loops(self, r):
+        def tasks():
+            stats = r.info('stats')
+            return sum(v['tasks'] for k, v in iteritems(stats)
+                       if k.startswith('async_io_loop'))
+        before = tasks()
+        clients = new_clients(r, 16)
+        addrs = []
+        for c in clients:
+            c.ping()
+            conn = c.connection_pool.get_connection('PING')
+            addrs.append('%s:%d' % conn._sock.getsockname())
+            c.connection_pool.release(conn)
+        for addr in addrs:
+            assert r.client_kill(addr)
+        # every kill is posted to the loop owning the client
+        time.sleep(0.1)
+        assert tasks() >= before + len(addrs)
+        for c in clients:
+            conn = c.connection_pool.get_connection('PING')
+            with pytest.raises(exceptions.ConnectionError):
+                conn.read_response()
+
+    def test_async_io_flushed_during_slow_script(self, r):
+        # a kill issued while a slow script runs on some loop must not wait
+        # for the script to finish
+        victim = new_client(r)
+        victim.ping()
+        conn = victim.connection_pool.get_connection('PING')
+        victim_addr = '%s:%d' % conn._sock.getsockname()
+        with running_slow_script(r, 200000000) as slow:
+            time.sleep(0.1)
+            assert new_client(r).client_kill(victim_addr)
+            time.sleep(0.2)
+            assert slow.is_alive()
+            with pytest.raises(exceptions.ConnectionError):
+                conn.read_response()
+
+
+class TestLoopRebalance(object):
+    "Tests for rebalancing connections across worker loops"
+
+    def test_info_loop_load(self, r):
+        stats = r.info('stats')
+        assert stats['loop0']['cpu_usage'] >= 0
+        assert stats['loop0']['migrated_in'] == 0
+        assert stats['loop0']['spin_us'] >= 0
+
+    def test_migrated_connections_served_and_killed(self, r):
+        config = r.config_get('loop-rebalance-*')
+        threshold = int(config.get('loop-rebalance-threshold', 0))
+        if threshold <= 0:
+            pytest.skip('loop rebalancing is disabled')
+        period = int(config.get('loop-rebalance-period', 1))
+
+        def migrated():
+            stats = r.info('stats')
+            return sum(v['migrated_out'] for k, v in iteritems(stats)
+                       if k.startswith('loop'))
+        before = migrated()
+        clients = new_clients(r, 4)
+        errors = []
+        stop = []
+
+        def hot(i, c):
+            n = 0
+            while not stop:
+                pipe = c.pipeline(transaction=False)
+                for j in range(200):
+                    pipe.incr('hot:%d' % i)
+                res = pipe.execute()
+                n += 200
+                if res[-1] != n:
+                    errors.append((i, res[-1], n))
+        threads = [threading.Thread(target=hot, args=(i, c))
+                   for i, c in enumerate(clients)]
+        for t in threads:
+            t.start()
+        deadline = time.time() + period * 3 + 5
+        while migrated() == before and time.time() < deadline:
+            time.sleep(0.5)
+        stop.append(True)
+        for t in threads:
+            t.join()
+        assert not errors
+        if migrated() == before:
+            pytest.skip('no connection was migrated')
+        # kills are posted to the loop the connection was moved to
+        conns = []
+        for c in clients:
+            conn = c.connection_pool.get_connection('PING')
+            assert r.client_kill('%s:%d' % conn._sock.getsockname())
+            conns.append(conn)
+        for conn in conns:
+            with pytest.raises(exceptions.ConnectionError):
+                conn.read_response()
+
+
 class TestStrictCommands(object):
 
     def test_strict_zadd(self, sr):
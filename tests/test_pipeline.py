@@ -44,6 +44,30 @@ class TestPipeline(object):
             assert r['b'] == b('b1')
             assert r['c'] == b('c1')
 
+    def test_pipeline_large_batch_no_transaction(self, r):
+        with r.pipeline(transaction=False) as pipe:
+            for i in range(200):
+                pipe.set('k%d' % i, i)
+                pipe.get('k%d' % i)
+            result = pipe.execute()
+            assert len(result) == 400
+            for i in range(200):
+                assert result[2 * i]
+                assert result[2 * i + 1] == b(str(i))
+
+    def test_pipeline_queued_multi_key_commands(self, r):
+        with r.pipeline() as pipe:
+            pipe.mset({'a': 'a1', 'b': 'b1'})
+            pipe.hmset('h', {'f1': 'v1', 'f2': 'v2'})
+            pipe.mget('a', 'b', 'c').hmget('h', 'f1', 'f2')
+            assert pipe.execute() == \
+                [
+                    True,
+                    True,
+                    [b('a1'), b('b1'), None],
+                    [b('v1'), b('v2')],
+                ]
+
     def test_pipeline_no_transaction_watch(self, r):
         r['a'] = 0
 
@@ -249,6 +249,18 @@ class TestPubSubMessages(object):
         assert message2 in expected
         assert message1 != message2
 
+    def test_published_large_message_to_subscribers(self, r):
+        # large payloads are shared by the replies to all subscribers
+        data = 'x' * (64 * 1024)
+        p1 = r.pubsub(ignore_subscribe_messages=True)
+        p1.subscribe('foo')
+        p2 = r.pubsub(ignore_subscribe_messages=True)
+        p2.psubscribe('f*')
+        assert r.publish('foo', data) == 2
+        assert wait_for_message(p1) == make_message('message', 'foo', data)
+        assert wait_for_message(p2) == \
+            make_message('pmessage', 'foo', data, pattern='f*')
+
     def test_channel_message_handler(self, r):
         p = r.pubsub(ignore_subscribe_messages=True)
         p.subscribe(foo=self.message_handler)
@@ -390,3 +402,118 @@ class TestPubSubRedisDown(object):
         p = r.pubsub()
         with pytest.raises(ConnectionError):
             p.subscribe('foo')
+
+
+class TestClientTracking(object):
+    def test_tracking_invalidation_messages(self, r):
+        conn = r.connection_pool.get_connection('pubsub')
+        try:
+            conn.send_command('CLIENT', 'ID')
+            target = conn.read_response()
+            conn.send_command('SUBSCRIBE', '__redis__:invalidate')
+            conn.read_response()
+
+            assert r.execute_command('CLIENT', 'TRACKING', 'on',
+                                     'REDIRECT', target)
+            assert r.execute_command('CLIENT', 'GETREDIR') == target
+            r.get('foo')
+            r.set('foo', 'bar')
+            assert conn.read_response() == \
+                [b'message', b'__redis__:invalidate', [b'foo']]
+
+            # keys not read are not tracked
+            r.set('foo', 'baz')
+            assert not conn.can_read(timeout=0.1)
+
+            assert r.execute_command('CLIENT', 'TRACKING', 'off')
+            assert r.execute_command('CLIENT', 'TRACKING', 'on',
+                                     'REDIRECT', target, 'BCAST',
+                                     'PREFIX', 'user:')
+            r.set('user:1', 'x')
+            assert conn.read_response() == \
+                [b'message', b'__redis__:invalidate', [b'user:1']]
+            r.set('other', 'x')
+            assert not conn.can_read(timeout=0.1)
+            assert r.execute_command('CLIENT', 'TRACKING', 'off')
+        finally:
+            conn.disconnect()
+            r.connection_pool.release(conn)
+
+    def test_tracking_redirect_broken(self, r):
+        target_conn = r.connection_pool.get_connection('pubsub')
+        conn = r.connection_pool.get_connection('pubsub')
+        try:
+            target_conn.send_command('CLIENT', 'ID')
+            target = target_conn.read_response()
+            conn.send_command('CLIENT', 'TRACKING', 'on', 'REDIRECT', target)
+            assert conn.read_response() == b'OK'
+            conn.send_command('GET', 'foo')
+            conn.read_response()
+
+            target_conn.disconnect()
+            time.sleep(0.1)
+            r.set('foo', 'bar')
+            # nothing is pushed in front of the next reply
+            assert not conn.can_read(timeout=0.1)
+            conn.send_command('PING')
+            assert conn.read_response() == b'PONG'
+        finally:
+            conn.disconnect()
+            r.connection_pool.release(conn)
+            r.connection_pool.release(target_conn)
+
+    def test_tracking_requires_redirect(self, r):
+        with pytest.raises(redis.ResponseError):
+            r.execute_command('CLIENT', 'TRACKING', 'on')
+        conn = r.connection_pool.get_connection('_')
+        try:
+            conn.send_command('CLIENT', 'ID')
+            self_id = conn.read_response()
+            conn.send_command('CLIENT', 'TRACKING', 'on', 'REDIRECT', self_id)
+            with pytest.raises(redis.ResponseError):
+                conn.read_response()
+        finally:
+            r.connection_pool.release(conn)
+
+    def test_tracking_only_to_subscribed_target(self, r):
+        target_conn = r.connection_pool.get_connection('pubsub')
+        conn = r.connection_pool.get_connection('_')
+        try:
+            target_conn.send_command('CLIENT', 'ID')
+            target = target_conn.read_response()
+            conn.send_command('CLIENT', 'TRACKING', 'on', 'REDIRECT', target)
+            assert conn.read_response() == b'OK'
+            conn.send_command('GET', 'foo')
+            conn.read_response()
+            r.set('foo', 'bar')
+            # not subscribed to __redis__:invalidate, the replies stay in step
+            assert not target_conn.can_read(timeout=0.1)
+            target_conn.send_command('PING')
+            assert target_conn.read_response() == b'PONG'
+        finally:
+            conn.disconnect()
+            target_conn.disconnect()
+            r.connection_pool.release(conn)
+            r.connection_pool.release(target_conn)
+
+    def test_tracking_off_stops_invalidations(self, r):
+        target_conn = r.connection_pool.get_connection('pubsub')
+        conn = r.connection_pool.get_connection('_')
+        try:
+            target_conn.send_command('CLIENT', 'ID')
+            target = target_conn.read_response()
+            target_conn.send_command('SUBSCRIBE', '__redis__:invalidate')
+            target_conn.read_response()
+            conn.send_command('CLIENT', 'TRACKING', 'on', 'REDIRECT', target)
+            assert conn.read_response() == b'OK'
+            conn.send_command('GET', 'foo')
+            conn.read_response()
+            conn.send_command('CLIENT', 'TRACKING', 'off')
+            assert conn.read_response() == b'OK'
+            r.set('foo', 'bar')
+            assert not target_conn.can_read(timeout=0.1)
+        finally:
+            conn.disconnect()
+            target_conn.disconnect()
+            r.connection_pool.release(conn)
+            r.connection_pool.release(target_conn)
@@ -0,0 +1,253 @@
+from __future__ import with_statement
+import os
+import pytest
+import redis
+import socket
+import struct
+import threading
+import time
+
+from redis._compat import b
+
+
+# these tests need a slave replicating the test server, e.g.
+#   comms -c slave.conf   (slaveof 127.0.0.1 6379, slave-apply-threads 4)
+#   COMMS_SLAVE_PORT=6380 py.test tests/test_replication.py
+slave_port = os.environ.get('COMMS_SLAVE_PORT')
+needs_slave = pytest.mark.skipif(slave_port is None,
+                                 reason='COMMS_SLAVE_PORT is not set')
+
+
+@pytest.fixture()
+def slave(request, r):
+    kwargs = dict(r.connection_pool.connection_kwargs)
+    kwargs['port'] = int(slave_port)
+    return redis.Redis(**kwargs)
+
+
+def wait_for(predicate, timeout=10):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if predicate():
+            return True
+        time.sleep(0.05)
+    return predicate()
+
+
+def mark_synced(r, slave, name):
+    # MSET is applied by the slave after everything before it, a SET could
+    # be applied ahead of other keys with slave-apply-threads
+    r.mset({name: 1})
+    assert wait_for(lambda: slave.get(name) == b('1'))
+
+
+def concurrent_writes(r, key, clients, writes):
+    errors = []
+
+    def writer(n):
+        try:
+            c = redis.Redis(**r.connection_pool.connection_kwargs)
+            for i in range(writes):
+                c.set(key, '%d:%d' % (n, i))
+                c.rpush(key + ':log', '%d:%d' % (n, i))
+        except Exception as e:
+            errors.append(e)
+    threads = [threading.Thread(target=writer, args=(n,))
+               for n in range(clients)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join(30)
+    return errors
+
+
+class TestWALGroupCommit(object):
+    def test_concurrent_writers_all_answered(self, r):
+        # every write is held until its WAL batch is written (and synced
+        # with wal-fsync always); all of them must be released
+        errors = concurrent_writes(r, 'wal:gc', 8, 200)
+        assert errors == []
+        assert r.llen('wal:gc:log') == 8 * 200
+        assert r.get('wal:gc') is not None
+
+    @needs_slave
+    def test_same_key_from_many_connections(self, r, slave):
+        errors = concurrent_writes(r, 'wal:order', 8, 200)
+        assert errors == []
+        mark_synced(r, slave, 'wal:order:done')
+        # the slave replays the WAL, so it only matches the master if the
+        # commands were logged in the order the master applied them
+        assert slave.get('wal:order') == r.get('wal:order')
+        assert slave.lrange('wal:order:log', 0, -1) == \
+            r.lrange('wal:order:log', 0, -1)
+
+
+@needs_slave
+class TestParallelApply(object):
+    def test_per_key_order(self, r, slave):
+        pipe = r.pipeline(transaction=False)
+        for i in range(2000):
+            key = 'apply:%d' % (i % 16)
+            pipe.rpush(key, i)
+            pipe.incr(key + ':n')
+            if i % 7 == 0:
+                pipe.ltrim(key, -50, -1)
+        pipe.execute()
+        mark_synced(r, slave, 'apply:done')
+        for k in range(16):
+            key = 'apply:%d' % k
+            assert slave.lrange(key, 0, -1) == r.lrange(key, 0, -1)
+            assert slave.get(key + ':n') == r.get(key + ':n')
+
+    def test_barriers_see_earlier_writes(self, r, slave):
+        pipe = r.pipeline(transaction=False)
+        for i in range(500):
+            pipe.set('barrier:a%d' % i, i)
+            pipe.sadd('barrier:s%d' % (i % 4), i)
+            if i % 50 == 0:
+                # multi key commands run alone once everything before is applied
+                pipe.sunionstore('barrier:u', ['barrier:s%d' % j
+                                               for j in range(4)])
+                pipe.rename('barrier:a%d' % i, 'barrier:r%d' % i)
+                pipe.mset({'barrier:m': i})
+        pipe.execute()
+        with r.pipeline() as tx:
+            tx.incr('barrier:tx')
+            tx.set('barrier:a0', 'tx')
+            tx.execute()
+        mark_synced(r, slave, 'barrier:done')
+        assert slave.smembers('barrier:u') == r.smembers('barrier:u')
+        assert slave.get('barrier:m') == r.get('barrier:m')
+        assert slave.get('barrier:tx') == b('1')
+        for i in range(0, 500, 50):
+            assert slave.get('barrier:r%d' % i) == r.get('barrier:r%d' % i)
+            assert slave.exists('barrier:a%d' % i) == \
+                r.exists('barrier:a%d' % i)
+
+
+@needs_slave
+class TestWALFileSend(object):
+    def test_lagging_slave_catches_up(self, r, slave):
+        # a burst larger than repl-backlog-cache-size leaves the slave behind
+        # the in-memory cache, so it is fed from the segment files while the
+        # master keeps appending and recycling segments
+        cache = int(r.info().get('repl_wal_cache_size', 0))
+        value = 'v' * 64 * 1024
+        total = max(cache * 2, 64 * 1024 * 1024)
+        pipe = r.pipeline(transaction=False)
+        for i in range(total // len(value)):
+            pipe.set('walfile:%d' % (i % 512), value + str(i))
+            if i % 256 == 255:
+                pipe.execute()
+        pipe.execute()
+        mark_synced(r, slave, 'walfile:done')
+        for i in range(0, 512, 37):
+            assert slave.get('walfile:%d' % i) == r.get('walfile:%d' % i)
+
+
+class LZ4Slave(object):
+    "Replicates from the test server over a raw socket, with 'capa lz4'"
+
+    def __init__(self, r, capa=True):
+        kwargs = r.connection_pool.connection_kwargs
+        self.sock = socket.create_connection((kwargs.get('host', 'localhost'),
+                                              kwargs.get('port', 6379)), 30)
+        self.wire = b('')
+        self.plain = b('')
+        self.frames = 0
+        self.compressed_frames = 0
+        args = ['REPLCONF', 'listening-port', '0']
+        if capa:
+            args += ['capa', 'lz4']
+        self.send(*args)
+        self.replconf_reply = self.read_line()
+
+    def send(self, *args):
+        cmd = '*%d\r\n' % len(args)
+        for a in args:
+            cmd += '$%d\r\n%s\r\n' % (len(a), a)
+        self.sock.sendall(b(cmd))
+
+    def recv(self):
+        data = self.sock.recv(65536)
+        assert data, 'master closed the connection'
+        self.wire += data
+
+    def read_line(self):
+        # the psync reply is not framed
+        while b('\r\n') not in self.wire:
+            self.recv()
+        line, self.wire = self.wire.split(b('\r\n'), 1)
+        return line
+
+    def read_frames(self, predicate):
+        import lz4.block
+        while not predicate(self.plain):
+            while len(self.wire) >= 8:
+                raw, clen = struct.unpack('<II', self.wire[:8])
+                size = clen or raw
+                if len(self.wire) < 8 + size:
+                    break
+                payload = self.wire[8:8 + size]
+                if clen:
+                    payload = lz4.block.decompress(payload,
+                                                   uncompressed_size=raw)
+                    self.compressed_frames += 1
+                assert len(payload) == raw
+                self.frames += 1
+                self.plain += payload
+                self.wire = self.wire[8 + size:]
+            if not predicate(self.plain):
+                self.recv()
+
+    def read_snapshot(self):
+        self.read_frames(lambda p: b('\r\n') in p)
+        header, rest = self.plain.split(b('\r\n'), 1)
+        size = int(header[1:])
+        self.read_frames(lambda p: len(p) >= len(header) + 2 + size)
+        self.plain = self.plain[len(header) + 2 + size:]
+
+    def close(self):
+        self.sock.close()
+
+
+class TestLZ4Replication(object):
+    def test_capa_negotiation(self, r):
+        plain = LZ4Slave(r, capa=False)
+        lz4 = LZ4Slave(r)
+        try:
+            assert plain.replconf_reply == b('+OK')
+            assert lz4.replconf_reply == b('+OK lz4')
+        finally:
+            plain.close()
+            lz4.close()
+
+    def test_frames_and_psync_continue(self, r):
+        pytest.importorskip('lz4.block')
+        run_id = str(r.info()['run_id'])
+        value = 'compressible' * 100
+        slave = LZ4Slave(r)
+        try:
+            slave.send('PSYNC', '?', '-1', 'cksm', '0')
+            reply = slave.read_line().split()
+            assert reply[0] == b('+FULLRESYNC')
+            offset = int(reply[2])
+            slave.read_snapshot()
+            r.set('lz4:full', value)
+            slave.read_frames(lambda p: b(value) in p)
+            # the offset counts the decompressed stream
+            offset += len(slave.plain)
+            assert slave.compressed_frames > 0
+        finally:
+            slave.close()
+
+        slave = LZ4Slave(r)
+        try:
+            slave.send('PSYNC', run_id, str(offset), 'cksm', '0')
+            assert slave.read_line() == b('+CONTINUE')
+            r.set('lz4:continue', value)
+            slave.read_frames(lambda p: b('lz4:continue') in p)
+            assert b(value) in slave.plain
+            assert b('lz4:full') not in slave.plain
+        finally:
+            slave.close()
@@ -1,9 +1,12 @@
 from __future__ import with_statement
 import pytest
+import time
 
 from redis import exceptions
 from redis._compat import b
 
+from .helpers import new_clients, running_slow_script
+
 
 multiply_script = """
 local value = redis.call('GET', KEYS[1])
@@ -117,3 +120,26 @@ class TestScripting(object):
         with pytest.raises(exceptions.ResponseError) as excinfo:
             pipe.execute()
         assert excinfo.type == exceptions.ResponseError
+
+    def test_pipelines_during_slow_script(self, r):
+        # a slow script re-enters the event loop of its connection, the
+        # pipelines of the other connections are read and served meanwhile
+        with running_slow_script(r, 30000000):
+            clients = new_clients(r, 8)
+            for n in range(20):
+                for i, c in enumerate(clients):
+                    pipe = c.pipeline(transaction=False)
+                    for j in range(100):
+                        pipe.set('slow:%d:%d' % (i, j), 'x' * j)
+                        pipe.get('slow:%d:%d' % (i, j))
+                    res = pipe.execute()
+                    assert res[1::2] == [b('x' * j) for j in range(100)]
+
+    def test_replies_flushed_during_slow_script(self, r):
+        # commands served while a slow script re-enters the event loop get
+        # their replies before the script returns
+        with running_slow_script(r, 200000000) as slow:
+            time.sleep(0.1)
+            for c in new_clients(r, 8):
+                assert c.echo('during') == b('during')
+            assert slow.is_alive()